@@ -30,8 +30,18 @@ typedef enum {
     ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_WRITE_FAIL,
     ESP_DIAG_DATA_STORE_EVENT_CRITICAL_DATA_LOW_MEM,
     ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_LOW_MEM,
+    ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_DROPPED,    /*!< Old non_critical data is overwritten to make room */
 } esp_diag_data_store_events_t;
 
+/**
+ * @brief Statistics of critical or non_critical data store
+ */
+typedef struct {
+    size_t size;        /*!< Size of the store */
+    size_t filled;      /*!< Bytes currently in the store */
+    uint32_t written;   /*!< Bytes written since init, wraps around */
+} esp_diag_data_store_stats_t;
+
 /**
  * @brief Write critical data to the diagnostics data store
  *
@@ -53,6 +63,21 @@ esp_err_t esp_diag_data_store_critical_write(void *data, size_t len);
  */
 esp_err_t esp_diag_data_store_non_critical_write(const char *dg, void *data, size_t len);
 
+/**
+ * @brief Write multiple non_critical data items to the diagnostics data store
+ *
+ * Items are written under a single lock with one free space check, either all of them
+ * are stored or none of them.
+ *
+ * @param[in] dg Data group of the data
+ * @param[in] data Array of buffers holding the data
+ * @param[in] len Array of lengths of the data to be written
+ * @param[in] count Number of items
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_data_store_non_critical_write_batch(const char *dg, void *const data[], const size_t len[], size_t count);
+
 /**
  * @brief Read critical data from the diagnostics data store
  *
@@ -63,6 +88,19 @@ esp_err_t esp_diag_data_store_non_critical_write(const char *dg, void *data, siz
  */
 int esp_diag_data_store_critical_read(uint8_t *buf, size_t size);
 
+/**
+ * @brief Read critical data from the diagnostics data store, skipping offset bytes
+ *
+ * This API can be used to read past the data which is sent asynchronously but not released yet.
+ *
+ * @param[in]  buf buffer to hold the data
+ * @param[in]  size Number of bytes to read
+ * @param[in]  offset Number of bytes after the oldest unreleased data to start reading from
+ *
+ * @return int bytes > 0 on success, 0 if there is no data past offset. Appropriate error otherwise
+ */
+int esp_diag_data_store_critical_read_offset(uint8_t *buf, size_t size, size_t offset);
+
 /**
  * @brief Read non_critical data from the diagnostics data store
  *
@@ -95,6 +133,40 @@ esp_err_t esp_diag_data_store_critical_release(size_t size);
  */
 esp_err_t esp_diag_data_store_non_critical_release(size_t size);
 
+/**
+ * @brief Get statistics of the critical data store
+ *
+ * Rate at which data enters the store can be found from the change in written bytes.
+ *
+ * @param[out] stats Statistics of the store
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_data_store_critical_get_stats(esp_diag_data_store_stats_t *stats);
+
+/**
+ * @brief Get statistics of the non_critical data store
+ *
+ * @param[out] stats Statistics of the store
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_data_store_non_critical_get_stats(esp_diag_data_store_stats_t *stats);
+
+/**
+ * @brief Get the sequence number of the oldest byte in the critical data store
+ *
+ * Every byte written to the store gets the next sequence number, so the data read at some offset
+ * starts at seq + offset. The sequence advances as data is released and is kept across soft resets,
+ * which lets the receiver drop data it got before.
+ *
+ * @param[out] seq_id Identifier of the sequence, changes when the sequence starts over
+ * @param[out] seq Sequence number of the oldest byte
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_data_store_critical_get_seq(uint32_t *seq_id, uint32_t *seq);
+
 /**
  * @brief Initializes the diagnostics data store
  *
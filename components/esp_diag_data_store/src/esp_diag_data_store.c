@@ -20,10 +20,18 @@ typedef void (*deinit_cb_t) (void);
 typedef esp_err_t (*write_cb_t) (void *data, size_t len);
 /* Callback type to write non_critical data */
 typedef esp_err_t (*nc_write_cb_t) (const char *dg, void *data, size_t len);
+/* Callback type to write multiple non_critical data items at once */
+typedef esp_err_t (*nc_write_batch_cb_t) (const char *dg, void *const data[], const size_t len[], size_t count);
 /* Callback type to read data */
 typedef int (*read_cb_t) (uint8_t *buf, size_t size);
+/* Callback type to read data past offset bytes */
+typedef int (*read_offset_cb_t) (uint8_t *buf, size_t size, size_t offset);
 /* Callback type to release the data */
 typedef esp_err_t (*release_cb_t) (size_t size);
+/* Callback type to get statistics of the store */
+typedef esp_err_t (*stats_cb_t) (esp_diag_data_store_stats_t *stats);
+/* Callback type to get the sequence number of the oldest data in the store */
+typedef esp_err_t (*seq_cb_t) (uint32_t *seq_id, uint32_t *seq);
 /* Callback type to get CRC of data store configuration.
 This crc will be used to discard data from data store if its value is changed */
 typedef uint32_t (*crc_cb_t) ();
@@ -35,10 +43,15 @@ typedef struct {
     deinit_cb_t deinit;
     write_cb_t critical_write;
     nc_write_cb_t non_critical_write;
+    nc_write_batch_cb_t non_critical_write_batch;
     read_cb_t critical_read;
+    read_offset_cb_t critical_read_offset;
     read_cb_t non_critical_read;
     release_cb_t critical_release;
     release_cb_t non_critical_release;
+    stats_cb_t critical_stats;
+    stats_cb_t non_critical_stats;
+    seq_cb_t critical_seq;
     crc_cb_t data_store_crc;
     discard_data_cb_t discard_data;
 } data_store_cbs_t;
@@ -63,10 +76,15 @@ static void set_diag_store_cbs(void)
     s_priv_data.cbs.deinit = rtc_store_deinit;
     s_priv_data.cbs.critical_write = rtc_store_critical_data_write;
     s_priv_data.cbs.non_critical_write = rtc_store_non_critical_data_write;
+    s_priv_data.cbs.non_critical_write_batch = rtc_store_non_critical_data_write_batch;
     s_priv_data.cbs.critical_read = rtc_store_critical_data_read;
+    s_priv_data.cbs.critical_read_offset = rtc_store_critical_data_read_offset;
     s_priv_data.cbs.non_critical_read = rtc_store_non_critical_data_read;
     s_priv_data.cbs.critical_release = rtc_store_critical_data_release;
     s_priv_data.cbs.non_critical_release = rtc_store_non_critical_data_release;
+    s_priv_data.cbs.critical_stats = rtc_store_critical_data_get_stats;
+    s_priv_data.cbs.non_critical_stats = rtc_store_non_critical_data_get_stats;
+    s_priv_data.cbs.critical_seq = rtc_store_critical_data_get_seq;
     s_priv_data.cbs.data_store_crc = rtc_store_get_crc;
     s_priv_data.cbs.discard_data = rtc_store_discard_data;
 }
@@ -77,10 +95,15 @@ static void unset_diag_store_cbs(void)
     s_priv_data.cbs.deinit = NULL;
     s_priv_data.cbs.critical_write = NULL;
     s_priv_data.cbs.non_critical_write = NULL;
+    s_priv_data.cbs.non_critical_write_batch = NULL;
     s_priv_data.cbs.critical_read = NULL;
+    s_priv_data.cbs.critical_read_offset = NULL;
     s_priv_data.cbs.non_critical_read = NULL;
     s_priv_data.cbs.critical_release = NULL;
     s_priv_data.cbs.non_critical_release = NULL;
+    s_priv_data.cbs.critical_stats = NULL;
+    s_priv_data.cbs.non_critical_stats = NULL;
+    s_priv_data.cbs.critical_seq = NULL;
     s_priv_data.cbs.data_store_crc = NULL;
     s_priv_data.cbs.discard_data = NULL;
 }
@@ -97,12 +120,24 @@ esp_err_t esp_diag_data_store_non_critical_write(const char *dg, void *data, siz
     return s_priv_data.cbs.non_critical_write(dg, data, len);
 }
 
+esp_err_t esp_diag_data_store_non_critical_write_batch(const char *dg, void *const data[], const size_t len[], size_t count)
+{
+    CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+    return s_priv_data.cbs.non_critical_write_batch(dg, data, len, count);
+}
+
 int esp_diag_data_store_critical_read(uint8_t *buf, size_t size)
 {
     CHECK_STORE_INIT(-1);
     return s_priv_data.cbs.critical_read(buf, size);
 }
 
+int esp_diag_data_store_critical_read_offset(uint8_t *buf, size_t size, size_t offset)
+{
+    CHECK_STORE_INIT(-1);
+    return s_priv_data.cbs.critical_read_offset(buf, size, offset);
+}
+
 int esp_diag_data_store_non_critical_read(uint8_t *buf, size_t size)
 {
     CHECK_STORE_INIT(-1);
@@ -121,6 +156,24 @@ esp_err_t esp_diag_data_store_non_critical_release(size_t size)
     return s_priv_data.cbs.non_critical_release(size);
 }
 
+esp_err_t esp_diag_data_store_critical_get_stats(esp_diag_data_store_stats_t *stats)
+{
+    CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+    return s_priv_data.cbs.critical_stats(stats);
+}
+
+esp_err_t esp_diag_data_store_non_critical_get_stats(esp_diag_data_store_stats_t *stats)
+{
+    CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+    return s_priv_data.cbs.non_critical_stats(stats);
+}
+
+esp_err_t esp_diag_data_store_critical_get_seq(uint32_t *seq_id, uint32_t *seq)
+{
+    CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+    return s_priv_data.cbs.critical_seq(seq_id, seq);
+}
+
 esp_err_t esp_diag_data_store_init(void)
 {
     set_diag_store_cbs();
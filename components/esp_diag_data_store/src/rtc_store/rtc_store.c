@@ -89,6 +89,11 @@ static inline esp_reset_reason_t esp_reset_reason(void) { return ESP_RST_POWERON
 #define DIAG_NON_CRITICAL_DATA_REPORTING_WATERMARK \
     ((DIAG_NON_CRITICAL_BUF_SIZE * (100 - CONFIG_DIAG_DATA_STORE_REPORTING_WATERMARK_PERCENT)) / 100)
 
+/* Marks seq and seq_id as written by this layout. Firmware without them leaves garbage at their
+ * place in RTC_NOINIT memory, which survives a soft reset e.g. after OTA. Change it with the layout.
+ */
+#define RTC_STORE_SEQ_MAGIC 0x51455331  // "SEQ1"
+
 /* non critical data is stored in Length - Value format */
 #define SIZE_OF_DATA_LEN    sizeof(size_t)
 
@@ -105,12 +110,16 @@ typedef struct {
     uint8_t *buf;
     size_t size;
     data_store_info_t info;
+    uint32_t seq;       // sequence number of the oldest byte, i.e. bytes released so far
+    uint32_t seq_id;    // identifies the sequence, changes when it starts over
+    uint32_t seq_magic; // RTC_STORE_SEQ_MAGIC once seq and seq_id are set
 } data_store_t;
 
 typedef struct {
     SemaphoreHandle_t lock;     // critical lock
     data_store_t *store;        // pointer to rtc data store
     size_t wrap_cnt;            // keep track of no. of times wrapping happened
+    uint32_t written;           // bytes written since init, wraps around
 } rbuf_data_t;
 
 typedef struct {
@@ -190,6 +199,7 @@ static void rtc_store_read_complete(rbuf_data_t *rbuf_data, size_t len)
     // modify new pointers
     info.filled -= len;
     info.read_offset += len;
+    rbuf_data->store->seq += len;
 
     if (((data_store_info_t *) &info)->read_offset > rbuf_data->store->size) {
         ((data_store_info_t *) &info)->read_offset -= rbuf_data->store->size;
@@ -209,6 +219,7 @@ static void rtc_store_write_complete(rbuf_data_t *rbuf_data, size_t len)
 #endif
 
     info->filled += len;
+    rbuf_data->written += len;
 
 #if RTC_STORE_DBG_PRINTS
     ESP_LOGI(TAG, "after write_complete, filled %" PRIu16 ", size %u, read_offset %" PRIu16 ", len %u",
@@ -295,11 +306,11 @@ esp_err_t rtc_store_critical_data_write(void *data, size_t len)
     return ret;
 }
 
-static int rtc_store_data_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size);
+static int rtc_store_data_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size, size_t offset);
 
-esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t len)
+esp_err_t rtc_store_non_critical_data_write_batch(const char *dg, void *const data[], const size_t len[], size_t count)
 {
-    if (!dg || !len || !data) {
+    if (!dg || !data || !len || !count) {
         return ESP_ERR_INVALID_ARG;
     }
 #if !CONFIG_IDF_TARGET_LINUX
@@ -312,8 +323,16 @@ esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t l
         return ESP_ERR_INVALID_STATE;
     }
     rtc_store_non_critical_data_hdr_t header;
-    size_t req_free = sizeof(header) + len + 1; // 1 byte for meta index
+    size_t req_free = 0;
     size_t curr_free;
+    bool dropped = false;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!data[i] || !len[i]) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        req_free += sizeof(header) + len[i] + 1; // 1 byte for meta index
+    }
 
     if (req_free > DIAG_NON_CRITICAL_BUF_SIZE) {
         printf("rtc_store_non_critical_data_write: len too large %zu, size %d\n",
@@ -326,15 +345,16 @@ esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t l
     }
 
 #if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
-    /* Make enough room for the item */
+    /* Make enough room for the items */
     while (data_store_get_free(s_priv_data.non_critical.store) < req_free) {
         uint8_t tmp_buf[sizeof(header) + 1];
-        rtc_store_data_read_unsafe(&s_priv_data.non_critical, tmp_buf, sizeof(tmp_buf));
+        rtc_store_data_read_unsafe(&s_priv_data.non_critical, tmp_buf, sizeof(tmp_buf), 0);
         memcpy(&header, tmp_buf + 1, sizeof(header)); // because 1 byte is meta_hdr idx
         size_t to_free = sizeof(tmp_buf) + header.len;
         rtc_store_read_complete(&s_priv_data.non_critical, to_free);
+        dropped = true;
     }
-#else // just check if we have enough space to write the item
+#else // just check if we have enough space to write the items
     curr_free = data_store_get_free(s_priv_data.non_critical.store);
     if (curr_free < req_free) {
         xSemaphoreGive(s_priv_data.non_critical.lock);
@@ -342,18 +362,25 @@ esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t l
         return ESP_ERR_NO_MEM;
     }
 #endif
-    memset(&header, 0, sizeof(header));
-    header.len = len;
-
-    // we have made sure of free size at this point, write index byte, data header and then actual data
-    rtc_store_write(&s_priv_data.non_critical, &s_rtc_store.meta_hdr_idx, 1);
-    rtc_store_write_at_offset(&s_priv_data.non_critical, &header, sizeof(header), 1);
-    rtc_store_write_at_offset(&s_priv_data.non_critical, data, len, 1 + sizeof(header));
+    // we have made sure of free size at this point, write every item as
+    // index byte, data header and then actual data, and commit them all at once
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        memset(&header, 0, sizeof(header));
+        header.len = len[i];
+        rtc_store_write_at_offset(&s_priv_data.non_critical, &s_rtc_store.meta_hdr_idx, 1, offset);
+        rtc_store_write_at_offset(&s_priv_data.non_critical, &header, sizeof(header), offset + 1);
+        rtc_store_write_at_offset(&s_priv_data.non_critical, data[i], len[i], offset + 1 + sizeof(header));
+        offset += 1 + sizeof(header) + len[i];
+    }
     rtc_store_write_complete(&s_priv_data.non_critical, req_free);
 
     curr_free = data_store_get_free(s_priv_data.non_critical.store);
     xSemaphoreGive(s_priv_data.non_critical.lock);
 
+    if (dropped) {
+        esp_event_post(ESP_DIAG_DATA_STORE_EVENT, ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_DROPPED, NULL, 0, 0);
+    }
     // Post low memory event even if data overwrite is enabled.
     if (curr_free < DIAG_NON_CRITICAL_DATA_REPORTING_WATERMARK) {
         esp_event_post(ESP_DIAG_DATA_STORE_EVENT, ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_LOW_MEM, NULL, 0, 0);
@@ -361,27 +388,40 @@ esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t l
     return ESP_OK;
 }
 
-static int rtc_store_data_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size)
+esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t len)
+{
+    return rtc_store_non_critical_data_write_batch(dg, &data, &len, 1);
+}
+
+// offset: bytes after the read offset to start reading from
+static int rtc_store_data_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size, size_t offset)
 {
     data_store_info_t *info = (data_store_info_t *) &rbuf_data->store->info;
 
-    if (info->filled < size) {
-        size = info->filled;
+    if (info->filled <= offset) {
+        return 0;
+    }
+    if (info->filled - offset < size) {
+        size = info->filled - offset;
     }
 
-    size_t data_at_end = rbuf_data->store->size - info->read_offset;
+    size_t start = info->read_offset + offset;
+    if (start >= rbuf_data->store->size) {
+        start -= rbuf_data->store->size;
+    }
+    size_t data_at_end = rbuf_data->store->size - start;
     if (data_at_end < size) {
         // data is wrapped, read data in 2 parts
-        memcpy(buf, rbuf_data->store->buf + info->read_offset, data_at_end);
+        memcpy(buf, rbuf_data->store->buf + start, data_at_end);
         memcpy(buf + data_at_end, rbuf_data->store->buf, size - data_at_end);
     } else {
         // single memcpy
-        memcpy(buf, rbuf_data->store->buf + info->read_offset, size);
+        memcpy(buf, rbuf_data->store->buf + start, size);
     }
     return size;
 }
 
-static int rtc_store_data_read(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size)
+static int rtc_store_data_read(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size, size_t offset)
 {
     if (!size) {
         return -1;
@@ -391,7 +431,7 @@ static int rtc_store_data_read(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size
     }
 
     xSemaphoreTake(rbuf_data->lock, portMAX_DELAY);
-    size = rtc_store_data_read_unsafe(rbuf_data, buf, size);
+    size = rtc_store_data_read_unsafe(rbuf_data, buf, size, offset);
     xSemaphoreGive(rbuf_data->lock);
     return size;
 }
@@ -414,12 +454,17 @@ static esp_err_t rtc_store_data_release(rbuf_data_t *rbuf_data, size_t size)
 
 int rtc_store_critical_data_read(uint8_t *buf, size_t size)
 {
-    return rtc_store_data_read(&s_priv_data.critical, buf, size);
+    return rtc_store_data_read(&s_priv_data.critical, buf, size, 0);
+}
+
+int rtc_store_critical_data_read_offset(uint8_t *buf, size_t size, size_t offset)
+{
+    return rtc_store_data_read(&s_priv_data.critical, buf, size, offset);
 }
 
 int rtc_store_critical_data_read_and_release(uint8_t *buf, size_t size)
 {
-    int data_read = rtc_store_data_read(&s_priv_data.critical, buf, size);
+    int data_read = rtc_store_data_read(&s_priv_data.critical, buf, size, 0);
     if (data_read > 0) {
         rtc_store_data_release(&s_priv_data.critical, size);
     }
@@ -428,12 +473,12 @@ int rtc_store_critical_data_read_and_release(uint8_t *buf, size_t size)
 
 int rtc_store_non_critical_data_read(uint8_t *buf, size_t size)
 {
-    return rtc_store_data_read(&s_priv_data.non_critical, buf, size);
+    return rtc_store_data_read(&s_priv_data.non_critical, buf, size, 0);
 }
 
 int rtc_store_non_critical_data_read_and_release(uint8_t *buf, size_t size)
 {
-    int data_read = rtc_store_data_read(&s_priv_data.non_critical, buf, size);
+    int data_read = rtc_store_data_read(&s_priv_data.non_critical, buf, size, 0);
     if (data_read > 0) {
         rtc_store_data_release(&s_priv_data.non_critical, data_read);
     }
@@ -450,6 +495,47 @@ esp_err_t rtc_store_non_critical_data_release(size_t size)
     return rtc_store_data_release(&s_priv_data.non_critical, size);
 }
 
+static esp_err_t rtc_store_data_get_stats(rbuf_data_t *rbuf_data, esp_diag_data_store_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(rbuf_data->lock, portMAX_DELAY);
+    stats->size = data_store_get_size(rbuf_data->store);
+    stats->filled = data_store_get_filled(rbuf_data->store);
+    stats->written = rbuf_data->written;
+    xSemaphoreGive(rbuf_data->lock);
+    return ESP_OK;
+}
+
+esp_err_t rtc_store_critical_data_get_stats(esp_diag_data_store_stats_t *stats)
+{
+    return rtc_store_data_get_stats(&s_priv_data.critical, stats);
+}
+
+esp_err_t rtc_store_non_critical_data_get_stats(esp_diag_data_store_stats_t *stats)
+{
+    return rtc_store_data_get_stats(&s_priv_data.non_critical, stats);
+}
+
+esp_err_t rtc_store_critical_data_get_seq(uint32_t *seq_id, uint32_t *seq)
+{
+    if (!seq_id || !seq) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_priv_data.critical.lock, portMAX_DELAY);
+    *seq_id = s_priv_data.critical.store->seq_id;
+    *seq = s_priv_data.critical.store->seq;
+    xSemaphoreGive(s_priv_data.critical.lock);
+    return ESP_OK;
+}
+
 static void rtc_store_rbuf_deinit(rbuf_data_t *rbuf_data)
 {
     if (rbuf_data->lock) {
@@ -472,9 +558,21 @@ static bool rtc_store_integrity_check(data_store_t *store)
             info->read_offset > store->size) {
         return false;
     }
+    if (store->seq_magic != RTC_STORE_SEQ_MAGIC) {
+        return false;
+    }
     return true;
 }
 
+/* Drops the data and starts a new sequence, the cloud can not dedupe against the old one anymore */
+static void rtc_store_reset(data_store_t *store)
+{
+    store->info.value = 0;
+    store->seq = 0;
+    store->seq_id = esp_random();
+    store->seq_magic = RTC_STORE_SEQ_MAGIC;
+}
+
 static esp_err_t rtc_store_rbuf_init(rbuf_data_t *rbuf_data,
                                      data_store_t *rtc_store,
                                      uint8_t *rtc_buf,
@@ -495,7 +593,7 @@ static esp_err_t rtc_store_rbuf_init(rbuf_data_t *rbuf_data,
             reset_reason == ESP_RST_POWERON ||
             reset_reason == ESP_RST_BROWNOUT) {
         // TODO: also check if hash is changed
-        rtc_store->info.value = 0;
+        rtc_store_reset(rtc_store);
     }
 
     /* Point priv_data to actual RTC data */
@@ -506,7 +604,7 @@ static esp_err_t rtc_store_rbuf_init(rbuf_data_t *rbuf_data,
     if (rtc_store_integrity_check(rtc_store) == false) {
         // discard all the existing data
         printf("%s: intergrity_check failed, discarding old data...\n", TAG);
-        rtc_store->info.value = 0;
+        rtc_store_reset(rtc_store);
     }
     return ESP_OK;
 }
@@ -594,6 +692,8 @@ esp_err_t rtc_store_discard_data(void)
         return ESP_ERR_INVALID_STATE;
     }
     xSemaphoreTake(s_priv_data.critical.lock, portMAX_DELAY);
+    /* Discarded bytes are never sent, keep the sequence going past them */
+    s_rtc_store.critical.store.seq += s_rtc_store.critical.store.info.filled;
     s_rtc_store.critical.store.info.value = 0;
     xSemaphoreGive(s_priv_data.critical.lock);
     xSemaphoreTake(s_priv_data.non_critical.lock, portMAX_DELAY);
@@ -8,6 +8,7 @@
 
 #include <esp_err.h>
 #include <esp_event.h>
+#include <esp_diag_data_store.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -68,6 +69,19 @@ esp_err_t rtc_store_critical_data_write(void *data, size_t len);
  */
 int rtc_store_critical_data_read(uint8_t *buf, size_t size);
 
+/**
+ * @brief Read critical data from the RTC storage, skipping offset bytes
+ *
+ * Used to read past the data which is read but not released yet, e.g. sent but not acknowledged.
+ *
+ * @param[in] buf Buffer to read data in
+ * @param[in] size Number of bytes to read
+ * @param[in] offset Number of bytes after the read offset to start reading from
+ *
+ * @return Number of bytes read, 0 if there is no data past offset or -1 on error
+ */
+int rtc_store_critical_data_read_offset(uint8_t *buf, size_t size, size_t offset);
+
 /**
  * @brief Release the size bytes critical data from RTC storage
  *
@@ -107,6 +121,21 @@ int rtc_store_critical_data_read_and_release(uint8_t *buf, size_t size);
  */
 esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t len);
 
+/**
+ * @brief Write multiple non critical data items to the RTC storage
+ *
+ * All the items are written under a single lock and committed together, either all of them
+ * are stored or none of them. Each item is stored the same way as \ref rtc_store_non_critical_data_write.
+ *
+ * @param[in] dg Data group of data eg: heap, wifi, ip(Must be the string stored in RODATA)
+ * @param[in] data Array of pointers to non critical data
+ * @param[in] len Array of lengths of non critical data
+ * @param[in] count Number of items
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t rtc_store_non_critical_data_write_batch(const char *dg, void *const data[], const size_t len[], size_t count);
+
 /**
  * @brief Read non critical data from the RTC storage
  *
@@ -136,6 +165,34 @@ esp_err_t rtc_store_non_critical_data_release(size_t size);
  */
 int rtc_store_non_critical_data_read_and_release(uint8_t *buf, size_t size);
 
+/**
+ * @brief Get size, fill level and bytes written of the critical data RTC storage
+ *
+ * @param[out] stats Statistics of the storage
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t rtc_store_critical_data_get_stats(esp_diag_data_store_stats_t *stats);
+
+/**
+ * @brief Get size, fill level and bytes written of the non critical data RTC storage
+ *
+ * @param[out] stats Statistics of the storage
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t rtc_store_non_critical_data_get_stats(esp_diag_data_store_stats_t *stats);
+
+/**
+ * @brief Get the sequence number of the oldest byte in the critical data RTC storage
+ *
+ * @param[out] seq_id Identifier of the sequence, changes when the sequence starts over
+ * @param[out] seq Sequence number, advances by the number of bytes released or discarded
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t rtc_store_critical_data_get_seq(uint32_t *seq_id, uint32_t *seq);
+
 /**
  * @brief Initializes the RTC storage
  *
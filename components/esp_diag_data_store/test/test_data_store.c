@@ -261,6 +261,45 @@ TEST_CASE("data store non-critical write read", "[data-store][data-store-rtc]")
     nvs_flash_deinit();
 }
 
+TEST_CASE("data store non-critical batch write read", "[data-store][data-store-rtc]")
+{
+    static const char dg[] = "test_nc";
+
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    uint32_t val_1 = 0xDEADBEEF;
+    uint8_t val_2[24];
+    uint16_t val_3 = 0xCAFE;
+    memset(val_2, 0xA5, sizeof(val_2));
+    void *const items[] = {&val_1, val_2, &val_3};
+    const size_t lens[] = {sizeof(val_1), sizeof(val_2), sizeof(val_3)};
+    TEST_ASSERT(rtc_store_non_critical_data_write_batch(dg, items, lens, 3) == ESP_OK);
+
+    /* Every item is stored as meta index byte, header and then data */
+    size_t expected = 3 * (1 + sizeof(rtc_store_non_critical_data_hdr_t)) + sizeof(val_1) + sizeof(val_2) + sizeof(val_3);
+    int len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    TEST_ASSERT(len == expected);
+
+    size_t offset = 0;
+    for (int i = 0; i < 3; i++) {
+        rtc_store_non_critical_data_hdr_t header;
+        memcpy(&header, data + offset + 1, sizeof(header));
+        TEST_ASSERT(header.len == lens[i]);
+        TEST_ASSERT(memcmp(data + offset + 1 + sizeof(header), items[i], lens[i]) == 0);
+        offset += 1 + sizeof(header) + header.len;
+    }
+    TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+
+    /* Invalid item must not write anything */
+    const size_t bad_lens[] = {sizeof(val_1), 0, sizeof(val_3)};
+    TEST_ASSERT(rtc_store_non_critical_data_write_batch(dg, items, bad_lens, 3) == ESP_ERR_INVALID_ARG);
+    TEST_ASSERT(rtc_store_non_critical_data_read(data, READ_DATA_SIZE) == 0);
+
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+
 TEST_CASE("data store discard", "[data-store][data-store-rtc]")
 {
     init_nvs_flash();
@@ -305,6 +344,105 @@ TEST_CASE("data store read and release combined", "[data-store][data-store-rtc]"
     nvs_flash_deinit();
 }
 
+TEST_CASE("data store read past unreleased data", "[data-store][data-store-rtc]")
+{
+    int len = 0;
+    uint32_t count = 10;
+    uint32_t skip = 4;
+    char char_list[count];
+    size_t record_size = sizeof(test_data_t) + 1; // meta_idx byte + record
+
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    write_random_critical_data(count, char_list);
+
+    /* Read past the first records without releasing them */
+    len = rtc_store_critical_data_read_offset(data, READ_DATA_SIZE, s_sha_off + skip * record_size);
+    TEST_ASSERT(len == (count - skip) * record_size);
+    validate_critical_data(data, len, count - skip, char_list + skip);
+
+    /* Nothing past all the data */
+    len = rtc_store_critical_data_read_offset(data, READ_DATA_SIZE, s_sha_off + count * record_size);
+    TEST_ASSERT(len == 0);
+
+    /* Once released, the same data is at the read offset */
+    TEST_ASSERT(rtc_store_critical_data_release(s_sha_off + skip * record_size) == ESP_OK);
+    len = rtc_store_critical_data_read_offset(data, READ_DATA_SIZE, 0);
+    TEST_ASSERT(len == (count - skip) * record_size);
+    validate_critical_data(data, len, count - skip, char_list + skip);
+
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+
+TEST_CASE("data store stats", "[data-store][data-store-rtc]")
+{
+    uint32_t count = 5;
+    char char_list[count];
+    size_t record_size = sizeof(test_data_t) + 1; // meta_idx byte + record
+    esp_diag_data_store_stats_t stats;
+
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    TEST_ASSERT(rtc_store_critical_data_get_stats(&stats) == ESP_OK);
+    TEST_ASSERT(stats.size == CRITICAL_DATA_SIZE);
+    uint32_t written = stats.written;
+    size_t filled = stats.filled;
+
+    write_random_critical_data(count, char_list);
+    TEST_ASSERT(rtc_store_critical_data_get_stats(&stats) == ESP_OK);
+    TEST_ASSERT(stats.written - written == count * record_size);
+    TEST_ASSERT(stats.filled - filled == count * record_size);
+
+    /* Released data is no more filled but stays written */
+    TEST_ASSERT(rtc_store_critical_data_release(stats.filled) == ESP_OK);
+    TEST_ASSERT(rtc_store_critical_data_get_stats(&stats) == ESP_OK);
+    TEST_ASSERT(stats.filled == 0);
+    TEST_ASSERT(stats.written - written == count * record_size);
+
+    TEST_ASSERT(rtc_store_critical_data_get_stats(NULL) == ESP_ERR_INVALID_ARG);
+
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+
+TEST_CASE("data store sequence", "[data-store][data-store-rtc]")
+{
+    uint32_t count = 5;
+    char char_list[count];
+    size_t record_size = sizeof(test_data_t) + 1; // meta_idx byte + record
+    uint32_t seq_id, seq, id, start;
+
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    TEST_ASSERT(rtc_store_critical_data_get_seq(&seq_id, &start) == ESP_OK);
+
+    /* Writing does not move the sequence, releasing does */
+    write_random_critical_data(count, char_list);
+    TEST_ASSERT(rtc_store_critical_data_get_seq(&id, &seq) == ESP_OK);
+    TEST_ASSERT(seq == start);
+
+    TEST_ASSERT(rtc_store_critical_data_release(record_size) == ESP_OK);
+    TEST_ASSERT(rtc_store_critical_data_get_seq(&id, &seq) == ESP_OK);
+    TEST_ASSERT(id == seq_id);
+    TEST_ASSERT(seq - start == record_size);
+
+    /* Discarded data is skipped, the sequence goes on */
+    TEST_ASSERT(rtc_store_discard_data() == ESP_OK);
+    TEST_ASSERT(rtc_store_critical_data_get_seq(&id, &seq) == ESP_OK);
+    TEST_ASSERT(id == seq_id);
+    TEST_ASSERT(seq - start == count * record_size);
+
+    TEST_ASSERT(rtc_store_critical_data_get_seq(NULL, &seq) == ESP_ERR_INVALID_ARG);
+    TEST_ASSERT(rtc_store_critical_data_get_seq(&id, NULL) == ESP_ERR_INVALID_ARG);
+
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+
 static char *nvs_read_chars(size_t *len, uint32_t bank)
 {
     nvs_handle_t handle;
@@ -108,6 +108,37 @@ typedef enum {
     ESP_DIAG_DATA_TYPE_MAX,      /*!< Max type */
 } esp_diag_data_type_t;
 
+/**
+ * @brief Metrics or variable metadata declared at build time
+ *
+ * Declarations are collected in a linker section, so the build can extract them from the ELF
+ * into the firmware package. Use \ref ESP_DIAG_METRICS_DECLARE or \ref ESP_DIAG_VARIABLE_DECLARE
+ * to declare one and the respective register_decl API to register it.
+ */
+typedef struct {
+    const char *tag;        /*!< Tag */
+    const char *key;        /*!< Unique key */
+    const char *label;      /*!< Label */
+    const char *path;       /*!< Hierarchical path for the key */
+    const char *unit;       /*!< Data unit, can be NULL */
+    uint16_t type;          /*!< Data point type, \ref esp_diag_data_pt_type_t */
+    uint16_t data_type;     /*!< Data type, \ref esp_diag_data_type_t */
+} esp_diag_meta_decl_t;
+
+/**
+ * @brief Declare metadata at build time, see \ref esp_diag_meta_decl_t
+ *
+ * Declaration is a static variable named `name`, pass its address to the register_decl API.
+ *
+ * @note Object file with the declaration must be linked in, declarations in an object
+ *       which is not referenced otherwise are dropped by the linker.
+ */
+#define ESP_DIAG_META_DECLARE(name, _type, _tag, _key, _label, _path, _unit, _data_type) \
+    static const esp_diag_meta_decl_t name __attribute__((used, section(".esp_diag_meta_decl." #name))) = { \
+        .tag = _tag, .key = _key, .label = _label, .path = _path, .unit = _unit, \
+        .type = _type, .data_type = _data_type, \
+    }
+
 /**
  * @brief Diagnostics log data structure
  */
@@ -294,6 +325,20 @@ void esp_diag_task_snapshot_dump(void);
  */
 uint32_t esp_diag_meta_crc_get(void);
 
+/**
+ * @brief Get hash of the metadata declared at build time
+ *
+ * Hash is CRC32 of all the declarations in the order they are linked, the same as computed
+ * by esp_insights/scripts/get_insights_meta.py from the ELF.
+ *
+ * @param[out] hash hash of the declared metadata
+ *
+ * @return ESP_OK if every registered metrics and variable is declared,
+ *         ESP_ERR_NOT_FOUND if any of them is registered without a declaration,
+ *         ESP_ERR_INVALID_ARG if hash is NULL.
+ */
+esp_err_t esp_diag_meta_decl_hash_get(uint32_t *hash);
+
 /**
  * @brief Get CRC of diagnostics data structures' size
  *
@@ -301,6 +346,19 @@ uint32_t esp_diag_meta_crc_get(void);
  */
 uint32_t esp_diag_data_size_get_crc(void);
 
+/**
+ * @brief Function queuing work, same as esp_rmaker_work_queue_add_task()
+ */
+typedef esp_err_t (*esp_diag_work_queue_add_t)(void (*work_fn)(void *priv_data), void *priv_data);
+
+/**
+ * @brief Set the work queue which runs the periodic diagnostics work, i.e. the heap and Wi-Fi
+ *        metrics dumps and the counters flush, off their timers.
+ *
+ * @param[in] add_fn Function queuing the work, NULL for the RainMaker work queue (default)
+ */
+void esp_diag_work_queue_set(esp_diag_work_queue_add_t add_fn);
+
 
 /**
  * @brief Convenience API for ingesting log data into diagnostics when esp_log_writev() is externally wrapped.
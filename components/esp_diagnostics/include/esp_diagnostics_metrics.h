@@ -25,14 +25,39 @@ extern "C"
  */
 typedef esp_err_t (*esp_diag_metrics_write_cb_t)(const char *tag, void *data, size_t len, void *cb_arg);
 
+/**
+ * @brief Callback to write a batch of metrics data in one go
+ *
+ * @param[in] tag    Tag for metrics
+ * @param[in] data   Array of metrics data
+ * @param[in] len    Array of lengths of metrics data
+ * @param[in] count  Number of entries in data and len arrays
+ * @param[in] cb_arg User data to pass in write callback
+ */
+typedef esp_err_t (*esp_diag_metrics_write_batch_cb_t)(const char *tag, void *const data[], const size_t len[],
+                                                       size_t count, void *cb_arg);
+
 /**
  * @brief Diagnostics metrics config structure
  */
 typedef struct {
     esp_diag_metrics_write_cb_t write_cb; /*!< Callback function to write diagnostics data */
     void *cb_arg;                         /*!< User data to pass in callback function */
+    esp_diag_metrics_write_batch_cb_t write_batch_cb; /*!< Optional callback function to write a batch of
+                                                           diagnostics data at once, if NULL write_cb is
+                                                           called for every data point of the batch */
 } esp_diag_metrics_config_t;
 
+/**
+ * @brief Single data point of a metrics batch
+ */
+typedef struct {
+    const char *key;                /*!< Key of metrics */
+    esp_diag_data_type_t data_type; /*!< Data type of metrics */
+    const void *val;                /*!< Value of metrics */
+    size_t val_sz;                  /*!< Size of val */
+} esp_diag_metrics_batch_item_t;
+
 /**
  * @brief Structure for diagnostics metrics metadata
  */
@@ -79,6 +104,32 @@ esp_err_t esp_diag_metrics_register(const char *tag,
                                     const char *path,
                                     esp_diag_data_type_t type);
 
+/**
+ * @brief Declare a metrics at build time
+ *
+ * Declared metrics is extracted from the ELF into the firmware package, register it using
+ * \ref esp_diag_metrics_register_decl.
+ *
+ * @param name  Name of the \ref esp_diag_meta_decl_t declared
+ * @param tag   Tag of metrics
+ * @param key   Unique key for the metrics
+ * @param label Label for the metrics
+ * @param path  Hierarchical path for key, must be separated by '.' for more than one level
+ * @param unit  Data unit, can be NULL
+ * @param type  Data type of metrics
+ */
+#define ESP_DIAG_METRICS_DECLARE(name, tag, key, label, path, unit, type) \
+    ESP_DIAG_META_DECLARE(name, ESP_DIAG_DATA_PT_METRICS, tag, key, label, path, unit, type)
+
+/**
+ * @brief Register a metrics declared using \ref ESP_DIAG_METRICS_DECLARE
+ *
+ * @param[in] decl Declaration of the metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_register_decl(const esp_diag_meta_decl_t *decl);
+
 /**
  * @brief Unregister all previously registered metrics
  *
@@ -92,9 +143,32 @@ esp_err_t esp_diag_metrics_unregister_all(void);
  * @param[out] len Length of the metrics meta data array
  *
  * @return array Array of metrics meta data
+ *
+ * @note Registered metrics are not stored contiguously, this API returns a copy which is
+ *       valid until the next call that changes the registered metrics. Prefer
+ *       \ref esp_diag_metrics_meta_count and \ref esp_diag_metrics_meta_get_by_index.
  */
 const esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_all(uint32_t *len);
 
+/**
+ * @brief Get the number of registered metrics
+ *
+ * @return Number of registered metrics
+ */
+uint32_t esp_diag_metrics_meta_count(void);
+
+/**
+ * @brief Get metadata of a registered metrics
+ *
+ * @param[in] index Index of the metrics, must be less than \ref esp_diag_metrics_meta_count
+ *
+ * @return Pointer to the metrics meta data if index is valid, NULL otherwise.
+ *
+ * @note Pointer stays valid until the metrics is unregistered, however the index of a metrics
+ *       may change when some other metrics is unregistered.
+ */
+const esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_by_index(uint32_t index);
+
 /**
  * @brief Print metadata for all metrics
  */
@@ -221,6 +295,23 @@ esp_err_t esp_diag_metrics_report_mac(const char *tag, const char *key, uint8_t
  */
 esp_err_t esp_diag_metrics_report_str(const char *tag, const char *key, const char *str);
 
+/**
+ * @brief Add a batch of metrics to storage
+ *
+ * All the data points are written to the storage in one go, which is cheaper than
+ * reporting them one by one. If any of the items is invalid nothing is written.
+ * Batches larger than CONFIG_DIAG_METRICS_MAX_BATCH_COUNT are written in chunks of that size.
+ *
+ * @param[in] tag   Tag of metrics, same for all the items
+ * @param[in] items Array of data points
+ * @param[in] count Number of data points
+ * @param[in] ts    Timestamp in microseconds, applied to all the data points
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_report_batch(const char *tag, const esp_diag_metrics_batch_item_t *items,
+                                        size_t count, uint64_t ts);
+
 #else /** APIs for older version of metadata for compatibility */
 
 /**
@@ -300,8 +391,103 @@ esp_err_t esp_diag_metrics_add_mac(const char *key, uint8_t *mac);
  */
 esp_err_t esp_diag_metrics_add_str(const char *key, const char *str);
 
+/**
+ * @brief Add a batch of metrics to storage
+ *
+ * @note Same as \ref esp_diag_metrics_report_batch but with legacy format
+ */
+esp_err_t esp_diag_metrics_add_batch(const esp_diag_metrics_batch_item_t *items, size_t count, uint64_t ts);
+
 #endif
 
+#if CONFIG_DIAG_ENABLE_COUNTERS
+/**
+ * @brief Handle of a diagnostics counter, 0 is never a valid handle
+ */
+typedef uint32_t esp_diag_counter_handle_t;
+
+/**
+ * @brief Initialize the diagnostics counters
+ *
+ * Counters are accumulated in RAM and reported as unsigned integer metrics periodically.
+ * The periodic interval is configurable through CONFIG_DIAG_COUNTERS_FLUSH_INTERVAL Kconfig option.
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_counters_init(void);
+
+/**
+ * @brief Deinitialize the diagnostics counters
+ *
+ * Pending counts are flushed and all the counters are unregistered.
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_counters_deinit(void);
+
+/**
+ * @brief Register a counter
+ *
+ * This registers a metrics of type \ref ESP_DIAG_DATA_TYPE_UINT with the given tag and key
+ * and returns a handle to be used with \ref esp_diag_counter_add.
+ *
+ * @param[in]  tag    Tag of the counter
+ * @param[in]  key    Unique key for the counter
+ * @param[in]  label  Label for the counter
+ * @param[in]  path   Hierarchical path for key, must be separated by '.' for more than one level
+ * @param[out] handle Handle of the registered counter
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_counter_register(const char *tag, const char *key,
+                                    const char *label, const char *path,
+                                    esp_diag_counter_handle_t *handle);
+
+/**
+ * @brief Unregister a counter
+ *
+ * @param[in] handle Handle of the counter
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ *
+ * @note Handle is invalid after this call, APIs return ESP_ERR_INVALID_ARG for it.
+ */
+esp_err_t esp_diag_counter_unregister(esp_diag_counter_handle_t handle);
+
+/**
+ * @brief Add to the counter
+ *
+ * This is a lock-free atomic increment in RAM and is safe to call from any task on any core.
+ * Nothing is written to the storage until the counter is flushed.
+ *
+ * @param[in] handle Handle of the counter
+ * @param[in] n      Value to add
+ *
+ * @return ESP_OK if successful, ESP_ERR_INVALID_ARG if the counter is not registered.
+ */
+esp_err_t esp_diag_counter_add(esp_diag_counter_handle_t handle, uint32_t n);
+
+/**
+ * @brief Report the counters
+ *
+ * Each counter which changed since the last flush is reported as one metrics data point
+ * holding the count accumulated in the interval, and is then reset to zero.
+ * Counters are flushed periodically, this API can be used to flush them at any given point in time.
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_counters_flush(void);
+
+/**
+ * @brief Reset the periodic flush interval
+ *
+ * If the interval is set to 0, periodic flush is disabled.
+ *
+ * @param[in] period Period interval in seconds
+ */
+void esp_diag_counters_reset_interval(uint32_t period);
+#endif /* CONFIG_DIAG_ENABLE_COUNTERS */
+
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
 
 #ifdef __cplusplus
@@ -81,6 +81,32 @@ esp_err_t esp_diag_variable_register(const char *tag,
                                      const char *path,
                                      esp_diag_data_type_t type);
 
+/**
+ * @brief Declare a variable at build time
+ *
+ * Declared variable is extracted from the ELF into the firmware package, register it using
+ * \ref esp_diag_variable_register_decl.
+ *
+ * @param name  Name of the \ref esp_diag_meta_decl_t declared
+ * @param tag   Tag of variable
+ * @param key   Unique key for the variable
+ * @param label Label for the variable
+ * @param path  Hierarchical path for key, must be separated by '.' for more than one level
+ * @param unit  Data unit, can be NULL
+ * @param type  Data type of variable
+ */
+#define ESP_DIAG_VARIABLE_DECLARE(name, tag, key, label, path, unit, type) \
+    ESP_DIAG_META_DECLARE(name, ESP_DIAG_DATA_PT_VARIABLE, tag, key, label, path, unit, type)
+
+/**
+ * @brief Register a variable declared using \ref ESP_DIAG_VARIABLE_DECLARE
+ *
+ * @param[in] decl Declaration of the variable
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_variable_register_decl(const esp_diag_meta_decl_t *decl);
+
 /**
  * @brief Unregister all previously registered variables
  *
@@ -94,14 +120,48 @@ esp_err_t esp_diag_variable_unregister_all(void);
  * @param[out] len Length of the variables  meta data array
  *
  * @return array Array of variables meta data
+ *
+ * @note Registered variables are not stored contiguously, this API returns a copy which is
+ *       valid until the next call that changes the registered variables. Prefer
+ *       \ref esp_diag_variable_meta_count and \ref esp_diag_variable_meta_get_by_index.
  */
 const esp_diag_variable_meta_t *esp_diag_variable_meta_get_all(uint32_t *len);
 
+/**
+ * @brief Get the number of registered variables
+ *
+ * @return Number of registered variables
+ */
+uint32_t esp_diag_variable_meta_count(void);
+
+/**
+ * @brief Get metadata of a registered variable
+ *
+ * @param[in] index Index of the variable, must be less than \ref esp_diag_variable_meta_count
+ *
+ * @return Pointer to the variable meta data if index is valid, NULL otherwise.
+ *
+ * @note Pointer stays valid until the variable is unregistered, however the index of a variable
+ *       may change when some other variable is unregistered.
+ */
+const esp_diag_variable_meta_t *esp_diag_variable_meta_get_by_index(uint32_t index);
+
 /**
  * @brief Print metadata for all variables
  */
 void esp_diag_variable_meta_print_all(void);
 
+/**
+ * @brief Report the last known value of all the variables
+ *
+ * Every variable which has been reported at least once is written again with its
+ * last value and the current timestamp. This can be used to resend the current state
+ * after previously reported data was lost, e.g. store discard or failed upload.
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_variable_report_all(void);
+
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
 
 /**
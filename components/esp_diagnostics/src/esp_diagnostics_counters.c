@@ -0,0 +1,274 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <freertos/semphr.h>
+#include "sdkconfig.h"
+
+#include <esp_diagnostics.h>
+#include <esp_diagnostics_metrics.h>
+#include "esp_diagnostics_internal.h"
+
+#define LOG_TAG                  "diag_counters"
+#define DIAG_COUNTERS_MAX_COUNT  CONFIG_DIAG_COUNTERS_MAX_COUNT
+#define DEFAULT_FLUSH_INTERVAL   CONFIG_DIAG_COUNTERS_FLUSH_INTERVAL
+
+/* Handle holds the generation of the slot in the upper half and the slot index + 1 in the lower half,
+ * a handle kept after unregister does not match the slot once it is registered again.
+ */
+#define HANDLE_MAKE(idx, gen)   (((uint32_t) (gen) << 16) | ((uint32_t) (idx) + 1))
+#define HANDLE_IDX(h)           ((int) ((h) & 0xFFFF) - 1)
+
+struct esp_diag_counter {
+    const char *tag;
+    const char *key;
+    atomic_uint_least32_t value;    /* Count accumulated since the last flush */
+    atomic_uint_least32_t handle;   /* Handle of the registration, 0 if the slot is free */
+    uint16_t gen;                   /* Bumped on every registration of the slot */
+};
+
+typedef struct {
+    bool init;
+    TimerHandle_t handle;
+    struct esp_diag_counter counters[DIAG_COUNTERS_MAX_COUNT];
+} counters_priv_data_t;
+
+static counters_priv_data_t s_priv_data;
+/* Guards registration and flush. Created once and kept across deinit, a flush queued
+ * before deinit may still run after it and must find the lock.
+ */
+static SemaphoreHandle_t s_lock;
+
+static inline bool counter_in_use(struct esp_diag_counter *counter)
+{
+    return atomic_load_explicit(&counter->handle, memory_order_acquire) != 0;
+}
+
+/* Returns the counter the handle is registered for, NULL for a stale or invalid handle */
+static struct esp_diag_counter *counter_get(esp_diag_counter_handle_t handle)
+{
+    int idx = HANDLE_IDX(handle);
+    if (!handle || idx < 0 || idx >= DIAG_COUNTERS_MAX_COUNT) {
+        return NULL;
+    }
+    struct esp_diag_counter *counter = &s_priv_data.counters[idx];
+    if (atomic_load_explicit(&counter->handle, memory_order_acquire) != handle) {
+        return NULL;
+    }
+    return counter;
+}
+
+static esp_err_t counter_report(struct esp_diag_counter *counter, uint32_t count)
+{
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    return esp_diag_metrics_report_uint(counter->tag, counter->key, count);
+#else
+    return esp_diag_metrics_add_uint(counter->key, count);
+#endif
+}
+
+static esp_err_t counters_flush(void)
+{
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; i < DIAG_COUNTERS_MAX_COUNT; i++) {
+        struct esp_diag_counter *counter = &s_priv_data.counters[i];
+        if (!counter_in_use(counter)) {
+            continue;
+        }
+        /* Claim the count in one go, increments racing with us land in the next interval */
+        uint32_t count = atomic_exchange_explicit(&counter->value, 0, memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        esp_err_t err = counter_report(counter, count);
+        if (err != ESP_OK) {
+            /* Put the count back so that it is not lost, it will be retried on next flush */
+            atomic_fetch_add_explicit(&counter->value, count, memory_order_relaxed);
+            ESP_LOGD(LOG_TAG, "Failed to report counter key:%s, err:0x%x", counter->key, err);
+            ret = err;
+        }
+    }
+    return ret;
+}
+
+esp_err_t esp_diag_counters_flush(void)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_priv_data.init) {
+        ret = counters_flush();
+    }
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+static void counters_flush_cb(void *arg)
+{
+    /* Does nothing if counters are deinitialized after this was queued */
+    esp_diag_counters_flush();
+}
+
+static void counters_timer_cb(TimerHandle_t handle)
+{
+    esp_diag_work_queue_add(counters_flush_cb, NULL);
+}
+
+esp_err_t esp_diag_counter_register(const char *tag, const char *key,
+                                    const char *label, const char *path,
+                                    esp_diag_counter_handle_t *handle)
+{
+    if (!tag || !key || !label || !path || !handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_priv_data.init) {
+        err = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+    int i;
+    for (i = 0; i < DIAG_COUNTERS_MAX_COUNT; i++) {
+        if (!counter_in_use(&s_priv_data.counters[i])) {
+            break;
+        }
+    }
+    if (i == DIAG_COUNTERS_MAX_COUNT) {
+        ESP_LOGE(LOG_TAG, "No space left for more counters");
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    err = esp_diag_metrics_register(tag, key, label, path, ESP_DIAG_DATA_TYPE_UINT);
+    if (err != ESP_OK) {
+        goto exit;
+    }
+    struct esp_diag_counter *counter = &s_priv_data.counters[i];
+    counter->tag = tag;
+    counter->key = key;
+    counter->gen++;
+    atomic_store_explicit(&counter->value, 0, memory_order_relaxed);
+    *handle = HANDLE_MAKE(i, counter->gen);
+    /* Publish the handle once the counter is set up */
+    atomic_store_explicit(&counter->handle, *handle, memory_order_release);
+exit:
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+static void counter_unregister(struct esp_diag_counter *counter)
+{
+    atomic_store_explicit(&counter->handle, 0, memory_order_release);
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_unregister(counter->tag, counter->key);
+#else
+    esp_diag_metrics_unregister(counter->key);
+#endif
+    counter->tag = NULL;
+    counter->key = NULL;
+}
+
+esp_err_t esp_diag_counter_unregister(esp_diag_counter_handle_t handle)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    struct esp_diag_counter *counter = counter_get(handle);
+    if (counter) {
+        counter_unregister(counter);
+    } else {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+esp_err_t esp_diag_counter_add(esp_diag_counter_handle_t handle, uint32_t n)
+{
+    struct esp_diag_counter *counter = counter_get(handle);
+    if (!counter) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_fetch_add_explicit(&counter->value, n, memory_order_relaxed);
+    return ESP_OK;
+}
+
+esp_err_t esp_diag_counters_init(void)
+{
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) {
+            ESP_LOGE(LOG_TAG, "Failed to create counters lock");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_priv_data.handle = xTimerCreate("diag_counters", SEC2TICKS(DEFAULT_FLUSH_INTERVAL),
+                                      pdTRUE, NULL, counters_timer_cb);
+    if (!s_priv_data.handle) {
+        ESP_LOGE(LOG_TAG, "Failed to create counters flush timer");
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_priv_data.init = true;
+    xSemaphoreGive(s_lock);
+    xTimerStart(s_priv_data.handle, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_diag_counters_deinit(void)
+{
+    if (!s_lock || !s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* No new flush gets queued once the timer is stopped */
+    xTimerStop(s_priv_data.handle, portMAX_DELAY);
+    /* Try to delete timer with 10 ticks wait time */
+    if (xTimerDelete(s_priv_data.handle, 10) == pdFALSE) {
+        ESP_LOGW(LOG_TAG, "Failed to delete counters flush timer");
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    /* Report whatever is pending before the counters go away */
+    counters_flush();
+    for (int i = 0; i < DIAG_COUNTERS_MAX_COUNT; i++) {
+        if (counter_in_use(&s_priv_data.counters[i])) {
+            counter_unregister(&s_priv_data.counters[i]);
+        }
+    }
+    /* A flush still queued finds init cleared under the lock and does nothing. Generations
+     * are kept so that handles from before stay stale after init.
+     */
+    s_priv_data.init = false;
+    s_priv_data.handle = NULL;
+    for (int i = 0; i < DIAG_COUNTERS_MAX_COUNT; i++) {
+        atomic_store_explicit(&s_priv_data.counters[i].value, 0, memory_order_relaxed);
+    }
+    xSemaphoreGive(s_lock);
+    return ESP_OK;
+}
+
+void esp_diag_counters_reset_interval(uint32_t period)
+{
+    if (!s_priv_data.init) {
+        return;
+    }
+    if (period == 0) {
+        xTimerStop(s_priv_data.handle, 0);
+        return;
+    }
+    xTimerChangePeriod(s_priv_data.handle, SEC2TICKS(period), 0);
+}
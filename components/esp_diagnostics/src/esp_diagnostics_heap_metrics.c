@@ -11,7 +11,6 @@
 #include <freertos/timers.h>
 #include "sdkconfig.h"
 
-#include <esp_rmaker_work_queue.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_metrics.h>
 #include "esp_diagnostics_internal.h"
@@ -47,6 +46,37 @@ typedef struct {
 
 static heap_diag_priv_data_t s_priv_data;
 
+ESP_DIAG_METRICS_DECLARE(s_alloc_fail_decl, METRICS_TAG, KEY_ALLOC_FAIL, "Malloc fail", METRICS_TAG,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+ESP_DIAG_METRICS_DECLARE(s_ext_free_decl, METRICS_TAG, KEY_EXT_FREE, "External free heap", PATH_HEAP_EXTERNAL,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_METRICS_DECLARE(s_ext_lfb_decl, METRICS_TAG, KEY_EXT_LFB, "External largest free block", PATH_HEAP_EXTERNAL,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_METRICS_DECLARE(s_ext_min_free_decl, METRICS_TAG, KEY_EXT_MIN_FREE, "External minimum free size", PATH_HEAP_EXTERNAL,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+#endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
+ESP_DIAG_METRICS_DECLARE(s_free_decl, METRICS_TAG, KEY_FREE, "Free heap", PATH_HEAP_INTERNAL,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_METRICS_DECLARE(s_lfb_decl, METRICS_TAG, KEY_LFB, "Largest free block", PATH_HEAP_INTERNAL,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_METRICS_DECLARE(s_min_free_decl, METRICS_TAG, KEY_MIN_FREE, "Minimum free size", PATH_HEAP_INTERNAL,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_UINT);
+
+static const esp_diag_meta_decl_t *const s_metrics_decls[] = {
+    &s_alloc_fail_decl,
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    &s_ext_free_decl,
+    &s_ext_lfb_decl,
+    &s_ext_min_free_decl,
+#endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
+    &s_free_decl,
+    &s_lfb_decl,
+    &s_min_free_decl,
+};
+
+#define HEAP_METRICS_ITEM(_key, _val) { .key = _key, .data_type = ESP_DIAG_DATA_TYPE_UINT, .val = &_val, .val_sz = sizeof(_val) }
+
 esp_err_t esp_diag_heap_metrics_dump(void)
 {
     if (!s_priv_data.init) {
@@ -56,53 +86,37 @@ esp_err_t esp_diag_heap_metrics_dump(void)
     uint32_t free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
     uint32_t lfb = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
     uint32_t min_free_ever = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_uint(METRICS_TAG, KEY_FREE, free), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_FREE);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_uint(METRICS_TAG, KEY_LFB, lfb), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_LFB);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_uint(METRICS_TAG, KEY_MIN_FREE, min_free_ever), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_MIN_FREE);
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    uint32_t ext_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    uint32_t ext_lfb = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    uint32_t ext_min_free_ever = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+#endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
 
-    ESP_LOGI(LOG_TAG, KEY_FREE ":0x%" PRIx32 " " KEY_LFB ":0x%" PRIx32 " " KEY_MIN_FREE ":0x%" PRIx32, free, lfb, min_free_ever);
+    /* Report all the heap metrics in a single write to the data store */
+    const esp_diag_metrics_batch_item_t items[] = {
+        HEAP_METRICS_ITEM(KEY_FREE, free),
+        HEAP_METRICS_ITEM(KEY_LFB, lfb),
+        HEAP_METRICS_ITEM(KEY_MIN_FREE, min_free_ever),
 #ifdef CONFIG_ESP32_SPIRAM_SUPPORT
-    free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
-    lfb = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
-    min_free_ever = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
-
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_uint(METRICS_TAG, KEY_EXT_FREE, free), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_EXT_FREE);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_uint(METRICS_TAG, KEY_EXT_LFB, lfb), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_EXT_LFB);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_uint(METRICS_TAG, KEY_EXT_MIN_FREE, min_free_ever), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_EXT_MIN_FREE);
-
-    ESP_LOGI(LOG_TAG, KEY_EXT_FREE ":0x%" PRIx32 " " KEY_EXT_LFB ":0x%" PRIx32 " " KEY_EXT_MIN_FREE ":0x%" PRIx32, free, lfb, min_free_ever);
+        HEAP_METRICS_ITEM(KEY_EXT_FREE, ext_free),
+        HEAP_METRICS_ITEM(KEY_EXT_LFB, ext_lfb),
+        HEAP_METRICS_ITEM(KEY_EXT_MIN_FREE, ext_min_free_ever),
 #endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
+    };
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    RET_ON_ERR_WITH_LOG(esp_diag_metrics_report_batch(METRICS_TAG, items, sizeof(items) / sizeof(items[0]),
+                                                      esp_diag_timestamp_get()),
+                        ESP_LOG_WARN, LOG_TAG, "Failed to add heap metrics");
 #else
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_uint(KEY_FREE, free), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_FREE);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_uint(KEY_LFB, lfb), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_LFB);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_uint(KEY_MIN_FREE, min_free_ever), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_MIN_FREE);
-
-    ESP_LOGI(LOG_TAG, KEY_FREE ":0x%"PRIx32" " KEY_LFB ":0x%"PRIx32" " KEY_MIN_FREE ":0x%"PRIx32, free, lfb, min_free_ever);
+    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_batch(items, sizeof(items) / sizeof(items[0]), esp_diag_timestamp_get()),
+                        ESP_LOG_WARN, LOG_TAG, "Failed to add heap metrics");
+#endif
+
+    ESP_LOGI(LOG_TAG, KEY_FREE ":0x%" PRIx32 " " KEY_LFB ":0x%" PRIx32 " " KEY_MIN_FREE ":0x%" PRIx32, free, lfb, min_free_ever);
 #ifdef CONFIG_ESP32_SPIRAM_SUPPORT
-    free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
-    lfb = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
-    min_free_ever = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
-
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_uint(KEY_EXT_FREE, free), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_EXT_FREE);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_uint(KEY_EXT_LFB, lfb), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_EXT_LFB);
-    RET_ON_ERR_WITH_LOG(esp_diag_metrics_add_uint(KEY_EXT_MIN_FREE, min_free_ever), ESP_LOG_WARN, LOG_TAG,
-                        "Failed to add heap metric key:" KEY_EXT_MIN_FREE);
-
-    ESP_LOGI(LOG_TAG, KEY_EXT_FREE ":0x%"PRIx32" " KEY_EXT_LFB ":0x%"PRIx32" " KEY_EXT_MIN_FREE ":0x%"PRIx32, free, lfb, min_free_ever);
+    ESP_LOGI(LOG_TAG, KEY_EXT_FREE ":0x%" PRIx32 " " KEY_EXT_LFB ":0x%" PRIx32 " " KEY_EXT_MIN_FREE ":0x%" PRIx32,
+             ext_free, ext_lfb, ext_min_free_ever);
 #endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
-#endif
     return ESP_OK;
 }
 
@@ -113,7 +127,7 @@ static void heap_metrics_dump_cb(void *arg)
 
 static void heap_timer_cb(TimerHandle_t handle)
 {
-    esp_rmaker_work_queue_add_task(heap_metrics_dump_cb, NULL);
+    esp_diag_work_queue_add(heap_metrics_dump_cb, NULL);
 }
 
 static void alloc_failed_hook(size_t size, uint32_t caps, const char *func)
@@ -137,40 +151,9 @@ esp_err_t esp_diag_heap_metrics_init(void)
     if (err != ESP_OK) {
         return err;
     }
-    esp_diag_metrics_register(METRICS_TAG, KEY_ALLOC_FAIL, "Malloc fail", METRICS_TAG, ESP_DIAG_DATA_TYPE_UINT);
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_ALLOC_FAIL, METRICS_UNIT);
-#else
-    esp_diag_metrics_add_unit(KEY_ALLOC_FAIL, METRICS_UNIT);
-#endif
-
-#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
-    esp_diag_metrics_register(METRICS_TAG, KEY_EXT_FREE, "External free heap", PATH_HEAP_EXTERNAL, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_metrics_register(METRICS_TAG, KEY_EXT_LFB, "External largest free block", PATH_HEAP_EXTERNAL, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_metrics_register(METRICS_TAG, KEY_EXT_MIN_FREE, "External minimum free size", PATH_HEAP_EXTERNAL, ESP_DIAG_DATA_TYPE_UINT);
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_EXT_FREE, METRICS_UNIT);
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_EXT_LFB, METRICS_UNIT);
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_EXT_MIN_FREE, METRICS_UNIT);
-#else
-    esp_diag_metrics_add_unit(KEY_EXT_FREE, METRICS_UNIT);
-    esp_diag_metrics_add_unit(KEY_EXT_LFB, METRICS_UNIT);
-    esp_diag_metrics_add_unit(KEY_EXT_MIN_FREE, METRICS_UNIT);
-#endif
-#endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
-
-    esp_diag_metrics_register(METRICS_TAG, KEY_FREE, "Free heap", PATH_HEAP_INTERNAL, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_metrics_register(METRICS_TAG, KEY_LFB, "Largest free block", PATH_HEAP_INTERNAL, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_metrics_register(METRICS_TAG, KEY_MIN_FREE, "Minimum free size", PATH_HEAP_INTERNAL, ESP_DIAG_DATA_TYPE_UINT);
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_FREE, METRICS_UNIT);
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_LFB, METRICS_UNIT);
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_MIN_FREE, METRICS_UNIT);
-#else
-    esp_diag_metrics_add_unit(KEY_FREE, METRICS_UNIT);
-    esp_diag_metrics_add_unit(KEY_LFB, METRICS_UNIT);
-    esp_diag_metrics_add_unit(KEY_MIN_FREE, METRICS_UNIT);
-#endif
+    for (int i = 0; i < sizeof(s_metrics_decls) / sizeof(s_metrics_decls[0]); i++) {
+        esp_diag_metrics_register_decl(s_metrics_decls[i]);
+    }
     s_priv_data.handle = xTimerCreate("heap_metrics", SEC2TICKS(DEFAULT_POLLING_INTERVAL),
                                       pdTRUE, NULL, heap_timer_cb);
     if (s_priv_data.handle) {
@@ -20,6 +20,12 @@ extern "C" {
 
 #define SEC2TICKS(s) ((s * 1000) / portTICK_PERIOD_MS)
 
+/* Marks the diagnostics metadata as changed, must be called whenever metrics or variables meta is modified */
+void esp_diag_meta_changed(void);
+
+/* Queues work on the work queue set by esp_diag_work_queue_set() */
+esp_err_t esp_diag_work_queue_add(void (*work_fn)(void *priv_data), void *priv_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,57 +8,74 @@
 #include <string.h>
 #include <stdbool.h>
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_metrics.h>
+#include "esp_diagnostics_registry.h"
+#include "esp_diagnostics_internal.h"
 
 #define TAG "DIAG_METRICS"
 #define DIAG_METRICS_MAX_COUNT   CONFIG_DIAG_METRICS_MAX_COUNT
+#define DIAG_REGISTRY_CHUNK_LEN  CONFIG_DIAG_REGISTRY_CHUNK_LEN
+#define DIAG_METRICS_MAX_BATCH_COUNT CONFIG_DIAG_METRICS_MAX_BATCH_COUNT
 
 /* Max supported string length */
 #define MAX_STR_LEN             (sizeof(((esp_diag_str_data_pt_t *)0)->value.str) - 1)
+/* Max supported size of non-string values */
+#define MAX_VALUE_SZ            sizeof(((esp_diag_data_pt_t *)0)->value)
 #define MAX_METRICS_WRITE_SZ     sizeof(esp_diag_data_pt_t)
 #define MAX_STR_METRICS_WRITE_SZ sizeof(esp_diag_str_data_pt_t)
 
 typedef struct {
-    size_t metrics_count;
-    esp_diag_metrics_meta_t metrics[DIAG_METRICS_MAX_COUNT];
+    diag_registry_t metrics;    /* Registry of esp_diag_metrics_meta_t */
     esp_diag_metrics_config_t config;
+    SemaphoreHandle_t batch_lock;   /* Guards s_batch */
     bool init;
 } metrics_priv_data_t;
 
+/* Data points of a batch are staged here rather than on the stack of the reporting task,
+ * which may be any task, e.g. the one running the allocation failed hook.
+ */
+typedef struct {
+    esp_diag_str_data_pt_t data[DIAG_METRICS_MAX_BATCH_COUNT];
+    void *data_ptrs[DIAG_METRICS_MAX_BATCH_COUNT];
+    size_t write_sz[DIAG_METRICS_MAX_BATCH_COUNT];
+} metrics_batch_t;
+
 static metrics_priv_data_t s_priv_data;
+static metrics_batch_t s_batch;
+
+static bool match_tag_key(const void *entry, const void *arg)
+{
+    const esp_diag_metrics_meta_t *metrics = entry;
+    const esp_diag_metrics_meta_t *lookup = arg;
+    return (strcmp(metrics->tag, lookup->tag) == 0) && (strcmp(metrics->key, lookup->key) == 0);
+}
 
+/* Lookups below are called with the registry lock held, see diag_registry_find() */
 static esp_diag_metrics_meta_t *esp_diag_metrics_meta_get(const char *tag, const char *key)
 {
-    uint32_t i;
     if (!tag || !key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.metrics_count; i++) {
-        if (s_priv_data.metrics[i].tag && s_priv_data.metrics[i].key &&
-                (strcmp(s_priv_data.metrics[i].tag, tag) == 0) &&
-                (strcmp(s_priv_data.metrics[i].key, key) == 0)) {
-            return &s_priv_data.metrics[i];
-        }
-    }
-    return NULL;
+    const esp_diag_metrics_meta_t lookup = { .tag = tag, .key = key };
+    return diag_registry_find(&s_priv_data.metrics, key, match_tag_key, &lookup);
 }
 
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+static bool match_key(const void *entry, const void *arg)
+{
+    return strcmp(((const esp_diag_metrics_meta_t *) entry)->key, arg) == 0;
+}
+
 /* Checks only by key for registered metric. Use this for meta version < 1.1 */
 static esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_by_key(const char *key)
 {
-    uint32_t i;
     if (!key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.metrics_count; i++) {
-        if (s_priv_data.metrics[i].key &&
-                (strcmp(s_priv_data.metrics[i].key, key) == 0)) {
-            return &s_priv_data.metrics[i];
-        }
-    }
-    return NULL;
+    return diag_registry_find(&s_priv_data.metrics, key, match_key, key);
 }
 #endif
 
@@ -67,9 +84,9 @@ static bool tag_key_present(const char *tag, const char *key)
     return (esp_diag_metrics_meta_get(tag, key) != NULL);
 }
 
-esp_err_t esp_diag_metrics_register(const char *tag, const char *key,
-                                    const char *label, const char *path,
-                                    esp_diag_data_type_t type)
+static esp_err_t metrics_register(const char *tag, const char *key,
+                                  const char *label, const char *path,
+                                  const char *unit, esp_diag_data_type_t type)
 {
     if (!tag || !key || !label || !path) {
         ESP_LOGE(TAG, "Failed to register metrics, tag, key, label, or path is NULL");
@@ -78,24 +95,44 @@ esp_err_t esp_diag_metrics_register(const char *tag, const char *key,
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
-    if (s_priv_data.metrics_count >= DIAG_METRICS_MAX_COUNT) {
-        ESP_LOGE(TAG, "No space left for more metrics");
-        return ESP_ERR_NO_MEM;
-    }
+    diag_registry_lock(&s_priv_data.metrics);
     if (tag_key_present(tag, key)) {
+        diag_registry_unlock(&s_priv_data.metrics);
         ESP_LOGE(TAG, "Metrics tag: %s key:%s exists", tag, key);
         return ESP_FAIL;
     }
-    s_priv_data.metrics[s_priv_data.metrics_count].tag = tag;
-    s_priv_data.metrics[s_priv_data.metrics_count].key = key;
-    s_priv_data.metrics[s_priv_data.metrics_count].label = label;
-    s_priv_data.metrics[s_priv_data.metrics_count].unit = NULL;
-    s_priv_data.metrics[s_priv_data.metrics_count].path = path;
-    s_priv_data.metrics[s_priv_data.metrics_count].type = type;
-    s_priv_data.metrics_count++;
+    esp_diag_metrics_meta_t *metrics = diag_registry_add(&s_priv_data.metrics, key);
+    if (!metrics) {
+        diag_registry_unlock(&s_priv_data.metrics);
+        ESP_LOGE(TAG, "No space left for more metrics");
+        return ESP_ERR_NO_MEM;
+    }
+    metrics->tag = tag;
+    metrics->key = key;
+    metrics->label = label;
+    metrics->unit = unit;
+    metrics->path = path;
+    metrics->type = type;
+    diag_registry_unlock(&s_priv_data.metrics);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
+esp_err_t esp_diag_metrics_register(const char *tag, const char *key,
+                                    const char *label, const char *path,
+                                    esp_diag_data_type_t type)
+{
+    return metrics_register(tag, key, label, path, NULL, type);
+}
+
+esp_err_t esp_diag_metrics_register_decl(const esp_diag_meta_decl_t *decl)
+{
+    if (!decl || decl->type != ESP_DIAG_DATA_PT_METRICS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return metrics_register(decl->tag, decl->key, decl->label, decl->path, decl->unit, decl->data_type);
+}
+
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 esp_err_t esp_diag_metrics_add_unit(const char *key, const char *unit)
 #else
@@ -114,20 +151,25 @@ esp_err_t esp_diag_metrics_add_unit(const char *tag, const char *key, const char
         return ESP_ERR_INVALID_STATE;
     }
 
+    diag_registry_lock(&s_priv_data.metrics);
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
     esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_by_key(key);
     if (!metrics) {
+        diag_registry_unlock(&s_priv_data.metrics);
         ESP_LOGI(TAG, "metrics with (key %s) not found", key);
         return ESP_ERR_NOT_FOUND;
     }
 #else
     esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get(tag, key);
     if (!metrics) {
+        diag_registry_unlock(&s_priv_data.metrics);
         ESP_LOGI(TAG, "metrics with (tag %s, key %s) not found", tag, key);
         return ESP_ERR_NOT_FOUND;
     }
 #endif
     metrics->unit = unit;
+    diag_registry_unlock(&s_priv_data.metrics);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -137,7 +179,6 @@ esp_err_t esp_diag_metrics_unregister(const char *key)
 esp_err_t esp_diag_metrics_unregister(const char *tag, const char *key)
 #endif
 {
-    int i;
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
     if (!tag) {
         return ESP_ERR_INVALID_ARG;
@@ -146,22 +187,21 @@ esp_err_t esp_diag_metrics_unregister(const char *tag, const char *key)
     if (!key) {
         return ESP_ERR_INVALID_ARG;
     }
-    for (i = 0; i < s_priv_data.metrics_count; i++) {
-        if (s_priv_data.metrics[i].key &&
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                (strcmp(s_priv_data.metrics[i].tag, tag) == 0) &&
-#endif
-                (strcmp(s_priv_data.metrics[i].key, key) == 0)) {
-            break;
-        }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
     }
-    if (i < s_priv_data.metrics_count) {
-        s_priv_data.metrics[i] = s_priv_data.metrics[s_priv_data.metrics_count - 1];
-        memset(&s_priv_data.metrics[s_priv_data.metrics_count - 1], 0, sizeof(esp_diag_metrics_meta_t));
-        s_priv_data.metrics_count--;
-        return ESP_OK;
+    diag_registry_lock(&s_priv_data.metrics);
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_by_key(key);
+#else
+    esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get(tag, key);
+#endif
+    esp_err_t err = metrics ? diag_registry_remove(&s_priv_data.metrics, metrics) : ESP_ERR_NOT_FOUND;
+    diag_registry_unlock(&s_priv_data.metrics);
+    if (err == ESP_OK) {
+        esp_diag_meta_changed();
     }
-    return ESP_ERR_NOT_FOUND;
+    return err;
 }
 
 esp_err_t esp_diag_metrics_unregister_all(void)
@@ -169,32 +209,58 @@ esp_err_t esp_diag_metrics_unregister_all(void)
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
-    memset(&s_priv_data.metrics, 0, sizeof(s_priv_data.metrics));
-    s_priv_data.metrics_count = 0;
+    diag_registry_clear(&s_priv_data.metrics);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
+uint32_t esp_diag_metrics_meta_count(void)
+{
+    if (!s_priv_data.init) {
+        return 0;
+    }
+    return diag_registry_count(&s_priv_data.metrics);
+}
+
+const esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_by_index(uint32_t index)
+{
+    if (!s_priv_data.init) {
+        return NULL;
+    }
+    return diag_registry_get(&s_priv_data.metrics, index);
+}
+
 const esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_all(uint32_t *len)
 {
     if (!s_priv_data.init) {
         *len = 0;
         return NULL;
     }
-    *len = s_priv_data.metrics_count;
-    return &s_priv_data.metrics[0];
+    /* Entries are spread over chunks, hand out a contiguous copy */
+    const esp_diag_metrics_meta_t *meta = diag_registry_snapshot(&s_priv_data.metrics, sizeof(esp_diag_metrics_meta_t));
+    *len = meta ? diag_registry_count(&s_priv_data.metrics) : 0;
+    return meta;
 }
 
 void esp_diag_metrics_meta_print_all(void)
 {
-    uint32_t len;
+    if (!s_priv_data.init) {
+        return;
+    }
+    diag_registry_lock(&s_priv_data.metrics);
+    uint32_t len = esp_diag_metrics_meta_count();
     uint32_t i;
-    const esp_diag_metrics_meta_t *meta = esp_diag_metrics_meta_get_all(&len);
-    if (meta) {
+    if (len) {
         ESP_LOGI(TAG, "Tag\tKey\tLabel\tPath\tData type\n");
         for (i = 0; i < len; i++) {
-            ESP_LOGI(TAG, "%s\t%s\t%s\t%s\t%d\n", meta[i].tag, meta[i].key, meta[i].label, meta[i].path, meta[i].type);
+            const esp_diag_metrics_meta_t *meta = esp_diag_metrics_meta_get_by_index(i);
+            if (!meta) {
+                continue;
+            }
+            ESP_LOGI(TAG, "%s\t%s\t%s\t%s\t%d\n", meta->tag, meta->key, meta->label, meta->path, meta->type);
         }
     }
+    diag_registry_unlock(&s_priv_data.metrics);
 }
 
 esp_err_t esp_diag_metrics_init(esp_diag_metrics_config_t *config)
@@ -205,6 +271,16 @@ esp_err_t esp_diag_metrics_init(esp_diag_metrics_config_t *config)
     if (s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    s_priv_data.batch_lock = xSemaphoreCreateMutex();
+    if (!s_priv_data.batch_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (diag_registry_init(&s_priv_data.metrics, sizeof(esp_diag_metrics_meta_t),
+                           DIAG_REGISTRY_CHUNK_LEN, DIAG_METRICS_MAX_COUNT) != ESP_OK) {
+        vSemaphoreDelete(s_priv_data.batch_lock);
+        s_priv_data.batch_lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
     memcpy(&s_priv_data.config, config, sizeof(s_priv_data.config));
     s_priv_data.init = true;
     return ESP_OK;
@@ -215,17 +291,20 @@ esp_err_t esp_diag_metrics_deinit(void)
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    diag_registry_deinit(&s_priv_data.metrics);
+    esp_diag_meta_changed();
+    vSemaphoreDelete(s_priv_data.batch_lock);
     memset(&s_priv_data, 0, sizeof(s_priv_data));
     return ESP_OK;
 }
 
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-esp_err_t esp_diag_metrics_add(esp_diag_data_type_t data_type,
-#else
-esp_err_t esp_diag_metrics_report(esp_diag_data_type_t data_type, const char *tag,
-#endif
-                                  const char *key, const void *val,
-                                  size_t val_sz, uint64_t ts)
+/* Validates the data point against the registered metrics and fills in the data to be written.
+ * Tag of the registered metrics is returned in meta_tag, the entry itself is not used past the lookup.
+ */
+static esp_err_t metrics_data_pt_prepare(esp_diag_data_type_t data_type, const char *tag,
+                                         const char *key, const void *val, size_t val_sz, uint64_t ts,
+                                         esp_diag_str_data_pt_t *data, size_t *write_sz,
+                                         const char **meta_tag)
 {
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
     if (!tag) {
@@ -235,48 +314,134 @@ esp_err_t esp_diag_metrics_report(esp_diag_data_type_t data_type, const char *ta
     if (!key || !val) {
         return ESP_ERR_INVALID_ARG;
     }
-    if (!s_priv_data.init) {
-        return ESP_ERR_INVALID_STATE;
-    }
 
+    diag_registry_lock(&s_priv_data.metrics);
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
     const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_by_key(key);
-    if (!metrics) {
-        ESP_LOGI(TAG, "metrics with (key %s) not registered", key);
-        return ESP_ERR_NOT_FOUND;
-    }
 #else
     const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get(tag, key);
+#endif
+    esp_diag_data_type_t type = metrics ? metrics->type : data_type;
+    const char *registered_tag = metrics ? metrics->tag : NULL;
+    diag_registry_unlock(&s_priv_data.metrics);
     if (!metrics) {
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        ESP_LOGI(TAG, "metrics with (key %s) not registered", key);
+#else
         ESP_LOGI(TAG, "metrics with (tag %s, key %s) not registered", tag, key);
+#endif
         return ESP_ERR_NOT_FOUND;
     }
-#endif
-    if (metrics->type != data_type) {
+    if (type != data_type) {
         return ESP_ERR_INVALID_ARG;
     }
-    size_t write_sz = MAX_METRICS_WRITE_SZ;
-    if (metrics->type == ESP_DIAG_DATA_TYPE_STR) {
-        write_sz = MAX_STR_METRICS_WRITE_SZ;
+    *write_sz = MAX_METRICS_WRITE_SZ;
+    if (type == ESP_DIAG_DATA_TYPE_STR) {
+        *write_sz = MAX_STR_METRICS_WRITE_SZ;
+        if (val_sz > MAX_STR_LEN) {
+            val_sz = MAX_STR_LEN;
+        }
+    } else if (val_sz > MAX_VALUE_SZ) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    esp_diag_str_data_pt_t data;
-    memset(&data, 0, sizeof(data));
-    data.type = ESP_DIAG_DATA_PT_METRICS;
-    data.data_type = data_type;
+    memset(data, 0, sizeof(*data));
+    data->type = ESP_DIAG_DATA_PT_METRICS;
+    data->data_type = data_type;
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    strlcpy(data.tag, tag, sizeof(data.tag));
+    strlcpy(data->tag, tag, sizeof(data->tag));
 #endif
-    strlcpy(data.key, key, sizeof(data.key));
-    data.ts = ts;
-    memcpy(&data.value, val, val_sz);
+    strlcpy(data->key, key, sizeof(data->key));
+    data->ts = ts;
+    memcpy(&data->value, val, val_sz);
+    *meta_tag = registered_tag;
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+esp_err_t esp_diag_metrics_add(esp_diag_data_type_t data_type,
+#else
+esp_err_t esp_diag_metrics_report(esp_diag_data_type_t data_type, const char *tag,
+#endif
+                                  const char *key, const void *val,
+                                  size_t val_sz, uint64_t ts)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    const char *tag = NULL;
+#endif
+    const char *meta_tag;
+    esp_diag_str_data_pt_t data;
+    size_t write_sz;
+    esp_err_t err = metrics_data_pt_prepare(data_type, tag, key, val, val_sz, ts, &data, &write_sz, &meta_tag);
+    if (err != ESP_OK) {
+        return err;
+    }
 
     if (s_priv_data.config.write_cb) {
-        return s_priv_data.config.write_cb(metrics->tag, &data, write_sz, s_priv_data.config.cb_arg);
+        return s_priv_data.config.write_cb(meta_tag, &data, write_sz, s_priv_data.config.cb_arg);
     }
     return ESP_OK;
 }
 
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+esp_err_t esp_diag_metrics_add_batch(const esp_diag_metrics_batch_item_t *items, size_t count, uint64_t ts)
+#else
+esp_err_t esp_diag_metrics_report_batch(const char *tag, const esp_diag_metrics_batch_item_t *items,
+                                        size_t count, uint64_t ts)
+#endif
+{
+    if (!items || !count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    const char *tag = NULL;
+#endif
+    const char *meta_tag = NULL;
+    esp_err_t err = ESP_OK;
+    size_t i;
+
+    xSemaphoreTake(s_priv_data.batch_lock, portMAX_DELAY);
+    if (count > DIAG_METRICS_MAX_BATCH_COUNT) {
+        /* Written in chunks below, validate every item upfront so that nothing is written if any is invalid */
+        for (i = 0; i < count && err == ESP_OK; i++) {
+            err = metrics_data_pt_prepare(items[i].data_type, tag, items[i].key, items[i].val,
+                                          items[i].val_sz, ts, &s_batch.data[0], &s_batch.write_sz[0], &meta_tag);
+        }
+    }
+    for (size_t start = 0; start < count && err == ESP_OK; start += DIAG_METRICS_MAX_BATCH_COUNT) {
+        size_t n = count - start;
+        if (n > DIAG_METRICS_MAX_BATCH_COUNT) {
+            n = DIAG_METRICS_MAX_BATCH_COUNT;
+        }
+        for (i = 0; i < n && err == ESP_OK; i++) {
+            const esp_diag_metrics_batch_item_t *item = &items[start + i];
+            err = metrics_data_pt_prepare(item->data_type, tag, item->key, item->val, item->val_sz, ts,
+                                          &s_batch.data[i], &s_batch.write_sz[i], &meta_tag);
+            s_batch.data_ptrs[i] = &s_batch.data[i];
+        }
+        if (err != ESP_OK) {
+            break;
+        }
+        if (s_priv_data.config.write_batch_cb) {
+            err = s_priv_data.config.write_batch_cb(meta_tag, s_batch.data_ptrs, s_batch.write_sz, n,
+                                                    s_priv_data.config.cb_arg);
+        } else if (s_priv_data.config.write_cb) {
+            for (i = 0; i < n && err == ESP_OK; i++) {
+                err = s_priv_data.config.write_cb(meta_tag, s_batch.data_ptrs[i], s_batch.write_sz[i],
+                                                  s_priv_data.config.cb_arg);
+            }
+        }
+    }
+    xSemaphoreGive(s_priv_data.batch_lock);
+    return err;
+}
+
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 esp_err_t esp_diag_metrics_add_bool(const char *key, bool b)
 {
@@ -54,6 +54,42 @@ typedef struct {
 
 static priv_data_t s_priv_data;
 
+/* Wifi variables */
+ESP_DIAG_VARIABLE_DECLARE(s_ssid_decl, TAG_WIFI, KEY_SSID, "SSID", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_STR);
+ESP_DIAG_VARIABLE_DECLARE(s_bssid_decl, TAG_WIFI, KEY_BSSID, "BSSID", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_MAC);
+ESP_DIAG_VARIABLE_DECLARE(s_channel_decl, TAG_WIFI, KEY_CHANNEL, "Channel", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_INT);
+ESP_DIAG_VARIABLE_DECLARE(s_authmode_decl, TAG_WIFI, KEY_AUTHMODE, "Auth Mode", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_VARIABLE_DECLARE(s_disc_cnt_decl, TAG_WIFI, KEY_DISC_CNT, "Disconnect count since last reboot", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_INT);
+ESP_DIAG_VARIABLE_DECLARE(s_reason_decl, TAG_WIFI, KEY_REASON, "Last Wi-Fi disconnect reason", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_INT);
+#if CONFIG_DIAG_MORE_NETWORK_VARS
+ESP_DIAG_VARIABLE_DECLARE(s_protocol_decl, TAG_WIFI, KEY_PROTOCOL, "Protocol", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_VARIABLE_DECLARE(s_bandwidth_decl, TAG_WIFI, KEY_BANDWIDTH, "Bandwidth", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_VARIABLE_DECLARE(s_power_save_decl, TAG_WIFI, KEY_POWER_SAVE, "Power Save", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_VARIABLE_DECLARE(s_second_ch_decl, TAG_WIFI, KEY_SECOND_CH, "Secondary Channel", PATH_WIFI_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_VARIABLE_DECLARE(s_protocol_ap_decl, TAG_WIFI, KEY_PROTOCOL_AP, "Protocol", PATH_WIFI_AP,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_VARIABLE_DECLARE(s_bandwidth_ap_decl, TAG_WIFI, KEY_BANDWIDTH_AP, "Bandwidth", PATH_WIFI_AP,
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+#endif
+
+/* IP address variables */
+ESP_DIAG_VARIABLE_DECLARE(s_ipv4_decl, TAG_IP, KEY_IPv4, "IPv4", PATH_IP_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_IPv4);
+ESP_DIAG_VARIABLE_DECLARE(s_netmask_decl, TAG_IP, KEY_NETMASK, "Netmask", PATH_IP_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_IPv4);
+ESP_DIAG_VARIABLE_DECLARE(s_gateway_decl, TAG_IP, KEY_GATEWAY, "Gateway", PATH_IP_STATION,
+                          NULL, ESP_DIAG_DATA_TYPE_IPv4);
+
 static bool bssid_matched(uint8_t *bssid1, uint8_t *bssid2)
 {
     uint8_t i;
@@ -111,24 +147,24 @@ static void diag_add_more_wifi_vars()
 
 static void diag_register_wifi_vars()
 {
-    esp_diag_variable_register(TAG_WIFI, KEY_SSID, "SSID", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_STR);
-    esp_diag_variable_register(TAG_WIFI, KEY_BSSID, "BSSID", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_MAC);
-    esp_diag_variable_register(TAG_WIFI, KEY_CHANNEL, "Channel", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_INT);
-    esp_diag_variable_register(TAG_WIFI, KEY_AUTHMODE, "Auth Mode", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_variable_register(TAG_WIFI, KEY_DISC_CNT, "Disconnect count since last reboot", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_INT);
-    esp_diag_variable_register(TAG_WIFI, KEY_REASON, "Last Wi-Fi disconnect reason", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_INT);
+    esp_diag_variable_register_decl(&s_ssid_decl);
+    esp_diag_variable_register_decl(&s_bssid_decl);
+    esp_diag_variable_register_decl(&s_channel_decl);
+    esp_diag_variable_register_decl(&s_authmode_decl);
+    esp_diag_variable_register_decl(&s_disc_cnt_decl);
+    esp_diag_variable_register_decl(&s_reason_decl);
 }
 
 #if CONFIG_DIAG_MORE_NETWORK_VARS
 static void diag_register_more_wifi_vars()
 {
-    esp_diag_variable_register(TAG_WIFI, KEY_PROTOCOL, "Protocol", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_variable_register(TAG_WIFI, KEY_BANDWIDTH, "Bandwidth", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_variable_register(TAG_WIFI, KEY_POWER_SAVE, "Power Save", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_variable_register(TAG_WIFI, KEY_SECOND_CH, "Secondary Channel", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_UINT);
+    esp_diag_variable_register_decl(&s_protocol_decl);
+    esp_diag_variable_register_decl(&s_bandwidth_decl);
+    esp_diag_variable_register_decl(&s_power_save_decl);
+    esp_diag_variable_register_decl(&s_second_ch_decl);
 
-    esp_diag_variable_register(TAG_WIFI, KEY_PROTOCOL_AP, "Protocol", PATH_WIFI_AP, ESP_DIAG_DATA_TYPE_UINT);
-    esp_diag_variable_register(TAG_WIFI, KEY_BANDWIDTH_AP, "Bandwidth", PATH_WIFI_AP, ESP_DIAG_DATA_TYPE_UINT);
+    esp_diag_variable_register_decl(&s_protocol_ap_decl);
+    esp_diag_variable_register_decl(&s_bandwidth_ap_decl);
 }
 #endif
 
@@ -261,9 +297,9 @@ esp_err_t esp_diag_network_variables_init(void)
 #endif
 
     /* IP address variables */
-    esp_diag_variable_register(TAG_IP, KEY_IPv4, "IPv4", PATH_IP_STATION, ESP_DIAG_DATA_TYPE_IPv4);
-    esp_diag_variable_register(TAG_IP, KEY_NETMASK, "Netmask", PATH_IP_STATION, ESP_DIAG_DATA_TYPE_IPv4);
-    esp_diag_variable_register(TAG_IP, KEY_GATEWAY, "Gateway", PATH_IP_STATION, ESP_DIAG_DATA_TYPE_IPv4);
+    esp_diag_variable_register_decl(&s_ipv4_decl);
+    esp_diag_variable_register_decl(&s_netmask_decl);
+    esp_diag_variable_register_decl(&s_gateway_decl);
 
     memset(&s_priv_data.prev_sta_data, 0, sizeof(s_priv_data.prev_sta_data));
     /* If wifi is not connected then wifi details are recorded in event handler */
@@ -0,0 +1,306 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_diagnostics_registry.h"
+
+#define FNV_OFFSET_BASIS    2166136261UL
+#define FNV_PRIME           16777619UL
+
+#define INDEX_MIN_CAP       16
+#define INDEX_TOMBSTONE     ((void *) &s_tombstone)
+
+/* Header placed in front of every entry slot */
+typedef struct {
+    uint32_t hash;      /* Hash of the key the entry was added with */
+    uint32_t pos;       /* Position of the entry in the dense entries array */
+} slot_hdr_t;
+
+static const uint8_t s_tombstone;
+
+static inline size_t slot_size(const diag_registry_t *reg)
+{
+    /* Keep every slot aligned to 8 bytes */
+    return (sizeof(slot_hdr_t) + reg->entry_size + 7) & ~((size_t) 7);
+}
+
+static inline slot_hdr_t *entry_hdr(const void *entry)
+{
+    return ((slot_hdr_t *) entry) - 1;
+}
+
+uint32_t diag_registry_hash(const char *key)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    while (*key) {
+        hash ^= (uint8_t) *key++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+#define REG_LOCK(reg)       xSemaphoreTakeRecursive((reg)->lock, portMAX_DELAY)
+#define REG_UNLOCK(reg)     xSemaphoreGiveRecursive((reg)->lock)
+
+esp_err_t diag_registry_init(diag_registry_t *reg, size_t entry_size, size_t chunk_len, size_t max_count)
+{
+    memset(reg, 0, sizeof(*reg));
+    reg->lock = xSemaphoreCreateRecursiveMutex();
+    if (!reg->lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    reg->entry_size = entry_size;
+    reg->chunk_len = chunk_len ? chunk_len : 1;
+    reg->max_count = max_count;
+    return ESP_OK;
+}
+
+void diag_registry_deinit(diag_registry_t *reg)
+{
+    if (!reg->lock) {
+        return;
+    }
+    for (size_t i = 0; i < reg->chunks_count; i++) {
+        free(reg->chunks[i]);
+    }
+    free(reg->chunks);
+    free(reg->entries);
+    free(reg->index);
+    free(reg->snapshot);
+    vSemaphoreDelete(reg->lock);
+    memset(reg, 0, sizeof(*reg));
+}
+
+void diag_registry_lock(const diag_registry_t *reg)
+{
+    REG_LOCK(reg);
+}
+
+void diag_registry_unlock(const diag_registry_t *reg)
+{
+    REG_UNLOCK(reg);
+}
+
+void diag_registry_clear(diag_registry_t *reg)
+{
+    REG_LOCK(reg);
+    /* Hand every slot out again through the free list */
+    reg->free_list = NULL;
+    for (size_t i = 0; i < reg->chunks_count; i++) {
+        size_t used = (i == reg->chunks_count - 1) ? reg->slots_used : reg->chunk_len;
+        for (size_t j = 0; j < used; j++) {
+            void *slot = (uint8_t *) reg->chunks[i] + (j * slot_size(reg));
+            memcpy(slot, &reg->free_list, sizeof(void *));
+            reg->free_list = slot;
+        }
+    }
+    if (reg->index) {
+        memset(reg->index, 0, reg->index_cap * sizeof(void *));
+    }
+    reg->index_used = 0;
+    reg->count = 0;
+    reg->snapshot_valid = false;
+    REG_UNLOCK(reg);
+}
+
+size_t diag_registry_count(const diag_registry_t *reg)
+{
+    REG_LOCK(reg);
+    size_t count = reg->count;
+    REG_UNLOCK(reg);
+    return count;
+}
+
+void *diag_registry_get(const diag_registry_t *reg, size_t i)
+{
+    REG_LOCK(reg);
+    void *entry = (i < reg->count) ? reg->entries[i] : NULL;
+    REG_UNLOCK(reg);
+    return entry;
+}
+
+/* Insert in the index, caller makes sure that there is a free bucket */
+static void index_insert(void **index, size_t cap, void *entry)
+{
+    size_t mask = cap - 1;
+    size_t i = entry_hdr(entry)->hash & mask;
+    while (index[i] && index[i] != INDEX_TOMBSTONE) {
+        i = (i + 1) & mask;
+    }
+    index[i] = entry;
+}
+
+/* Rebuilds the index with at least twice the live entries worth of buckets, drops the tombstones */
+static esp_err_t index_grow(diag_registry_t *reg)
+{
+    size_t cap = INDEX_MIN_CAP;
+    while (cap < (reg->count + 1) * 2) {
+        cap <<= 1;
+    }
+    void **index = calloc(cap, sizeof(void *));
+    if (!index) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < reg->count; i++) {
+        index_insert(index, cap, reg->entries[i]);
+    }
+    free(reg->index);
+    reg->index = index;
+    reg->index_cap = cap;
+    reg->index_used = reg->count;
+    return ESP_OK;
+}
+
+static void *slot_alloc(diag_registry_t *reg)
+{
+    if (reg->free_list) {
+        void *slot = reg->free_list;
+        memcpy(&reg->free_list, slot, sizeof(void *));
+        return slot;
+    }
+    if (reg->chunks_count == 0 || reg->slots_used == reg->chunk_len) {
+        void **chunks = realloc(reg->chunks, (reg->chunks_count + 1) * sizeof(void *));
+        if (!chunks) {
+            return NULL;
+        }
+        reg->chunks = chunks;
+        void *chunk = malloc(reg->chunk_len * slot_size(reg));
+        if (!chunk) {
+            return NULL;
+        }
+        reg->chunks[reg->chunks_count++] = chunk;
+        reg->slots_used = 0;
+    }
+    return (uint8_t *) reg->chunks[reg->chunks_count - 1] + (reg->slots_used++ * slot_size(reg));
+}
+
+/* Called with the lock held. Allocations are done before any update, the registry
+ * stays consistent for the allocation failed hook and on failure.
+ */
+static void *registry_add(diag_registry_t *reg, const char *key)
+{
+    if (reg->max_count && reg->count >= reg->max_count) {
+        return NULL;
+    }
+    /* Keep the load factor of the index (tombstones included) under 3/4 */
+    if ((reg->index_used + 1) * 4 > reg->index_cap * 3) {
+        if (index_grow(reg) != ESP_OK) {
+            return NULL;
+        }
+    }
+    if (reg->count == reg->entries_cap) {
+        size_t cap = reg->entries_cap ? reg->entries_cap * 2 : reg->chunk_len;
+        void **entries = realloc(reg->entries, cap * sizeof(void *));
+        if (!entries) {
+            return NULL;
+        }
+        reg->entries = entries;
+        reg->entries_cap = cap;
+    }
+    void *slot = slot_alloc(reg);
+    if (!slot) {
+        return NULL;
+    }
+    memset(slot, 0, slot_size(reg));
+    slot_hdr_t *hdr = slot;
+    hdr->hash = diag_registry_hash(key);
+    hdr->pos = reg->count;
+    void *entry = hdr + 1;
+
+    reg->entries[reg->count++] = entry;
+    index_insert(reg->index, reg->index_cap, entry);
+    reg->index_used++;
+    reg->snapshot_valid = false;
+    return entry;
+}
+
+void *diag_registry_add(diag_registry_t *reg, const char *key)
+{
+    REG_LOCK(reg);
+    void *entry = registry_add(reg, key);
+    REG_UNLOCK(reg);
+    return entry;
+}
+
+void *diag_registry_find(const diag_registry_t *reg, const char *key, diag_registry_match_cb_t match_cb, const void *arg)
+{
+    void *found = NULL;
+    REG_LOCK(reg);
+    if (reg->count) {
+        uint32_t hash = diag_registry_hash(key);
+        size_t mask = reg->index_cap - 1;
+        for (size_t i = hash & mask; reg->index[i]; i = (i + 1) & mask) {
+            void *entry = reg->index[i];
+            if (entry != INDEX_TOMBSTONE && entry_hdr(entry)->hash == hash && match_cb(entry, arg)) {
+                found = entry;
+                break;
+            }
+        }
+    }
+    REG_UNLOCK(reg);
+    return found;
+}
+
+esp_err_t diag_registry_remove(diag_registry_t *reg, void *entry)
+{
+    if (!entry) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    REG_LOCK(reg);
+    if (!reg->count) {
+        REG_UNLOCK(reg);
+        return ESP_ERR_INVALID_ARG;
+    }
+    slot_hdr_t *hdr = entry_hdr(entry);
+    size_t mask = reg->index_cap - 1;
+    size_t i;
+    for (i = hdr->hash & mask; reg->index[i] && reg->index[i] != entry; i = (i + 1) & mask);
+    if (!reg->index[i]) {
+        REG_UNLOCK(reg);
+        return ESP_ERR_NOT_FOUND;
+    }
+    reg->index[i] = INDEX_TOMBSTONE;
+
+    /* Move the last entry in the freed position of dense array */
+    void *last = reg->entries[reg->count - 1];
+    reg->entries[hdr->pos] = last;
+    entry_hdr(last)->pos = hdr->pos;
+    reg->count--;
+
+    memcpy(hdr, &reg->free_list, sizeof(void *));
+    reg->free_list = hdr;
+    reg->snapshot_valid = false;
+    REG_UNLOCK(reg);
+    return ESP_OK;
+}
+
+const void *diag_registry_snapshot(diag_registry_t *reg, size_t size)
+{
+    const void *ret = NULL;
+    REG_LOCK(reg);
+    if (!reg->count) {
+        goto exit;
+    }
+    if (!reg->snapshot_valid) {
+        if (reg->snapshot_len < reg->count) {
+            void *snapshot = realloc(reg->snapshot, reg->count * size);
+            if (!snapshot) {
+                goto exit;
+            }
+            reg->snapshot = snapshot;
+            reg->snapshot_len = reg->count;
+        }
+        for (size_t i = 0; i < reg->count; i++) {
+            memcpy((uint8_t *) reg->snapshot + (i * size), reg->entries[i], size);
+        }
+        reg->snapshot_valid = true;
+    }
+    ret = reg->snapshot;
+exit:
+    REG_UNLOCK(reg);
+    return ret;
+}
@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2026 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Growable registry used to hold metrics and variables metadata.
+ *
+ * Entries are allocated from fixed size chunks and never move on growth, but the slot of a
+ * removed or cleared entry is handed out again. A looked up entry is only used while the
+ * registry lock is held, see diag_registry_lock(). Entries are additionally
+ * kept in a dense array for ordered iteration and indexed in an open addressing hash
+ * table keyed on the `key` string for O(1) lookups.
+ *
+ * The dense array and the index are reallocated as the registry grows, every access to them
+ * is done under the registry lock. The lock is recursive, the allocation failed hook may
+ * report metrics from within an addition.
+ */
+
+/* Callback to match an entry against the lookup arguments */
+typedef bool (*diag_registry_match_cb_t)(const void *entry, const void *arg);
+
+typedef struct {
+    SemaphoreHandle_t lock; /* Guards everything below */
+    size_t entry_size;      /* Size of a single entry */
+    size_t chunk_len;       /* Number of entries allocated at a time */
+    size_t max_count;       /* Maximum number of entries, 0 for no limit */
+    void **chunks;          /* Chunks of entry slots */
+    size_t chunks_count;
+    void *free_list;        /* Slots freed by remove, reused before allocating new chunks */
+    size_t slots_used;      /* Slots handed out from the last chunk */
+    void **entries;         /* Dense array of live entries, in registration order */
+    size_t count;
+    size_t entries_cap;
+    void **index;           /* Hash index of entries, capacity is a power of two */
+    size_t index_cap;
+    size_t index_used;      /* Live entries and tombstones in the index */
+    void *snapshot;         /* Contiguous copy of the entries built for legacy accessors */
+    size_t snapshot_len;
+    bool snapshot_valid;
+} diag_registry_t;
+
+/* FNV-1a hash of the key string */
+uint32_t diag_registry_hash(const char *key);
+
+/* Initialize the registry, no memory other than the lock is allocated until the first entry is added */
+esp_err_t diag_registry_init(diag_registry_t *reg, size_t entry_size, size_t chunk_len, size_t max_count);
+
+/* Free all the memory held by the registry, lock included */
+void diag_registry_deinit(diag_registry_t *reg);
+
+/* Take and give the registry lock, recursive so the functions below can be called with it held */
+void diag_registry_lock(const diag_registry_t *reg);
+void diag_registry_unlock(const diag_registry_t *reg);
+
+/* Remove all the entries. Their memory is kept for later additions, so that an entry
+ * found before stays readable. */
+void diag_registry_clear(diag_registry_t *reg);
+
+/* Allocate a zeroed entry and index it under `key`, NULL if the limit is hit or on allocation failure */
+void *diag_registry_add(diag_registry_t *reg, const char *key);
+
+/* Find an entry with the `key` for which match_cb returns true.
+ * Entry may be removed and its slot reused once the lock is released, so the caller holds
+ * diag_registry_lock() from the lookup until it is done with the entry. */
+void *diag_registry_find(const diag_registry_t *reg, const char *key, diag_registry_match_cb_t match_cb, const void *arg);
+
+/* Remove the entry, its slot is reused for later additions */
+esp_err_t diag_registry_remove(diag_registry_t *reg, void *entry);
+
+/* Number of live entries */
+size_t diag_registry_count(const diag_registry_t *reg);
+
+/* Entry at `i` in registration order, order changes when an entry is removed.
+ * NULL if `i` is out of range, e.g. entries are removed while iterating. */
+void *diag_registry_get(const diag_registry_t *reg, size_t i);
+
+/* Contiguous copy of the first `size` bytes of every entry, NULL if empty or on allocation failure.
+ * The copy may move when entries are added. */
+const void *diag_registry_snapshot(diag_registry_t *reg, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
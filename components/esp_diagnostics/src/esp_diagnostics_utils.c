@@ -18,6 +18,8 @@
 #include "esp_debug_helpers.h"
 #include "esp_diagnostics_metrics.h"
 #include "esp_diagnostics_variables.h"
+#include "esp_diagnostics_internal.h"
+#include <esp_rmaker_work_queue.h>
 
 #include "esp_chip_info.h"
 #include <esp_rom_crc.h>
@@ -299,39 +301,158 @@ uint32_t esp_diag_data_size_get_crc(void)
     return crc;
 }
 
+static esp_diag_work_queue_add_t s_work_queue_add;
+
+void esp_diag_work_queue_set(esp_diag_work_queue_add_t add_fn)
+{
+    s_work_queue_add = add_fn;
+}
+
+esp_err_t esp_diag_work_queue_add(void (*work_fn)(void *priv_data), void *priv_data)
+{
+    esp_diag_work_queue_add_t add_fn = s_work_queue_add;
+    if (add_fn) {
+        return add_fn(work_fn, priv_data);
+    }
+    return esp_rmaker_work_queue_add_task(work_fn, priv_data);
+}
+
+/* Bumped on every metadata change, meta CRC is recomputed only when it differs from s_meta_crc_generation */
+static uint32_t s_meta_generation = 1;
+static uint32_t s_meta_crc_generation;
+static uint32_t s_meta_crc;
+
+void esp_diag_meta_changed(void)
+{
+    s_meta_generation++;
+    if (s_meta_generation == 0) {
+        s_meta_generation = 1;
+    }
+}
+
 uint32_t esp_diag_meta_crc_get(void)
 {
+    uint32_t generation = s_meta_generation;
+    if (s_meta_crc_generation == generation) {
+        return s_meta_crc;
+    }
     uint32_t crc = 0;
     const esp_app_desc_t *app_desc = esp_app_get_description();
     crc = ESP_CRC32_LE(crc, (const uint8_t *) app_desc->app_elf_sha256, sizeof(app_desc->app_elf_sha256));
 #if CONFIG_DIAG_ENABLE_METRICS
-    uint32_t metrics_len = 0;
-    const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_all(&metrics_len);
-    if (metrics) {
-        uint32_t i;
-        for (i = 0; i < metrics_len; i++) {
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].tag, strlen(metrics[i].tag));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].key, strlen(metrics[i].key));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].label, strlen(metrics[i].label));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].path, strlen(metrics[i].path));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)&metrics[i].type, sizeof(metrics[i].type));
+    uint32_t metrics_len = esp_diag_metrics_meta_count();
+    for (uint32_t i = 0; i < metrics_len; i++) {
+        const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_by_index(i);
+        if (!metrics) {
+            continue;
+        }
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics->tag, strlen(metrics->tag));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics->key, strlen(metrics->key));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics->label, strlen(metrics->label));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics->path, strlen(metrics->path));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)&metrics->type, sizeof(metrics->type));
+        if (metrics->unit) {
+            crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics->unit, strlen(metrics->unit));
         }
     }
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
 
 #if CONFIG_DIAG_ENABLE_VARIABLES
-    uint32_t variables_len = 0;
-    const esp_diag_variable_meta_t *variables = esp_diag_variable_meta_get_all(&variables_len);
-    if (variables) {
-        uint32_t i;
-        for (i = 0; i < variables_len; i++) {
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].tag, strlen(variables[i].tag));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].key, strlen(variables[i].key));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].label, strlen(variables[i].label));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].path, strlen(variables[i].path));
-            crc = ESP_CRC32_LE(crc, (const uint8_t *)&variables[i].type, sizeof(variables[i].type));
+    uint32_t variables_len = esp_diag_variable_meta_count();
+    for (uint32_t i = 0; i < variables_len; i++) {
+        const esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get_by_index(i);
+        if (!variable) {
+            continue;
+        }
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)variable->tag, strlen(variable->tag));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)variable->key, strlen(variable->key));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)variable->label, strlen(variable->label));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)variable->path, strlen(variable->path));
+        crc = ESP_CRC32_LE(crc, (const uint8_t *)&variable->type, sizeof(variable->type));
+        if (variable->unit) {
+            crc = ESP_CRC32_LE(crc, (const uint8_t *)variable->unit, strlen(variable->unit));
         }
     }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    s_meta_crc = crc;
+    s_meta_crc_generation = generation;
+    return crc;
+}
+
+/* Declarations are placed between these by linker.lf */
+extern const esp_diag_meta_decl_t _esp_diag_meta_decl_start;
+extern const esp_diag_meta_decl_t _esp_diag_meta_decl_end;
+
+#if CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES
+static bool str_equal(const char *a, const char *b)
+{
+    if (a == b) {
+        return true;
+    }
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static bool meta_is_declared(uint16_t type, const char *tag, const char *key, const char *label,
+                             const char *path, const char *unit, esp_diag_data_type_t data_type)
+{
+    for (const esp_diag_meta_decl_t *decl = &_esp_diag_meta_decl_start; decl < &_esp_diag_meta_decl_end; decl++) {
+        if (decl->type == type && decl->data_type == data_type &&
+            str_equal(decl->tag, tag) && str_equal(decl->key, key) && str_equal(decl->label, label) &&
+            str_equal(decl->path, path) && str_equal(decl->unit, unit)) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif /* CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES */
+
+/* Every string is hashed with its terminating NUL, NULL unit as an empty string */
+static uint32_t meta_decl_crc(uint32_t crc, const esp_diag_meta_decl_t *decl)
+{
+    const uint8_t types[4] = {
+        decl->type & 0xff, decl->type >> 8, decl->data_type & 0xff, decl->data_type >> 8
+    };
+    const char *strs[] = { decl->tag, decl->key, decl->label, decl->path, decl->unit ? decl->unit : "" };
+    crc = ESP_CRC32_LE(crc, types, sizeof(types));
+    for (int i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+        crc = ESP_CRC32_LE(crc, (const uint8_t *) strs[i], strlen(strs[i]) + 1);
+    }
     return crc;
 }
+
+esp_err_t esp_diag_meta_decl_hash_get(uint32_t *hash)
+{
+    if (!hash) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_DIAG_ENABLE_METRICS
+    uint32_t metrics_len = esp_diag_metrics_meta_count();
+    for (uint32_t i = 0; i < metrics_len; i++) {
+        const esp_diag_metrics_meta_t *m = esp_diag_metrics_meta_get_by_index(i);
+        if (!m) {
+            continue;
+        }
+        if (!meta_is_declared(ESP_DIAG_DATA_PT_METRICS, m->tag, m->key, m->label, m->path, m->unit, m->type)) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+#endif /* CONFIG_DIAG_ENABLE_METRICS */
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    uint32_t variables_len = esp_diag_variable_meta_count();
+    for (uint32_t i = 0; i < variables_len; i++) {
+        const esp_diag_variable_meta_t *v = esp_diag_variable_meta_get_by_index(i);
+        if (!v) {
+            continue;
+        }
+        if (!meta_is_declared(ESP_DIAG_DATA_PT_VARIABLE, v->tag, v->key, v->label, v->path, v->unit, v->type)) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    uint32_t crc = 0;
+    for (const esp_diag_meta_decl_t *decl = &_esp_diag_meta_decl_start; decl < &_esp_diag_meta_decl_end; decl++) {
+        crc = meta_decl_crc(crc, decl);
+    }
+    *hash = crc;
+    return ESP_OK;
+}
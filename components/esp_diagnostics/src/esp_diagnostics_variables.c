@@ -10,66 +10,85 @@
 #include <esp_log.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_variables.h>
+#include "esp_diagnostics_registry.h"
+#include "esp_diagnostics_internal.h"
 
 #define TAG "DIAG_VARIABLES"
 #define DIAG_VARIABLES_MAX_COUNT   CONFIG_DIAG_VARIABLES_MAX_COUNT
+#define DIAG_REGISTRY_CHUNK_LEN    CONFIG_DIAG_REGISTRY_CHUNK_LEN
 
 /* Max supported string length */
 #define MAX_STR_LEN         (sizeof(((esp_diag_str_data_pt_t *)0)->value.str) - 1)
 #define MAX_VARIABLES_WRITE_SZ     sizeof(esp_diag_data_pt_t)
 #define MAX_STR_VARIABLES_WRITE_SZ sizeof(esp_diag_str_data_pt_t)
+#define VARIABLE_VALUE_SZ          sizeof(((esp_diag_str_data_pt_t *)0)->value)
 
+/* Last value successfully written for a variable */
 typedef struct {
-    size_t variables_count;
-    esp_diag_variable_meta_t variables[DIAG_VARIABLES_MAX_COUNT];
+    bool valid;
+    uint8_t value[VARIABLE_VALUE_SZ];
+} variable_cache_t;
+
+/* Registry entry, meta must be the first member */
+typedef struct {
+    esp_diag_variable_meta_t meta;
+    variable_cache_t cache;
+} variable_entry_t;
+
+typedef struct {
+    diag_registry_t variables;  /* Registry of variable_entry_t */
     esp_diag_variable_config_t config;
     bool init;
 } variables_priv_data_t;
 
 static variables_priv_data_t s_priv_data;
 
+static bool match_tag_key(const void *entry, const void *arg)
+{
+    const esp_diag_variable_meta_t *variable = entry;
+    const esp_diag_variable_meta_t *lookup = arg;
+    return (strcmp(variable->tag, lookup->tag) == 0) && (strcmp(variable->key, lookup->key) == 0);
+}
+
+/* Lookups below are called with the registry lock held, see diag_registry_find() */
 static esp_diag_variable_meta_t *esp_diag_variable_meta_get(const char *tag, const char *key)
 {
-    uint32_t i;
     if (!tag || !key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.variables_count; i++) {
-        if (s_priv_data.variables[i].key &&
-                (strcmp(s_priv_data.variables[i].tag, tag) == 0) &&
-                (strcmp(s_priv_data.variables[i].key, key) == 0)) {
-            return &s_priv_data.variables[i];
-        }
-    }
-    return NULL;
+    const esp_diag_variable_meta_t lookup = { .tag = tag, .key = key };
+    return diag_registry_find(&s_priv_data.variables, key, match_tag_key, &lookup);
 }
 
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+static bool match_key(const void *entry, const void *arg)
+{
+    return strcmp(((const esp_diag_variable_meta_t *) entry)->key, arg) == 0;
+}
+
 /* Checks only by key for registered variable. Use this for meta version < 1.1 */
 static esp_diag_variable_meta_t *esp_diag_variable_meta_get_by_key(const char *key)
 {
-    uint32_t i;
     if (!key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.variables_count; i++) {
-        if (s_priv_data.variables[i].key &&
-                (strcmp(s_priv_data.variables[i].key, key) == 0)) {
-            return &s_priv_data.variables[i];
-        }
-    }
-    return NULL;
+    return diag_registry_find(&s_priv_data.variables, key, match_key, key);
 }
 #endif
 
+static inline variable_cache_t *variable_cache_get(const esp_diag_variable_meta_t *variable)
+{
+    return &((variable_entry_t *) variable)->cache;
+}
+
 static bool tag_key_present(const char *tag, const char *key)
 {
     return (esp_diag_variable_meta_get(tag, key) != NULL);
 }
 
-esp_err_t esp_diag_variable_register(const char *tag, const char *key,
-                                     const char *label, const char *path,
-                                     esp_diag_data_type_t type)
+static esp_err_t variable_register(const char *tag, const char *key,
+                                   const char *label, const char *path,
+                                   const char *unit, esp_diag_data_type_t type)
 {
     if (!tag || !key || !label || !path) {
         ESP_LOGE(TAG, "Failed to register variable, tag, key, label, or path is NULL");
@@ -78,24 +97,44 @@ esp_err_t esp_diag_variable_register(const char *tag, const char *key,
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
-    if (s_priv_data.variables_count >= DIAG_VARIABLES_MAX_COUNT) {
-        ESP_LOGE(TAG, "No space left for more variable");
-        return ESP_ERR_NO_MEM;
-    }
+    diag_registry_lock(&s_priv_data.variables);
     if (tag_key_present(tag, key)) {
+        diag_registry_unlock(&s_priv_data.variables);
         ESP_LOGE(TAG, "Param-val tag:%s, key:%s exists", tag, key);
         return ESP_FAIL;
     }
-    s_priv_data.variables[s_priv_data.variables_count].tag = tag;
-    s_priv_data.variables[s_priv_data.variables_count].key = key;
-    s_priv_data.variables[s_priv_data.variables_count].label = label;
-    s_priv_data.variables[s_priv_data.variables_count].unit = NULL;
-    s_priv_data.variables[s_priv_data.variables_count].path = path;
-    s_priv_data.variables[s_priv_data.variables_count].type = type;
-    s_priv_data.variables_count++;
+    esp_diag_variable_meta_t *variable = diag_registry_add(&s_priv_data.variables, key);
+    if (!variable) {
+        diag_registry_unlock(&s_priv_data.variables);
+        ESP_LOGE(TAG, "No space left for more variable");
+        return ESP_ERR_NO_MEM;
+    }
+    variable->tag = tag;
+    variable->key = key;
+    variable->label = label;
+    variable->unit = unit;
+    variable->path = path;
+    variable->type = type;
+    diag_registry_unlock(&s_priv_data.variables);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
+esp_err_t esp_diag_variable_register(const char *tag, const char *key,
+                                     const char *label, const char *path,
+                                     esp_diag_data_type_t type)
+{
+    return variable_register(tag, key, label, path, NULL, type);
+}
+
+esp_err_t esp_diag_variable_register_decl(const esp_diag_meta_decl_t *decl)
+{
+    if (!decl || decl->type != ESP_DIAG_DATA_PT_VARIABLE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return variable_register(decl->tag, decl->key, decl->label, decl->path, decl->unit, decl->data_type);
+}
+
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 esp_err_t esp_diag_variable_add_unit(const char *key, const char *unit)
 #else
@@ -108,20 +147,25 @@ esp_err_t esp_diag_variable_add_unit(const char *tag, const char *key, const cha
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    diag_registry_lock(&s_priv_data.variables);
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
     esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get_by_key(key);
     if (!variable) {
+        diag_registry_unlock(&s_priv_data.variables);
         ESP_LOGI(TAG, "var with (key %s) not found", key);
         return ESP_ERR_NOT_FOUND;
     }
 #else
     esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get(tag, key);
     if (!variable) {
+        diag_registry_unlock(&s_priv_data.variables);
         ESP_LOGI(TAG, "var with (tag %s, key %s) not found", tag, key);
         return ESP_ERR_NOT_FOUND;
     }
 #endif
     variable->unit = unit;
+    diag_registry_unlock(&s_priv_data.variables);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -131,7 +175,6 @@ esp_err_t esp_diag_variable_unregister(const char *key)
 esp_err_t esp_diag_variable_unregister(const char *tag, const char *key)
 #endif
 {
-    int i;
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
     if (!tag) {
         return ESP_ERR_INVALID_ARG;
@@ -140,22 +183,21 @@ esp_err_t esp_diag_variable_unregister(const char *tag, const char *key)
     if (!key) {
         return ESP_ERR_INVALID_ARG;
     }
-    for (i = 0; i < s_priv_data.variables_count; i++) {
-        if (s_priv_data.variables[i].key &&
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                (strcmp(s_priv_data.variables[i].tag, tag) == 0) &&
-#endif
-                (strcmp(s_priv_data.variables[i].key, key) == 0)) {
-            break;
-        }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
     }
-    if (i < s_priv_data.variables_count) {
-        s_priv_data.variables[i] = s_priv_data.variables[s_priv_data.variables_count - 1];
-        memset(&s_priv_data.variables[s_priv_data.variables_count - 1], 0, sizeof(esp_diag_variable_meta_t));
-        s_priv_data.variables_count--;
-        return ESP_OK;
+    diag_registry_lock(&s_priv_data.variables);
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get_by_key(key);
+#else
+    esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get(tag, key);
+#endif
+    esp_err_t err = variable ? diag_registry_remove(&s_priv_data.variables, variable) : ESP_ERR_NOT_FOUND;
+    diag_registry_unlock(&s_priv_data.variables);
+    if (err == ESP_OK) {
+        esp_diag_meta_changed();
     }
-    return ESP_ERR_NOT_FOUND;
+    return err;
 }
 
 esp_err_t esp_diag_variable_unregister_all(void)
@@ -163,32 +205,58 @@ esp_err_t esp_diag_variable_unregister_all(void)
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
-    memset(&s_priv_data.variables, 0, sizeof(s_priv_data.variables));
-    s_priv_data.variables_count = 0;
+    diag_registry_clear(&s_priv_data.variables);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
+uint32_t esp_diag_variable_meta_count(void)
+{
+    if (!s_priv_data.init) {
+        return 0;
+    }
+    return diag_registry_count(&s_priv_data.variables);
+}
+
+const esp_diag_variable_meta_t *esp_diag_variable_meta_get_by_index(uint32_t index)
+{
+    if (!s_priv_data.init) {
+        return NULL;
+    }
+    return diag_registry_get(&s_priv_data.variables, index);
+}
+
 const esp_diag_variable_meta_t *esp_diag_variable_meta_get_all(uint32_t *len)
 {
     if (!s_priv_data.init) {
         *len = 0;
         return NULL;
     }
-    *len = s_priv_data.variables_count;
-    return &s_priv_data.variables[0];
+    /* Entries are spread over chunks, hand out a contiguous copy */
+    const esp_diag_variable_meta_t *meta = diag_registry_snapshot(&s_priv_data.variables, sizeof(esp_diag_variable_meta_t));
+    *len = meta ? diag_registry_count(&s_priv_data.variables) : 0;
+    return meta;
 }
 
 void esp_diag_variable_meta_print_all(void)
 {
-    uint32_t len;
+    if (!s_priv_data.init) {
+        return;
+    }
+    diag_registry_lock(&s_priv_data.variables);
+    uint32_t len = esp_diag_variable_meta_count();
     uint32_t i;
-    const esp_diag_variable_meta_t *meta = esp_diag_variable_meta_get_all(&len);
-    if (meta) {
+    if (len) {
         ESP_LOGI(TAG, "Tag\tKey\tLabel\tPath\tData type\n");
         for (i = 0; i < len; i++) {
-            ESP_LOGI(TAG, "%s\t%s\t%s\t%s\t%d\n", meta[i].tag, meta[i].key, meta[i].label, meta[i].path, meta[i].type);
+            const esp_diag_variable_meta_t *meta = esp_diag_variable_meta_get_by_index(i);
+            if (!meta) {
+                continue;
+            }
+            ESP_LOGI(TAG, "%s\t%s\t%s\t%s\t%d\n", meta->tag, meta->key, meta->label, meta->path, meta->type);
         }
     }
+    diag_registry_unlock(&s_priv_data.variables);
 }
 
 esp_err_t esp_diag_variable_init(esp_diag_variable_config_t *config)
@@ -199,6 +267,10 @@ esp_err_t esp_diag_variable_init(esp_diag_variable_config_t *config)
     if (s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    if (diag_registry_init(&s_priv_data.variables, sizeof(variable_entry_t),
+                           DIAG_REGISTRY_CHUNK_LEN, DIAG_VARIABLES_MAX_COUNT) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
     memcpy(&s_priv_data.config, config, sizeof(s_priv_data.config));
     s_priv_data.init = true;
     return ESP_OK;
@@ -209,10 +281,36 @@ esp_err_t esp_diag_variables_deinit(void)
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    diag_registry_deinit(&s_priv_data.variables);
+    esp_diag_meta_changed();
     memset(&s_priv_data, 0, sizeof(s_priv_data));
     return ESP_OK;
 }
 
+static esp_err_t variable_write(const esp_diag_variable_meta_t *variable, const uint8_t *value, uint64_t ts)
+{
+    size_t write_sz = MAX_VARIABLES_WRITE_SZ;
+    if (variable->type == ESP_DIAG_DATA_TYPE_STR) {
+        write_sz = MAX_STR_VARIABLES_WRITE_SZ;
+    }
+
+    esp_diag_str_data_pt_t data;
+    memset(&data, 0, sizeof(data));
+    data.type = ESP_DIAG_DATA_PT_VARIABLE;
+    data.data_type = variable->type;
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    strlcpy(data.tag, variable->tag, sizeof(data.tag));
+#endif
+    strlcpy(data.key, variable->key, sizeof(data.key));
+    data.ts = ts;
+    memcpy(&data.value, value, sizeof(data.value));
+
+    if (s_priv_data.config.write_cb) {
+        return s_priv_data.config.write_cb(variable->tag, &data, write_sz, s_priv_data.config.cb_arg);
+    }
+    return ESP_OK;
+}
+
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 esp_err_t esp_diag_variable_add(esp_diag_data_type_t data_type,
 #else
@@ -233,42 +331,93 @@ esp_err_t esp_diag_variable_report(esp_diag_data_type_t data_type, const char *t
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (val_sz > MAX_STR_LEN) {
+        val_sz = MAX_STR_LEN;
+    }
+    uint8_t value[VARIABLE_VALUE_SZ];
+    memset(value, 0, sizeof(value));
+    memcpy(value, val, val_sz);
+
+    /* The entry and its cache are only touched with the lock held, the write goes out on a copy */
+    diag_registry_lock(&s_priv_data.variables);
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    const esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get_by_key(key);
+    esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get_by_key(key);
     if (!variable) {
+        diag_registry_unlock(&s_priv_data.variables);
         ESP_LOGI(TAG, "var with (key %s) not registered", key);
         return ESP_ERR_NOT_FOUND;
     }
 #else
-    const esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get(tag, key);
+    esp_diag_variable_meta_t *variable = esp_diag_variable_meta_get(tag, key);
     if (!variable) {
+        diag_registry_unlock(&s_priv_data.variables);
         ESP_LOGI(TAG, "var with (tag %s, key %s) not registered", tag, key);
         return ESP_ERR_NOT_FOUND;
     }
 #endif
     if (variable->type != data_type) {
+        diag_registry_unlock(&s_priv_data.variables);
         return ESP_ERR_INVALID_ARG;
     }
-    size_t write_sz = MAX_VARIABLES_WRITE_SZ;
-    if (variable->type == ESP_DIAG_DATA_TYPE_STR) {
-        write_sz = MAX_STR_VARIABLES_WRITE_SZ;
+#if CONFIG_DIAG_VARIABLES_REPORT_ON_CHANGE
+    const variable_cache_t *cache = variable_cache_get(variable);
+    if (cache->valid && memcmp(cache->value, value, sizeof(value)) == 0) {
+        diag_registry_unlock(&s_priv_data.variables);
+        /* Value is unchanged, nothing to report */
+        return ESP_OK;
     }
+#endif
+    esp_diag_variable_meta_t meta = *variable;
+    diag_registry_unlock(&s_priv_data.variables);
 
-    esp_diag_str_data_pt_t data;
-    memset(&data, 0, sizeof(data));
-    data.type = ESP_DIAG_DATA_PT_VARIABLE;
-    data.data_type = data_type;
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    strlcpy(data.tag, tag, sizeof(data.tag));
+    esp_err_t err = variable_write(&meta, value, ts);
+    if (err == ESP_OK) {
+        diag_registry_lock(&s_priv_data.variables);
+        /* Look up again, the variable may have been unregistered meanwhile */
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        variable = esp_diag_variable_meta_get_by_key(key);
+#else
+        variable = esp_diag_variable_meta_get(tag, key);
 #endif
-    strlcpy(data.key, key, sizeof(data.key));
-    data.ts = ts;
-    memcpy(&data.value, val, val_sz);
+        if (variable) {
+            variable_cache_t *cache = variable_cache_get(variable);
+            memcpy(cache->value, value, sizeof(value));
+            cache->valid = true;
+        }
+        diag_registry_unlock(&s_priv_data.variables);
+    }
+    return err;
+}
 
-    if (s_priv_data.config.write_cb) {
-        return s_priv_data.config.write_cb(variable->tag, &data, write_sz, s_priv_data.config.cb_arg);
+esp_err_t esp_diag_variable_report_all(void)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
     }
-    return ESP_OK;
+    esp_err_t ret = ESP_OK;
+    uint64_t ts = esp_diag_timestamp_get();
+    for (uint32_t i = 0; ; i++) {
+        variable_entry_t entry;
+        diag_registry_lock(&s_priv_data.variables);
+        if (i >= diag_registry_count(&s_priv_data.variables)) {
+            diag_registry_unlock(&s_priv_data.variables);
+            break;
+        }
+        const variable_entry_t *cur = diag_registry_get(&s_priv_data.variables, i);
+        bool valid = cur && cur->cache.valid;
+        if (valid) {
+            entry = *cur;
+        }
+        diag_registry_unlock(&s_priv_data.variables);
+        if (!valid) {
+            continue;
+        }
+        esp_err_t err = variable_write(&entry.meta, entry.cache.value, ts);
+        if (err != ESP_OK) {
+            ret = err;
+        }
+    }
+    return ret;
 }
 
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
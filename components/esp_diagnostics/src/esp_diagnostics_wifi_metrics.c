@@ -12,7 +12,6 @@
 #include <esp_wifi.h>
 #include "sdkconfig.h"
 
-#include <esp_rmaker_work_queue.h>
 #include <esp_diagnostics_metrics.h>
 #include "esp_diagnostics_internal.h"
 
@@ -47,6 +46,13 @@ typedef struct {
 
 static wifi_diag_priv_data_t s_priv_data;
 
+ESP_DIAG_METRICS_DECLARE(s_rssi_decl, METRICS_TAG, KEY_RSSI, "Wi-Fi RSSI", PATH_WIFI_STATION,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_INT);
+ESP_DIAG_METRICS_DECLARE(s_min_rssi_decl, METRICS_TAG, KEY_MIN_RSSI, "Minimum ever Wi-Fi RSSI", PATH_WIFI_STATION,
+                         METRICS_UNIT, ESP_DIAG_DATA_TYPE_INT);
+ESP_DIAG_METRICS_DECLARE(s_status_decl, METRICS_TAG, KEY_STATUS, "Wi-Fi connect status", PATH_WIFI_STATION,
+                         NULL, ESP_DIAG_DATA_TYPE_BOOL);
+
 static void update_min_rssi(int32_t rssi)
 {
     if (rssi < s_priv_data.min_rssi) {
@@ -163,7 +169,7 @@ static void wifi_metrics_dump_cb(void *arg)
 
 static void wifi_timer_cb(TimerHandle_t handle)
 {
-    esp_rmaker_work_queue_add_task(wifi_metrics_dump_cb, NULL);
+    esp_diag_work_queue_add(wifi_metrics_dump_cb, NULL);
 }
 
 esp_err_t esp_diag_wifi_metrics_init(void)
@@ -180,16 +186,9 @@ esp_err_t esp_diag_wifi_metrics_init(void)
     if (err != ESP_OK) {
         ESP_LOGW(LOG_TAG, "Failed to set rssi threshold value");
     }
-    esp_diag_metrics_register(METRICS_TAG, KEY_RSSI, "Wi-Fi RSSI", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_INT);
-    esp_diag_metrics_register(METRICS_TAG, KEY_MIN_RSSI, "Minimum ever Wi-Fi RSSI", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_INT);
-    esp_diag_metrics_register(METRICS_TAG, KEY_STATUS, "Wi-Fi connect status", PATH_WIFI_STATION, ESP_DIAG_DATA_TYPE_BOOL);
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_RSSI, METRICS_UNIT);
-    esp_diag_metrics_add_unit(METRICS_TAG, KEY_MIN_RSSI, METRICS_UNIT);
-#else
-    esp_diag_metrics_add_unit(KEY_RSSI, METRICS_UNIT);
-    esp_diag_metrics_add_unit(KEY_MIN_RSSI, METRICS_UNIT);
-#endif
+    esp_diag_metrics_register_decl(&s_rssi_decl);
+    esp_diag_metrics_register_decl(&s_min_rssi_decl);
+    esp_diag_metrics_register_decl(&s_status_decl);
     s_priv_data.min_rssi = WIFI_RSSI_THRESHOLD;
     s_priv_data.handle = xTimerCreate("wifi_metrics", SEC2TICKS(DEFAULT_POLLING_INTERVAL),
                                       pdTRUE, NULL, wifi_timer_cb);
@@ -102,6 +102,36 @@ typedef void(*esp_insights_transport_disconnect_t)(void);
  */
 typedef int(*esp_insights_transport_data_send_t)(void *data, size_t len);
 
+/**
+ * @brief Insights transport data begin callback prototype
+ *
+ * Starts a message which is then passed in chunks to \ref esp_insights_transport_data_write_t
+ *
+ * @param[in] len Total length of the message
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+typedef esp_err_t(*esp_insights_transport_data_begin_t)(size_t len);
+
+/**
+ * @brief Insights transport data write callback prototype
+ *
+ * @param[in] data Chunk of the message
+ * @param[in] len  Length of the chunk
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+typedef esp_err_t(*esp_insights_transport_data_write_t)(const void *data, size_t len);
+
+/**
+ * @brief Insights transport data end callback prototype
+ *
+ * @return msg_id  Message_id of the sent data, same as \ref esp_insights_transport_data_send_t.
+ *                 If less than the length passed to \ref esp_insights_transport_data_begin_t was written,
+ *                 message must be dropped and -1 returned.
+ */
+typedef int(*esp_insights_transport_data_end_t)(void);
+
 /**
  * @brief Insights transport configurations
  */
@@ -118,6 +148,14 @@ typedef struct {
         esp_insights_transport_disconnect_t disconnect;
         /** Function to send data */
         esp_insights_transport_data_send_t data_send;
+        /** Function to begin a streamed message, optional.
+         *  Messages are streamed only if data_begin, data_write and data_end are all set
+         *  and CONFIG_ESP_INSIGHTS_STREAMING_ENABLED is enabled */
+        esp_insights_transport_data_begin_t data_begin;
+        /** Function to write a chunk of the streamed message */
+        esp_insights_transport_data_write_t data_write;
+        /** Function to finish the streamed message */
+        esp_insights_transport_data_end_t data_end;
     } callbacks;
     /** User data */
     void *userdata;
@@ -174,6 +212,16 @@ void esp_insights_transport_unregister(void);
  */
 esp_err_t esp_insights_send_data(void);
 
+/**
+ * @brief Send complete metadata with the next report
+ *
+ * With CONFIG_ESP_INSIGHTS_META_DELTA, only the metrics and variables changed since the metadata
+ * last acknowledged by the cloud are sent. If the cloud signals that it does not have the metadata
+ * a delta was encoded against, call this to fall back to complete metadata.
+ * Default HTTPS transport does this on HTTP status 409 (Conflict).
+ */
+void esp_insights_meta_resync(void);
+
 /**
  * @brief Enable ESP Insights except transport.
  *
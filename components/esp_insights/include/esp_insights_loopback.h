@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Loopback transport sink callback prototype
+ *
+ * Called with every message which is delivered, e.g. to keep it in memory or to forward it over a socket.
+ *
+ * @param[in] data Message, as it would be sent to the cloud
+ * @param[in] len  Length of the message
+ * @param[in] arg  sink_arg from \ref esp_insights_loopback_config_t
+ */
+typedef void (*esp_insights_loopback_sink_t)(const void *data, size_t len, void *arg);
+
+/**
+ * @brief Loopback transport configuration
+ */
+typedef struct {
+    /** File to append delivered messages to, back to back. NULL for none. */
+    const char *path;
+    /** Called with every delivered message. NULL for none. */
+    esp_insights_loopback_sink_t sink;
+    /** Argument passed to the sink */
+    void *sink_arg;
+    /** 0 to acknowledge messages synchronously like HTTPS. Otherwise messages are acknowledged
+     *  asynchronously, like MQTT, this long after they are sent. */
+    uint32_t ack_delay_ms;
+    /** Percentage of messages which are lost, i.e. not delivered and reported as failed */
+    uint8_t loss_percent;
+} esp_insights_loopback_config_t;
+
+/**
+ * @brief Loopback transport statistics
+ */
+typedef struct {
+    uint32_t sent_msgs;         /*!< Messages handed to the transport */
+    uint32_t sent_bytes;        /*!< Bytes handed to the transport */
+    uint32_t delivered_msgs;    /*!< Messages passed to the file and sink */
+    uint32_t delivered_bytes;   /*!< Bytes passed to the file and sink */
+    uint32_t lost_msgs;         /*!< Messages reported as failed */
+    uint32_t acked_msgs;        /*!< Messages acknowledged, synchronously or asynchronously */
+} esp_insights_loopback_stats_t;
+
+/**
+ * @brief Register the loopback transport
+ *
+ * Loopback transport delivers messages locally instead of sending them to the cloud, to measure
+ * the throughput and drop rate of insights without a network. Call this before esp_insights_init(),
+ * or use it with esp_insights_enable(), see esp_insights_transport_register().
+ *
+ * @note Loopback transport does not support streamed messages. Network connectivity is not checked only
+ *       if CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK is the default transport, otherwise messages are sent
+ *       while the network is up as with the other transports. Insights depends on Wi-Fi and other
+ *       target components, so the loopback transport does not work on the Linux target.
+ *
+ * @param[in] config Configuration, NULL to use the values from sdkconfig if
+ *                   CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK is selected, no file, no delay and no loss
+ *                   otherwise. Strings must stay valid until the transport is unregistered.
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t esp_insights_loopback_register(const esp_insights_loopback_config_t *config);
+
+/**
+ * @brief Get the loopback transport statistics
+ *
+ * @param[out] stats Statistics since the transport was registered or the statistics were reset
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the loopback transport is not registered.
+ */
+esp_err_t esp_insights_loopback_get_stats(esp_insights_loopback_stats_t *stats);
+
+/**
+ * @brief Reset the loopback transport statistics
+ */
+void esp_insights_loopback_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
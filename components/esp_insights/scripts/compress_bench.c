@@ -0,0 +1,143 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host benchmark for the insights payload compressor
+ *
+ * Build:
+ *   gcc -O2 -I../src -o compress_bench compress_bench.c ../src/esp_insights_compress.c
+ *
+ * Run:
+ *   ./compress_bench [-n iterations] <payload>...
+ *
+ * A payload can be a message as sent to the transport (TLV header is skipped), raw CBOR, or
+ * a hex dump as printed with ESP_INSIGHTS_DEBUG_ENABLED and ESP_INSIGHTS_DEBUG_PRINT_JSON
+ * disabled ("0x02 0x4c 0x01 ...").
+ * Every payload is compressed, checked to decompress to the original and timed.
+ * Host CPU time is only meant to compare changes, it is not what the device would take.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_insights_compress.h"
+
+#define MAX_PAYLOAD_SIZE    UINT16_MAX
+#define TLV_OFFSET          3
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static size_t parse_hex_dump(const char *text, size_t text_len, uint8_t *out)
+{
+    size_t len = 0;
+    const char *p = text;
+    const char *end = text + text_len;
+    while (p + 4 <= end && len < MAX_PAYLOAD_SIZE) {
+        if (p[0] == '0' && p[1] == 'x') {
+            out[len++] = (uint8_t) strtoul(p, NULL, 16);
+            p += 4;
+        } else {
+            p++;
+        }
+    }
+    return len;
+}
+
+static size_t load_payload(const char *path, uint8_t *out)
+{
+    static uint8_t file_buf[4 * MAX_PAYLOAD_SIZE + 1];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    size_t len = fread(file_buf, 1, sizeof(file_buf) - 1, f);
+    fclose(f);
+    if (len >= 4 && memcmp(file_buf, "0x", 2) == 0) {
+        file_buf[len] = '\0';
+        len = parse_hex_dump((const char *) file_buf, len, out);
+    } else {
+        if (len > MAX_PAYLOAD_SIZE) {
+            fprintf(stderr, "%s: larger than %d bytes, truncated\n", path, MAX_PAYLOAD_SIZE);
+            len = MAX_PAYLOAD_SIZE;
+        }
+        memcpy(out, file_buf, len);
+    }
+    // skip TLV header if it matches the length
+    if (len > TLV_OFFSET) {
+        uint16_t tlv_len = out[1] | (out[2] << 8);
+        if (tlv_len == len - TLV_OFFSET) {
+            len -= TLV_OFFSET;
+            memmove(out, out + TLV_OFFSET, len);
+        }
+    }
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t in[MAX_PAYLOAD_SIZE], comp[MAX_PAYLOAD_SIZE + MAX_PAYLOAD_SIZE / 8 + 16], out[MAX_PAYLOAD_SIZE];
+    static uint16_t hash_table[ESP_INSIGHTS_LZ_HASH_SIZE];
+    int iterations = 1000;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        iterations = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || iterations <= 0) {
+        fprintf(stderr, "usage: %s [-n iterations] <payload>...\n", argv[0]);
+        return 1;
+    }
+
+    size_t total_in = 0, total_comp = 0;
+    double total_comp_us = 0, total_decomp_us = 0;
+    int ret = 0;
+    printf("%-32s %8s %8s %7s %10s %10s\n", "payload", "size", "comp", "ratio", "comp us", "decomp us");
+    for (int a = first; a < argc; a++) {
+        size_t len = load_payload(argv[a], in);
+        if (len == 0) {
+            ret = 1;
+            continue;
+        }
+        size_t comp_len = 0, out_len = 0;
+        double start = now_us();
+        for (int i = 0; i < iterations; i++) {
+            comp_len = esp_insights_lz_compress(in, len, comp, sizeof(comp), hash_table);
+        }
+        double comp_us = (now_us() - start) / iterations;
+        start = now_us();
+        for (int i = 0; i < iterations; i++) {
+            out_len = esp_insights_lz_decompress(comp, comp_len, out, sizeof(out));
+        }
+        double decomp_us = (now_us() - start) / iterations;
+        if (comp_len == 0 || out_len != len || memcmp(in, out, len) != 0) {
+            fprintf(stderr, "%s: round trip failed\n", argv[a]);
+            ret = 1;
+            continue;
+        }
+        printf("%-32s %8zu %8zu %6.1f%% %10.2f %10.2f\n", argv[a], len, comp_len,
+               100.0 * comp_len / len, comp_us, decomp_us);
+        total_in += len;
+        total_comp += comp_len;
+        total_comp_us += comp_us;
+        total_decomp_us += decomp_us;
+    }
+    if (total_in) {
+        printf("%-32s %8zu %8zu %6.1f%% %10.2f %10.2f\n", "total", total_in, total_comp,
+               100.0 * total_comp / total_in, total_comp_us, total_decomp_us);
+        printf("compress %.1f MB/s, decompress %.1f MB/s\n",
+               total_in / total_comp_us, total_in / total_decomp_us);
+    }
+    return ret;
+}
@@ -28,6 +28,8 @@ set(flash_args_file_path ${BUILD_DIR}/flash_args)
 set(proj_desc_file_path ${BUILD_DIR}/project_description.json)
 # Set custom project build config file path
 set(custom_proj_desc_file_path ${BUILD_DIR}/project_description_custom.json)
+# Set insights meta file path
+set(insights_meta_file_path ${BUILD_DIR}/${INSIGHTS_META_FILE})
 
 # Create archive directory
 file(MAKE_DIRECTORY ${BUILD_DIR}/${ARCHIVE_DIR})
@@ -92,3 +94,8 @@ endif()
 if (EXISTS ${custom_proj_desc_file_path})
     file(COPY ${custom_proj_desc_file_path} DESTINATION ${BUILD_DIR}/${ARCHIVE_DIR}/)
 endif()
+
+# Copy insights meta json file to archive directory
+if (EXISTS ${insights_meta_file_path})
+    file(COPY ${insights_meta_file_path} DESTINATION ${BUILD_DIR}/${ARCHIVE_DIR}/)
+endif()
@@ -0,0 +1,126 @@
+# This file is expected to be present in ${COMPONENT_DIR}
+# accessed from components/esp_insights/project_include.cmake
+# Used in:
+# 1. Project ESP Insights build package tar file, with CONFIG_ESP_INSIGHTS_META_FROM_BUILD
+#
+# Extracts the metrics and variables declared using ESP_DIAG_METRICS_DECLARE and
+# ESP_DIAG_VARIABLE_DECLARE from the app ELF and computes the same hash as
+# esp_diag_meta_decl_hash_get() on the device.
+
+import sys
+import json
+import struct
+import zlib
+
+try:
+    from elftools.elf.elffile import ELFFile
+    from elftools.elf.sections import SymbolTableSection
+except ImportError:
+    sys.exit("ERROR: pyelftools is needed for CONFIG_ESP_INSIGHTS_META_FROM_BUILD, "
+             "please install it using: python -m pip install pyelftools")
+
+# Input app ELF file
+ELF_FILE = sys.argv[1]
+# Output meta json file
+FILENAME = sys.argv[2]
+
+START_SYM = "_esp_diag_meta_decl_start"
+END_SYM = "_esp_diag_meta_decl_end"
+
+# esp_diag_meta_decl_t: tag, key, label, path, unit, type, data_type
+DECL_FMT = "<5IHH"
+DECL_SIZE = struct.calcsize(DECL_FMT)
+
+# esp_diag_data_pt_type_t
+DATA_PT_METRICS = 0
+DATA_PT_VARIABLE = 1
+
+
+def _get_symbols(elf, names):
+    symbols = {}
+    for section in elf.iter_sections():
+        if not isinstance(section, SymbolTableSection):
+            continue
+        for name in names:
+            syms = section.get_symbol_by_name(name)
+            if syms:
+                symbols[name] = syms[0]["st_value"]
+    return symbols
+
+
+def _read(elf, addr, size):
+    for section in elf.iter_sections():
+        start = section["sh_addr"]
+        if section["sh_type"] == "SHT_NOBITS" or not start:
+            continue
+        if start <= addr and addr + size <= start + section["sh_size"]:
+            off = addr - start
+            return section.data()[off:off + size]
+    raise Exception("ERROR: address 0x{:08x} not found in {}".format(addr, ELF_FILE))
+
+
+def _read_str(elf, addr):
+    if not addr:
+        return None
+    for section in elf.iter_sections():
+        start = section["sh_addr"]
+        if section["sh_type"] == "SHT_NOBITS" or not start:
+            continue
+        if start <= addr < start + section["sh_size"]:
+            data = section.data()
+            off = addr - start
+            return data[off:data.index(b"\0", off)].decode("utf-8")
+    raise Exception("ERROR: string at 0x{:08x} not found in {}".format(addr, ELF_FILE))
+
+
+def _decl_crc(crc, decl):
+    # Same as meta_decl_crc() in esp_diagnostics_utils.c
+    crc = zlib.crc32(struct.pack("<HH", decl["type"], decl["data_type"]), crc)
+    for field in ("tag", "key", "label", "path", "unit"):
+        crc = zlib.crc32((decl[field] or "").encode("utf-8") + b"\0", crc)
+    return crc
+
+
+def main():
+    meta = {"hash": 0, "metrics": [], "params": []}
+    with open(ELF_FILE, "rb") as f:
+        elf = ELFFile(f)
+        symbols = _get_symbols(elf, (START_SYM, END_SYM))
+        if START_SYM in symbols and END_SYM in symbols:
+            start = symbols[START_SYM]
+            count = (symbols[END_SYM] - start) // DECL_SIZE
+            data = _read(elf, start, count * DECL_SIZE) if count else b""
+            crc = 0
+            for i in range(count):
+                fields = struct.unpack_from(DECL_FMT, data, i * DECL_SIZE)
+                decl = {
+                    "tag": _read_str(elf, fields[0]),
+                    "key": _read_str(elf, fields[1]),
+                    "label": _read_str(elf, fields[2]),
+                    "path": _read_str(elf, fields[3]),
+                    "unit": _read_str(elf, fields[4]),
+                    "type": fields[5],
+                    "data_type": fields[6],
+                }
+                crc = _decl_crc(crc, decl)
+                entry = {
+                    "tag": decl["tag"],
+                    "key": decl["key"],
+                    "label": decl["label"],
+                    "path": decl["path"],
+                    "data_type": decl["data_type"],
+                }
+                if decl["unit"] is not None:
+                    entry["unit"] = decl["unit"]
+                if decl["type"] == DATA_PT_METRICS:
+                    meta["metrics"].append(entry)
+                elif decl["type"] == DATA_PT_VARIABLE:
+                    meta["params"].append(entry)
+            meta["hash"] = crc
+
+    with open(FILENAME, "w") as f:
+        json.dump(meta, f, indent=4)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,174 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host simulator for the insights report scheduler
+ *
+ * Build:
+ *   gcc -O2 -I../src -o sched_sim sched_sim.c ../src/esp_insights_sched.c
+ *
+ * Run:
+ *   ./sched_sim [options]
+ *     -d sec       simulated duration (default 86400)
+ *     -c bytes     critical store size (default 4096)
+ *     -n bytes     non-critical store size (default 2048)
+ *     -r rate      critical bytes per second, steady (default 0.5)
+ *     -R rate      non-critical bytes per second, steady (default 2)
+ *     -b bytes,sec critical burst of bytes every sec seconds (default none)
+ *     -s bytes     bytes of every class sent per report, 0 for all (default 1024)
+ *     -m sec       min period (default 60)
+ *     -M sec       max period (default 240)
+ *     -t percent   target fill level (default 50)
+ *     -w percent   data store reporting watermark (default 80)
+ *     -L           use the previous doubling/halving scheduler instead, for comparison
+ *
+ * Data is written every second, reports are sent when the period expires or a class crosses
+ * the watermark, like the data store low memory event does on device. Critical data which
+ * does not fit is dropped and oldest non-critical data is overwritten.
+ * Mean delay is the time data waited in the store (pending bytes over time / bytes sent).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "esp_insights_sched.h"
+
+#define CRITICAL        0
+#define NON_CRITICAL    1
+
+typedef struct {
+    uint32_t size;
+    double pending;
+    double written;
+    double dropped;
+    double sent;
+    double pending_sum;     // pending bytes summed every second
+    double max_pending;
+} sim_store_t;
+
+static void sim_write(sim_store_t *store, double bytes, int overwrite)
+{
+    double room = store->size - store->pending;
+    if (bytes > room) {
+        store->dropped += bytes - room;
+        if (overwrite) {
+            store->pending = store->size;
+        } else {
+            store->pending += room;
+        }
+    } else {
+        store->pending += bytes;
+    }
+    store->written += bytes;
+    if (store->pending > store->max_pending) {
+        store->max_pending = store->pending;
+    }
+}
+
+static void sim_send(sim_store_t *store, uint32_t per_report)
+{
+    double bytes = store->pending;
+    if (per_report && bytes > per_report) {
+        bytes = per_report;
+    }
+    store->pending -= bytes;
+    store->sent += bytes;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t duration = 86400, per_report = 1024, min_sec = 60, max_sec = 240, target_pct = 50, watermark_pct = 80;
+    uint32_t burst_bytes = 0, burst_sec = 0;
+    double rate[2] = {0.5, 2};
+    int legacy = 0;
+    sim_store_t store[2] = {{.size = 4096}, {.size = 2048}};
+    int opt;
+    while ((opt = getopt(argc, argv, "d:c:n:r:R:b:s:m:M:t:w:L")) != -1) {
+        switch (opt) {
+            case 'd': duration = atoi(optarg); break;
+            case 'c': store[CRITICAL].size = atoi(optarg); break;
+            case 'n': store[NON_CRITICAL].size = atoi(optarg); break;
+            case 'r': rate[CRITICAL] = atof(optarg); break;
+            case 'R': rate[NON_CRITICAL] = atof(optarg); break;
+            case 'b':
+                if (sscanf(optarg, "%u,%u", &burst_bytes, &burst_sec) != 2 || !burst_sec) {
+                    fprintf(stderr, "invalid burst %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's': per_report = atoi(optarg); break;
+            case 'm': min_sec = atoi(optarg); break;
+            case 'M': max_sec = atoi(optarg); break;
+            case 't': target_pct = atoi(optarg); break;
+            case 'w': watermark_pct = atoi(optarg); break;
+            case 'L': legacy = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-d sec] [-c bytes] [-n bytes] [-r rate] [-R rate] [-b bytes,sec] "
+                        "[-s bytes] [-m sec] [-M sec] [-t percent] [-w percent] [-L]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    esp_insights_sched_t sched;
+    esp_insights_sched_init(&sched, min_sec, max_sec, target_pct);
+    uint32_t reports = 0, period = min_sec, last_report = 0, next_report = min_sec;
+    int prev_sent = 0;
+    for (uint32_t t = 1; t <= duration; t++) {
+        sim_write(&store[CRITICAL], rate[CRITICAL], 0);
+        sim_write(&store[NON_CRITICAL], rate[NON_CRITICAL], 1);
+        if (burst_bytes && t % burst_sec == 0) {
+            sim_write(&store[CRITICAL], burst_bytes, 0);
+        }
+        int watermark = 0;
+        for (int i = 0; i < 2; i++) {
+            store[i].pending_sum += store[i].pending;
+            if (store[i].pending * 100 > (double) store[i].size * watermark_pct) {
+                watermark = 1;
+            }
+        }
+        if (t < next_report && !watermark) {
+            continue;
+        }
+
+        int sent = store[CRITICAL].pending >= 1 || store[NON_CRITICAL].pending >= 1;
+        sim_send(&store[CRITICAL], per_report);
+        sim_send(&store[NON_CRITICAL], per_report);
+        reports++;
+        if (legacy) {
+            if (t >= next_report) {
+                /* Period follows whether the previous period sent anything */
+                period = prev_sent ? period * 2 : period / 2;
+                period = period > max_sec ? max_sec : period < min_sec ? min_sec : period;
+                next_report = t + period;
+                prev_sent = 0;
+            }
+            prev_sent |= sent;
+        } else {
+            esp_insights_sched_store_t s[ESP_INSIGHTS_SCHED_CLASS_CNT];
+            for (int i = 0; i < 2; i++) {
+                s[i].size = store[i].size;
+                s[i].pending = store[i].pending;
+                s[i].written = (uint32_t) store[i].written;
+            }
+            period = esp_insights_sched_update(&sched, s, (t - last_report) * 1000);
+            next_report = t + period;
+        }
+        last_report = t;
+    }
+
+    printf("%-13s %10s %10s %10s %9s %10s\n", "class", "written", "sent", "dropped", "max fill", "mean delay");
+    const char *names[2] = {"critical", "non-critical"};
+    for (int i = 0; i < 2; i++) {
+        printf("%-13s %10.0f %10.0f %10.0f %8.1f%% %9.1fs\n", names[i], store[i].written, store[i].sent,
+               store[i].dropped, 100 * store[i].max_pending / store[i].size,
+               store[i].sent ? store[i].pending_sum / store[i].sent : 0);
+    }
+    printf("reports %u, %.1f per hour\n", reports, reports * 3600.0 / duration);
+    return 0;
+}
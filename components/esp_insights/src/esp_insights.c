@@ -11,6 +11,8 @@
 #include <string.h>
 #include <esp_log.h>
 #include <esp_wifi.h>
+#include <esp_netif.h>
+#include <esp_idf_version.h>
 #if CONFIG_ESP_COREDUMP_ENABLE
 #include <esp_core_dump.h>
 #endif
@@ -32,6 +34,9 @@
 #include "esp_insights_client_data.h"
 #include "esp_insights_encoder.h"
 #include "esp_insights_cbor_decoder.h"
+#include "esp_insights_sched.h"
+#include "esp_insights_spool.h"
+#include "esp_insights_worker.h"
 
 #ifdef CONFIG_ESP_INSIGHTS_CMD_RESP_ENABLED
 #define INSIGHTS_CMD_RESP 1
@@ -47,6 +52,7 @@
 
 #define CLOUD_REPORTING_PERIOD_MIN_SEC    CONFIG_ESP_INSIGHTS_CLOUD_POST_MIN_INTERVAL_SEC
 #define CLOUD_REPORTING_PERIOD_MAX_SEC    CONFIG_ESP_INSIGHTS_CLOUD_POST_MAX_INTERVAL_SEC
+#define CLOUD_REPORTING_TARGET_FILL_PCT   CONFIG_ESP_INSIGHTS_CLOUD_POST_TARGET_FILL_PERCENT
 #define CLOUD_REPORTING_TIMEOUT_TICKS     ((30 * 1000) / portTICK_PERIOD_MS)
 
 #if defined(CONFIG_DIAG_DATA_STORE_RTC) || defined(CONFIG_DIAG_DATA_STORE_RAM)
@@ -69,9 +75,53 @@
 #endif /* defined(CONFIG_DIAG_DATA_STORE_RTC) || defined(CONFIG_DIAG_DATA_STORE_RAM) */
 
 #define INSIGHTS_READ_BUF_SIZE  (1024)  // read this much data from data store in one go
+#define INSIGHTS_UPLINKS_MAX    4       // network interfaces tracked as uplinks
+
+/* Messages other than data which are pending to be sent in the upload cycle */
+#define INSIGHTS_PENDING_META       (1 << 0)
+#define INSIGHTS_PENDING_CONF_META  (1 << 1)
+#define INSIGHTS_PENDING_BOOT       (1 << 2)
+#define INSIGHTS_DATA_MSGS_MAX  CONFIG_ESP_INSIGHTS_DATA_MSGS_INFLIGHT_MAX
+
+#if CONFIG_ESP_INSIGHTS_STREAMING_ENABLED
+#define INSIGHTS_STREAMING      1
+#define INSIGHTS_CHUNK_SIZE     CONFIG_ESP_INSIGHTS_STREAMING_CHUNK_SIZE
+#endif
+
+#if CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED
+#define INSIGHTS_COMPRESSION    1
+#endif
+
+#if CONFIG_ESP_INSIGHTS_DRAIN_ENABLED
+#define INSIGHTS_DRAIN                  1
+#define INSIGHTS_DRAIN_BYTES_MAX        CONFIG_ESP_INSIGHTS_DRAIN_BYTES_MAX
+#define INSIGHTS_DRAIN_TIME_MAX_TICKS   pdMS_TO_TICKS(CONFIG_ESP_INSIGHTS_DRAIN_TIME_MAX_MS)
+#endif
+
+#if CONFIG_ESP_INSIGHTS_SPOOL_ENABLED
+#define INSIGHTS_SPOOL          1
+#define INSIGHTS_SPOOL_LABEL    CONFIG_ESP_INSIGHTS_SPOOL_PARTITION_LABEL
+#endif
+
+#if CONFIG_ESP_INSIGHTS_WORKER_ENABLED
+#define INSIGHTS_WORKER         1
+#endif
+
+#if CONFIG_ESP_INSIGHTS_BUNDLE_ENABLED
+#define INSIGHTS_BUNDLE         1
+#define INSIGHTS_BUNDLE_DATA_MIN    (INSIGHTS_DATA_MAX_SIZE / 2)   // room below which data is not bundled
+#endif
+
+#if CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED
+#define INSIGHTS_DATA_SEQ       1
+#endif
 
 #define SEND_INSIGHTS_META (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
 
+#if CONFIG_ESP_INSIGHTS_META_DELTA && SEND_INSIGHTS_META
+#define INSIGHTS_META_DELTA     1
+#endif
+
 /* TAG for reporting generic miscellaneous insights. Different from ESP_LOGx tag */
 #define TAG_DIAG            "diag"
 #define KEY_LOG_WR_FAIL     "log_wr_fail"
@@ -81,6 +131,26 @@
 
 ESP_EVENT_DEFINE_BASE(INSIGHTS_EVENT);
 
+#if INSIGHTS_WORKER && CONFIG_DIAG_ENABLE_METRICS
+#define TAG_INSIGHTS        "insights"
+#define KEY_WQ_LAT_MAX      "wq_lat_max"
+#define KEY_WQ_LAT_AVG      "wq_lat_avg"
+#define KEY_WQ_DROPPED      "wq_dropped"
+#define PATH_WQ             "Insights.WorkQueue"
+
+ESP_DIAG_METRICS_DECLARE(s_wq_lat_max_decl, TAG_INSIGHTS, KEY_WQ_LAT_MAX, "Work queue max latency", PATH_WQ,
+                         "ms", ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_METRICS_DECLARE(s_wq_lat_avg_decl, TAG_INSIGHTS, KEY_WQ_LAT_AVG, "Work queue average latency", PATH_WQ,
+                         "ms", ESP_DIAG_DATA_TYPE_UINT);
+ESP_DIAG_METRICS_DECLARE(s_wq_dropped_decl, TAG_INSIGHTS, KEY_WQ_DROPPED, "Work queue dropped jobs", PATH_WQ,
+                         "count", ESP_DIAG_DATA_TYPE_UINT);
+#endif /* INSIGHTS_WORKER && CONFIG_DIAG_ENABLE_METRICS */
+
+#if CONFIG_DIAG_ENABLE_VARIABLES
+ESP_DIAG_VARIABLE_DECLARE(s_log_wr_fail_decl, TAG_DIAG, KEY_LOG_WR_FAIL, "Log write fail count", "Diagnostics.Log",
+                          NULL, ESP_DIAG_DATA_TYPE_UINT);
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+
 #ifdef CONFIG_ESP_INSIGHTS_ENABLED
 
 static const char *TAG = "esp_insights"; /* tag for ESP_LOGx */
@@ -94,14 +164,37 @@ typedef struct esp_insights_entry {
     void *priv_data;
 } esp_insights_entry_t;
 
+/* Data message sent but not acknowledged yet */
+typedef struct {
+    int msg_id;         /* 0 once acknowledged */
+    uint32_t len;       /* critical data covered by the message */
+} insights_inflight_msg_t;
+
 typedef struct {
     uint8_t *scratch_buf;
     uint8_t *read_buf;      // buffer to hold data read from RTC buf
-    int data_msg_id;
-    uint32_t data_msg_len;
+#if INSIGHTS_STREAMING
+    uint8_t *chunk_buf;     // used instead of scratch_buf if the transport supports streaming
+#endif
+    insights_inflight_msg_t data_msgs[INSIGHTS_DATA_MSGS_MAX]; /* oldest first */
+    uint8_t data_msgs_cnt;
+    uint32_t data_msgs_len;     /* critical data covered by data_msgs, next message is read past it */
+    uint32_t data_msgs_epoch;   /* incremented when data_msgs are dropped to send their data again */
+#if INSIGHTS_DRAIN
+    uint32_t drain_bytes;       /* data sent in the current upload cycle */
+    TickType_t drain_start;     /* start of the current upload cycle */
+    bool drain_wait_ack;        /* upload cycle continues once a data message is acknowledged */
+#endif
+#if INSIGHTS_SPOOL
+    bool spool_ready;           /* spool partition is found */
+    bool spool_pending;         /* spool may hold messages not sent yet */
+    int spool_msg_id;           /* spooled message awaiting acknowledgment, it stays in the spool until then */
+    bool spool_msg_acked;       /* spool_msg_id is acknowledged, the replay removes it from the spool */
+#endif
     SemaphoreHandle_t data_lock;
     char app_sha256[DIAG_HEX_SHA_SIZE + 1];
-    bool data_sent;
+    esp_insights_sched_t sched;     /* decides the period until the next report */
+    TickType_t sched_update_ticks;  /* time of the last scheduler update */
 #if SEND_INSIGHTS_META
 #if INSIGHTS_CMD_RESP
      bool conf_meta_msg_pending;
@@ -110,10 +203,22 @@ typedef struct {
     bool meta_msg_pending;
     uint32_t meta_msg_id;
     uint32_t meta_crc;
+    bool meta_resync;       /* cloud reported a meta mismatch, send complete meta */
+#if INSIGHTS_META_DELTA
+    esp_insights_meta_entry_t *meta_entries;   /* entries of the meta being sent, sized to the registry */
+    size_t meta_entries_cnt;
+    bool meta_entries_valid;    /* meta_entries could be collected, they are stored only then */
+#endif /* INSIGHTS_META_DELTA */
 #endif /* SEND_INSIGHTS_META */
     bool data_send_inprogress;
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    bool variables_stale;   /* variables are dropped from the store, report them again on next upload */
+#endif
+    esp_netif_t *uplinks[INSIGHTS_UPLINKS_MAX];    /* interfaces with an IP address, updated from network events */
+    uint8_t uplinks_cnt;
+    bool network_up;        /* uplinks_cnt > 0, protected by data_lock */
     uint32_t log_write_fail_cnt; /* Count of failed log write */
-    TimerHandle_t data_send_timer; /* timer to reset data_send_inprogress flag on timeout */
+    TimerHandle_t data_send_timer; /* timer to drop unacknowledged data messages on timeout */
     char *node_id;
     int boot_msg_id;   /* To track whether first message is sent or not, -1:failed, 0:success, >0:inprogress */
 #if INSIGHTS_CMD_RESP
@@ -128,72 +233,78 @@ static esp_insights_entry_t *s_periodic_insights_entry;
 
 extern esp_err_t esp_insights_cmd_resp_init(void);
 
+/* Queues insights work on the dedicated worker task if enabled, on the RainMaker work queue otherwise */
+static esp_err_t insights_work_queue_add(esp_rmaker_work_fn_t work_fn, void *priv_data)
+{
+#if INSIGHTS_WORKER
+    return esp_insights_worker_add_task(work_fn, priv_data);
+#else
+    return esp_rmaker_work_queue_add_task(work_fn, priv_data);
+#endif
+}
+
 static void esp_insights_first_call(void *priv_data)
 {
     if (!priv_data) {
         return;
     }
     esp_insights_entry_t *entry = (esp_insights_entry_t *)priv_data;
-    esp_rmaker_work_queue_add_task(entry->work_fn, entry->priv_data);
+    insights_work_queue_add(entry->work_fn, entry->priv_data);
     /* Start timer here so that the function is called periodically */
     ESP_LOGI(TAG, "Scheduling Insights timer for %" PRIu32 " seconds.", entry->cur_seconds);
     xTimerStart(entry->timer, 0);
 }
 
-/* Returns true if wifi is connected and insights is enabled, false otherwise */
+/* Returns true if a network uplink has an IP address and insights is enabled, false otherwise.
+ * Called with data_lock held.
+ */
 static bool is_insights_active(void)
 {
-    wifi_ap_record_t ap_info;
-    bool wifi_connected = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
-    return wifi_connected && s_insights_data.enabled;
+    return s_insights_data.network_up && s_insights_data.enabled;
 }
 
-/* Returns true if wifi is connected, false otherwise */
-static bool is_wifi_connected(void)
+/* Same as is_insights_active(), for callers which do not hold data_lock */
+static bool is_insights_active_unlocked(void)
 {
-    wifi_ap_record_t ap_info;
-    bool wifi_connected = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
-    return wifi_connected;
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    bool active = is_insights_active();
+    xSemaphoreGive(s_insights_data.data_lock);
+    return active;
+}
+
+/* Returns true if a network uplink has an IP address, false otherwise */
+static bool is_network_up(void)
+{
+    if (!s_insights_data.data_lock) {
+        return false;
+    }
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    bool up = s_insights_data.network_up;
+    xSemaphoreGive(s_insights_data.data_lock);
+    return up;
 }
 
 /* This executes in the context of timer task.
  *
- * There is a dynamic logic to decide the next instance when the insights
- * data will be reported. Depending on whether data was sent or not during
- * the previous timeout, we double or halve the time period.
- * This ensures that data generally gets reported quick enough,
- * but if there's very frequent data being generated, it won't result
- * into too frequent publishes.
- * The period will keep changing between CLOUD_REPORTING_PERIOD_MIN_SEC and
- * CLOUD_REPORTING_PERIOD_MAX_SEC
+ * Period until the next report is set by insights_sched_update() after every report, see
+ * esp_insights_sched.h. Timer is restarted here with the same period in case the report
+ * does not happen, e.g. when the network is disconnected.
  */
 static void esp_insights_common_cb(TimerHandle_t handle)
 {
     esp_insights_entry_t *entry = (esp_insights_entry_t *)pvTimerGetTimerID(handle);
-    /* Check if any data was sent during the previous time out */
-    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-    bool l_data_sent = s_insights_data.data_sent;
-    s_insights_data.data_sent = false;
-    xSemaphoreGive(s_insights_data.data_lock);
-
     if (entry) {
-        if (is_insights_active() == true) {
-            esp_rmaker_work_queue_add_task(entry->work_fn, entry->priv_data);
+        /* Timer task must not block on data_lock, its holder may be waiting on a timer command.
+         * If the lock is busy the work is queued anyway, the handler checks again under the lock.
+         */
+        bool active = true;
+        if (xSemaphoreTake(s_insights_data.data_lock, 0) == pdTRUE) {
+            active = is_insights_active();
+            xSemaphoreGive(s_insights_data.data_lock);
         }
-        /* If data was sent during previous timer interval, double the period */
-        if (l_data_sent) {
-            entry->cur_seconds <<= 1; /* Double the period */
-            if (entry->cur_seconds > entry->max_seconds) {
-                entry->cur_seconds = entry->max_seconds;
-            }
-        } else {
-            /* If no data was sent during previous timer interval, halve the period */
-            entry->cur_seconds >>= 1; /* Halve the period */
-            if (entry->cur_seconds < entry->min_seconds) {
-                entry->cur_seconds = entry->min_seconds;
-            }
+        if (active == true) {
+            insights_work_queue_add(entry->work_fn, entry->priv_data);
         }
-        xTimerChangePeriod(handle, (entry->cur_seconds * 1000)/ portTICK_PERIOD_MS, 100);
         xTimerStart(handle, 0);
     }
 }
@@ -250,20 +361,99 @@ static esp_err_t esp_insights_register_periodic_handler(esp_rmaker_work_fn_t wor
         return ESP_FAIL;
     }
     /* Rainmaker work queue execution start after MQTT connection is established,
-     * esp_insights_first_call() will be executed after MQTT connection is established.
+     * esp_insights_first_call() will be executed after MQTT connection is established
+     * (right away on the insights worker task, see insights_work_queue_add()).
      * It add the work_fn to the queue and start the periodic timer.
      */
-    esp_err_t ret = esp_rmaker_work_queue_add_task(esp_insights_first_call, s_periodic_insights_entry);
+    esp_err_t ret = insights_work_queue_add(esp_insights_first_call, s_periodic_insights_entry);
     if (ret != ESP_OK) {
         ESP_LOGI(TAG, "failed to enqueue insights_first_call, line %d", __LINE__);
     }
     return ret;
 }
 
+/* Below data_msgs_* functions are called with data_lock held */
+
+/* Returns true if a spooled message is awaiting acknowledgment */
+static bool spool_msg_inflight(void)
+{
+#if INSIGHTS_SPOOL
+    return s_insights_data.spool_msg_id > 0 && !s_insights_data.spool_msg_acked;
+#else
+    return false;
+#endif
+}
+
+static int data_msgs_find(int msg_id)
+{
+    for (int i = 0; i < s_insights_data.data_msgs_cnt; i++) {
+        if (s_insights_data.data_msgs[i].msg_id == msg_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Releases critical data of the acknowledged messages, in the order it was sent */
+static void data_msgs_release(void)
+{
+    uint8_t done = 0;
+    while (done < s_insights_data.data_msgs_cnt && s_insights_data.data_msgs[done].msg_id == 0) {
+        esp_diag_data_store_critical_release(s_insights_data.data_msgs[done].len);
+        s_insights_data.data_msgs_len -= s_insights_data.data_msgs[done].len;
+        done++;
+    }
+    if (done) {
+        s_insights_data.data_msgs_cnt -= done;
+        memmove(s_insights_data.data_msgs, s_insights_data.data_msgs + done,
+                s_insights_data.data_msgs_cnt * sizeof(s_insights_data.data_msgs[0]));
+    }
+}
+
+/* Drops messages from idx onwards, their data is read and sent again */
+static void data_msgs_drop(uint8_t idx)
+{
+    while (s_insights_data.data_msgs_cnt > idx) {
+        s_insights_data.data_msgs_cnt--;
+        s_insights_data.data_msgs_len -= s_insights_data.data_msgs[s_insights_data.data_msgs_cnt].len;
+    }
+    s_insights_data.data_msgs_epoch++;
+}
+
+/* Adds the message sent with data read in epoch, msg_id 0 if it is already acknowledged */
+static void data_msgs_add(int msg_id, uint32_t len, uint32_t epoch)
+{
+    if (epoch != s_insights_data.data_msgs_epoch) {
+        /* Messages before it are dropped and its data will be sent again, ignore it */
+        return;
+    }
+    s_insights_data.data_msgs[s_insights_data.data_msgs_cnt].msg_id = msg_id;
+    s_insights_data.data_msgs[s_insights_data.data_msgs_cnt].len = len;
+    s_insights_data.data_msgs_cnt++;
+    s_insights_data.data_msgs_len += len;
+    data_msgs_release();
+}
+
+#if CONFIG_DIAG_ENABLE_VARIABLES
+static void variables_resend(void *priv_data);
+#endif
+
 static void data_send_timeout_cb(TimerHandle_t handle)
 {
     xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-    s_insights_data.data_send_inprogress = false;
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    if (s_insights_data.data_msgs_cnt) {
+        /* Variables in the dropped messages may be lost, same as on send failure */
+        insights_work_queue_add(variables_resend, NULL);
+    }
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    data_msgs_drop(0);
+#if INSIGHTS_SPOOL
+    if (spool_msg_inflight()) {
+        /* Sent again by the next replay */
+        s_insights_data.spool_msg_id = 0;
+    }
+#endif
     if (s_insights_data.boot_msg_id > 0) {
         s_insights_data.boot_msg_id = -1;
     }
@@ -275,6 +465,27 @@ static void data_send_timeout_cb(TimerHandle_t handle)
     xSemaphoreGive(s_insights_data.data_lock);
 }
 
+#if CONFIG_DIAG_ENABLE_VARIABLES
+/* Non-critical data is released as soon as it is encoded, so variables in a lost
+ * data message are gone. Report their last values again so that cloud has the current state.
+ */
+static void variables_resend(void *priv_data)
+{
+    esp_diag_variable_report_all();
+}
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+
+#if SEND_INSIGHTS_META
+static void insights_meta_acked(void);
+static void insights_meta_sent(int msg_id);
+#endif /* SEND_INSIGHTS_META */
+#if INSIGHTS_DRAIN
+static void insights_drain_resume(void *priv_data);
+#endif
+#if INSIGHTS_SPOOL
+static void insights_periodic_handler(void *priv_data);
+#endif
+
 /* This executes in the context of default event loop task */
 static void insights_event_handler(void* arg, esp_event_base_t event_base,
                                    int32_t event_id, void* event_data)
@@ -287,26 +498,46 @@ static void insights_event_handler(void* arg, esp_event_base_t event_base,
         case INSIGHTS_EVENT_TRANSPORT_SEND_SUCCESS:
             if (data && data->msg_id) {
                 xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-                if (data->msg_id == s_insights_data.data_msg_id) {
+                int idx = data_msgs_find(data->msg_id);
+                if (idx >= 0) {
 #if INSIGHTS_DEBUG_ENABLED
                     ESP_LOGI(TAG, "Data message send success, msg_id:%d.", data ? data->msg_id : 0);
 #endif
-                    esp_diag_data_store_critical_release(s_insights_data.data_msg_len);
-                    s_insights_data.data_sent = true;
-                    s_insights_data.data_send_inprogress = false;
-                    if (xTimerIsTimerActive(s_insights_data.data_send_timer) == pdTRUE) {
+                    s_insights_data.data_msgs[idx].msg_id = 0;
+                    data_msgs_release();
+#if INSIGHTS_DRAIN
+                    if (s_insights_data.drain_wait_ack) {
+                        s_insights_data.drain_wait_ack = false;
+                        insights_work_queue_add(insights_drain_resume, NULL);
+                    }
+#endif
+                    if (s_insights_data.data_msgs_cnt == 0 && !spool_msg_inflight()) {
                         xTimerStop(s_insights_data.data_send_timer, portMAX_DELAY);
+                    } else {
+                        xTimerReset(s_insights_data.data_send_timer, portMAX_DELAY);
                     }
+                }
+#if INSIGHTS_SPOOL
+                if (spool_msg_inflight() && data->msg_id == s_insights_data.spool_msg_id) {
+                    /* Replay removes it from the spool and goes on with the next one */
+                    s_insights_data.spool_msg_acked = true;
+                    if (s_insights_data.data_msgs_cnt == 0) {
+                        xTimerStop(s_insights_data.data_send_timer, portMAX_DELAY);
+                    }
+                    insights_work_queue_add(insights_periodic_handler, NULL);
+                }
+#endif /* INSIGHTS_SPOOL */
+                /* Not else-if, a bundle message acknowledges all of its sections with the same msg_id */
 #if SEND_INSIGHTS_META
-                } else if (s_insights_data.meta_msg_pending && data->msg_id == s_insights_data.meta_msg_id) {
+                if (s_insights_data.meta_msg_pending && data->msg_id == s_insights_data.meta_msg_id) {
 #if INSIGHTS_DEBUG_ENABLED
                     ESP_LOGI(TAG, "Meta message send success, msg_id:%d.", data ? data->msg_id : 0);
 #endif
-                    esp_insights_meta_nvs_crc_set(s_insights_data.meta_crc);
+                    insights_meta_acked();
                     s_insights_data.meta_msg_pending = false;
-                    s_insights_data.data_sent = true;
+                }
 #endif /* SEND_INSIGHTS_META */
-                } else if (s_insights_data.boot_msg_id > 0 && s_insights_data.boot_msg_id == data->msg_id) {
+                if (s_insights_data.boot_msg_id > 0 && s_insights_data.boot_msg_id == data->msg_id) {
 #if INSIGHTS_DEBUG_ENABLED
                     ESP_LOGI(TAG, "Boot message send success, msg_id:%d.", data ? data->msg_id : 0);
 #endif
@@ -316,7 +547,7 @@ static void insights_event_handler(void* arg, esp_event_base_t event_base,
                     s_insights_data.boot_msg_id = 0;
                 }
 #if INSIGHTS_CMD_RESP
-                else if (s_insights_data.conf_msg_id > 0 && s_insights_data.conf_msg_id == data->msg_id) {
+                if (s_insights_data.conf_msg_id > 0 && s_insights_data.conf_msg_id == data->msg_id) {
 #if INSIGHTS_DEBUG_ENABLED
                     ESP_LOGI(TAG, "Conf message send success, msg_id:%d.", data ? data->msg_id : 0);
 #endif
@@ -329,15 +560,33 @@ static void insights_event_handler(void* arg, esp_event_base_t event_base,
             break;
         case INSIGHTS_EVENT_TRANSPORT_SEND_FAILED:
             xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-            if (xTimerIsTimerActive(s_insights_data.data_send_timer) == pdTRUE) {
-                xTimerStop(s_insights_data.data_send_timer, portMAX_DELAY);
+            if (data && data->msg_id) {
+                int idx = data_msgs_find(data->msg_id);
+                if (idx >= 0) {
+                    /* Data of the failed message and the ones after it is sent again */
+                    data_msgs_drop(idx);
+                    if (s_insights_data.data_msgs_cnt == 0 && !spool_msg_inflight()) {
+                        xTimerStop(s_insights_data.data_send_timer, portMAX_DELAY);
+                    }
+#if CONFIG_DIAG_ENABLE_VARIABLES
+                    insights_work_queue_add(variables_resend, NULL);
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+                }
+#if INSIGHTS_SPOOL
+                if (spool_msg_inflight() && data->msg_id == s_insights_data.spool_msg_id) {
+                    /* Still in the spool, sent again by the next replay */
+                    s_insights_data.spool_msg_id = 0;
+                    if (s_insights_data.data_msgs_cnt == 0) {
+                        xTimerStop(s_insights_data.data_send_timer, portMAX_DELAY);
+                    }
+                }
+#endif /* INSIGHTS_SPOOL */
             }
-            s_insights_data.data_send_inprogress = false;
             if (s_insights_data.boot_msg_id > 0 && data->msg_id == s_insights_data.boot_msg_id) {
                 s_insights_data.boot_msg_id = -1;
             }
 #if INSIGHTS_CMD_RESP
-            else if (s_insights_data.conf_msg_id > 0 && data->msg_id == s_insights_data.conf_msg_id) {
+            if (s_insights_data.conf_msg_id > 0 && data->msg_id == s_insights_data.conf_msg_id) {
                 s_insights_data.conf_msg_id = -1;
             }
 #endif
@@ -357,7 +606,7 @@ static void hex_dump(uint8_t *data, uint32_t len)
         if ((index % 16) == 0) {
             printf("\n");
         }
-        printf("0x%02x ", s_insights_data.scratch_buf[index]);
+        printf("0x%02x ", data[index]);
     }
     printf("\n");
 }
@@ -366,28 +615,88 @@ static void hex_dump(uint8_t *data, uint32_t len)
 static void insights_dbg_dump(uint8_t *data, uint32_t len)
 {
 #if CONFIG_ESP_INSIGHTS_DEBUG_PRINT_JSON
-    esp_insights_cbor_decode_dump((const uint8_t *) (s_insights_data.scratch_buf + 3), len - 3);
+    esp_insights_cbor_decode_dump((const uint8_t *) (data + 3), len - 3);
 #else
     hex_dump(data, len);
 #endif
 }
 #endif /* INSIGHTS_DEBUG_ENABLED */
 
-static void send_boottime_data(void)
+#if INSIGHTS_STREAMING
+/* Encodes the message in stream, returns length of the message or 0 if there is nothing to send */
+typedef size_t (*insights_stream_encode_t)(esp_insights_enc_stream_t *stream, void *arg);
+
+static esp_err_t stream_flush(const void *data, size_t len)
+{
+    return esp_insights_transport_data_write(data, len);
+}
+
+/* Length of the message is needed before sending its first byte, so the message
+ * is encoded once to find the length and then again to send it chunk by chunk.
+ *
+ * Returns msg_id same as esp_insights_transport_data_send(), len is set to 0 if
+ * there was nothing to send.
+ */
+static int insights_stream_send(insights_stream_encode_t encode, void *arg, size_t *len)
 {
-    uint16_t len = 0;
-    esp_insights_encode_data_begin(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE);
-    esp_insights_encode_boottime_data();
-    len = esp_insights_encode_data_end(s_insights_data.scratch_buf);
+    esp_insights_enc_stream_t stream;
+    esp_insights_enc_stream_init(&stream, s_insights_data.chunk_buf, INSIGHTS_CHUNK_SIZE);
+    *len = encode(&stream, arg);
+    if (*len == 0) {
+        return -1;
+    }
+    esp_err_t err = esp_insights_enc_stream_start(&stream, stream_flush);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Message of length %d can not be sent, err 0x%x", *len, err);
+        return -1;
+    }
+#if INSIGHTS_DEBUG_ENABLED
+    ESP_LOGI(TAG, "Streaming message of length: %d", *len);
+#endif
+    err = esp_insights_transport_data_begin(*len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to begin message, err 0x%x", err);
+        return -1;
+    }
+    encode(&stream, arg);
+    err = esp_insights_enc_stream_finish(&stream);
+    if (err != ESP_OK) {
+        /* Transport drops the incomplete message in data_end */
+        ESP_LOGE(TAG, "Failed to stream message, err 0x%x", err);
+    }
+    return esp_insights_transport_data_end();
+}
+
+static size_t encode_boottime_data(esp_insights_enc_stream_t *stream, void *arg)
+{
+    esp_insights_encode_data_begin_stream(stream);
+    esp_insights_encode_boottime_data(&stream->cbor);
+    return esp_insights_encode_data_end_stream(stream);
+}
+#endif /* INSIGHTS_STREAMING */
+
+/* Encodes boot-time data in buf, compressed if enabled. Returns the length, 0 if it does not fit */
+static size_t encode_boottime_data_buf(uint8_t *buf, size_t size)
+{
+    esp_insights_cbor_enc_t enc;
+    esp_insights_encode_data_begin(&enc, buf, size);
+    esp_insights_encode_boottime_data(&enc);
+    size_t len = esp_insights_encode_data_end(&enc, buf);
     if (len == 0) {
-        ESP_LOGE(TAG, "No boottime data to send");
-        s_insights_data.boot_msg_id = 0; // mark it sent
+        return 0;
     }
 #if INSIGHTS_DEBUG_ENABLED
     ESP_LOGI(TAG, "Sending boottime data of length: %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+    insights_dbg_dump(buf, len);
+#endif
+#if INSIGHTS_COMPRESSION
+    len = esp_insights_encode_compress(buf, len);
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+    return len;
+}
+
+static void boottime_data_sent(int msg_id)
+{
     s_insights_data.boot_msg_id = msg_id;
     if (msg_id > 0) {
         return;
@@ -402,6 +711,29 @@ static void send_boottime_data(void)
     }
 }
 
+static void send_boottime_data(void)
+{
+    size_t len = 0;
+    int msg_id = -1;
+#if INSIGHTS_STREAMING
+    if (s_insights_data.chunk_buf) {
+        msg_id = insights_stream_send(encode_boottime_data, NULL, &len);
+    } else
+#endif /* INSIGHTS_STREAMING */
+    {
+        len = encode_boottime_data_buf(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE);
+        if (len) {
+            msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+        }
+    }
+    if (len == 0) {
+        ESP_LOGE(TAG, "No boottime data to send");
+        s_insights_data.boot_msg_id = 0; // mark it sent
+        return;
+    }
+    boottime_data_sent(msg_id);
+}
+
 #if INSIGHTS_CMD_RESP
 static void send_insights_conf_meta(void);
 static void send_insights_config(void)
@@ -417,7 +749,7 @@ static bool insights_meta_changed(void)
     uint32_t nvs_crc;
     uint32_t meta_crc = esp_diag_meta_crc_get();
     esp_err_t err = esp_insights_meta_nvs_crc_get(&nvs_crc);
-    if (err == ESP_OK && nvs_crc == meta_crc) {
+    if (err == ESP_OK && nvs_crc == meta_crc && !s_insights_data.meta_resync) {
         /* crc found and matched, no need to send insights meta */
         return false;
     }
@@ -426,30 +758,150 @@ static bool insights_meta_changed(void)
     return true;
 }
 
-static void send_insights_meta(void)
+/* Called once the cloud has the meta being sent, with data_lock held */
+static void insights_meta_acked(void)
+{
+    esp_insights_meta_nvs_crc_set(s_insights_data.meta_crc);
+#if INSIGHTS_META_DELTA
+    if (s_insights_data.meta_entries_valid) {
+        esp_insights_meta_nvs_entries_set(s_insights_data.meta_crc, s_insights_data.meta_entries,
+                                          s_insights_data.meta_entries_cnt * sizeof(s_insights_data.meta_entries[0]));
+    }
+#endif /* INSIGHTS_META_DELTA */
+    s_insights_data.meta_resync = false;
+}
+
+#if INSIGHTS_META_DELTA
+#define INSIGHTS_META_SNAPSHOT_TRIES  3
+
+/* Returns the meta last acknowledged by the cloud, NULL if complete meta is to be sent.
+ * Returned base is freed using insights_meta_base_free()
+ *
+ * Current entries are taken once, the delta is encoded from them and they are stored as the next
+ * base on acknowledgment. They are replaced only here, on the insights work queue, so base->cur
+ * stays valid until the message is encoded.
+ */
+static const esp_insights_meta_base_t *insights_meta_base_get(esp_insights_meta_base_t *base)
+{
+    esp_insights_meta_entry_t *entries = NULL, *prev;
+    size_t metrics_cnt = 0, cnt = 0;
+    uint32_t crc = 0;
+    bool valid = false;
+    /* CRC goes with the entries, take them again if something was registered in between */
+    for (int i = 0; i < INSIGHTS_META_SNAPSHOT_TRIES && !valid; i++) {
+        free(entries);
+        entries = NULL;
+        crc = esp_diag_meta_crc_get();
+        valid = esp_insights_meta_entries_get(&entries, &metrics_cnt, &cnt) == ESP_OK &&
+                crc == esp_diag_meta_crc_get();
+    }
+    if (!valid) {
+        free(entries);
+        entries = NULL;
+        metrics_cnt = cnt = 0;
+    }
+
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    prev = s_insights_data.meta_entries;
+    s_insights_data.meta_entries = entries;
+    s_insights_data.meta_entries_cnt = cnt;
+    s_insights_data.meta_entries_valid = valid;
+    if (valid) {
+        s_insights_data.meta_crc = crc;
+    }
+    bool resync = s_insights_data.meta_resync;
+    xSemaphoreGive(s_insights_data.data_lock);
+    free(prev);
+
+    void *base_entries;
+    size_t len;
+    if (!valid || resync || esp_insights_meta_nvs_entries_get(&base->crc, &base_entries, &len) != ESP_OK) {
+        return NULL;
+    }
+    base->entries = base_entries;
+    base->cnt = len / sizeof(esp_insights_meta_entry_t);
+    base->cur = entries;
+    base->cur_metrics_cnt = metrics_cnt;
+    base->cur_cnt = cnt;
+    return base;
+}
+
+static void insights_meta_base_free(const esp_insights_meta_base_t *base)
+{
+    if (base) {
+        free((void *) base->entries);
+    }
+}
+#endif /* INSIGHTS_META_DELTA */
+
+#if INSIGHTS_STREAMING
+static size_t encode_insights_meta(esp_insights_enc_stream_t *stream, void *arg)
 {
-    uint16_t len = 0;
+    return esp_insights_encode_meta_stream(stream, s_insights_data.app_sha256, arg);
+}
+#endif /* INSIGHTS_STREAMING */
 
-    memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
-    len = esp_insights_encode_meta(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, s_insights_data.app_sha256);
+/* Encodes the meta message in buf with base, compressed if enabled. Returns the length, 0 if it does not fit */
+static size_t encode_insights_meta_buf(uint8_t *buf, size_t size, const esp_insights_meta_base_t *base)
+{
+    memset(buf, 0, size);
+    size_t len = esp_insights_encode_meta(buf, size, s_insights_data.app_sha256, base);
     if (len == 0) {
+        return 0;
+    }
 #if INSIGHTS_DEBUG_ENABLED
-        ESP_LOGI(TAG, "No metadata to send");
+    ESP_LOGI(TAG, "Insights meta data length %d", len);
+    insights_dbg_dump(buf, len);
 #endif
-        return;
+#if INSIGHTS_COMPRESSION
+    len = esp_insights_encode_compress(buf, len);
+#endif
+    return len;
+}
+
+static void send_insights_meta(void)
+{
+    size_t len = 0;
+    int msg_id = -1;
+    const esp_insights_meta_base_t *base = NULL;
+#if INSIGHTS_META_DELTA
+    esp_insights_meta_base_t delta_base;
+    base = insights_meta_base_get(&delta_base);
+#endif /* INSIGHTS_META_DELTA */
+#if INSIGHTS_STREAMING
+    if (s_insights_data.chunk_buf) {
+        msg_id = insights_stream_send(encode_insights_meta, (void *) base, &len);
+    } else
+#endif /* INSIGHTS_STREAMING */
+    {
+        len = encode_insights_meta_buf(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, base);
+        if (len) {
+            msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+        }
     }
+#if INSIGHTS_META_DELTA
+    insights_meta_base_free(base);
+#endif /* INSIGHTS_META_DELTA */
+    if (len == 0) {
 #if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Insights meta data length %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+        ESP_LOGI(TAG, "No metadata to send");
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+        return;
+    }
+    insights_meta_sent(msg_id);
+}
+
+static void insights_meta_sent(int msg_id)
+{
     if (msg_id > 0) {
         xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
         s_insights_data.meta_msg_pending = true;
         s_insights_data.meta_msg_id = msg_id;
         xSemaphoreGive(s_insights_data.data_lock);
     } else if (msg_id == 0) {
-        esp_insights_meta_nvs_crc_set(s_insights_data.meta_crc);
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        insights_meta_acked();
+        xSemaphoreGive(s_insights_data.data_lock);
     } else {
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "meta message send failed");
@@ -459,23 +911,54 @@ static void send_insights_meta(void)
 #endif /* SEND_INSIGHTS_META */
 
 #if INSIGHTS_CMD_RESP
-static void send_insights_conf_meta(void)
+#if INSIGHTS_STREAMING
+static size_t encode_insights_conf_meta(esp_insights_enc_stream_t *stream, void *arg)
 {
-    uint16_t len = 0;
+    return esp_insights_encode_conf_meta_stream(stream, s_insights_data.app_sha256);
+}
+#endif /* INSIGHTS_STREAMING */
 
-    memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
-    len = esp_insights_encode_conf_meta(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, s_insights_data.app_sha256);
+/* Encodes the conf meta message in buf. Returns the length, 0 if it does not fit */
+static size_t encode_insights_conf_meta_buf(uint8_t *buf, size_t size)
+{
+    memset(buf, 0, size);
+    size_t len = esp_insights_encode_conf_meta(buf, size, s_insights_data.app_sha256);
+#if INSIGHTS_DEBUG_ENABLED
+    if (len) {
+        ESP_LOGI(TAG, "Insights conf meta data length %d", len);
+        insights_dbg_dump(buf, len);
+    }
+#endif
+    return len;
+}
+
+static void insights_conf_meta_sent(int msg_id);
+static void send_insights_conf_meta(void)
+{
+    size_t len = 0;
+    int msg_id = -1;
+#if INSIGHTS_STREAMING
+    if (s_insights_data.chunk_buf) {
+        msg_id = insights_stream_send(encode_insights_conf_meta, NULL, &len);
+    } else
+#endif /* INSIGHTS_STREAMING */
+    {
+        len = encode_insights_conf_meta_buf(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE);
+        if (len) {
+            msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+        }
+    }
     if (len == 0) {
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "No conf metadata to send");
 #endif
         return;
     }
-#if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Insights conf meta data length %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
-#endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+    insights_conf_meta_sent(msg_id);
+}
+
+static void insights_conf_meta_sent(int msg_id)
+{
     if (msg_id > 0) {
         xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
         s_insights_data.conf_meta_msg_pending = true;
@@ -494,19 +977,208 @@ static void send_insights_conf_meta(void)
  * will be removed from the buffers.
  *
  * In short, there is the possibility of data duplication, so cloud should be able to handle it.
+ * With CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED, critical data carries its sequence range to make that exact.
+ */
+
+/* Data store contents covered by a data message */
+typedef struct {
+    int critical_size;              /* data read from the store */
+    int non_critical_size;
+    size_t critical_consumed;       /* data encoded in the message */
+    size_t non_critical_consumed;
+    uint32_t epoch;                 /* data_msgs_epoch when critical data was read */
+#if INSIGHTS_DATA_SEQ
+    uint32_t seq_id;                /* sequence of the critical data */
+    uint32_t seq;                   /* sequence number of the first byte of critical data read */
+#endif
+} insights_data_read_t;
+
+#if INSIGHTS_STREAMING
+typedef struct {
+    const uint8_t *critical;
+    int critical_size;
+    const uint8_t *non_critical;
+    int non_critical_size;
+    size_t critical_consumed;
+    size_t non_critical_consumed;
+#if INSIGHTS_DATA_SEQ
+    uint32_t seq_id;
+    uint32_t seq;
+#endif
+} insights_data_msg_t;
+
+static size_t encode_insights_data(esp_insights_enc_stream_t *stream, void *arg)
+{
+    insights_data_msg_t *msg = (insights_data_msg_t *) arg;
+    esp_insights_encode_data_begin_stream(stream);
+    if (msg->critical_size > 0) {
+        msg->critical_consumed = esp_insights_encode_critical_data(&stream->cbor, msg->critical, msg->critical_size);
+#if INSIGHTS_DATA_SEQ
+        esp_insights_encode_critical_seq(&stream->cbor, msg->seq_id, msg->seq, msg->critical_consumed);
+#endif
+    }
+    if (msg->non_critical_size > 0) {
+        msg->non_critical_consumed = esp_insights_encode_non_critical_data(&stream->cbor, msg->non_critical,
+                                                                           msg->non_critical_size);
+    }
+    size_t len = esp_insights_encode_data_end_stream(stream);
+    if (!msg->critical_consumed && !msg->non_critical_consumed) {
+        len = 0; // just ignore the encoded data
+    }
+    return len;
+}
+#endif /* INSIGHTS_STREAMING */
+
+/* Reads critical data past the data messages which are not acknowledged yet */
+static int data_critical_read(uint8_t *buf, insights_data_read_t *rd)
+{
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    int size = esp_diag_data_store_critical_read_offset(buf, INSIGHTS_READ_BUF_SIZE, s_insights_data.data_msgs_len);
+    rd->epoch = s_insights_data.data_msgs_epoch;
+#if INSIGHTS_DATA_SEQ
+    /* Data is released under this lock too, so the offset read at is still from the oldest byte */
+    rd->seq_id = 0;
+    rd->seq = 0;
+    if (esp_diag_data_store_critical_get_seq(&rd->seq_id, &rd->seq) == ESP_OK) {
+        rd->seq += s_insights_data.data_msgs_len;
+    }
+#endif
+    xSemaphoreGive(s_insights_data.data_lock);
+    return size;
+}
+
+/* Either of the data did not fit in the message or filled the read buffer */
+static bool insights_data_read_more(const insights_data_read_t *rd)
+{
+    return (rd->critical_consumed && ((int) rd->critical_consumed < rd->critical_size ||
+                                      rd->critical_size == INSIGHTS_READ_BUF_SIZE)) ||
+           (rd->non_critical_consumed && ((int) rd->non_critical_consumed < rd->non_critical_size ||
+                                          rd->non_critical_size == INSIGHTS_READ_BUF_SIZE));
+}
+
+/* Encodes a data message of at most size bytes in buf, compressed if enabled.
+ * Non-critical data is released once encoded, critical data once the message is delivered.
+ * Returns the length of the message, 0 if there is no data.
  */
+static size_t encode_insights_data_buf(uint8_t *buf, size_t size, insights_data_read_t *rd)
+{
+    esp_insights_cbor_enc_t enc;
+    memset(buf, 0, size);
+    esp_insights_encode_data_begin(&enc, buf, size);
+
+    rd->critical_size = data_critical_read(s_insights_data.read_buf, rd);
+    if (rd->critical_size > 0) {
+        rd->critical_consumed = esp_insights_encode_critical_data(&enc, s_insights_data.read_buf, rd->critical_size);
+#if INSIGHTS_DATA_SEQ
+        esp_insights_encode_critical_seq(&enc, rd->seq_id, rd->seq, rd->critical_consumed);
+#endif
+    }
+
+    rd->non_critical_size = esp_diag_data_store_non_critical_read(s_insights_data.read_buf, INSIGHTS_READ_BUF_SIZE);
+    if (rd->non_critical_size > 0) {
+        rd->non_critical_consumed = esp_insights_encode_non_critical_data(&enc, s_insights_data.read_buf,
+                                                                          rd->non_critical_size);
+        esp_diag_data_store_non_critical_release(rd->non_critical_consumed);
+    }
+    size_t len = esp_insights_encode_data_end(&enc, buf);
+    if (!rd->critical_consumed && !rd->non_critical_consumed) {
+        return 0; // just ignore the encoded data
+    }
+#if INSIGHTS_DEBUG_ENABLED
+    ESP_LOGI(TAG, "Sending data of length: %d", len);
+    insights_dbg_dump(buf, len);
+#endif
+#if INSIGHTS_COMPRESSION
+    len = esp_insights_encode_compress(buf, len);
+#endif
+    return len;
+}
+
+/* Keeps track of a data message until it is acknowledged, returns true if it was sent */
+static bool insights_data_sent(int msg_id, const insights_data_read_t *rd)
+{
+    if (msg_id >= 0) {
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        /* Critical data is released once this and all the messages before it are acknowledged */
+        data_msgs_add(msg_id, rd->critical_consumed, rd->epoch);
+        if (msg_id > 0) {
+            xTimerReset(s_insights_data.data_send_timer, portMAX_DELAY);
+        }
+        xSemaphoreGive(s_insights_data.data_lock);
+        return true;
+    }
+#if INSIGHTS_DEBUG_ENABLED
+    ESP_LOGI(TAG, "insights_data message send failed");
+#endif
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    if (rd->non_critical_consumed) {
+        variables_resend(NULL);
+    }
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    return false;
+}
+
+/* Encodes and sends one data message, sent_len is set to its length if it was sent.
+ * Returns true if there may be more data to send right away.
+ */
+static bool send_insights_data_msg(size_t *sent_len)
+{
+    size_t len = 0;
+    insights_data_read_t rd = {0};
+    int msg_id = -1;
+
+#if INSIGHTS_STREAMING
+    if (s_insights_data.chunk_buf) {
+        /* Both the encoding passes must see the same data. Non-critical data may get
+         * overwritten in the store in between, so it is read in a buffer of its own.
+         */
+        insights_data_msg_t msg = {
+            .critical = s_insights_data.read_buf,
+            .non_critical = s_insights_data.read_buf + INSIGHTS_READ_BUF_SIZE,
+        };
+        rd.critical_size = msg.critical_size = data_critical_read(s_insights_data.read_buf, &rd);
+#if INSIGHTS_DATA_SEQ
+        msg.seq_id = rd.seq_id;
+        msg.seq = rd.seq;
+#endif
+        rd.non_critical_size = msg.non_critical_size =
+            esp_diag_data_store_non_critical_read(s_insights_data.read_buf + INSIGHTS_READ_BUF_SIZE, INSIGHTS_READ_BUF_SIZE);
+        msg_id = insights_stream_send(encode_insights_data, &msg, &len);
+        rd.critical_consumed = msg.critical_consumed;
+        rd.non_critical_consumed = msg.non_critical_consumed;
+        if (rd.non_critical_consumed) {
+            esp_diag_data_store_non_critical_release(rd.non_critical_consumed);
+        }
+    } else
+#endif /* INSIGHTS_STREAMING */
+    {
+        len = encode_insights_data_buf(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, &rd);
+        if (len) {
+            msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+        }
+    }
+
+    if (len == 0) {
+#if INSIGHTS_DEBUG_ENABLED
+        ESP_LOGI(TAG, "No data to send");
+#endif
+        return false;
+    }
+    if (!insights_data_sent(msg_id, &rd)) {
+        return false;
+    }
+    *sent_len = len;
+    bool more = insights_data_read_more(&rd);
+#if !INSIGHTS_DRAIN
+    /* Only messages awaiting acknowledgment are sent one after another, one per period otherwise */
+    more = more && msg_id > 0;
+#endif
+    return more;
+}
 
 /* This encodes and sends insights data */
 static void send_insights_data(void)
 {
-    uint16_t len = 0;
-    size_t critical_data_size = 0;
-    size_t non_critical_data_size = 0;
-    size_t critical_consumed = 0;
-    size_t non_critical_consumed = 0;
-
-    memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
-
 #if CONFIG_DIAG_ENABLE_VARIABLES
     static uint32_t prev_log_write_fail_cnt = 0;
     if (s_insights_data.log_write_fail_cnt > prev_log_write_fail_cnt) {
@@ -519,54 +1191,236 @@ static void send_insights_data(void)
     }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
 
-    esp_insights_encode_data_begin(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE);
+    bool more = true;
+    while (more) {
+#if INSIGHTS_DRAIN
+        if (s_insights_data.drain_bytes >= INSIGHTS_DRAIN_BYTES_MAX ||
+            xTaskGetTickCount() - s_insights_data.drain_start >= INSIGHTS_DRAIN_TIME_MAX_TICKS) {
+            break;
+        }
+#endif
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        bool window_full = s_insights_data.data_msgs_cnt >= INSIGHTS_DATA_MSGS_MAX;
+#if INSIGHTS_DRAIN
+        /* Wait for room in the window, the event handler resumes sending */
+        s_insights_data.drain_wait_ack = window_full;
+#endif
+        xSemaphoreGive(s_insights_data.data_lock);
+        if (window_full) {
+            break;
+        }
+        size_t len = 0;
+        more = send_insights_data_msg(&len);
+#if INSIGHTS_DRAIN
+        s_insights_data.drain_bytes += len;
+#endif
+    }
+
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    s_insights_data.data_send_inprogress = false;
+    xSemaphoreGive(s_insights_data.data_lock);
+}
+
+#if INSIGHTS_DRAIN
+/* Continues the upload cycle once there is room for more messages awaiting acknowledgment */
+static void insights_drain_resume(void *priv_data)
+{
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    if (is_insights_active() == false || s_insights_data.data_send_inprogress) {
+        xSemaphoreGive(s_insights_data.data_lock);
+        return;
+    }
+    s_insights_data.data_send_inprogress = true;
+    xSemaphoreGive(s_insights_data.data_lock);
+    send_insights_data();
+}
+#endif /* INSIGHTS_DRAIN */
 
-    critical_data_size = esp_diag_data_store_critical_read(s_insights_data.read_buf, INSIGHTS_READ_BUF_SIZE);
-    if (critical_data_size > 0) {
-        critical_consumed = esp_insights_encode_critical_data(s_insights_data.read_buf, critical_data_size);
+#if INSIGHTS_SPOOL
+/* Moves data from the data store to the spool while the transport is not available */
+static void insights_spool_store(void *priv_data)
+{
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    /* Data is sent as usual once back online, messages awaiting acknowledgment are dropped on timeout */
+    if (is_insights_active() == true || s_insights_data.data_send_inprogress || s_insights_data.data_msgs_cnt) {
+        xSemaphoreGive(s_insights_data.data_lock);
+        return;
     }
+    s_insights_data.data_send_inprogress = true;
+    xSemaphoreGive(s_insights_data.data_lock);
 
-    non_critical_data_size = esp_diag_data_store_non_critical_read(s_insights_data.read_buf, INSIGHTS_READ_BUF_SIZE);
-    if (non_critical_data_size > 0) {
-        non_critical_consumed = esp_insights_encode_non_critical_data(s_insights_data.read_buf, non_critical_data_size);
-        esp_diag_data_store_non_critical_release(non_critical_consumed);
+    size_t size = esp_insights_spool_msg_max();
+    if (size > INSIGHTS_DATA_MAX_SIZE) {
+        size = INSIGHTS_DATA_MAX_SIZE;
     }
-    len = esp_insights_encode_data_end(s_insights_data.scratch_buf);
-    if (!critical_consumed && !non_critical_consumed) {
-        len = 0; // just ignore the encoded data
+    bool more = true;
+    while (more) {
+        insights_data_read_t rd = {0};
+        size_t len = encode_insights_data_buf(s_insights_data.scratch_buf, size, &rd);
+        if (len == 0) {
+            break;
+        }
+        if (esp_insights_spool_write(s_insights_data.scratch_buf, len) != ESP_OK) {
+            /* Critical data stays in the store */
+            break;
+        }
+        if (rd.critical_consumed) {
+            esp_diag_data_store_critical_release(rd.critical_consumed);
+        }
+        s_insights_data.spool_pending = true;
+        more = insights_data_read_more(&rd);
     }
 
-    if (len == 0) {
-#if INSIGHTS_DEBUG_ENABLED
-        ESP_LOGI(TAG, "No data to send");
-#endif
-        goto data_send_end;
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    s_insights_data.data_send_inprogress = false;
+    xSemaphoreGive(s_insights_data.data_lock);
+}
+
+/* Sends the spooled messages, oldest first. Returns true once the spool is empty.
+ *
+ * A message is removed from the spool only once it is delivered. One awaiting acknowledgment
+ * is the last one peeked, so replay waits for it and removes it here before peeking the next.
+ */
+static bool insights_spool_replay(void)
+{
+    if (!s_insights_data.spool_pending) {
+        return true;
     }
-#if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Sending data of length: %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    bool inflight = spool_msg_inflight();
+    bool acked = s_insights_data.spool_msg_acked;
+    if (acked) {
+        s_insights_data.spool_msg_id = 0;
+        s_insights_data.spool_msg_acked = false;
+    }
+    xSemaphoreGive(s_insights_data.data_lock);
+    if (inflight) {
+        return false;
+    }
+    if (acked) {
+        esp_insights_spool_pop();
+    }
+
+    size_t len;
+    while ((len = esp_insights_spool_peek(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE)) > 0) {
+        int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+        if (msg_id < 0) {
+            return false;
+        }
+        if (msg_id > 0) {
+            /* Replay goes on once it is acknowledged, it is sent again on failure or timeout */
+            xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+            s_insights_data.spool_msg_id = msg_id;
+            xTimerReset(s_insights_data.data_send_timer, portMAX_DELAY);
+            xSemaphoreGive(s_insights_data.data_lock);
+            return false;
+        }
+        esp_insights_spool_pop();
+    }
+    s_insights_data.spool_pending = false;
+    return true;
+}
+#endif /* INSIGHTS_SPOOL */
+
+#if INSIGHTS_BUNDLE
+/* Sends the pending meta, conf meta and boot-time messages and a data message as the sections
+ * of one bundle message. Returns the pending messages which did not fit, to be sent on their own.
+ */
+static uint8_t insights_bundle_send(uint8_t pending)
+{
+    uint8_t *buf = s_insights_data.scratch_buf;
+    size_t off = ESP_INSIGHTS_TLV_HDR_LEN;
+    size_t boot_len = 0, data_len = 0;
+    insights_data_read_t rd = {0};
+    int sections = 0;
+
+#if SEND_INSIGHTS_META
+    size_t meta_len = 0;
+    if (pending & INSIGHTS_PENDING_META) {
+        const esp_insights_meta_base_t *base = NULL;
+#if INSIGHTS_META_DELTA
+        esp_insights_meta_base_t delta_base;
+        base = insights_meta_base_get(&delta_base);
+#endif /* INSIGHTS_META_DELTA */
+        meta_len = encode_insights_meta_buf(buf + off, INSIGHTS_DATA_MAX_SIZE - off, base);
+#if INSIGHTS_META_DELTA
+        insights_meta_base_free(base);
+#endif /* INSIGHTS_META_DELTA */
+        off += meta_len;
+        sections += meta_len ? 1 : 0;
+    }
+#endif /* SEND_INSIGHTS_META */
+#if INSIGHTS_CMD_RESP
+    size_t conf_meta_len = 0;
+    if (pending & INSIGHTS_PENDING_CONF_META) {
+        conf_meta_len = encode_insights_conf_meta_buf(buf + off, INSIGHTS_DATA_MAX_SIZE - off);
+        off += conf_meta_len;
+        sections += conf_meta_len ? 1 : 0;
+    }
+#endif /* INSIGHTS_CMD_RESP */
+    if (pending & INSIGHTS_PENDING_BOOT) {
+        boot_len = encode_boottime_data_buf(buf + off, INSIGHTS_DATA_MAX_SIZE - off);
+        off += boot_len;
+        sections += boot_len ? 1 : 0;
+    }
+
+    /* Data goes last and takes the room left, the rest of it is sent as usual */
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    bool add_data = s_insights_data.data_msgs_cnt < INSIGHTS_DATA_MSGS_MAX;
+    xSemaphoreGive(s_insights_data.data_lock);
+#if INSIGHTS_SPOOL
+    /* Spooled data is older and goes first */
+    add_data = add_data && !s_insights_data.spool_pending;
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
-    if (msg_id > 0) {
-        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-        s_insights_data.data_msg_len = critical_consumed;
-        s_insights_data.data_msg_id = msg_id;
-        xTimerReset(s_insights_data.data_send_timer, portMAX_DELAY);
-        xSemaphoreGive(s_insights_data.data_lock);
-        return;
-    } else if (msg_id == 0) {
-        esp_diag_data_store_critical_release(critical_consumed);
-        s_insights_data.data_sent = true;
+    if (add_data && INSIGHTS_DATA_MAX_SIZE - off >= INSIGHTS_BUNDLE_DATA_MIN) {
+        data_len = encode_insights_data_buf(buf + off, INSIGHTS_DATA_MAX_SIZE - off, &rd);
+        off += data_len;
+        sections += data_len ? 1 : 0;
+    }
+    if (sections == 0) {
+        return pending;
+    }
+
+    int msg_id = -1;
+    if (sections == 1) {
+        /* Nothing to bundle it with, sent as is */
+        msg_id = esp_insights_transport_data_send(buf + ESP_INSIGHTS_TLV_HDR_LEN, off - ESP_INSIGHTS_TLV_HDR_LEN);
     } else {
+        size_t len = esp_insights_encode_bundle_end(buf, off - ESP_INSIGHTS_TLV_HDR_LEN);
 #if INSIGHTS_DEBUG_ENABLED
-        ESP_LOGI(TAG, "insights_data message send failed");
+        ESP_LOGI(TAG, "Sending bundle of %d sections, length: %d", sections, len);
 #endif
+        if (len) {
+            msg_id = esp_insights_transport_data_send(buf, len);
+        }
     }
-data_send_end:
-    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-    s_insights_data.data_send_inprogress = false;
-    xSemaphoreGive(s_insights_data.data_lock);
+#if INSIGHTS_DRAIN
+    s_insights_data.drain_bytes += off;
+#endif
+
+    /* Every section is tracked as if it was sent on its own with the msg_id of the bundle */
+#if SEND_INSIGHTS_META
+    if (meta_len) {
+        insights_meta_sent(msg_id);
+        pending &= ~INSIGHTS_PENDING_META;
+    }
+#endif /* SEND_INSIGHTS_META */
+#if INSIGHTS_CMD_RESP
+    if (conf_meta_len) {
+        insights_conf_meta_sent(msg_id);
+        pending &= ~INSIGHTS_PENDING_CONF_META;
+    }
+#endif /* INSIGHTS_CMD_RESP */
+    if (boot_len) {
+        boottime_data_sent(msg_id);
+        pending &= ~INSIGHTS_PENDING_BOOT;
+    }
+    if (data_len) {
+        insights_data_sent(msg_id, &rd);
+    }
+    return pending;
 }
+#endif /* INSIGHTS_BUNDLE */
 
 #if INSIGHTS_CMD_RESP
 static void __insights_report_config_update(void *priv_data)
@@ -575,6 +1429,68 @@ static void __insights_report_config_update(void *priv_data)
 }
 #endif
 
+/* Schedules the next report from the rate at which the data store is filling up */
+static void insights_sched_update(void)
+{
+    esp_insights_sched_store_t store[ESP_INSIGHTS_SCHED_CLASS_CNT];
+    esp_diag_data_store_stats_t stats;
+    memset(store, 0, sizeof(store));
+
+    if (esp_diag_data_store_critical_get_stats(&stats) == ESP_OK) {
+        store[0].size = stats.size;
+        store[0].written = stats.written;
+        /* Data of the messages awaiting acknowledgment is as good as sent */
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        store[0].pending = stats.filled > s_insights_data.data_msgs_len ? stats.filled - s_insights_data.data_msgs_len : 0;
+        xSemaphoreGive(s_insights_data.data_lock);
+    }
+    if (esp_diag_data_store_non_critical_get_stats(&stats) == ESP_OK) {
+        store[1].size = stats.size;
+        store[1].written = stats.written;
+        store[1].pending = stats.filled;
+    }
+    TickType_t now = xTaskGetTickCount();
+    uint32_t elapsed_ms = (now - s_insights_data.sched_update_ticks) * portTICK_PERIOD_MS;
+    s_insights_data.sched_update_ticks = now;
+
+    uint32_t next_sec = esp_insights_sched_update(&s_insights_data.sched, store, elapsed_ms);
+#if INSIGHTS_SPOOL
+    if (s_insights_data.spool_pending) {
+        next_sec = CLOUD_REPORTING_PERIOD_MIN_SEC;
+    }
+#endif
+    esp_insights_entry_t *entry = s_periodic_insights_entry;
+    if (entry && entry->timer) {
+        entry->cur_seconds = next_sec;
+#if INSIGHTS_DEBUG_ENABLED
+        ESP_LOGI(TAG, "Next report in %" PRIu32 " seconds", next_sec);
+#endif
+        /* This also restarts the timer */
+        xTimerChangePeriod(entry->timer, (entry->cur_seconds * 1000) / portTICK_PERIOD_MS, 100);
+    }
+}
+
+#if INSIGHTS_WORKER && CONFIG_DIAG_ENABLE_METRICS
+#define WQ_METRICS_ITEM(_key, _val) { .key = _key, .data_type = ESP_DIAG_DATA_TYPE_UINT, .val = &_val, .val_sz = sizeof(_val) }
+
+/* Reports how long insights work waited in the worker queue since the last report */
+static void worker_metrics_report(void)
+{
+    esp_insights_worker_stats_t stats;
+    esp_insights_worker_stats_get(&stats);
+    const esp_diag_metrics_batch_item_t items[] = {
+        WQ_METRICS_ITEM(KEY_WQ_LAT_MAX, stats.latency_max_ms),
+        WQ_METRICS_ITEM(KEY_WQ_LAT_AVG, stats.latency_avg_ms),
+        WQ_METRICS_ITEM(KEY_WQ_DROPPED, stats.dropped),
+    };
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_report_batch(TAG_INSIGHTS, items, sizeof(items) / sizeof(items[0]), esp_diag_timestamp_get());
+#else
+    esp_diag_metrics_add_batch(items, sizeof(items) / sizeof(items[0]), esp_diag_timestamp_get());
+#endif
+}
+#endif /* INSIGHTS_WORKER && CONFIG_DIAG_ENABLE_METRICS */
+
 static void insights_periodic_handler(void *priv_data)
 {
     xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
@@ -589,42 +1505,85 @@ static void insights_periodic_handler(void *priv_data)
         return;
     }
     s_insights_data.data_send_inprogress = true;
+#if INSIGHTS_DRAIN
+    /* Budget of the upload cycle starting now */
+    s_insights_data.drain_bytes = 0;
+    s_insights_data.drain_start = xTaskGetTickCount();
+#endif
     xSemaphoreGive(s_insights_data.data_lock);
+#if INSIGHTS_WORKER && CONFIG_DIAG_ENABLE_METRICS
+    /* Goes out with this report */
+    worker_metrics_report();
+#endif
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    if (s_insights_data.variables_stale) {
+        s_insights_data.variables_stale = false;
+        variables_resend(NULL);
+    }
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    uint8_t pending = 0;
 #if SEND_INSIGHTS_META
     if (insights_meta_changed()) {
-        send_insights_meta();
-#if INSIGHTS_CMD_RESP
-        send_insights_conf_meta();
-#endif
+        pending |= INSIGHTS_PENDING_META | INSIGHTS_PENDING_CONF_META;
     }
 #endif /* SEND_INSIGHTS_META */
-
-#if INSIGHTS_CMD_RESP
     xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+#if INSIGHTS_CMD_RESP
     if (s_insights_data.conf_msg_id == -1) {
-        xSemaphoreGive(s_insights_data.data_lock);
-        send_insights_config();
-    } else {
-        xSemaphoreGive(s_insights_data.data_lock);
+        pending |= INSIGHTS_PENDING_CONF_META;
     }
 #endif
-    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
     if (s_insights_data.boot_msg_id == -1) {
-        xSemaphoreGive(s_insights_data.data_lock);
+        pending |= INSIGHTS_PENDING_BOOT;
+    }
+    xSemaphoreGive(s_insights_data.data_lock);
+#if INSIGHTS_BUNDLE
+    if (pending) {
+        pending = insights_bundle_send(pending);
+    }
+#endif
+#if SEND_INSIGHTS_META
+    if (pending & INSIGHTS_PENDING_META) {
+        send_insights_meta();
+    }
+#endif /* SEND_INSIGHTS_META */
+#if INSIGHTS_CMD_RESP
+    if (pending & INSIGHTS_PENDING_CONF_META) {
+        send_insights_conf_meta();
+    }
+#endif
+    if (pending & INSIGHTS_PENDING_BOOT) {
         send_boottime_data();
-    } else {
+    }
+#if INSIGHTS_SPOOL
+    /* Live data waits until the spooled data, which is older, is sent */
+    if (insights_spool_replay() == false) {
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        s_insights_data.data_send_inprogress = false;
         xSemaphoreGive(s_insights_data.data_lock);
+        insights_sched_update();
+        return;
     }
+#endif
     send_insights_data();
+    insights_sched_update();
+}
+
+void esp_insights_meta_resync(void)
+{
+#if SEND_INSIGHTS_META
+    ESP_LOGI(TAG, "Metadata mismatch reported, sending complete metadata");
+    s_insights_data.meta_resync = true;
+#endif /* SEND_INSIGHTS_META */
 }
 
 esp_err_t esp_insights_send_data(void)
 {
-    if (is_wifi_connected() == true) {
+    if (is_network_up() == true) {
         ESP_LOGI(TAG, "Sending data to cloud");
-        return esp_rmaker_work_queue_add_task(insights_periodic_handler, NULL);
+        return insights_work_queue_add(insights_periodic_handler, NULL);
     }
-    ESP_LOGW(TAG, "Wi-Fi not in connected state");
+    ESP_LOGW(TAG, "Network not in connected state");
     return ESP_FAIL;
 }
 
@@ -632,10 +1591,10 @@ esp_err_t esp_insights_send_data(void)
 void esp_insights_report_config_update(void)
 {
     s_insights_data.conf_msg_id = -1;
-    if (is_wifi_connected() == true) {
-        /* if wifi is connected, immediately send the report */
+    if (is_network_up() == true) {
+        /* if network is connected, immediately send the report */
         /* if not, this will be reported from periodic handler */
-        esp_rmaker_work_queue_add_task(__insights_report_config_update, NULL);
+        insights_work_queue_add(__insights_report_config_update, NULL);
     }
 }
 #else
@@ -659,9 +1618,14 @@ static void data_store_event_handler(void* arg, esp_event_base_t event_base,
             ESP_LOGI(TAG, "ESP_DIAG_DATA_STORE_EVENT_%sCRITICAL_DATA_LOW_MEM",
                     event_id == ESP_DIAG_DATA_STORE_EVENT_CRITICAL_DATA_LOW_MEM ? "" : "NON_");
 #endif
-            if (is_insights_active() == true) {
-                esp_rmaker_work_queue_add_task(insights_periodic_handler, NULL);
+            if (is_insights_active_unlocked() == true) {
+                insights_work_queue_add(insights_periodic_handler, NULL);
             }
+#if INSIGHTS_SPOOL
+            else if (s_insights_data.spool_ready) {
+                insights_work_queue_add(insights_spool_store, NULL);
+            }
+#endif
             break;
         }
 
@@ -678,11 +1642,131 @@ static void data_store_event_handler(void* arg, esp_event_base_t event_base,
 #endif
             break;
 
+#if CONFIG_DIAG_ENABLE_VARIABLES
+        case ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_DROPPED:
+            /* Not resent right away, reporting them now would only push more data out of the full store */
+            s_insights_data.variables_stale = true;
+            break;
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+
         default:
             break;
     }
 }
 
+#if !CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK
+static bool netif_has_ip(esp_netif_t *netif)
+{
+    if (!esp_netif_is_netif_up(netif)) {
+        return false;
+    }
+    esp_netif_ip_info_t ip_info;
+    if (esp_netif_get_ip_info(netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0) {
+        return true;
+    }
+#if CONFIG_LWIP_IPV6
+    esp_ip6_addr_t ip6;
+    if (esp_netif_get_ip6_global(netif, &ip6) == ESP_OK) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+/* Adds (up) or removes an uplink and updates network_up. Sending starts right away when the
+ * first uplink comes up, instead of waiting for the next period.
+ */
+static void uplink_update(esp_netif_t *netif, bool up)
+{
+    if (!netif) {
+        return;
+    }
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    int idx;
+    for (idx = 0; idx < s_insights_data.uplinks_cnt; idx++) {
+        if (s_insights_data.uplinks[idx] == netif) {
+            break;
+        }
+    }
+    if (up && idx == s_insights_data.uplinks_cnt && idx < INSIGHTS_UPLINKS_MAX) {
+        s_insights_data.uplinks[s_insights_data.uplinks_cnt++] = netif;
+    } else if (!up && idx < s_insights_data.uplinks_cnt) {
+        s_insights_data.uplinks[idx] = s_insights_data.uplinks[--s_insights_data.uplinks_cnt];
+    }
+    /* Interfaces without a lost IP event (e.g. IPv6 only) are dropped once they are down */
+    for (idx = s_insights_data.uplinks_cnt - 1; idx >= 0; idx--) {
+        if (!esp_netif_is_netif_up(s_insights_data.uplinks[idx])) {
+            s_insights_data.uplinks[idx] = s_insights_data.uplinks[--s_insights_data.uplinks_cnt];
+        }
+    }
+    bool was_up = s_insights_data.network_up;
+    bool now_up = s_insights_data.uplinks_cnt > 0;
+    bool enabled = s_insights_data.enabled;
+    s_insights_data.network_up = now_up;
+    xSemaphoreGive(s_insights_data.data_lock);
+
+    if (!was_up && now_up) {
+        ESP_LOGI(TAG, "Network connected");
+        if (enabled) {
+            insights_work_queue_add(insights_periodic_handler, NULL);
+        }
+    } else if (was_up && !now_up) {
+        ESP_LOGI(TAG, "Network disconnected");
+    }
+}
+
+static void network_event_handler(void* arg, esp_event_base_t event_base,
+                                  int32_t event_id, void* event_data)
+{
+    if (event_base == IP_EVENT) {
+        switch (event_id) {
+            case IP_EVENT_STA_GOT_IP:
+            case IP_EVENT_ETH_GOT_IP:
+            case IP_EVENT_PPP_GOT_IP:
+                uplink_update(((ip_event_got_ip_t *) event_data)->esp_netif, true);
+                break;
+            case IP_EVENT_STA_LOST_IP:
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+            case IP_EVENT_ETH_LOST_IP:
+#endif
+            case IP_EVENT_PPP_LOST_IP:
+                uplink_update(((ip_event_got_ip_t *) event_data)->esp_netif, false);
+                break;
+            case IP_EVENT_GOT_IP6:
+            {
+                /* e.g. Thread, which has no IPv4. Link local address is not enough to reach the cloud */
+                ip_event_got_ip6_t *event = (ip_event_got_ip6_t *) event_data;
+                if (esp_netif_ip6_get_addr_type(&event->ip6_info.ip) != ESP_IP6_ADDR_IS_LINK_LOCAL) {
+                    uplink_update(event->esp_netif, true);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        /* IP is lost only after a timeout, link is down right away */
+        uplink_update(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), false);
+    }
+}
+
+/* Network may be up before insights is enabled, on any of the interfaces */
+static void uplinks_init(void)
+{
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    s_insights_data.uplinks_cnt = 0;
+    s_insights_data.network_up = false;
+    xSemaphoreGive(s_insights_data.data_lock);
+
+    esp_netif_t *netif = NULL;
+    while ((netif = esp_netif_next(netif)) != NULL) {
+        if (netif_has_ip(netif)) {
+            uplink_update(netif, true);
+        }
+    }
+}
+#endif /* !CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK */
+
 static esp_err_t log_write_cb(void *data, size_t len, void *priv_data)
 {
     esp_err_t ret_val = esp_diag_data_store_critical_write(data, len);
@@ -706,12 +1790,25 @@ static esp_err_t metrics_write_cb(const char *group, void *data, size_t len, voi
     return ret_val;
 }
 
+static esp_err_t metrics_write_batch_cb(const char *group, void *const data[], const size_t len[],
+                                        size_t count, void *cb_arg)
+{
+    esp_err_t ret_val = esp_diag_data_store_non_critical_write_batch(group, data, len, count);
+#if INSIGHTS_DEBUG_ENABLED
+    if (ret_val != ESP_OK) {
+        ESP_LOGI(TAG, "esp_diag_data_store_non_critical_write_batch failed group %s, count %d, err 0x%04x", group, count, ret_val);
+    }
+#endif
+    return ret_val;
+}
+
 static void metrics_init(void)
 {
     /* Initialize and enable metrics */
     esp_diag_metrics_config_t metrics_config = {
         .write_cb = metrics_write_cb,
         .cb_arg = NULL,
+        .write_batch_cb = metrics_write_batch_cb,
     };
     esp_err_t ret = esp_diag_metrics_init(&metrics_config);
     if (ret == ESP_OK) {
@@ -727,6 +1824,17 @@ static void metrics_init(void)
             ESP_LOGW(TAG, "Failed to initialize wifi metrics");
         }
 #endif /* CONFIG_DIAG_ENABLE_WIFI_METRICS */
+#if CONFIG_DIAG_ENABLE_COUNTERS
+        ret = esp_diag_counters_init();
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to initialize counters");
+        }
+#endif /* CONFIG_DIAG_ENABLE_COUNTERS */
+#if INSIGHTS_WORKER
+        esp_diag_metrics_register_decl(&s_wq_lat_max_decl);
+        esp_diag_metrics_register_decl(&s_wq_lat_avg_decl);
+        esp_diag_metrics_register_decl(&s_wq_dropped_decl);
+#endif /* INSIGHTS_WORKER */
         return;
     }
     ESP_LOGE(TAG, "Failed to initialize metrics.");
@@ -734,6 +1842,9 @@ static void metrics_init(void)
 
 static void metrics_deinit(void)
 {
+#if CONFIG_DIAG_ENABLE_COUNTERS
+    esp_diag_counters_deinit();
+#endif
 #if CONFIG_DIAG_ENABLE_HEAP_METRICS
     esp_diag_heap_metrics_deinit();
 #endif
@@ -765,7 +1876,7 @@ static void variables_init(void)
             ESP_LOGW(TAG, "Failed to initialize network variables");
         }
 #endif /* CONFIG_DIAG_ENABLE_NETWORK_VARIABLES */
-        esp_diag_variable_register(TAG_DIAG, KEY_LOG_WR_FAIL, "Log write fail count", "Diagnostics.Log", ESP_DIAG_DATA_TYPE_UINT);
+        esp_diag_variable_register_decl(&s_log_wr_fail_decl);
         return;
     }
     ESP_LOGE(TAG, "Failed to initialize param-values.");
@@ -792,6 +1903,26 @@ static void esp_insights_disable_internal(void *priv_data)
         free(s_insights_data.scratch_buf);
         s_insights_data.scratch_buf = NULL;
     }
+#if INSIGHTS_STREAMING
+    if (s_insights_data.chunk_buf) {
+        free(s_insights_data.chunk_buf);
+        s_insights_data.chunk_buf = NULL;
+    }
+#endif
+#if INSIGHTS_META_DELTA
+    free(s_insights_data.meta_entries);
+    s_insights_data.meta_entries = NULL;
+    s_insights_data.meta_entries_cnt = 0;
+#endif /* INSIGHTS_META_DELTA */
+#if INSIGHTS_SPOOL
+    if (s_insights_data.spool_ready) {
+        esp_insights_spool_deinit();
+        s_insights_data.spool_ready = false;
+        s_insights_data.spool_pending = false;
+        s_insights_data.spool_msg_id = 0;
+        s_insights_data.spool_msg_acked = false;
+    }
+#endif
     if (s_insights_data.data_send_timer) {
         xTimerDelete(s_insights_data.data_send_timer, portMAX_DELAY);
         s_insights_data.data_send_timer = NULL;
@@ -818,20 +1949,34 @@ void esp_insights_disable(void)
 #ifdef CONFIG_DIAG_ENABLE_METRICS
     metrics_deinit();
 #endif
+#if INSIGHTS_WORKER
+    esp_diag_work_queue_set(NULL);
+#endif /* INSIGHTS_WORKER */
     esp_diag_log_hook_disable(ESP_DIAG_LOG_TYPE_ERROR | ESP_DIAG_LOG_TYPE_WARNING | ESP_DIAG_LOG_TYPE_EVENT);
     esp_diag_data_store_deinit();
     esp_event_handler_unregister(INSIGHTS_EVENT, ESP_EVENT_ANY_ID, insights_event_handler);
     esp_event_handler_unregister(ESP_DIAG_DATA_STORE_EVENT, ESP_EVENT_ANY_ID, data_store_event_handler);
+#if !CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK
+    esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID, network_event_handler);
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, network_event_handler);
+#endif
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    s_insights_data.network_up = false;
+    xSemaphoreGive(s_insights_data.data_lock);
 
     /* Let the existing Insights work to complete and then delete the semaphores */
     ESP_LOGI(TAG, "Adding task to delete the semaphores");
-    esp_rmaker_work_queue_add_task(esp_insights_disable_internal, NULL);
+    insights_work_queue_add(esp_insights_disable_internal, NULL);
 }
 
 void esp_insights_deinit(void)
 {
     esp_insights_transport_disconnect();
     esp_insights_disable();
+#if INSIGHTS_WORKER
+    /* Stops after the work queued by esp_insights_disable() is done */
+    esp_insights_worker_stop();
+#endif /* INSIGHTS_WORKER */
     esp_insights_transport_unregister();
     esp_rmaker_work_queue_deinit();
     s_insights_data.init_done = false;
@@ -917,9 +2062,19 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
         ESP_LOGW(TAG, "Insights already enabled");
         return ESP_OK;
     }
+#if INSIGHTS_WORKER
+    err = esp_insights_worker_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start insights worker.");
+        return err;
+    }
+#endif /* INSIGHTS_WORKER */
     s_insights_data.data_lock = xSemaphoreCreateMutex();
     if (!s_insights_data.data_lock) {
         ESP_LOGE(TAG, "Failed to create data lock.");
+#if INSIGHTS_WORKER
+        esp_insights_worker_stop();
+#endif /* INSIGHTS_WORKER */
         return ESP_ERR_NO_MEM;
     }
     err = s_insights_data.node_id ? ESP_OK : esp_insights_set_node_id(config->node_id);
@@ -927,21 +2082,45 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
         ESP_LOGE(TAG, "Failed to set node id");
         goto enable_err;
     }
-    if (config->alloc_ext_ram) {
-        s_insights_data.scratch_buf = MEM_ALLOC_EXTRAM(INSIGHTS_DATA_MAX_SIZE);
-        s_insights_data.read_buf = MEM_ALLOC_EXTRAM(INSIGHTS_READ_BUF_SIZE);
-    } else {
-        s_insights_data.scratch_buf = malloc(INSIGHTS_DATA_MAX_SIZE);
-        s_insights_data.read_buf = malloc(INSIGHTS_READ_BUF_SIZE);
-    }
-    if (!s_insights_data.scratch_buf) {
-        ESP_LOGE(TAG, "Failed to allocate memory for scratch buffer.");
-        err = ESP_ERR_NO_MEM;
-        goto enable_err;
+#if INSIGHTS_STREAMING
+    if (esp_insights_transport_data_stream_supported()) {
+        /* Messages are streamed in chunks, scratch buffer is not needed.
+         * Critical and non-critical data are read in separate halves of read_buf.
+         */
+        if (config->alloc_ext_ram) {
+            s_insights_data.chunk_buf = MEM_ALLOC_EXTRAM(INSIGHTS_CHUNK_SIZE);
+            s_insights_data.read_buf = MEM_ALLOC_EXTRAM(2 * INSIGHTS_READ_BUF_SIZE);
+        } else {
+            s_insights_data.chunk_buf = malloc(INSIGHTS_CHUNK_SIZE);
+            s_insights_data.read_buf = malloc(2 * INSIGHTS_READ_BUF_SIZE);
+        }
+        if (!s_insights_data.chunk_buf) {
+            ESP_LOGE(TAG, "Failed to allocate memory for chunk buffer.");
+            err = ESP_ERR_NO_MEM;
+            goto enable_err;
+        }
+    } else
+#endif /* INSIGHTS_STREAMING */
+    {
+        if (config->alloc_ext_ram) {
+            s_insights_data.scratch_buf = MEM_ALLOC_EXTRAM(INSIGHTS_DATA_MAX_SIZE);
+            s_insights_data.read_buf = MEM_ALLOC_EXTRAM(INSIGHTS_READ_BUF_SIZE);
+        } else {
+            s_insights_data.scratch_buf = malloc(INSIGHTS_DATA_MAX_SIZE);
+            s_insights_data.read_buf = malloc(INSIGHTS_READ_BUF_SIZE);
+        }
+        if (!s_insights_data.scratch_buf) {
+            ESP_LOGE(TAG, "Failed to allocate memory for scratch buffer.");
+            err = ESP_ERR_NO_MEM;
+            goto enable_err;
+        }
     }
     if (!s_insights_data.read_buf) {
         ESP_LOGE(TAG, "Failed to allocate memory for read_buf");
         free(s_insights_data.scratch_buf);
+#if INSIGHTS_STREAMING
+        free(s_insights_data.chunk_buf);
+#endif
         err = ESP_ERR_NO_MEM;
         goto enable_err;
     }
@@ -966,6 +2145,23 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
         ESP_LOGE(TAG, "Failed to register event handler for DIAG_DATA_STORE_EVENT");
         goto enable_err;
     }
+#if CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK
+    /* Loopback transport does not need a network */
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    s_insights_data.network_up = true;
+    xSemaphoreGive(s_insights_data.data_lock);
+#else
+    /* Connectivity is tracked from network events instead of being polled */
+    err = esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, network_event_handler, NULL);
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, network_event_handler, NULL);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register event handler for network events");
+        goto enable_err;
+    }
+    uplinks_init();
+#endif
     err = esp_diag_data_store_init();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialise RTC store.");
@@ -994,6 +2190,10 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
     }
     esp_diag_log_hook_enable(config->log_type);
 
+#if INSIGHTS_WORKER
+    /* Metrics dumps off the diagnostics timers run on the worker too */
+    esp_diag_work_queue_set(esp_insights_worker_add_task);
+#endif /* INSIGHTS_WORKER */
 #if CONFIG_DIAG_ENABLE_METRICS
     metrics_init();
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
@@ -1005,6 +2205,9 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
 #if INSIGHTS_CMD_RESP
     s_insights_data.conf_msg_id = -1;
 #endif
+    /* Data of the messages not acknowledged before disable is sent again */
+    s_insights_data.data_msgs_cnt = 0;
+    s_insights_data.data_msgs_len = 0;
     s_insights_data.data_send_timer = xTimerCreate("data_send_timer", CLOUD_REPORTING_TIMEOUT_TICKS,
                                                    pdFALSE, NULL, data_send_timeout_cb);
     if (!s_insights_data.data_send_timer) {
@@ -1013,6 +2216,18 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
         goto enable_err;
     }
 
+#if INSIGHTS_SPOOL
+    if (esp_insights_spool_init(INSIGHTS_SPOOL_LABEL) == ESP_OK) {
+        s_insights_data.spool_ready = true;
+        /* Messages may be left from before reboot */
+        s_insights_data.spool_pending = true;
+    } else {
+        ESP_LOGW(TAG, "Spool partition %s not available, data is not kept while offline", INSIGHTS_SPOOL_LABEL);
+    }
+#endif
+    esp_insights_sched_init(&s_insights_data.sched, CLOUD_REPORTING_PERIOD_MIN_SEC, CLOUD_REPORTING_PERIOD_MAX_SEC,
+                            CLOUD_REPORTING_TARGET_FILL_PCT);
+    s_insights_data.sched_update_ticks = xTaskGetTickCount();
     err = esp_insights_register_periodic_handler(insights_periodic_handler,
                 CLOUD_REPORTING_PERIOD_MIN_SEC, CLOUD_REPORTING_PERIOD_MAX_SEC, NULL);
     if (err != ESP_OK) {
@@ -1029,6 +2244,11 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
     return ESP_OK;
 enable_err:
     esp_insights_disable();
+#if INSIGHTS_WORKER
+    /* Worker stops once the work queued so far is done */
+    esp_diag_work_queue_set(NULL);
+    esp_insights_worker_stop();
+#endif /* INSIGHTS_WORKER */
     return err;
 }
 
@@ -1050,6 +2270,8 @@ esp_err_t esp_insights_init(esp_insights_config_t *config)
     }
 #ifdef CONFIG_ESP_INSIGHTS_TRANSPORT_MQTT
     err = esp_insights_transport_register(&g_default_insights_transport_mqtt);
+#elif CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK
+    err = esp_insights_transport_register(&g_default_insights_transport_loopback);
 #else
     g_default_insights_transport_https.userdata = (void *)config->auth_key;
     err = esp_insights_transport_register(&g_default_insights_transport_https);
@@ -10,7 +10,9 @@
 #include <soc/soc_memory_layout.h>
 #include <esp_rmaker_utils.h>
 
+#include <string.h>
 #include <cbor.h>
+#include <esp_diagnostics.h>
 #include "esp_insights_cbor_decoder.h"
 
 static const char *TAG = "insight_cbor_dec";
@@ -72,6 +74,142 @@ static void cbor_dump_list_insert_at_head(cbor_dump_value_t* data)
     dump_list_head = node;
 }
 
+/* Prints a name, bool, number or string value without advancing the iterator */
+static CborError dump_scalar(const CborValue *it)
+{
+    CborError ret = CborNoError;
+    CborValue next = *it;
+    switch (cbor_value_get_type(it)) {
+    case CborIntegerType: {
+        int64_t val;
+        ret = cbor_value_get_int64(it, &val);
+        printf("%lld", (long long)val);
+        break;
+    }
+    case CborBooleanType: {
+        bool val;
+        ret = cbor_value_get_boolean(it, &val);
+        printf(val ? "true" : "false");
+        break;
+    }
+    case CborFloatType: {
+        float val;
+        ret = cbor_value_get_float(it, &val);
+        printf("%g", val);
+        break;
+    }
+    case CborTextStringType: {
+        char *buf;
+        size_t n;
+        ret = cbor_value_dup_text_string(it, &buf, &n, &next);
+        if (ret == CborNoError) {
+            printf("\"%s\"", buf);
+            free(buf);
+        }
+        break;
+    }
+    case CborByteStringType: {
+        uint8_t *buf;
+        size_t n;
+        ret = cbor_value_dup_byte_string(it, &buf, &n, &next);
+        if (ret == CborNoError) {
+            dumpbytes(buf, n);
+            free(buf);
+        }
+        break;
+    }
+    case CborArrayType: {
+        // name of the data point, [<tag>, <key>]
+        CborValue elem;
+        ret = cbor_value_enter_container(it, &elem);
+        printf("[");
+        while (ret == CborNoError && !cbor_value_at_end(&elem)) {
+            ret = dump_scalar(&elem);
+            if (ret == CborNoError) {
+                ret = cbor_value_advance(&elem);
+                printf(cbor_value_at_end(&elem) ? "" : ", ");
+            }
+        }
+        printf("]");
+        break;
+    }
+    default:
+        printf("null");
+        break;
+    }
+    return ret;
+}
+
+/* Metrics series of compact payload are printed as the data points they were made from.
+ * series: [<n>, <data_type>, [<t0>, <t1 - t0>, ...], [<v0>, <v1 - v0>, ...]],
+ * values are differences only for int and uint data types.
+ */
+static CborError dump_metrics_series(CborValue *it, int nestingLevel)
+{
+    CborError ret;
+    CborValue list, series, name, ts, val;
+    uint64_t data_type;
+    int cnt = 0;
+
+    ret = cbor_value_enter_container(it, &list);
+    CBOR_CHECK(ret, "enter series list failed", err, ret);
+    printf("[");
+    while (!cbor_value_at_end(&list)) {
+        ret = cbor_value_enter_container(&list, &series);
+        CBOR_CHECK(ret, "enter series failed", err, ret);
+        name = series;
+        ret = cbor_value_advance(&series);
+        CBOR_CHECK(ret, "parse series name failed", err, ret);
+        ret = cbor_value_get_uint64(&series, &data_type);
+        CBOR_CHECK(ret, "parse series data type failed", err, ret);
+        ret = cbor_value_advance_fixed(&series);
+        CBOR_CHECK(ret, "parse series data type failed", err, ret);
+        ret = cbor_value_enter_container(&series, &ts);
+        CBOR_CHECK(ret, "enter series timestamps failed", err, ret);
+        CborValue val_arr = series;
+        ret = cbor_value_advance(&val_arr); // skips the timestamps array
+        CBOR_CHECK(ret, "parse series values failed", err, ret);
+        ret = cbor_value_enter_container(&val_arr, &val);
+        CBOR_CHECK(ret, "enter series values failed", err, ret);
+
+        bool is_delta = (data_type == ESP_DIAG_DATA_TYPE_INT || data_type == ESP_DIAG_DATA_TYPE_UINT);
+        int64_t t = 0, v = 0, diff;
+        for (int p = 0; !cbor_value_at_end(&ts) && !cbor_value_at_end(&val); p++) {
+            ret = cbor_value_get_int64(&ts, &diff);
+            CBOR_CHECK(ret, "parse series timestamp failed", err, ret);
+            t = p ? t + diff : diff;
+            printf("%s\n", cnt++ ? "," : "");
+            indent(nestingLevel + 1);
+            printf("{\"n\": ");
+            ret = dump_scalar(&name);
+            CBOR_CHECK(ret, "parse series name failed", err, ret);
+            printf(", \"v\": ");
+            if (is_delta) {
+                ret = cbor_value_get_int64(&val, &diff);
+                CBOR_CHECK(ret, "parse series value failed", err, ret);
+                v = p ? v + diff : diff;
+                printf("%lld", (long long)v);
+            } else {
+                ret = dump_scalar(&val);
+                CBOR_CHECK(ret, "parse series value failed", err, ret);
+            }
+            printf(", \"t\": %llu}", (unsigned long long)t);
+            ret = cbor_value_advance(&ts);
+            CBOR_CHECK(ret, "parse series timestamp failed", err, ret);
+            ret = cbor_value_advance(&val);
+            CBOR_CHECK(ret, "parse series value failed", err, ret);
+        }
+        ret = cbor_value_advance(&list);
+        CBOR_CHECK(ret, "parse series failed", err, ret);
+    }
+    printf("\n");
+    indent(nestingLevel);
+    printf("]");
+    ret = cbor_value_advance(it);
+err:
+    return ret;
+}
+
 /**
  * Decode CBOR data manually
  */
@@ -86,6 +224,7 @@ static CborError insights_dump_cbor_buffer(cbor_dump_value_t *value)
         CborValue *it = value->it;
         int nestingLevel = value->nesting_level;
         CborType parent_type = value->parent_type;
+        bool is_series = false; // value of the "series" key
 
         while (!cbor_value_at_end(it)) {
             CborType type = cbor_value_get_type(it);
@@ -102,6 +241,12 @@ static CborError insights_dump_cbor_buffer(cbor_dump_value_t *value)
                 printf(" : ");
             }
 
+            if (type == CborArrayType && is_series) {
+                is_series = false;
+                ret = dump_metrics_series(it, nestingLevel);
+                CBOR_CHECK(ret, "parse series failed", err, ret);
+                continue;
+            }
             if (type == CborArrayType || type == CborMapType) {
                 // push current node
                 cbor_dump_value_t *value = MEM_ALLOC_EXTRAM(sizeof(cbor_dump_value_t));
@@ -156,6 +301,7 @@ static CborError insights_dump_cbor_buffer(cbor_dump_value_t *value)
                 ret = cbor_value_dup_text_string(it, &buf, &n, it);
                 CBOR_CHECK(ret, "parse text string failed", err, ret);
                 printf("\"%s\"", buf);
+                is_series = (parent_type == CborMapType) && (cnt % 2 == 0) && (strcmp(buf, "series") == 0);
                 free(buf);
                 continue;
             }
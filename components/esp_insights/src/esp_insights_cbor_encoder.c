@@ -5,6 +5,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -26,8 +27,10 @@
 #define METRICS_PATH_VALUE      "M"
 #define VARIABLES_PATH_VALUE    "P"
 
-static CborEncoder s_encoder, s_result_map, s_diag_map, s_diag_data_map, s_diag_conf_map;
-static CborEncoder s_meta_encoder, s_meta_result_map, s_diag_meta_map, s_diag_meta_data_map;
+/* Space kept free after the records for what follows them: the record lists themselves,
+ * meta headers, the sequence range and the ends of the open containers. Measured at about 100 bytes.
+ */
+#define DIAG_TAIL_RESERVE   256
 
 #define CBOR_ENC_MAX_CBS    10
 static struct cbor_encoder_data {
@@ -35,7 +38,7 @@ static struct cbor_encoder_data {
     int cb_cnt;
 } s_priv_data;
 
-static inline void _cbor_encode_meta_hdr(CborEncoder *hdr_map, const rtc_store_meta_header_t *hdr);
+static inline void _cbor_encode_meta_hdr(esp_insights_cbor_enc_t *enc, CborEncoder *hdr_map, const rtc_store_meta_header_t *hdr);
 
 esp_err_t esp_insights_cbor_encoder_register_meta_cb(insights_cbor_encoder_cb_t cb)
 {
@@ -47,64 +50,101 @@ esp_err_t esp_insights_cbor_encoder_register_meta_cb(insights_cbor_encoder_cb_t
     return ESP_OK;
 }
 
-void esp_insights_cbor_encode_diag_begin(void *data, size_t data_size, const char *version)
+static void encode_diag_begin(esp_insights_cbor_enc_t *enc, const char *version, uint64_t ts)
 {
-    cbor_encoder_init(&s_encoder, data, data_size, 0);
-    cbor_encoder_create_map(&s_encoder, &s_result_map, 1);
-    cbor_encode_text_stringz(&s_result_map, "diag");
-    cbor_encoder_create_map(&s_result_map, &s_diag_map, CborIndefiniteLength);
+    cbor_encoder_create_map(&enc->encoder, &enc->result_map, 1);
+    cbor_encode_text_stringz(&enc->result_map, "diag");
+    cbor_encoder_create_map(&enc->result_map, &enc->diag_map, CborIndefiniteLength);
 
-    cbor_encode_text_stringz(&s_diag_map, "ver");
-    cbor_encode_text_stringz(&s_diag_map, version);
+    cbor_encode_text_stringz(&enc->diag_map, "ver");
+    cbor_encode_text_stringz(&enc->diag_map, version);
 
-    cbor_encode_text_stringz(&s_diag_map, "ts");
-    cbor_encode_uint(&s_diag_map, esp_diag_timestamp_get());
+    cbor_encode_text_stringz(&enc->diag_map, "ts");
+    cbor_encode_uint(&enc->diag_map, ts);
 
-    // cbor_encode_text_stringz(&s_diag_map, "sha256");
-    // cbor_encode_text_stringz(&s_diag_map, sha256);
+    // cbor_encode_text_stringz(&enc->diag_map, "sha256");
+    // cbor_encode_text_stringz(&enc->diag_map, sha256);
 
     // encode meta_data
     const rtc_store_meta_header_t *hdr = rtc_store_get_meta_record_current();
-    _cbor_encode_meta_hdr(&s_diag_map, hdr);
+    _cbor_encode_meta_hdr(enc, &enc->diag_map, hdr);
+}
+
+void esp_insights_cbor_encode_diag_begin(esp_insights_cbor_enc_t *enc, void *data, size_t data_size, const char *version)
+{
+    enc->buf = data;
+    enc->buf_size = data_size;
+    cbor_encoder_init(&enc->encoder, data, data_size, 0);
+    encode_diag_begin(enc, version, esp_diag_timestamp_get());
+}
+
+void esp_insights_cbor_encode_diag_begin_writer(esp_insights_cbor_enc_t *enc,
+                                                CborEncoderWriteFunction writer, void *token,
+                                                const char *version, uint64_t ts)
+{
+    enc->buf = NULL;
+    enc->buf_size = 0;
+    cbor_encoder_init_writer(&enc->encoder, writer, token);
+    encode_diag_begin(enc, version, ts);
+}
+
+size_t esp_insights_cbor_encode_diag_end(esp_insights_cbor_enc_t *enc, void *data)
+{
+    cbor_encoder_close_container(&enc->result_map, &enc->diag_map);
+    cbor_encoder_close_container(&enc->encoder, &enc->result_map);
+    if (!data) {
+        return 0; // encoded using writer, length is tracked by the writer
+    }
+    if (cbor_encoder_get_extra_bytes_needed(&enc->encoder)) {
+        ESP_LOGE(TAG, "Message does not fit, %d more bytes needed", cbor_encoder_get_extra_bytes_needed(&enc->encoder));
+        return 0;
+    }
+    return cbor_encoder_get_buffer_size(&enc->encoder, data);
 }
 
-size_t esp_insights_cbor_encode_diag_end(void *data)
+/* Bytes which records may take in the message being encoded, SIZE_MAX if there is no limit */
+static size_t diag_records_budget(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encoder_close_container(&s_result_map, &s_diag_map);
-    cbor_encoder_close_container(&s_encoder, &s_result_map);
-    return cbor_encoder_get_buffer_size(&s_encoder, data);
+    if (!enc->buf) {
+        return SIZE_MAX;
+    }
+    if (cbor_encoder_get_extra_bytes_needed(&enc->data_map)) {
+        return 0;
+    }
+    size_t used = cbor_encoder_get_buffer_size(&enc->data_map, enc->buf) + DIAG_TAIL_RESERVE;
+    return (used < enc->buf_size) ? enc->buf_size - used : 0;
 }
 
-void esp_insights_cbor_encode_diag_data_begin(void)
+void esp_insights_cbor_encode_diag_data_begin(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encode_text_stringz(&s_diag_map, "data");
-    cbor_encoder_create_map(&s_diag_map, &s_diag_data_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->diag_map, "data");
+    cbor_encoder_create_map(&enc->diag_map, &enc->data_map, CborIndefiniteLength);
 }
 
-void esp_insights_cbor_encode_diag_conf_data_begin(void)
+void esp_insights_cbor_encode_diag_conf_data_begin(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encode_text_stringz(&s_diag_data_map, "configs");
-    cbor_encoder_create_array(&s_diag_data_map, &s_diag_conf_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "configs");
+    cbor_encoder_create_array(&enc->data_map, &enc->conf_map, CborIndefiniteLength);
 }
 
-void esp_insights_cbor_encode_diag_data_end(void)
+void esp_insights_cbor_encode_diag_data_end(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encoder_close_container(&s_diag_map, &s_diag_data_map);
+    cbor_encoder_close_container(&enc->diag_map, &enc->data_map);
 }
 
-void esp_insights_cbor_encode_diag_conf_data_end(void)
+void esp_insights_cbor_encode_diag_conf_data_end(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encoder_close_container(&s_diag_data_map, &s_diag_conf_map);
+    cbor_encoder_close_container(&enc->data_map, &enc->conf_map);
 }
 
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
-void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
+void esp_insights_cbor_encode_diag_crash(esp_insights_cbor_enc_t *enc, esp_core_dump_summary_t *summary)
 {
     uint32_t i = 0;
     CborEncoder crash_map, val_list, bt_list;
 
-    cbor_encode_text_stringz(&s_diag_data_map, "crash");
-    cbor_encoder_create_map(&s_diag_data_map, &crash_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "crash");
+    cbor_encoder_create_map(&enc->data_map, &crash_map, CborIndefiniteLength);
     cbor_encode_text_stringz(&crash_map, "ver");
     cbor_encode_uint(&crash_map, summary->core_dump_version);
     cbor_encode_text_stringz(&crash_map, "sha256");
@@ -183,22 +223,10 @@ void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
     }
     cbor_encoder_close_container(&crash_map, &epcx_list);
 #endif /* CONFIG_IDF_TARGET_ARCH_RISCV */
-    cbor_encoder_close_container(&s_diag_data_map, &crash_map);
+    cbor_encoder_close_container(&enc->data_map, &crash_map);
 }
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
 
-// use a scratch_pad to memcpy data before access
-// this avoids `potential` unaligned memory accesses as
-// data pointer we receive is not guaranteed to be word aligned
-static union encode_scratch_buf {
-#if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
-    esp_diag_str_data_pt_t str_data_pt;
-    esp_diag_data_pt_t data_pt;
-#endif
-    esp_diag_log_data_t log_data_pt;
-    char sha_sum[DIAG_HEX_SHA_SIZE + 1];
-} enc_scratch_buf;
-
 static inline uint8_t to_hex_digit(unsigned val)
 {
     return (val < 10) ? ('0' + val) : ('a' + val - 10);
@@ -213,22 +241,22 @@ void bytes_to_hex(uint8_t *src, uint8_t *dst, int in_len)
     dst[2 * in_len] = 0;
 }
 
-static inline void _cbor_encode_meta_hdr(CborEncoder *hdr_map, const rtc_store_meta_header_t *hdr)
+static inline void _cbor_encode_meta_hdr(esp_insights_cbor_enc_t *enc, CborEncoder *hdr_map, const rtc_store_meta_header_t *hdr)
 {
     cbor_encode_text_stringz(hdr_map, "sha256");
-    bytes_to_hex((uint8_t *) hdr->sha_sum, (uint8_t *) enc_scratch_buf.sha_sum, DIAG_SHA_SIZE); // expand uint8 packed data to hex
-    cbor_encode_text_stringz(hdr_map, enc_scratch_buf.sha_sum);
+    bytes_to_hex((uint8_t *) hdr->sha_sum, (uint8_t *) enc->scratch.sha_sum, DIAG_SHA_SIZE); // expand uint8 packed data to hex
+    cbor_encode_text_stringz(hdr_map, enc->scratch.sha_sum);
     cbor_encode_text_stringz(hdr_map, "gen_id");
     cbor_encode_uint(hdr_map, hdr->gen_id);
     cbor_encode_text_stringz(hdr_map, "boot_cnt");
     cbor_encode_uint(hdr_map, hdr->boot_cnt);
 }
 
-void esp_insights_cbor_encode_diag_boot_info(esp_diag_device_info_t *device_info)
+void esp_insights_cbor_encode_diag_boot_info(esp_insights_cbor_enc_t *enc, esp_diag_device_info_t *device_info)
 {
     CborEncoder boot_map;
-    cbor_encode_text_stringz(&s_diag_data_map, "boot");
-    cbor_encoder_create_map(&s_diag_data_map, &boot_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "boot");
+    cbor_encoder_create_map(&enc->data_map, &boot_map, CborIndefiniteLength);
 
     /* xTaskGetTickCount() API returns count of ticks since start of scheduler
      * For boot timestamp, we subtract the ticks since boot to get closest timestamp to bootup
@@ -247,14 +275,14 @@ void esp_insights_cbor_encode_diag_boot_info(esp_diag_device_info_t *device_info
     cbor_encode_text_stringz(&boot_map, "app_ver");
     cbor_encode_text_stringz(&boot_map, device_info->app_version);
 
-    cbor_encoder_close_container(&s_diag_data_map, &boot_map);
+    cbor_encoder_close_container(&enc->data_map, &boot_map);
 }
 
-void esp_insights_cbor_encode_meta_c_hdr(const rtc_store_meta_header_t *hdr)
+void esp_insights_cbor_encode_meta_c_hdr(esp_insights_cbor_enc_t *enc, const rtc_store_meta_header_t *hdr)
 {
     CborEncoder hdr_map;
-    cbor_encode_text_stringz(&s_diag_data_map, "meta_c");
-    cbor_encoder_create_map(&s_diag_data_map, &hdr_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "meta_c");
+    cbor_encoder_create_map(&enc->data_map, &hdr_map, CborIndefiniteLength);
 
     CborEncoder map_list;
     cbor_encode_text_stringz(&hdr_map, "maps_to");
@@ -262,15 +290,15 @@ void esp_insights_cbor_encode_meta_c_hdr(const rtc_store_meta_header_t *hdr)
     cbor_encode_text_stringz(&map_list, "traces");
     cbor_encoder_close_container(&hdr_map, &map_list);
 
-    _cbor_encode_meta_hdr(&hdr_map, hdr);
-    cbor_encoder_close_container(&s_diag_data_map, &hdr_map);
+    _cbor_encode_meta_hdr(enc, &hdr_map, hdr);
+    cbor_encoder_close_container(&enc->data_map, &hdr_map);
 }
 
-void esp_insights_cbor_encode_meta_nc_hdr(const rtc_store_meta_header_t *hdr)
+void esp_insights_cbor_encode_meta_nc_hdr(esp_insights_cbor_enc_t *enc, const rtc_store_meta_header_t *hdr)
 {
     CborEncoder hdr_map;
-    cbor_encode_text_stringz(&s_diag_data_map, "meta_nc");
-    cbor_encoder_create_map(&s_diag_data_map, &hdr_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "meta_nc");
+    cbor_encoder_create_map(&enc->data_map, &hdr_map, CborIndefiniteLength);
 
     CborEncoder map_list;
     cbor_encode_text_stringz(&hdr_map, "maps_to");
@@ -279,9 +307,22 @@ void esp_insights_cbor_encode_meta_nc_hdr(const rtc_store_meta_header_t *hdr)
     cbor_encode_text_stringz(&map_list, "params");
     cbor_encoder_close_container(&hdr_map, &map_list);
 
-    _cbor_encode_meta_hdr(&hdr_map, hdr);
-    cbor_encoder_close_container(&s_diag_data_map, &hdr_map);
+    _cbor_encode_meta_hdr(enc, &hdr_map, hdr);
+    cbor_encoder_close_container(&enc->data_map, &hdr_map);
+}
+
+#if CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED
+void esp_insights_cbor_encode_diag_seq(esp_insights_cbor_enc_t *enc, uint32_t seq_id, uint32_t first, uint32_t last)
+{
+    CborEncoder arr;
+    cbor_encode_text_stringz(&enc->data_map, "seq");
+    cbor_encoder_create_array(&enc->data_map, &arr, 3);
+    cbor_encode_uint(&arr, seq_id);
+    cbor_encode_uint(&arr, first);
+    cbor_encode_uint(&arr, last);
+    cbor_encoder_close_container(&enc->data_map, &arr);
 }
+#endif /* CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED */
 
 static void encode_msg_args(CborEncoder *element, uint8_t *args, uint8_t args_len)
 {
@@ -426,13 +467,26 @@ static void encode_msg_args(CborEncoder *element, uint8_t *args, uint8_t args_le
 #endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV */
 }
 
-static void encode_log_element(CborEncoder *list, esp_diag_log_data_t *data)
+static void encode_log_element(esp_insights_cbor_enc_t *enc, CborEncoder *list, esp_diag_log_data_t *data)
 {
     CborEncoder element;
-    esp_diag_log_data_t *log = &enc_scratch_buf.log_data_pt;
+    esp_diag_log_data_t *log = &enc->scratch.log_data_pt;
     // copy at aligned address to avoid potential alignment issue
     memcpy(log, data, sizeof(esp_diag_log_data_t));
 
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+    // [<ts>, <tag>, <pc>, <ro>, <av>, <task>], task is left out if not set
+    bool has_task = log->task_name[0] != '\0';
+    cbor_encoder_create_array(list, &element, has_task ? 6 : 5);
+    cbor_encode_uint(&element, log->timestamp);
+    cbor_encode_text_stringz(&element, log->tag);
+    cbor_encode_uint(&element, log->pc);
+    cbor_encode_uint(&element, (uint32_t)log->msg_ptr);
+    encode_msg_args(&element, log->msg_args, log->msg_args_len);
+    if (has_task) {
+        cbor_encode_text_stringz(&element, log->task_name);
+    }
+#else
     cbor_encoder_create_map(list, &element, CborIndefiniteLength);
     cbor_encode_text_stringz(&element, "ts");
     cbor_encode_uint(&element, log->timestamp);
@@ -448,19 +502,47 @@ static void encode_log_element(CborEncoder *list, esp_diag_log_data_t *data)
         cbor_encode_text_stringz(&element, "task");
         cbor_encode_text_stringz(&element, log->task_name);
     }
+#endif /* CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD */
     cbor_encoder_close_container(list, &element);
 }
 
-static size_t encode_log_list(CborEncoder *map, esp_diag_log_type_t type,
-                              const char *key, const uint8_t *data, size_t size)
+/* Log lists in the order they are encoded */
+static const struct {
+    esp_diag_log_type_t type;
+    const char *key;
+} s_log_lists[] = {
+    { ESP_DIAG_LOG_TYPE_ERROR, "errors" },
+    { ESP_DIAG_LOG_TYPE_WARNING, "warnings" },
+    { ESP_DIAG_LOG_TYPE_EVENT, "events" },
+};
+
+#define LOG_LISTS_CNT       (sizeof(s_log_lists) / sizeof(s_log_lists[0]))
+
+static size_t log_element_size(esp_insights_cbor_enc_t *enc, const uint8_t *data)
 {
-    int i = 0, len = 0;
-    CborEncoder list;
-    esp_diag_log_data_t *log = NULL;
-    cbor_encode_text_stringz(map, key);
-    cbor_encoder_create_array(map, &list, CborIndefiniteLength);
+    CborEncoder sizer;
+    cbor_encoder_init(&sizer, NULL, 0, 0); // only counts the bytes needed
+    encode_log_element(enc, &sizer, (esp_diag_log_data_t *) data);
+    return cbor_encoder_get_extra_bytes_needed(&sizer);
+}
+/* Max log records encoded in one go, remaining records are left for the next call */
+#define LOG_RECORDS_MAX     32
+
+/* The TinyCBOR library does not support DOM (Document Object Model)-like API, so every log list
+ * has to be encoded completely before the next one. Records are classified by type in a single
+ * pass and then every list is encoded from the collected record indices.
+ * Records are consumed in order, so the pass stops at the first record which does not fit.
+ */
+size_t esp_insights_cbor_encode_diag_logs(esp_insights_cbor_enc_t *enc, const uint8_t *data, size_t size)
+{
+    const size_t record_sz = 1 + sizeof(esp_diag_log_data_t); // meta byte followed by log data
+    uint8_t records[LOG_LISTS_CNT][LOG_RECORDS_MAX];
+    uint8_t records_cnt[LOG_LISTS_CNT] = { 0 };
     uint8_t meta_idx = data[0];
-    while (size > sizeof (esp_diag_log_data_t)) {
+    size_t i = 0, n = 0;
+    size_t budget = diag_records_budget(enc);
+
+    while ((size - i) >= record_sz && n < LOG_RECORDS_MAX) {
         if (data[i] != meta_idx) {
 #if INSIGHTS_DEBUG_ENABLED
             printf("%s: skip data for next iteration meta: %d, data[i]: %d, itr: %d\n",
@@ -468,144 +550,341 @@ static size_t encode_log_list(CborEncoder *map, esp_diag_log_type_t type,
 #endif
             break; // do not encode for next meta info
         }
-        i += 1; // skip meta byte
-        size -= 1;
-        if (data[i] == type) {
-            log = (esp_diag_log_data_t *)&data[i];
-            encode_log_element(&list, log);
+        if (budget != SIZE_MAX) {
+            size_t element_size = log_element_size(enc, &data[i + 1]);
+            if (element_size > budget) {
+#if INSIGHTS_DEBUG_ENABLED
+                printf("%s: message full, %d log records left for the next message\n",
+                        "insights_cbor_enocoder", (size - i) / record_sz);
+#endif
+                break;
+            }
+            budget -= element_size;
+        }
+        for (int t = 0; t < LOG_LISTS_CNT; t++) {
+            if (data[i + 1] == s_log_lists[t].type) {
+                records[t][records_cnt[t]++] = n;
+                break;
+            }
         }
-        len = sizeof(esp_diag_log_data_t);
-        i += len;
-        size -= len ;
+        i += record_sz;
+        n++;
     }
-    cbor_encoder_close_container(map, &list);
-    return i;
-}
 
-/* The TinyCBOR library does not support DOM (Document Object Model)-like API.
- * So, we need to traverse through the entire data to encode every type of log.
- */
-size_t esp_insights_cbor_encode_diag_logs(const uint8_t *data, size_t size)
-{
     CborEncoder log_map;
-    cbor_encode_text_stringz(&s_diag_data_map, "traces");
-    cbor_encoder_create_map(&s_diag_data_map, &log_map, CborIndefiniteLength);
-    size_t consumed = 0, consumed_max = 0;
-    consumed_max = encode_log_list(&log_map, ESP_DIAG_LOG_TYPE_ERROR, "errors", data, size);
-    consumed = encode_log_list(&log_map, ESP_DIAG_LOG_TYPE_WARNING, "warnings", data, size);
-    if (consumed > consumed_max) {
-        consumed_max = consumed;
-    }
-    consumed = encode_log_list(&log_map, ESP_DIAG_LOG_TYPE_EVENT, "events", data, size);
-    if (consumed > consumed_max) {
-        consumed_max = consumed;
+    cbor_encode_text_stringz(&enc->data_map, "traces");
+    cbor_encoder_create_map(&enc->data_map, &log_map, CborIndefiniteLength);
+    for (int t = 0; t < LOG_LISTS_CNT; t++) {
+        CborEncoder list;
+        cbor_encode_text_stringz(&log_map, s_log_lists[t].key);
+        cbor_encoder_create_array(&log_map, &list, CborIndefiniteLength);
+        for (int r = 0; r < records_cnt[t]; r++) {
+            encode_log_element(enc, &list, (esp_diag_log_data_t *)&data[(records[t][r] * record_sz) + 1]);
+        }
+        cbor_encoder_close_container(&log_map, &list);
     }
-    cbor_encoder_close_container(&s_diag_data_map, &log_map);
-    return consumed_max;
+    cbor_encoder_close_container(&enc->data_map, &log_map);
+    return i;
 }
 
 #if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
-// {"n":<key>, "v": <value>, "t": <ts> }
-static void encode_str_data_pt(CborEncoder *array, const uint8_t *data)
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+// <key> or [<tag>, <key>]
+static void encode_data_pt_name(CborEncoder *enc, const char *tag, const char *key)
 {
-    CborEncoder map;
-    cbor_encoder_create_map(array, &map, CborIndefiniteLength);
-    esp_diag_str_data_pt_t *m_data = &enc_scratch_buf.str_data_pt;
-    // copy at aligned address to avoid potential alignment issue
-    memcpy(m_data, data, sizeof(esp_diag_str_data_pt_t));
-    cbor_encode_text_stringz(&map, "n");
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    char temp_path_key[10] = {0};
-    snprintf(temp_path_key, sizeof(temp_path_key), "%s", ((m_data->type & 0xffff)==ESP_DIAG_DATA_PT_METRICS)?METRICS_PATH_VALUE:VARIABLES_PATH_VALUE);
     CborEncoder key_arr;
-    cbor_encoder_create_array(&map, &key_arr, CborIndefiniteLength);
-    cbor_encode_text_stringz(&key_arr, temp_path_key);
-    cbor_encode_text_stringz(&key_arr, m_data->tag);
-    cbor_encode_text_stringz(&key_arr, m_data->key);
-    cbor_encoder_close_container(&map, &key_arr);
+    cbor_encoder_create_array(enc, &key_arr, 2);
+    cbor_encode_text_stringz(&key_arr, tag);
+    cbor_encode_text_stringz(&key_arr, key);
+    cbor_encoder_close_container(enc, &key_arr);
 #else
-    cbor_encode_text_stringz(&map, m_data->key);
+    cbor_encode_text_stringz(enc, key);
 #endif
-    cbor_encode_text_stringz(&map, "v");
-    cbor_encode_text_stringz(&map, m_data->value.str);
-    cbor_encode_text_stringz(&map, "t");
-    cbor_encode_uint(&map, m_data->ts);
-
-    cbor_encoder_close_container(array, &map);
 }
+#endif /* CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD */
 
-static void encode_data_pt(CborEncoder *array, const uint8_t *data)
+/* Opens the data point and encodes its name, caller encodes the value
+ * and then closes the data point using encode_data_pt_end()
+ */
+static void encode_data_pt_begin(CborEncoder *array, CborEncoder *map, uint16_t type, const char *tag, const char *key)
 {
-    CborEncoder map;
-    cbor_encoder_create_map(array, &map, CborIndefiniteLength);
-    esp_diag_data_pt_t *m_data = &enc_scratch_buf.data_pt;
-    // copy at aligned address to avoid potential alignment issue
-    memcpy(m_data, data, sizeof(esp_diag_data_pt_t));
-    cbor_encode_text_stringz(&map, "n");
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+    // [<n>, <v>, <t>], list the data point is in tells if it is a metrics or a param
+    cbor_encoder_create_array(array, map, 3);
+    encode_data_pt_name(map, tag, key);
+#else
+    // {"n":<key>, "v": <value>, "t": <ts> }
+    cbor_encoder_create_map(array, map, CborIndefiniteLength);
+    cbor_encode_text_stringz(map, "n");
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    char temp_path_key[10] = {0};
-    snprintf(temp_path_key, sizeof(temp_path_key), "%s", ((m_data->type & 0xffff)==ESP_DIAG_DATA_PT_METRICS)?METRICS_PATH_VALUE:VARIABLES_PATH_VALUE);
     CborEncoder key_arr;
-    cbor_encoder_create_array(&map, &key_arr, CborIndefiniteLength);
-    cbor_encode_text_stringz(&key_arr, temp_path_key);
-    cbor_encode_text_stringz(&key_arr, m_data->tag);
-    cbor_encode_text_stringz(&key_arr, m_data->key);
-    cbor_encoder_close_container(&map, &key_arr);
+    cbor_encoder_create_array(map, &key_arr, CborIndefiniteLength);
+    cbor_encode_text_stringz(&key_arr, (type == ESP_DIAG_DATA_PT_METRICS) ? METRICS_PATH_VALUE : VARIABLES_PATH_VALUE);
+    cbor_encode_text_stringz(&key_arr, tag);
+    cbor_encode_text_stringz(&key_arr, key);
+    cbor_encoder_close_container(map, &key_arr);
 #else
-    cbor_encode_text_stringz(&map, m_data->key);
+    cbor_encode_text_stringz(map, key);
+#endif
+    cbor_encode_text_stringz(map, "v");
+#endif /* CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD */
+}
+
+static void encode_data_pt_end(CborEncoder *array, CborEncoder *map, uint64_t ts)
+{
+#if !CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+    cbor_encode_text_stringz(map, "t");
 #endif
-    cbor_encode_text_stringz(&map, "v");
+    cbor_encode_uint(map, ts);
+    cbor_encoder_close_container(array, map);
+}
+
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+#define DATA_PT_TAG(pt)     ((pt)->tag)
+#else
+#define DATA_PT_TAG(pt)     NULL
+#endif
+
+static void encode_str_data_pt(esp_insights_cbor_enc_t *enc, CborEncoder *array, const uint8_t *data)
+{
+    CborEncoder map;
+    esp_diag_str_data_pt_t *m_data = &enc->scratch.str_data_pt;
+    // copy at aligned address to avoid potential alignment issue
+    memcpy(m_data, data, sizeof(esp_diag_str_data_pt_t));
+    encode_data_pt_begin(array, &map, m_data->type, DATA_PT_TAG(m_data), m_data->key);
+    cbor_encode_text_stringz(&map, m_data->value.str);
+    encode_data_pt_end(array, &map, m_data->ts);
+}
+
+static void encode_data_pt_value(CborEncoder *enc, const esp_diag_data_pt_t *m_data)
+{
     switch (m_data->data_type) {
         case ESP_DIAG_DATA_TYPE_BOOL:
-            cbor_encode_boolean(&map, m_data->value.b);
+            cbor_encode_boolean(enc, m_data->value.b);
             break;
         case ESP_DIAG_DATA_TYPE_INT:
             if (m_data->value.i < 0) {
-                cbor_encode_negative_int(&map, -(m_data->value.i));
+                cbor_encode_negative_int(enc, -(m_data->value.i));
             } else {
-                cbor_encode_int(&map, m_data->value.i);
+                cbor_encode_int(enc, m_data->value.i);
             }
             break;
         case ESP_DIAG_DATA_TYPE_UINT:
-            cbor_encode_uint(&map, m_data->value.u);
+            cbor_encode_uint(enc, m_data->value.u);
             break;
         case ESP_DIAG_DATA_TYPE_FLOAT:
-            cbor_encode_float(&map, m_data->value.f);
+            cbor_encode_float(enc, m_data->value.f);
             break;
         case ESP_DIAG_DATA_TYPE_IPv4:
-            cbor_encode_byte_string(&map, (uint8_t *)&m_data->value.ipv4, sizeof(m_data->value.ipv4));
+            cbor_encode_byte_string(enc, (uint8_t *)&m_data->value.ipv4, sizeof(m_data->value.ipv4));
             break;
         case ESP_DIAG_DATA_TYPE_MAC:
-            cbor_encode_byte_string(&map, &m_data->value.mac[0], sizeof(m_data->value.mac));
+            cbor_encode_byte_string(enc, &m_data->value.mac[0], sizeof(m_data->value.mac));
             break;
         default:
             break;
     }
-    cbor_encode_text_stringz(&map, "t");
-    cbor_encode_uint(&map, m_data->ts);
+}
 
-    cbor_encoder_close_container(array, &map);
+static void encode_data_pt(esp_insights_cbor_enc_t *enc, CborEncoder *array, const uint8_t *data)
+{
+    CborEncoder map;
+    esp_diag_data_pt_t *m_data = &enc->scratch.data_pt;
+    // copy at aligned address to avoid potential alignment issue
+    memcpy(m_data, data, sizeof(esp_diag_data_pt_t));
+    encode_data_pt_begin(array, &map, m_data->type, DATA_PT_TAG(m_data), m_data->key);
+    encode_data_pt_value(&map, m_data);
+    encode_data_pt_end(array, &map, m_data->ts);
 }
 
-static size_t encode_data_points(const uint8_t *data, size_t size, const char *key, uint16_t type)
+/* Max data points encoded in one go, remaining records are left for the next call */
+#define DATA_PT_RECORDS_MAX     32
+
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+/* A point in a series takes at most this much more than on its own, for the series header or deltas */
+#define DATA_PT_SERIES_SLACK    8
+#else
+#define DATA_PT_SERIES_SLACK    0
+#endif
+
+/* record is the header followed by the data point */
+static size_t data_pt_size(esp_insights_cbor_enc_t *enc, const uint8_t *record)
+{
+    CborEncoder sizer;
+    rtc_store_non_critical_data_hdr_t header;
+    memcpy(&header, record, sizeof(header));
+    cbor_encoder_init(&sizer, NULL, 0, 0); // only counts the bytes needed
+    if (header.len == sizeof(esp_diag_str_data_pt_t)) {
+        encode_str_data_pt(enc, &sizer, record + sizeof(header));
+    } else if (header.len == sizeof(esp_diag_data_pt_t)) {
+        encode_data_pt(enc, &sizer, record + sizeof(header));
+    }
+    return cbor_encoder_get_extra_bytes_needed(&sizer) + DATA_PT_SERIES_SLACK;
+}
+
+static void encode_data_pt_list(esp_insights_cbor_enc_t *enc, const uint8_t *data, const char *key,
+                                const uint16_t *records, size_t records_cnt)
+{
+    CborEncoder array;
+    rtc_store_non_critical_data_hdr_t header;
+    cbor_encode_text_stringz(&enc->data_map, key);
+    cbor_encoder_create_array(&enc->data_map, &array, CborIndefiniteLength);
+    for (int r = 0; r < records_cnt; r++) {
+        const uint8_t *record = data + records[r];
+        uint32_t type_int;
+        memcpy(&header, record, sizeof(header));
+        memcpy(&type_int, record + sizeof(header), 4); // copy, (b'cos alignment!)
+        esp_diag_data_type_t data_type = (type_int >> 16) & 0xffff;
+        if (data_type == ESP_DIAG_DATA_TYPE_STR && header.len == sizeof(esp_diag_str_data_pt_t)) {
+            encode_str_data_pt(enc, &array, record + sizeof(header));
+        } else if (header.len == sizeof(esp_diag_data_pt_t)) {
+            encode_data_pt(enc, &array, record + sizeof(header));
+        }
+    }
+    cbor_encoder_close_container(&enc->data_map, &array);
+}
+
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD && CONFIG_DIAG_ENABLE_METRICS
+#define DATA_PT_FIELD_SIZE(field)   sizeof(((esp_diag_data_pt_t *) 0)->field)
+
+/* Records of same metrics and data type belong to the same series.
+ * Data point and string data point share the layout up to the value.
+ */
+static bool is_same_series(const uint8_t *a, const uint8_t *b)
+{
+    rtc_store_non_critical_data_hdr_t hdr_a, hdr_b;
+    memcpy(&hdr_a, a, sizeof(hdr_a));
+    memcpy(&hdr_b, b, sizeof(hdr_b));
+    if (hdr_a.len != hdr_b.len) {
+        return false;
+    }
+    a += sizeof(hdr_a);
+    b += sizeof(hdr_b);
+    // type and data_type
+    if (memcmp(a, b, offsetof(esp_diag_data_pt_t, data_type) + sizeof(uint16_t)) != 0) {
+        return false;
+    }
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    if (strncmp((const char *)a + offsetof(esp_diag_data_pt_t, tag), (const char *)b + offsetof(esp_diag_data_pt_t, tag),
+                DATA_PT_FIELD_SIZE(tag)) != 0) {
+        return false;
+    }
+#endif
+    return strncmp((const char *)a + offsetof(esp_diag_data_pt_t, key), (const char *)b + offsetof(esp_diag_data_pt_t, key),
+                   DATA_PT_FIELD_SIZE(key)) == 0;
+}
+
+/* Encodes the points of a series as columns, integer timestamps and values are
+ * encoded as the difference from the previous point which mostly fits in a byte or two
+ */
+static void encode_series(esp_insights_cbor_enc_t *enc, CborEncoder *array, const uint8_t *data,
+                          const uint16_t *records, const uint8_t *pts, size_t pts_cnt)
+{
+    CborEncoder series, column;
+    rtc_store_non_critical_data_hdr_t header;
+    esp_diag_data_pt_t *m_data = &enc->scratch.data_pt;
+    const uint8_t *first = data + records[pts[0]] + sizeof(header);
+    memcpy(&header, data + records[pts[0]], sizeof(header));
+    bool is_str = (header.len == sizeof(esp_diag_str_data_pt_t));
+
+    // copy just the common part, enough for name and data type
+    memcpy(m_data, first, offsetof(esp_diag_data_pt_t, ts));
+    cbor_encoder_create_array(array, &series, 4);
+    encode_data_pt_name(&series, DATA_PT_TAG(m_data), m_data->key);
+    uint16_t data_type = m_data->data_type;
+    cbor_encode_uint(&series, data_type);
+
+    uint64_t ts, prev_ts = 0;
+    cbor_encoder_create_array(&series, &column, pts_cnt);
+    for (int p = 0; p < pts_cnt; p++) {
+        memcpy(&ts, data + records[pts[p]] + sizeof(header) + offsetof(esp_diag_data_pt_t, ts), sizeof(ts));
+        if (p == 0) {
+            cbor_encode_uint(&column, ts);
+        } else {
+            cbor_encode_int(&column, (int64_t)(ts - prev_ts));
+        }
+        prev_ts = ts;
+    }
+    cbor_encoder_close_container(&series, &column);
+
+    int64_t val, prev_val = 0;
+    cbor_encoder_create_array(&series, &column, pts_cnt);
+    for (int p = 0; p < pts_cnt; p++) {
+        const uint8_t *record = data + records[pts[p]] + sizeof(header);
+        if (is_str) {
+            memcpy(&enc->scratch.str_data_pt, record, sizeof(esp_diag_str_data_pt_t));
+            cbor_encode_text_stringz(&column, enc->scratch.str_data_pt.value.str);
+            continue;
+        }
+        memcpy(m_data, record, sizeof(esp_diag_data_pt_t));
+        if (data_type == ESP_DIAG_DATA_TYPE_INT || data_type == ESP_DIAG_DATA_TYPE_UINT) {
+            // no ternary here, it would promote int32_t to uint32_t
+            if (data_type == ESP_DIAG_DATA_TYPE_INT) {
+                val = m_data->value.i;
+            } else {
+                val = m_data->value.u;
+            }
+            cbor_encode_int(&column, (p == 0) ? val : val - prev_val);
+            prev_val = val;
+        } else {
+            encode_data_pt_value(&column, m_data);
+        }
+    }
+    cbor_encoder_close_container(&series, &column);
+    cbor_encoder_close_container(array, &series);
+}
+
+// "series": [[<n>, <data_type>, [<t0>, <t1 - t0>, ...], [<v0>, <v1 - v0>, ...]], ...]
+static void encode_metrics_series(esp_insights_cbor_enc_t *enc, const uint8_t *data,
+                                  const uint16_t *records, size_t records_cnt)
 {
-    assert(key);
-    size_t i = 0;
     CborEncoder array;
-    /* FIXME */
+    bool done[DATA_PT_RECORDS_MAX] = {0};
+    uint8_t pts[DATA_PT_RECORDS_MAX];
+    cbor_encode_text_stringz(&enc->data_map, "series");
+    cbor_encoder_create_array(&enc->data_map, &array, CborIndefiniteLength);
+    for (int r = 0; r < records_cnt; r++) {
+        if (done[r]) {
+            continue;
+        }
+        size_t pts_cnt = 0;
+        for (int s = r; s < records_cnt; s++) {
+            if (!done[s] && is_same_series(data + records[r], data + records[s])) {
+                done[s] = true;
+                pts[pts_cnt++] = s;
+            }
+        }
+        encode_series(enc, &array, data, records, pts, pts_cnt);
+    }
+    cbor_encoder_close_container(&enc->data_map, &array);
+}
+#endif /* CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD && CONFIG_DIAG_ENABLE_METRICS */
+
+size_t esp_insights_cbor_encode_diag_data_points(esp_insights_cbor_enc_t *enc, const uint8_t *data, size_t size)
+{
+    size_t i = 0;
     rtc_store_non_critical_data_hdr_t header;
-    esp_diag_data_type_t data_type;
+    /* Offsets of the data point headers for every type, collected in a single pass */
+#if CONFIG_DIAG_ENABLE_METRICS
+    uint16_t metrics[DATA_PT_RECORDS_MAX];
+    size_t metrics_cnt = 0;
+#endif
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    uint16_t params[DATA_PT_RECORDS_MAX];
+    size_t params_cnt = 0;
+#endif
+    size_t records_cnt = 0;
+    size_t budget = diag_records_budget(enc);
 
     if (!data || (size <= sizeof(header))) {
         printf("%s: Invalid arg! data %p, size %d. line %d\n",
                 "insights_cbor_enocoder", data, size, __LINE__);
         return 0;
     }
-    cbor_encode_text_stringz(&s_diag_data_map, key);
-    cbor_encoder_create_array(&s_diag_data_map, &array, CborIndefiniteLength);
 
     uint8_t meta_idx = data[0];
-    while (size > sizeof(header)) { // if remaining
+    while (size > sizeof(header) && records_cnt < DATA_PT_RECORDS_MAX) { // if remaining
         if (data[i] != meta_idx) {
 #if INSIGHTS_DEBUG_ENABLED
             printf("%s: skip data for next iteration meta: %d, data[i]: %d, itr: %d\n",
@@ -613,18 +892,13 @@ static size_t encode_data_points(const uint8_t *data, size_t size, const char *k
 #endif
             break; // do not encode for next meta info
         }
-        i += 1; // skip meta_idx byte
-        size -= 1;
-
-        memcpy(&header, data + i, sizeof(header));
-        if (sizeof(header) + header.len > size) {
+        memcpy(&header, data + i + 1, sizeof(header)); // skip meta_idx byte
+        if (1 + sizeof(header) + header.len > size) {
 #if INSIGHTS_DEBUG_ENABLED
             // partial record
             printf("%s: partial record, needed %d, size %d\n",
-                    "insights_cbor_enocoder", sizeof(header) + header.len, size);
+                    "insights_cbor_enocoder", sizeof(header) + header.len, size - 1);
 #endif
-            i -= 1;
-            size += 1;
             break;
         }
 
@@ -635,100 +909,162 @@ static size_t encode_data_points(const uint8_t *data, size_t size, const char *k
 
             ESP_LOG_BUFFER_HEX_LEVEL("cbor_enc", data, size, ESP_LOG_INFO);
 #endif
-            i -= 1;
-            size += 1;
             break;
         }
-        uint32_t type_int;
-        memcpy(&type_int, &data[i + sizeof(header)], 4); // copy, (b'cos alignment!)
-        if ((type_int & 0xffff) == type) {
-            data_type = (type_int >> 16) & 0xffff;
-            if (data_type == ESP_DIAG_DATA_TYPE_STR && header.len == sizeof(esp_diag_str_data_pt_t)) {
-                encode_str_data_pt(&array, data + i + sizeof(header));
-            } else if (header.len == sizeof(esp_diag_data_pt_t)) {
-                encode_data_pt(&array, data + i + sizeof(header));
+        if (budget != SIZE_MAX) {
+            // records are consumed in order, so stop at the first one which does not fit
+            size_t pt_size = data_pt_size(enc, &data[i + 1]);
+            if (pt_size > budget) {
+#if INSIGHTS_DEBUG_ENABLED
+                printf("%s: message full, data points left for the next message\n", "insights_cbor_enocoder");
+#endif
+                break;
             }
+            budget -= pt_size;
+        }
+        uint32_t type_int;
+        memcpy(&type_int, &data[i + 1 + sizeof(header)], 4); // copy, (b'cos alignment!)
+        switch (type_int & 0xffff) {
+#if CONFIG_DIAG_ENABLE_METRICS
+            case ESP_DIAG_DATA_PT_METRICS:
+                metrics[metrics_cnt++] = i + 1;
+                break;
+#endif
+#if CONFIG_DIAG_ENABLE_VARIABLES
+            case ESP_DIAG_DATA_PT_VARIABLE:
+                params[params_cnt++] = i + 1;
+                break;
+#endif
+            default:
+                break;
         }
-        size -= (sizeof(header) + header.len);
-        i += (sizeof(header) + header.len);
+        records_cnt++;
+        size -= (1 + sizeof(header) + header.len);
+        i += (1 + sizeof(header) + header.len);
     }
-    cbor_encoder_close_container(&s_diag_data_map, &array);
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD && CONFIG_DIAG_ENABLE_METRICS
+    encode_metrics_series(enc, data, metrics, metrics_cnt);
+#elif CONFIG_DIAG_ENABLE_METRICS
+    encode_data_pt_list(enc, data, "metrics", metrics, metrics_cnt);
+#endif
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    encode_data_pt_list(enc, data, "params", params, params_cnt);
+#endif
     return i;
 }
 #endif /* (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES) */
 
-#if CONFIG_DIAG_ENABLE_METRICS
-size_t esp_insights_cbor_encode_diag_metrics(const uint8_t *data, size_t size)
+/* Below are the helpers to encode esp insights meta data */
+
+static void encode_meta_begin(esp_insights_cbor_enc_t *enc, const char *version, const char *sha256, uint64_t ts)
 {
-    return encode_data_points(data, size, "metrics", ESP_DIAG_DATA_PT_METRICS);
+    cbor_encoder_create_map(&enc->encoder, &enc->result_map, 1);
+    cbor_encode_text_stringz(&enc->result_map, "diagmeta");
+    cbor_encoder_create_map(&enc->result_map, &enc->diag_map, CborIndefiniteLength);
+
+    cbor_encode_text_stringz(&enc->diag_map, "ver");
+    cbor_encode_text_stringz(&enc->diag_map, version);
+
+    cbor_encode_text_stringz(&enc->diag_map, "ts");
+    cbor_encode_uint(&enc->diag_map, ts);
+    cbor_encode_text_stringz(&enc->diag_map, "sha256");
+    cbor_encode_text_stringz(&enc->diag_map, sha256);
 }
-#endif /* CONFIG_DIAG_ENABLE_METRICS */
 
-#if CONFIG_DIAG_ENABLE_VARIABLES
-size_t  esp_insights_cbor_encode_diag_variables(const uint8_t *data, size_t size)
+void esp_insights_cbor_encode_meta_begin(esp_insights_cbor_enc_t *enc, void *data, size_t data_size,
+                                         const char *version, const char *sha256)
 {
-    return encode_data_points(data, size, "params", ESP_DIAG_DATA_PT_VARIABLE);
+    cbor_encoder_init(&enc->encoder, data, data_size, 0);
+    encode_meta_begin(enc, version, sha256, esp_diag_timestamp_get());
 }
-#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
 
-/* Below are the helpers to encode esp insights meta data */
+void esp_insights_cbor_encode_meta_begin_writer(esp_insights_cbor_enc_t *enc,
+                                                CborEncoderWriteFunction writer, void *token,
+                                                const char *version, const char *sha256, uint64_t ts)
+{
+    cbor_encoder_init_writer(&enc->encoder, writer, token);
+    encode_meta_begin(enc, version, sha256, ts);
+}
 
-void esp_insights_cbor_encode_meta_begin(void *data, size_t data_size, const char *version, const char *sha256)
+size_t esp_insights_cbor_encode_meta_end(esp_insights_cbor_enc_t *enc, void *data)
 {
-    cbor_encoder_init(&s_meta_encoder, data, data_size, 0);
-    cbor_encoder_create_map(&s_meta_encoder, &s_meta_result_map, 1);
-    cbor_encode_text_stringz(&s_meta_result_map, "diagmeta");
-    cbor_encoder_create_map(&s_meta_result_map, &s_diag_meta_map, CborIndefiniteLength);
+    cbor_encoder_close_container(&enc->result_map, &enc->diag_map);
+    cbor_encoder_close_container(&enc->encoder, &enc->result_map);
+    if (!data) {
+        return 0; // encoded using writer, length is tracked by the writer
+    }
+    if (cbor_encoder_get_extra_bytes_needed(&enc->encoder)) {
+        ESP_LOGE(TAG, "Meta does not fit, %d more bytes needed", cbor_encoder_get_extra_bytes_needed(&enc->encoder));
+        return 0;
+    }
+    return cbor_encoder_get_buffer_size(&enc->encoder, data);
+}
 
-    cbor_encode_text_stringz(&s_diag_meta_map, "ver");
-    cbor_encode_text_stringz(&s_diag_meta_map, version);
+void esp_insights_cbor_encode_meta_data_begin(esp_insights_cbor_enc_t *enc)
+{
+    cbor_encode_text_stringz(&enc->diag_map, "data");
+    cbor_encoder_create_map(&enc->diag_map, &enc->data_map, CborIndefiniteLength);
+}
 
-    cbor_encode_text_stringz(&s_diag_meta_map, "ts");
-    cbor_encode_uint(&s_diag_meta_map, esp_diag_timestamp_get()); 
-    cbor_encode_text_stringz(&s_diag_meta_map, "sha256");
-    cbor_encode_text_stringz(&s_diag_meta_map, sha256);
+void esp_insights_cbor_encode_meta_data_end(esp_insights_cbor_enc_t *enc)
+{
+    cbor_encoder_close_container(&enc->diag_map, &enc->data_map);
 }
 
-size_t esp_insights_cbor_encode_meta_end(void *data)
+void esp_insights_cbor_encode_meta_hash(esp_insights_cbor_enc_t *enc, uint32_t hash)
 {
-    cbor_encoder_close_container(&s_meta_result_map, &s_diag_meta_map);
-    cbor_encoder_close_container(&s_meta_encoder, &s_meta_result_map);
-    return cbor_encoder_get_buffer_size(&s_meta_encoder, data);
+    cbor_encode_text_stringz(&enc->diag_map, "meta_hash");
+    cbor_encode_uint(&enc->diag_map, hash);
 }
 
-void esp_insights_cbor_encode_meta_data_begin(void)
+void esp_insights_cbor_encode_meta_base(esp_insights_cbor_enc_t *enc, uint32_t base_crc)
 {
-    cbor_encode_text_stringz(&s_diag_meta_map, "data");
-    cbor_encoder_create_map(&s_diag_meta_map, &s_diag_meta_data_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->diag_map, "base");
+    cbor_encode_uint(&enc->diag_map, base_crc);
 }
 
-void esp_insights_cbor_encode_meta_data_end(void)
+void esp_insights_cbor_encode_meta_removed(esp_insights_cbor_enc_t *enc, const uint32_t *ids, size_t cnt)
 {
-    cbor_encoder_close_container(&s_diag_meta_map, &s_diag_meta_data_map);
+    if (!cnt) {
+        return;
+    }
+    CborEncoder arr;
+    cbor_encode_text_stringz(&enc->data_map, "removed");
+    cbor_encoder_create_array(&enc->data_map, &arr, cnt);
+    for (size_t i = 0; i < cnt; i++) {
+        cbor_encode_uint(&arr, ids[i]);
+    }
+    cbor_encoder_close_container(&enc->data_map, &arr);
 }
 
-void esp_insights_cbor_encode_conf_meta_data_begin(void)
+void esp_insights_cbor_encode_conf_meta_data_begin(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encode_text_stringz(&s_diag_meta_map, "data");
-    cbor_encoder_create_map(&s_diag_meta_map, &s_diag_meta_data_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->diag_map, "data");
+    cbor_encoder_create_map(&enc->diag_map, &enc->data_map, CborIndefiniteLength);
 #ifdef NEW_META_STRUCT
     for (int i = 0; i < s_priv_data.cb_cnt; i++) {
         if (s_priv_data.cb[i]) {
-            s_priv_data.cb[i] (&s_diag_meta_data_map, INSIGHTS_MSG_TYPE_META);
+            s_priv_data.cb[i] (&enc->data_map, INSIGHTS_MSG_TYPE_META);
         }
     }
 #endif
 }
 
 /** Vikram: remove? */
-void esp_insights_cbor_encode_conf_meta_data_end(void)
+void esp_insights_cbor_encode_conf_meta_data_end(esp_insights_cbor_enc_t *enc)
 {
-    cbor_encoder_close_container(&s_diag_meta_map, &s_diag_meta_data_map);
+    cbor_encoder_close_container(&enc->diag_map, &enc->data_map);
 }
 
+/* include is indexed like the metrics / variables, cnt long. NULL to encode all of them */
+#define META_INCLUDED(include, cnt, i)  (!(include) || ((i) < (cnt) && (include)[i]))
+
 #if CONFIG_DIAG_ENABLE_METRICS
 static void encode_metrics_meta_element(CborEncoder *map, const esp_diag_metrics_meta_t *metrics)
 {
+    if (!metrics) {
+        return; // unregistered while encoding
+    }
     CborEncoder id_map;
 #ifdef NEW_META_STRUCT
     CborEncoder m_map;
@@ -763,38 +1099,50 @@ static void encode_metrics_meta_element(CborEncoder *map, const esp_diag_metrics
 #endif
 }
 
-void esp_insights_cbor_encode_meta_metrics(const esp_diag_metrics_meta_t *metrics, uint32_t metrics_len)
+void esp_insights_cbor_encode_meta_metrics(esp_insights_cbor_enc_t *enc, const bool *include, size_t include_cnt)
 {
-    if (!metrics || !metrics_len) {
+    uint32_t metrics_len = esp_diag_metrics_meta_count();
+    if (!metrics_len) {
         return;
     }
     CborEncoder map;
 #ifdef NEW_META_STRUCT
     CborEncoder metrics_map;
-    cbor_encode_text_stringz(&s_diag_meta_data_map, METRICS_PATH_VALUE);
-    cbor_encoder_create_map(&s_diag_meta_data_map, &metrics_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, METRICS_PATH_VALUE);
+    cbor_encoder_create_map(&enc->data_map, &metrics_map, CborIndefiniteLength);
     // d: descendants map
     cbor_encode_text_stringz(&metrics_map, "d");
     cbor_encoder_create_map(&metrics_map, &map, CborIndefiniteLength);
     // d: descendants map
     // enabled config for data
 #else
-    cbor_encode_text_stringz(&s_diag_meta_data_map, "metrics");
-    cbor_encoder_create_map(&s_diag_meta_data_map, &map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "metrics");
+    cbor_encoder_create_map(&enc->data_map, &map, CborIndefiniteLength);
 #endif
 #ifndef TAG_IS_OUTER_KEY
     for (int i = 0; i < metrics_len; i++) {
-        encode_metrics_meta_element(&map, (metrics + i));
+        if (META_INCLUDED(include, include_cnt, i)) {
+            encode_metrics_meta_element(&map, esp_diag_metrics_meta_get_by_index(i));
+        }
     }
 #else
     for (int i = 0; i < metrics_len; i++) {
-        const esp_diag_metrics_meta_t *metrics_i = metrics + i;
+        const esp_diag_metrics_meta_t *metrics_i = esp_diag_metrics_meta_get_by_index(i);
+        if (!metrics_i) {
+            continue;
+        }
+        if (!META_INCLUDED(include, include_cnt, i)) {
+            continue;
+        }
         // check if this group was already encoded
         bool encoded = false;
         for (int j = 0; j < i; j++) {
-            const esp_diag_metrics_meta_t *metrics_j = metrics + j;
+            const esp_diag_metrics_meta_t *metrics_j = esp_diag_metrics_meta_get_by_index(j);
+            if (!metrics_j) {
+                continue;
+            }
             // ESP_LOGI(TAG, "Comparing tags %s %s", metrics_i->tag, metrics_j->tag);
-            if (metrics_j->tag == metrics_i->tag) {
+            if (META_INCLUDED(include, include_cnt, j) && metrics_j->tag == metrics_i->tag) {
                 encoded = true;
                 break;
             }
@@ -813,8 +1161,11 @@ void esp_insights_cbor_encode_meta_metrics(const esp_diag_metrics_meta_t *metric
             cbor_encoder_create_map(&map, &tag_map, CborIndefiniteLength);
 #endif
             for (int j = i; j < metrics_len; j++) {
-                const esp_diag_metrics_meta_t *metrics_j = metrics + j;
-                if (metrics_j->tag == metrics_i->tag) {
+                const esp_diag_metrics_meta_t *metrics_j = esp_diag_metrics_meta_get_by_index(j);
+                if (!metrics_j) {
+                    continue;
+                }
+                if (META_INCLUDED(include, include_cnt, j) && metrics_j->tag == metrics_i->tag) {
                     ESP_LOGD(TAG, "Encoding key %s", metrics_j->key);
                     encode_metrics_meta_element(&tag_map, metrics_j);
                 }
@@ -831,9 +1182,9 @@ void esp_insights_cbor_encode_meta_metrics(const esp_diag_metrics_meta_t *metric
 #ifdef NEW_META_STRUCT
     // close d: descendants
     cbor_encoder_close_container(&metrics_map, &map);
-    cbor_encoder_close_container(&s_diag_meta_data_map, &metrics_map);
+    cbor_encoder_close_container(&enc->data_map, &metrics_map);
 #else
-    cbor_encoder_close_container(&s_diag_meta_data_map, &map);
+    cbor_encoder_close_container(&enc->data_map, &map);
 #endif
 }
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
@@ -841,6 +1192,9 @@ void esp_insights_cbor_encode_meta_metrics(const esp_diag_metrics_meta_t *metric
 #if CONFIG_DIAG_ENABLE_VARIABLES
 static void encode_variable_meta_element(CborEncoder *map, const esp_diag_variable_meta_t *variable)
 {
+    if (!variable) {
+        return; // unregistered while encoding
+    }
     CborEncoder id_map;
 #ifdef NEW_META_STRUCT
     CborEncoder m_map;
@@ -875,36 +1229,48 @@ static void encode_variable_meta_element(CborEncoder *map, const esp_diag_variab
 #endif
 }
 
-void esp_insights_cbor_encode_meta_variables(const esp_diag_variable_meta_t *variables, uint32_t variables_len)
+void esp_insights_cbor_encode_meta_variables(esp_insights_cbor_enc_t *enc, const bool *include, size_t include_cnt)
 {
-    if (!variables || !variables_len) {
+    uint32_t variables_len = esp_diag_variable_meta_count();
+    if (!variables_len) {
         return;
     }
 
     CborEncoder map;
 #ifdef NEW_META_STRUCT
     CborEncoder variables_map;
-    cbor_encode_text_stringz(&s_diag_meta_data_map, VARIABLES_PATH_VALUE);
-    cbor_encoder_create_map(&s_diag_meta_data_map, &variables_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, VARIABLES_PATH_VALUE);
+    cbor_encoder_create_map(&enc->data_map, &variables_map, CborIndefiniteLength);
     // d: descendants map
     cbor_encode_text_stringz(&variables_map, "d");
     cbor_encoder_create_map(&variables_map, &map, CborIndefiniteLength);
 #else
-    cbor_encode_text_stringz(&s_diag_meta_data_map, "params");
-    cbor_encoder_create_map(&s_diag_meta_data_map, &map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&enc->data_map, "params");
+    cbor_encoder_create_map(&enc->data_map, &map, CborIndefiniteLength);
 #endif
 #ifndef TAG_IS_OUTER_KEY
     for (int i = 0; i < variables_len; i++) {
-        encode_variable_meta_element(&map, (variables + i));
+        if (META_INCLUDED(include, include_cnt, i)) {
+            encode_variable_meta_element(&map, esp_diag_variable_meta_get_by_index(i));
+        }
     }
 #else
     for (int i = 0; i < variables_len; i++) {
-        const esp_diag_variable_meta_t *variables_i = variables + i;
+        const esp_diag_variable_meta_t *variables_i = esp_diag_variable_meta_get_by_index(i);
+        if (!variables_i) {
+            continue;
+        }
+        if (!META_INCLUDED(include, include_cnt, i)) {
+            continue;
+        }
         // check if this group was already encoded
         bool encoded = false;
         for (int j = 0; j < i; j++) {
-            const esp_diag_variable_meta_t *variables_j = variables + j;
-            if (variables_j->tag == variables_i->tag) {
+            const esp_diag_variable_meta_t *variables_j = esp_diag_variable_meta_get_by_index(j);
+            if (!variables_j) {
+                continue;
+            }
+            if (META_INCLUDED(include, include_cnt, j) && variables_j->tag == variables_i->tag) {
                 encoded = true;
                 break;
             }
@@ -922,8 +1288,11 @@ void esp_insights_cbor_encode_meta_variables(const esp_diag_variable_meta_t *var
             cbor_encoder_create_map(&map, &tag_map, CborIndefiniteLength);
 #endif
             for (int j = i; j < variables_len; j++) {
-                const esp_diag_variable_meta_t *variables_j = variables + j;
-                if (variables_j->tag == variables_i->tag) {
+                const esp_diag_variable_meta_t *variables_j = esp_diag_variable_meta_get_by_index(j);
+                if (!variables_j) {
+                    continue;
+                }
+                if (META_INCLUDED(include, include_cnt, j) && variables_j->tag == variables_i->tag) {
                     encode_variable_meta_element(&tag_map, variables_j);
                 }
             }
@@ -939,9 +1308,9 @@ void esp_insights_cbor_encode_meta_variables(const esp_diag_variable_meta_t *var
 #ifdef NEW_META_STRUCT
     // close d: descendants
     cbor_encoder_close_container(&variables_map, &map);
-    cbor_encoder_close_container(&s_diag_meta_data_map, &variables_map);
+    cbor_encoder_close_container(&enc->data_map, &variables_map);
 #else
-    cbor_encoder_close_container(&s_diag_meta_data_map, &map);
+    cbor_encoder_close_container(&enc->data_map, &map);
 #endif
 }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
@@ -42,50 +42,118 @@ typedef void (*insights_cbor_encoder_cb_t) (CborEncoder *map, insights_msg_type_
  */
 esp_err_t esp_insights_cbor_encoder_register_meta_cb(insights_cbor_encoder_cb_t cb);
 
-void esp_insights_cbor_encode_diag_begin(void *data, size_t data_size, const char *version);
-void esp_insights_cbor_encode_diag_data_begin(void);
-void esp_insights_cbor_encode_diag_boot_info(esp_diag_device_info_t *device_info);
+/**
+ * @brief state of a message being encoded
+ *
+ * Every message is encoded in its own context, so more than one message can be encoded at a time.
+ * Context is owned by the caller and need not be initialized, begin functions take care of it.
+ * Same context is used for diag and meta messages.
+ */
+typedef struct {
+    CborEncoder encoder;
+    CborEncoder result_map;
+    CborEncoder diag_map;
+    CborEncoder data_map;
+    CborEncoder conf_map;
+    uint8_t *buf;           /* NULL while encoding using writer */
+    size_t buf_size;
+    // use a scratch_pad to memcpy data before access
+    // this avoids `potential` unaligned memory accesses as
+    // data pointer we receive is not guaranteed to be word aligned
+    union {
+#if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
+        esp_diag_str_data_pt_t str_data_pt;
+        esp_diag_data_pt_t data_pt;
+#endif
+        esp_diag_log_data_t log_data_pt;
+        char sha_sum[DIAG_HEX_SHA_SIZE + 1];
+    } scratch;
+} esp_insights_cbor_enc_t;
+
+void esp_insights_cbor_encode_diag_begin(esp_insights_cbor_enc_t *enc, void *data, size_t data_size, const char *version);
+
+/**
+ * @brief begin diag message which is passed to the writer as it is encoded
+ *
+ * @param enc     context of the message
+ * @param writer  called for every encoded piece of the message
+ * @param token   passed to the writer as is
+ * @param version message version
+ * @param ts      timestamp of the message, kept same if the message is encoded more than once
+ */
+void esp_insights_cbor_encode_diag_begin_writer(esp_insights_cbor_enc_t *enc,
+                                                CborEncoderWriteFunction writer, void *token,
+                                                const char *version, uint64_t ts);
+void esp_insights_cbor_encode_diag_data_begin(esp_insights_cbor_enc_t *enc);
+void esp_insights_cbor_encode_diag_boot_info(esp_insights_cbor_enc_t *enc, esp_diag_device_info_t *device_info);
 
 /**
  * @brief encode master header
  *
+ * @param enc context of the message
  * @param hdr meta header which contains data regarding message it follows
  * @param type rtc_store type (viz., "critical", "non_critical")
  */
-void esp_insights_cbor_encode_meta_c_hdr(const rtc_store_meta_header_t *hdr);
-void esp_insights_cbor_encode_meta_nc_hdr(const rtc_store_meta_header_t *hdr);
+void esp_insights_cbor_encode_meta_c_hdr(esp_insights_cbor_enc_t *enc, const rtc_store_meta_header_t *hdr);
+void esp_insights_cbor_encode_meta_nc_hdr(esp_insights_cbor_enc_t *enc, const rtc_store_meta_header_t *hdr);
+#if CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED
+/* Sequence id and the sequence numbers of the first and the last byte of critical data in the message */
+void esp_insights_cbor_encode_diag_seq(esp_insights_cbor_enc_t *enc, uint32_t seq_id, uint32_t first, uint32_t last);
+#endif /* CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED */
 
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
-void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary);
+void esp_insights_cbor_encode_diag_crash(esp_insights_cbor_enc_t *enc, esp_core_dump_summary_t *summary);
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
-size_t esp_insights_cbor_encode_diag_logs(const uint8_t *data, size_t size);
-size_t esp_insights_cbor_encode_diag_metrics(const uint8_t *data, size_t size);
-size_t esp_insights_cbor_encode_diag_variables(const uint8_t *data, size_t size);
-void esp_insights_cbor_encode_diag_data_end(void);
-size_t esp_insights_cbor_encode_diag_end(void *data);
+size_t esp_insights_cbor_encode_diag_logs(esp_insights_cbor_enc_t *enc, const uint8_t *data, size_t size);
+#if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
+size_t esp_insights_cbor_encode_diag_data_points(esp_insights_cbor_enc_t *enc, const uint8_t *data, size_t size);
+#endif
+void esp_insights_cbor_encode_diag_data_end(esp_insights_cbor_enc_t *enc);
+
+/**
+ * @brief finish diag message
+ *
+ * @param enc  context of the message
+ * @param data buffer passed to begin, NULL if the message was begun with a writer
+ *
+ * @return size_t length of the encoded message, 0 if encoded using writer
+ */
+size_t esp_insights_cbor_encode_diag_end(esp_insights_cbor_enc_t *enc, void *data);
 
 /* For encoding diag meta data */
-void esp_insights_cbor_encode_meta_begin(void *data, size_t data_size, const char *version, const char *sha256);
-void esp_insights_cbor_encode_meta_data_begin(void);
+void esp_insights_cbor_encode_meta_begin(esp_insights_cbor_enc_t *enc, void *data, size_t data_size,
+                                         const char *version, const char *sha256);
+void esp_insights_cbor_encode_meta_begin_writer(esp_insights_cbor_enc_t *enc,
+                                                CborEncoderWriteFunction writer, void *token,
+                                                const char *version, const char *sha256, uint64_t ts);
+void esp_insights_cbor_encode_meta_data_begin(esp_insights_cbor_enc_t *enc);
+/* include[i] tells whether the entry at index i is encoded, entries past include_cnt are not.
+ * NULL to encode all the entries */
 #if CONFIG_DIAG_ENABLE_METRICS
-void esp_insights_cbor_encode_meta_metrics(const esp_diag_metrics_meta_t *metrics, uint32_t metrics_len);
+void esp_insights_cbor_encode_meta_metrics(esp_insights_cbor_enc_t *enc, const bool *include, size_t include_cnt);
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
 #if CONFIG_DIAG_ENABLE_VARIABLES
-void esp_insights_cbor_encode_meta_variables(const esp_diag_variable_meta_t *variables, uint32_t variables_len);
+void esp_insights_cbor_encode_meta_variables(esp_insights_cbor_enc_t *enc, const bool *include, size_t include_cnt);
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
-void esp_insights_cbor_encode_meta_data_end(void);
-size_t esp_insights_cbor_encode_meta_end(void *data);
+void esp_insights_cbor_encode_meta_data_end(esp_insights_cbor_enc_t *enc);
+/* Replaces the meta data with the hash of the meta extracted at build time */
+void esp_insights_cbor_encode_meta_hash(esp_insights_cbor_enc_t *enc, uint32_t hash);
+/* Delta meta: CRC of the meta it applies to and ids of the entries removed since then */
+void esp_insights_cbor_encode_meta_base(esp_insights_cbor_enc_t *enc, uint32_t base_crc);
+void esp_insights_cbor_encode_meta_removed(esp_insights_cbor_enc_t *enc, const uint32_t *ids, size_t cnt);
+size_t esp_insights_cbor_encode_meta_end(esp_insights_cbor_enc_t *enc, void *data);
 
 
 /* For encoding conf data */
-void esp_insights_cbor_encode_conf_meta_begin(void *data, size_t data_size, const char *version, const char *sha256);
-void esp_insights_cbor_encode_conf_meta_data_begin(void);
-void esp_insights_cbor_encode_conf_meta_data_end(void);
-size_t esp_insights_cbor_encode_conf_meta_end(void *data);
-
-void esp_insights_cbor_encode_diag_conf_data_begin(void);
-void esp_insights_cbor_encode_diag_conf_data_end(void);
-void esp_insights_cbor_encode_diag_conf_data(void);
+void esp_insights_cbor_encode_conf_meta_begin(esp_insights_cbor_enc_t *enc, void *data, size_t data_size,
+                                              const char *version, const char *sha256);
+void esp_insights_cbor_encode_conf_meta_data_begin(esp_insights_cbor_enc_t *enc);
+void esp_insights_cbor_encode_conf_meta_data_end(esp_insights_cbor_enc_t *enc);
+size_t esp_insights_cbor_encode_conf_meta_end(esp_insights_cbor_enc_t *enc, void *data);
+
+void esp_insights_cbor_encode_diag_conf_data_begin(esp_insights_cbor_enc_t *enc);
+void esp_insights_cbor_encode_diag_conf_data_end(esp_insights_cbor_enc_t *enc);
+void esp_insights_cbor_encode_diag_conf_data(esp_insights_cbor_enc_t *enc);
 
 /* For converting 8 bytes sha256 to hex form */
 void bytes_to_hex(uint8_t *src, uint8_t *dst, int in_len);
@@ -6,6 +6,8 @@
 
 #include <sdkconfig.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <nvs_flash.h>
 #include <nvs.h>
@@ -17,6 +19,7 @@
 #define INSIGHTS_MQTT_HOST_NVS_KEY       "mqtt_host"
 #define INSIGHTS_NODE_ID                 "node_id"
 #define INSIGHTS_META_CRC_NVS_KEY        "i_meta_crc"
+#define INSIGHTS_META_ENTRIES_NVS_KEY    "i_meta_ent"
 #define INSIGHTS_NVS_NAMESPACE           "nvs"
 
 extern uint8_t mqtt_server_root_ca_pem_start[] asm("_binary_mqtt_server_crt_start");
@@ -81,11 +84,19 @@ void esp_insights_clean_mqtt_conn_params(esp_rmaker_mqtt_conn_params_t *mqtt_con
     }
 }
 
+/* NVS copy of the meta CRC is cached to avoid NVS access on every check */
+static uint32_t s_meta_nvs_crc;
+static bool s_meta_nvs_crc_cached;
+
 esp_err_t esp_insights_meta_nvs_crc_get(uint32_t *crc)
 {
     if (!crc) {
         return ESP_ERR_INVALID_ARG;
     }
+    if (s_meta_nvs_crc_cached) {
+        *crc = s_meta_nvs_crc;
+        return ESP_OK;
+    }
     nvs_handle_t handle;
     esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READONLY, &handle);
     if (err != ESP_OK) {
@@ -97,11 +108,20 @@ esp_err_t esp_insights_meta_nvs_crc_get(uint32_t *crc)
         return err;
     }
     nvs_close(handle);
+    s_meta_nvs_crc = *crc;
+    s_meta_nvs_crc_cached = true;
     return err;
 }
 
 esp_err_t esp_insights_meta_nvs_crc_set(uint32_t crc)
 {
+    if (s_meta_nvs_crc_cached && s_meta_nvs_crc == crc) {
+        return ESP_OK;
+    }
+    /* Cloud already has this meta, remember it even if NVS write fails */
+    s_meta_nvs_crc = crc;
+    s_meta_nvs_crc_cached = true;
+
     nvs_handle_t handle;
     esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READWRITE, &handle);
     if (err != ESP_OK) {
@@ -116,3 +136,71 @@ esp_err_t esp_insights_meta_nvs_crc_set(uint32_t crc)
     nvs_close(handle);
     return err;
 }
+
+/* Entries are stored with the CRC of the meta they belong to, in a single blob, so that
+ * the two can not go out of sync
+ */
+esp_err_t esp_insights_meta_nvs_entries_get(uint32_t *crc, void **entries, size_t *len)
+{
+    if (!crc || !entries || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    size_t blob_len = 0;
+    err = nvs_get_blob(handle, INSIGHTS_META_ENTRIES_NVS_KEY, NULL, &blob_len);
+    if (err != ESP_OK) {
+        nvs_close(handle);
+        return err;
+    }
+    if (blob_len < sizeof(*crc)) {
+        nvs_close(handle);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t *blob = malloc(blob_len);
+    if (!blob) {
+        nvs_close(handle);
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(handle, INSIGHTS_META_ENTRIES_NVS_KEY, blob, &blob_len);
+    nvs_close(handle);
+    if (err == ESP_OK) {
+        /* entries are moved to the start of the blob, which is handed over as is */
+        memcpy(crc, blob, sizeof(*crc));
+        *len = blob_len - sizeof(*crc);
+        memmove(blob, blob + sizeof(*crc), *len);
+        *entries = blob;
+        return ESP_OK;
+    }
+    free(blob);
+    return err;
+}
+
+esp_err_t esp_insights_meta_nvs_entries_set(uint32_t crc, const void *entries, size_t len)
+{
+    if (!entries && len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t *blob = malloc(sizeof(crc) + len);
+    if (!blob) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(blob, &crc, sizeof(crc));
+    if (len) {
+        memcpy(blob + sizeof(crc), entries, len);
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, INSIGHTS_META_ENTRIES_NVS_KEY, blob, sizeof(crc) + len);
+        if (err == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    free(blob);
+    return err;
+}
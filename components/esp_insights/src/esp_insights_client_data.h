@@ -18,6 +18,9 @@ esp_rmaker_mqtt_conn_params_t *esp_insights_get_mqtt_conn_params(void);
 void esp_insights_clean_mqtt_conn_params(esp_rmaker_mqtt_conn_params_t *mqtt_conn_params);
 esp_err_t esp_insights_meta_nvs_crc_get(uint32_t *crc);
 esp_err_t esp_insights_meta_nvs_crc_set(uint32_t crc);
+/* entries is allocated to the length of the stored entries, len, and is to be freed by the caller */
+esp_err_t esp_insights_meta_nvs_entries_get(uint32_t *crc, void **entries, size_t *len);
+esp_err_t esp_insights_meta_nvs_entries_set(uint32_t crc, const void *entries, size_t len);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,125 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include "esp_insights_compress.h"
+
+#define LZ_LEN_HDR_SIZE     2   /* Uncompressed length */
+#define LZ_REF_SIZE         2
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v = ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+    return (v * 2654435761u) >> 22; // top 10 bits, ESP_INSIGHTS_LZ_HASH_SIZE entries
+}
+
+size_t esp_insights_lz_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size,
+                                uint16_t *hash_table)
+{
+    if (!in || !out || !hash_table || in_len > UINT16_MAX || out_size < LZ_LEN_HDR_SIZE) {
+        return 0;
+    }
+    // positions are stored + 1, so that 0 means empty
+    memset(hash_table, 0, ESP_INSIGHTS_LZ_HASH_SIZE * sizeof(hash_table[0]));
+    out[0] = in_len & 0xff;
+    out[1] = in_len >> 8;
+
+    size_t o = LZ_LEN_HDR_SIZE;
+    size_t ctrl = 0;
+    int bit = 8;
+    size_t i = 0;
+    while (i < in_len) {
+        if (bit == 8) {
+            if (o >= out_size) {
+                return 0;
+            }
+            ctrl = o;
+            out[o++] = 0;
+            bit = 0;
+        }
+        size_t match_len = 0, dist = 0;
+        if (i + ESP_INSIGHTS_LZ_MIN_MATCH <= in_len) {
+            uint32_t h = lz_hash(&in[i]);
+            size_t cand = hash_table[h];
+            hash_table[h] = i + 1;
+            if (cand && (i - (cand - 1)) <= ESP_INSIGHTS_LZ_WINDOW) {
+                cand -= 1;
+                dist = i - cand;
+                size_t max = in_len - i;
+                if (max > ESP_INSIGHTS_LZ_MAX_MATCH) {
+                    max = ESP_INSIGHTS_LZ_MAX_MATCH;
+                }
+                while (match_len < max && in[cand + match_len] == in[i + match_len]) {
+                    match_len++;
+                }
+            }
+        }
+        if (match_len >= ESP_INSIGHTS_LZ_MIN_MATCH) {
+            if (o + LZ_REF_SIZE > out_size) {
+                return 0;
+            }
+            uint16_t ref = ((dist - 1) << 4) | (match_len - ESP_INSIGHTS_LZ_MIN_MATCH);
+            out[o++] = ref >> 8;
+            out[o++] = ref & 0xff;
+            // keep the hash table up to date for the positions skipped by the match
+            for (size_t k = 1; k < match_len && i + k + ESP_INSIGHTS_LZ_MIN_MATCH <= in_len; k++) {
+                hash_table[lz_hash(&in[i + k])] = i + k + 1;
+            }
+            i += match_len;
+        } else {
+            if (o >= out_size) {
+                return 0;
+            }
+            out[ctrl] |= 1 << bit;
+            out[o++] = in[i++];
+        }
+        bit++;
+    }
+    return o;
+}
+
+size_t esp_insights_lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size)
+{
+    if (!in || !out || in_len < LZ_LEN_HDR_SIZE) {
+        return 0;
+    }
+    size_t out_len = in[0] | (in[1] << 8);
+    if (out_len > out_size) {
+        return 0;
+    }
+    size_t i = LZ_LEN_HDR_SIZE;
+    size_t o = 0;
+    while (o < out_len) {
+        if (i >= in_len) {
+            return 0;
+        }
+        uint8_t ctrl = in[i++];
+        for (int bit = 0; bit < 8 && o < out_len; bit++) {
+            if (ctrl & (1 << bit)) {
+                if (i >= in_len) {
+                    return 0;
+                }
+                out[o++] = in[i++];
+                continue;
+            }
+            if (i + LZ_REF_SIZE > in_len) {
+                return 0;
+            }
+            uint16_t ref = (in[i] << 8) | in[i + 1];
+            i += LZ_REF_SIZE;
+            size_t dist = (ref >> 4) + 1;
+            size_t len = (ref & 0xf) + ESP_INSIGHTS_LZ_MIN_MATCH;
+            if (dist > o || o + len > out_len) {
+                return 0;
+            }
+            // byte by byte, source and destination may overlap
+            for (size_t k = 0; k < len; k++, o++) {
+                out[o] = out[o - dist];
+            }
+        }
+    }
+    return o;
+}
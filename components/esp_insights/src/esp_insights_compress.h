@@ -0,0 +1,56 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/**
+ * @file esp_insights_compress.h
+ * @brief Small LZSS compressor for insights payloads
+ *
+ * Compressed data starts with the uncompressed length (2 bytes, little endian) followed by
+ * groups of a control byte and 8 items. Bit n (LSB first) of the control byte tells the type
+ * of the n-th item, 1 for a literal byte and 0 for a 2 byte back reference (big endian) with
+ * 12 bits distance - 1 and 4 bits length - 3. Last group may have less than 8 items.
+ *
+ * Complete input is in memory, so the window costs no RAM. Only a hash table of
+ * ESP_INSIGHTS_LZ_HASH_SIZE entries is needed to find the matches.
+ *
+ * @note please keep this file free of ESP-IDF dependencies, it is built on host for benchmark
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ESP_INSIGHTS_LZ_HASH_SIZE       1024        /* Entries in the hash table */
+#define ESP_INSIGHTS_LZ_WINDOW          4096        /* Max distance of a back reference */
+#define ESP_INSIGHTS_LZ_MIN_MATCH       3
+#define ESP_INSIGHTS_LZ_MAX_MATCH       18
+
+/**
+ * @brief Compress data
+ *
+ * @param[in] in input data, at most UINT16_MAX bytes
+ * @param[in] in_len length of the input data
+ * @param[out] out output buffer
+ * @param[in] out_size size of the output buffer
+ * @param[in] hash_table scratch of ESP_INSIGHTS_LZ_HASH_SIZE entries, need not be initialized
+ *
+ * @return length of the compressed data, 0 if it does not fit in the output buffer
+ */
+size_t esp_insights_lz_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size,
+                                uint16_t *hash_table);
+
+/**
+ * @brief Decompress data compressed with esp_insights_lz_compress()
+ *
+ * @param[in] in compressed data
+ * @param[in] in_len length of the compressed data
+ * @param[out] out output buffer
+ * @param[in] out_size size of the output buffer
+ *
+ * @return length of the decompressed data, 0 if compressed data is invalid or does not fit
+ */
+size_t esp_insights_lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size);
@@ -4,14 +4,25 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_metrics.h>
 #include <esp_diagnostics_variables.h>
+#include <esp_crc.h>
 
 #include "esp_insights_cbor_encoder.h"
+#include "esp_insights_encoder.h"
+#if CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED || CONFIG_ESP_INSIGHTS_META_DELTA
+#include <esp_rmaker_utils.h>
+#endif
+#if CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED
+#include "esp_insights_compress.h"
+#endif
 
-#if CONFIG_ESP_INSIGHTS_META_VERSION_10
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+#define INSIGHTS_VERSION_MAJOR           "3"
+#elif CONFIG_ESP_INSIGHTS_META_VERSION_10
 #define INSIGHTS_VERSION_MAJOR           "1"
 #else
 #define INSIGHTS_VERSION_MAJOR           "2"
@@ -33,90 +44,371 @@
 #define INSIGHTS_DATA_TYPE          0x02
 #define INSIGHTS_META_DATA_TYPE     0x03
 #define INSIGHTS_CONF_DATA_TYPE     0x12
-#define TLV_OFFSET                  3
+#define INSIGHTS_COMPRESSED_FLAG    0x80    /* ORed into the type of a compressed message */
+#define INSIGHTS_BUNDLE_TYPE        0x04    /* sections are complete messages of the types above */
+#define TLV_OFFSET                  ESP_INSIGHTS_TLV_HDR_LEN
+
+void esp_insights_enc_stream_init(esp_insights_enc_stream_t *stream, uint8_t *chunk, size_t chunk_size)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->chunk = chunk;
+    stream->chunk_size = chunk_size;
+    stream->ts = esp_diag_timestamp_get();
+}
+
+esp_err_t esp_insights_enc_stream_start(esp_insights_enc_stream_t *stream,
+                                        esp_err_t (*flush)(const void *data, size_t len))
+{
+    if (!stream || !flush || !stream->chunk || !stream->chunk_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->err != ESP_OK) {
+        return stream->err;
+    }
+    if (stream->len <= TLV_OFFSET || stream->len - TLV_OFFSET > UINT16_MAX) {
+        return ESP_ERR_INVALID_SIZE; // does not fit in length field of TLV
+    }
+    stream->flush = flush;
+    stream->msg_len = stream->len;
+    stream->len = 0;
+    stream->chunk_len = 0;
+    return ESP_OK;
+}
+
+static esp_err_t stream_put(esp_insights_enc_stream_t *stream, const uint8_t *data, size_t len)
+{
+    if (stream->err != ESP_OK) {
+        return stream->err;
+    }
+    stream->len += len;
+    if (!stream->flush) {
+        return ESP_OK; // just sizing the message
+    }
+    if (stream->len > stream->msg_len) {
+        /* Message changed after it was sized, remaining length can't be sent */
+        stream->err = ESP_ERR_INVALID_SIZE;
+        return stream->err;
+    }
+    while (len) {
+        size_t to_copy = stream->chunk_size - stream->chunk_len;
+        if (to_copy > len) {
+            to_copy = len;
+        }
+        memcpy(stream->chunk + stream->chunk_len, data, to_copy);
+        stream->chunk_len += to_copy;
+        data += to_copy;
+        len -= to_copy;
+        if (stream->chunk_len == stream->chunk_size) {
+            stream->err = stream->flush(stream->chunk, stream->chunk_len);
+            if (stream->err != ESP_OK) {
+                return stream->err;
+            }
+            stream->chunk_len = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_insights_enc_stream_finish(esp_insights_enc_stream_t *stream)
+{
+    if (!stream || !stream->flush) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->err == ESP_OK && stream->chunk_len) {
+        stream->err = stream->flush(stream->chunk, stream->chunk_len);
+        stream->chunk_len = 0;
+    }
+    if (stream->err == ESP_OK && stream->len != stream->msg_len) {
+        stream->err = ESP_ERR_INVALID_SIZE;
+    }
+    return stream->err;
+}
+
+static CborError stream_writer(void *token, const void *data, size_t len, CborEncoderAppendType append)
+{
+    return stream_put((esp_insights_enc_stream_t *) token, data, len) == ESP_OK ? CborNoError : CborErrorIO;
+}
+
+/* Length is not known while sizing, that pass just counts the header */
+static void stream_put_tlv_hdr(esp_insights_enc_stream_t *stream, uint8_t type)
+{
+    uint8_t hdr[TLV_OFFSET] = {0};
+    if (stream->flush) {
+        uint16_t len = stream->msg_len - TLV_OFFSET;
+        hdr[0] = type;                           /* Data type - 1 byte */
+        memcpy(&hdr[1], &len, sizeof(len));      /* Data length - 2 bytes */
+    }
+    stream_put(stream, hdr, sizeof(hdr));
+}
 
-static void esp_insights_encode_meta_data(void)
+static void esp_insights_encode_meta_data(esp_insights_cbor_enc_t *enc)
 {
 #if CONFIG_DIAG_ENABLE_METRICS
-    uint32_t metrics_len = 0;
-    const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_all(&metrics_len);
-    if (!metrics) {
-        return;
+    esp_insights_cbor_encode_meta_metrics(enc, NULL, 0);
+#endif /* CONFIG_DIAG_ENABLE_METRICS */
+
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    esp_insights_cbor_encode_meta_variables(enc, NULL, 0);
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+}
+
+static uint32_t meta_str_crc(uint32_t crc, const char *str)
+{
+    /* NUL included so that the fields can not run into each other */
+    if (!str) {
+        str = "";
+    }
+    return esp_crc32_le(crc, (const uint8_t *) str, strlen(str) + 1);
+}
+
+static void meta_entry_set(esp_insights_meta_entry_t *entry, esp_diag_data_pt_type_t pt_type,
+                           const char *tag, const char *key, const char *label, const char *path,
+                           const char *unit, esp_diag_data_type_t type)
+{
+    uint8_t pt = pt_type;
+    uint8_t data_type = type;
+    entry->id = meta_str_crc(meta_str_crc(esp_crc32_le(0, &pt, sizeof(pt)), tag), key);
+    entry->hash = meta_str_crc(meta_str_crc(entry->id, label), path);
+    entry->hash = meta_str_crc(esp_crc32_le(entry->hash, &data_type, sizeof(data_type)), unit);
+}
+
+esp_err_t esp_insights_meta_entries_get(esp_insights_meta_entry_t **entries, size_t *metrics_cnt, size_t *cnt)
+{
+    if (!entries || !metrics_cnt || !cnt) {
+        return ESP_ERR_INVALID_ARG;
     }
-    esp_insights_cbor_encode_meta_metrics((const esp_diag_metrics_meta_t *)metrics, metrics_len);
+    uint32_t metrics_len = 0, variables_len = 0;
+#if CONFIG_DIAG_ENABLE_METRICS
+    metrics_len = esp_diag_metrics_meta_count();
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    variables_len = esp_diag_variable_meta_count();
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    *entries = NULL;
+    *metrics_cnt = *cnt = 0;
+    if (!metrics_len && !variables_len) {
+        return ESP_OK;
+    }
+    esp_insights_meta_entry_t *e = calloc(metrics_len + variables_len, sizeof(esp_insights_meta_entry_t));
+    if (!e) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Entries stay at the index of their meta, the one removed in the meanwhile is left zeroed */
+#if CONFIG_DIAG_ENABLE_METRICS
+    for (uint32_t i = 0; i < metrics_len; i++) {
+        const esp_diag_metrics_meta_t *m = esp_diag_metrics_meta_get_by_index(i);
+        if (m) {
+            meta_entry_set(&e[i], ESP_DIAG_DATA_PT_METRICS, m->tag, m->key, m->label, m->path, m->unit, m->type);
+        }
+    }
+#endif /* CONFIG_DIAG_ENABLE_METRICS */
+#if CONFIG_DIAG_ENABLE_VARIABLES
+    for (uint32_t i = 0; i < variables_len; i++) {
+        const esp_diag_variable_meta_t *v = esp_diag_variable_meta_get_by_index(i);
+        if (v) {
+            meta_entry_set(&e[metrics_len + i], ESP_DIAG_DATA_PT_VARIABLE, v->tag, v->key, v->label, v->path, v->unit, v->type);
+        }
+    }
+#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    *entries = e;
+    *metrics_cnt = metrics_len;
+    *cnt = metrics_len + variables_len;
+    return ESP_OK;
+}
+
+#if CONFIG_ESP_INSIGHTS_META_DELTA
+static bool meta_base_has(const esp_insights_meta_base_t *base, const esp_insights_meta_entry_t *entry)
+{
+    for (size_t i = 0; i < base->cnt; i++) {
+        if (base->entries[i].id == entry->id && base->entries[i].hash == entry->hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Only the entries added or changed since base, and ids of the removed ones */
+static esp_err_t esp_insights_encode_meta_delta(esp_insights_cbor_enc_t *enc, const esp_insights_meta_base_t *base)
+{
+    const esp_insights_meta_entry_t *cur = base->cur;
+    size_t metrics_cnt = base->cur_metrics_cnt, cnt = base->cur_cnt, removed_cnt = 0;
+    bool *changed = cnt ? MEM_ALLOC_EXTRAM(cnt * sizeof(bool)) : NULL;
+    uint32_t *removed = base->cnt ? MEM_ALLOC_EXTRAM(base->cnt * sizeof(uint32_t)) : NULL;
+    if ((cnt && !changed) || (base->cnt && !removed)) {
+        free(changed);
+        free(removed);
+        return ESP_ERR_NO_MEM;
+    }
 
+    for (size_t i = 0; i < cnt; i++) {
+        changed[i] = !meta_base_has(base, &cur[i]);
+    }
+    for (size_t i = 0; i < base->cnt; i++) {
+        bool found = false;
+        for (size_t j = 0; j < cnt && !found; j++) {
+            found = cur[j].id == base->entries[i].id;
+        }
+        if (!found) {
+            removed[removed_cnt++] = base->entries[i].id;
+        }
+    }
+
+    esp_insights_cbor_encode_meta_base(enc, base->crc);
+    esp_insights_cbor_encode_meta_data_begin(enc);
+#if CONFIG_DIAG_ENABLE_METRICS
+    for (size_t i = 0; i < metrics_cnt; i++) {
+        if (changed[i]) {
+            esp_insights_cbor_encode_meta_metrics(enc, changed, metrics_cnt);
+            break;
+        }
+    }
+#endif /* CONFIG_DIAG_ENABLE_METRICS */
 #if CONFIG_DIAG_ENABLE_VARIABLES
-    uint32_t variables_len = 0;
-    const esp_diag_variable_meta_t *variables = esp_diag_variable_meta_get_all(&variables_len);
-    if (!variables) {
-        return;
+    for (size_t i = metrics_cnt; i < cnt; i++) {
+        if (changed[i]) {
+            esp_insights_cbor_encode_meta_variables(enc, changed + metrics_cnt, cnt - metrics_cnt);
+            break;
+        }
     }
-    esp_insights_cbor_encode_meta_variables((const esp_diag_variable_meta_t *)variables, variables_len);
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    esp_insights_cbor_encode_meta_removed(enc, removed, removed_cnt);
+    esp_insights_cbor_encode_meta_data_end(enc);
+    free(changed);
+    free(removed);
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_INSIGHTS_META_DELTA */
+
+static void esp_insights_encode_meta_body(esp_insights_cbor_enc_t *enc, const esp_insights_meta_base_t *base)
+{
+#if CONFIG_ESP_INSIGHTS_META_FROM_BUILD
+    /* Meta is in the firmware package, cloud only needs to know which one */
+    uint32_t hash;
+    if (esp_diag_meta_decl_hash_get(&hash) == ESP_OK) {
+        esp_insights_cbor_encode_meta_hash(enc, hash);
+        return;
+    }
+#endif /* CONFIG_ESP_INSIGHTS_META_FROM_BUILD */
+#if CONFIG_ESP_INSIGHTS_META_DELTA
+    /* Complete meta goes if there is no memory to work out the delta */
+    if (base && esp_insights_encode_meta_delta(enc, base) == ESP_OK) {
+        return;
+    }
+#endif /* CONFIG_ESP_INSIGHTS_META_DELTA */
+    esp_insights_cbor_encode_meta_data_begin(enc);
+    esp_insights_encode_meta_data(enc);
+    esp_insights_cbor_encode_meta_data_end(enc);
 }
 
-size_t esp_insights_encode_meta(uint8_t *out_data, size_t out_data_size, char *sha256)
+size_t esp_insights_encode_meta(uint8_t *out_data, size_t out_data_size, char *sha256,
+                                const esp_insights_meta_base_t *base)
 {
     if (!out_data || !out_data_size) {
         return 0;
     }
+    esp_insights_cbor_enc_t enc;
     char sha[DIAG_HEX_SHA_SIZE + 1];
     bytes_to_hex((uint8_t *) sha256,(uint8_t *) sha, DIAG_SHA_SIZE);
-    esp_insights_cbor_encode_meta_begin(out_data + TLV_OFFSET,
+    esp_insights_cbor_encode_meta_begin(&enc, out_data + TLV_OFFSET,
                                         out_data_size - TLV_OFFSET,
                                         INSIGHTS_META_VERSION, sha);
-    esp_insights_cbor_encode_meta_data_begin();
-    esp_insights_encode_meta_data();
-    esp_insights_cbor_encode_meta_data_end();
-    uint16_t len = esp_insights_cbor_encode_meta_end(out_data + TLV_OFFSET);
-
+    esp_insights_encode_meta_body(&enc, base);
+    uint16_t len = esp_insights_cbor_encode_meta_end(&enc, out_data + TLV_OFFSET);
+    if (len == 0) {
+        return 0; // does not fit
+    }
     out_data[0] = INSIGHTS_META_DATA_TYPE;      /* Data type indication diagnostics meta - 1 byte */
     memcpy(&out_data[1], &len, sizeof(len));    /* Data length - 2 bytes */
     len += TLV_OFFSET;
     return len;
 }
 
-esp_err_t esp_insights_encode_data_begin(void *out_data, size_t out_data_size)
+size_t esp_insights_encode_meta_stream(esp_insights_enc_stream_t *stream, char *sha256,
+                                       const esp_insights_meta_base_t *base)
 {
-    if (!out_data || !out_data_size) {
+    if (!stream) {
+        return 0;
+    }
+    char sha[DIAG_HEX_SHA_SIZE + 1];
+    bytes_to_hex((uint8_t *) sha256,(uint8_t *) sha, DIAG_SHA_SIZE);
+    stream_put_tlv_hdr(stream, INSIGHTS_META_DATA_TYPE);
+    esp_insights_cbor_encode_meta_begin_writer(&stream->cbor, stream_writer, stream,
+                                               INSIGHTS_META_VERSION, sha, stream->ts);
+    esp_insights_encode_meta_body(&stream->cbor, base);
+    esp_insights_cbor_encode_meta_end(&stream->cbor, NULL);
+    return stream->err == ESP_OK ? stream->len : 0;
+}
+
+esp_err_t esp_insights_encode_data_begin(esp_insights_cbor_enc_t *enc, uint8_t *out_data, size_t out_data_size)
+{
+    if (!enc || !out_data || !out_data_size) {
         return ESP_ERR_INVALID_ARG;
     }
-    esp_insights_cbor_encode_diag_begin(out_data + TLV_OFFSET, out_data_size - TLV_OFFSET, INSIGHTS_VERSION);
-    esp_insights_cbor_encode_diag_data_begin();
+    esp_insights_cbor_encode_diag_begin(enc, out_data + TLV_OFFSET, out_data_size - TLV_OFFSET, INSIGHTS_VERSION);
+    esp_insights_cbor_encode_diag_data_begin(enc);
     return ESP_OK;
 }
 
+esp_err_t esp_insights_encode_data_begin_stream(esp_insights_enc_stream_t *stream)
+{
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stream_put_tlv_hdr(stream, INSIGHTS_DATA_TYPE);
+    esp_insights_cbor_encode_diag_begin_writer(&stream->cbor, stream_writer, stream, INSIGHTS_VERSION, stream->ts);
+    esp_insights_cbor_encode_diag_data_begin(&stream->cbor);
+    return stream->err;
+}
+
 size_t esp_insights_encode_conf_meta(uint8_t *out_data, size_t out_data_size, char *sha256)
 {
     if (!out_data || !out_data_size) {
         return 0;
     }
+    esp_insights_cbor_enc_t enc;
     char sha[DIAG_HEX_SHA_SIZE + 1];
     bytes_to_hex((uint8_t *) sha256,(uint8_t *) sha, DIAG_SHA_SIZE);
-    esp_insights_cbor_encode_meta_begin(out_data + TLV_OFFSET,
+    esp_insights_cbor_encode_meta_begin(&enc, out_data + TLV_OFFSET,
                                         out_data_size - TLV_OFFSET,
                                         INSIGHTS_META_VERSION, sha);
-    esp_insights_cbor_encode_conf_meta_data_begin();
+    esp_insights_cbor_encode_conf_meta_data_begin(&enc);
     /* TODO: Implement and collect diagnostics specific conf meta */
     // esp_insights_encode_conf_meta_data();
-    esp_insights_cbor_encode_conf_meta_data_end();
-
-    uint16_t len = esp_insights_cbor_encode_meta_end(out_data + TLV_OFFSET);
+    esp_insights_cbor_encode_conf_meta_data_end(&enc);
 
+    uint16_t len = esp_insights_cbor_encode_meta_end(&enc, out_data + TLV_OFFSET);
+    if (len == 0) {
+        return 0; // does not fit
+    }
     out_data[0] = INSIGHTS_META_DATA_TYPE;      /* Data type indication diagnostics meta - 1 byte */
     memcpy(&out_data[1], &len, sizeof(len));    /* Data length - 2 bytes */
     len += TLV_OFFSET;
     return len;
 }
 
-void esp_insights_encode_boottime_data(void)
+size_t esp_insights_encode_conf_meta_stream(esp_insights_enc_stream_t *stream, char *sha256)
+{
+    if (!stream) {
+        return 0;
+    }
+    char sha[DIAG_HEX_SHA_SIZE + 1];
+    bytes_to_hex((uint8_t *) sha256,(uint8_t *) sha, DIAG_SHA_SIZE);
+    stream_put_tlv_hdr(stream, INSIGHTS_META_DATA_TYPE);
+    esp_insights_cbor_encode_meta_begin_writer(&stream->cbor, stream_writer, stream,
+                                               INSIGHTS_META_VERSION, sha, stream->ts);
+    esp_insights_cbor_encode_conf_meta_data_begin(&stream->cbor);
+    esp_insights_cbor_encode_conf_meta_data_end(&stream->cbor);
+    esp_insights_cbor_encode_meta_end(&stream->cbor, NULL);
+    return stream->err == ESP_OK ? stream->len : 0;
+}
+
+void esp_insights_encode_boottime_data(esp_insights_cbor_enc_t *enc)
 {
     /* encode device info */
     esp_diag_device_info_t device_info;
     memset(&device_info, 0, sizeof(device_info));
     esp_diag_device_info_get(&device_info);
-    esp_insights_cbor_encode_diag_boot_info(&device_info);
+    esp_insights_cbor_encode_diag_boot_info(enc, &device_info);
 
     /* encode core dump summary */
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
@@ -127,7 +419,7 @@ void esp_insights_encode_boottime_data(void)
         if (summary) {
             memset(summary, 0, sizeof(esp_core_dump_summary_t));
             if (esp_core_dump_get_summary(summary) == ESP_OK) {
-                esp_insights_cbor_encode_diag_crash(summary);
+                esp_insights_cbor_encode_diag_crash(enc, summary);
             }
             free(summary);
         }
@@ -137,81 +429,138 @@ void esp_insights_encode_boottime_data(void)
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
 }
 
-void esp_insights_encode_conf_data()
+void esp_insights_encode_conf_data(esp_insights_cbor_enc_t *enc)
 {
     /* collect the configs */
-    esp_insights_cbor_encode_diag_conf_data_begin();
-    esp_insights_cbor_encode_diag_conf_data();
-    esp_insights_cbor_encode_diag_conf_data_end();
+    esp_insights_cbor_encode_diag_conf_data_begin(enc);
+    esp_insights_cbor_encode_diag_conf_data(enc);
+    esp_insights_cbor_encode_diag_conf_data_end(enc);
 }
 
 
-size_t esp_insights_encode_conf_end(uint8_t *out_data)
+size_t esp_insights_encode_conf_end(esp_insights_cbor_enc_t *enc, uint8_t *out_data)
 {
-    if (!out_data) {
+    if (!enc || !out_data) {
         return 0;
     }
-    esp_insights_cbor_encode_diag_data_end();
-    uint16_t len = esp_insights_cbor_encode_diag_end(out_data + TLV_OFFSET);
-
+    esp_insights_cbor_encode_diag_data_end(enc);
+    uint16_t len = esp_insights_cbor_encode_diag_end(enc, out_data + TLV_OFFSET);
+    if (len == 0) {
+        return 0; // does not fit
+    }
     out_data[0] = INSIGHTS_CONF_DATA_TYPE;      /* Data type indicating diagnostics - 1 byte */
     memcpy(&out_data[1], &len, sizeof(len));    /* Data length - 2 bytes */
     len += TLV_OFFSET;
     return len;
 }
 
-size_t esp_insights_encode_critical_data(const void *data, size_t data_size)
+size_t esp_insights_encode_critical_data(esp_insights_cbor_enc_t *enc, const void *data, size_t data_size)
 {
     size_t consumed = 0;
     if (data) {
-        consumed = esp_insights_cbor_encode_diag_logs(data, data_size);
+        consumed = esp_insights_cbor_encode_diag_logs(enc, data, data_size);
         if (consumed) {
             uint8_t meta_idx = ((uint8_t *) data)[0];
             const rtc_store_meta_header_t *hdr = rtc_store_get_meta_record_by_index(meta_idx);
             if (hdr) {
-                esp_insights_cbor_encode_meta_c_hdr(hdr);
+                esp_insights_cbor_encode_meta_c_hdr(enc, hdr);
             }
         }
     }
     return consumed;
 }
 
-size_t esp_insights_encode_non_critical_data(const void *data, size_t data_size)
+#if CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED
+void esp_insights_encode_critical_seq(esp_insights_cbor_enc_t *enc, uint32_t seq_id, uint32_t seq, size_t consumed)
+{
+    if (consumed) {
+        /* Sequence numbers wrap around, so does last */
+        esp_insights_cbor_encode_diag_seq(enc, seq_id, seq, seq + consumed - 1);
+    }
+}
+#endif /* CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED */
+
+size_t esp_insights_encode_non_critical_data(esp_insights_cbor_enc_t *enc, const void *data, size_t data_size)
 {
-    size_t consumed_max = 0;
+    size_t consumed = 0;
     if (data) {
-#if CONFIG_DIAG_ENABLE_METRICS
-        consumed_max = esp_insights_cbor_encode_diag_metrics(data, data_size);
-#endif /* CONFIG_DIAG_ENABLE_METRICS */
-#if CONFIG_DIAG_ENABLE_VARIABLES
-        size_t consumed = esp_insights_cbor_encode_diag_variables(data, data_size);
-        if (consumed > consumed_max) {
-            consumed_max = consumed;
-        }
-#endif /* CONFIG_DIAG_ENABLE_VARIABLES */
 #if CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES
-        if (consumed_max) {
+        /* Metrics and variables are encoded in one go, both share the consumed length */
+        consumed = esp_insights_cbor_encode_diag_data_points(enc, data, data_size);
+        if (consumed) {
             uint8_t meta_idx = ((uint8_t *) data)[0];
             const rtc_store_meta_header_t *hdr = rtc_store_get_meta_record_by_index(meta_idx);
             if (hdr) {
-                esp_insights_cbor_encode_meta_nc_hdr(hdr);
+                esp_insights_cbor_encode_meta_nc_hdr(enc, hdr);
             }
         }
 #endif
     }
-    return consumed_max;
+    return consumed;
 }
 
-size_t esp_insights_encode_data_end(uint8_t *out_data)
+size_t esp_insights_encode_data_end(esp_insights_cbor_enc_t *enc, uint8_t *out_data)
 {
-    if (!out_data) {
+    if (!enc || !out_data) {
         return 0;
     }
-    esp_insights_cbor_encode_diag_data_end();
-    uint16_t len = esp_insights_cbor_encode_diag_end(out_data + TLV_OFFSET);
-
+    esp_insights_cbor_encode_diag_data_end(enc);
+    uint16_t len = esp_insights_cbor_encode_diag_end(enc, out_data + TLV_OFFSET);
+    if (len == 0) {
+        return 0; // does not fit
+    }
     out_data[0] = INSIGHTS_DATA_TYPE;               /* Data type indicating diagnostics - 1 byte */
     memcpy(&out_data[1], &len, sizeof(len));    /* Data length - 2 bytes */
     len += TLV_OFFSET;
     return len;
 }
+
+size_t esp_insights_encode_data_end_stream(esp_insights_enc_stream_t *stream)
+{
+    if (!stream) {
+        return 0;
+    }
+    esp_insights_cbor_encode_diag_data_end(&stream->cbor);
+    esp_insights_cbor_encode_diag_end(&stream->cbor, NULL);
+    return stream->err == ESP_OK ? stream->len : 0;
+}
+
+#if CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED
+size_t esp_insights_encode_compress(uint8_t *data, size_t len)
+{
+    if (!data || len <= TLV_OFFSET || (data[0] & INSIGHTS_COMPRESSED_FLAG)) {
+        return len;
+    }
+    size_t payload_len = len - TLV_OFFSET;
+    // only worth it if smaller, so output need not be larger than the payload
+    uint8_t *out = MEM_ALLOC_EXTRAM(payload_len);
+    uint16_t *hash_table = MEM_ALLOC_EXTRAM(ESP_INSIGHTS_LZ_HASH_SIZE * sizeof(uint16_t));
+    size_t out_len = 0;
+    if (out && hash_table) {
+        out_len = esp_insights_lz_compress(data + TLV_OFFSET, payload_len, out, payload_len, hash_table);
+    }
+    if (out_len && out_len < payload_len) {
+        uint16_t tlv_len = out_len;
+        memcpy(data + TLV_OFFSET, out, out_len);
+        data[0] |= INSIGHTS_COMPRESSED_FLAG;
+        memcpy(&data[1], &tlv_len, sizeof(tlv_len));
+        len = out_len + TLV_OFFSET;
+    }
+    free(hash_table);
+    free(out);
+    return len;
+}
+#endif /* CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED */
+
+#if CONFIG_ESP_INSIGHTS_BUNDLE_ENABLED
+size_t esp_insights_encode_bundle_end(uint8_t *out_data, size_t sections_len)
+{
+    if (!out_data || sections_len == 0 || sections_len > UINT16_MAX) {
+        return 0;
+    }
+    uint16_t len = sections_len;
+    out_data[0] = INSIGHTS_BUNDLE_TYPE;         /* Data type indicating bundle - 1 byte */
+    memcpy(&out_data[1], &len, sizeof(len));    /* Data length - 2 bytes */
+    return sections_len + TLV_OFFSET;
+}
+#endif /* CONFIG_ESP_INSIGHTS_BUNDLE_ENABLED */
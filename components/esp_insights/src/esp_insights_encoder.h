@@ -6,37 +6,192 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "esp_insights_cbor_encoder.h"
+
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
 #include <esp_core_dump.h>
 #endif
 
-size_t esp_insights_encode_meta(uint8_t *out_data, size_t out_data_size, char *sha256);
+/* TLV header of a message: type (1 byte) and length of the payload (2 bytes) */
+#define ESP_INSIGHTS_TLV_HDR_LEN    3
+
+/**
+ * @brief Output stream to encode a message in small chunks
+ *
+ * TLV header of a message needs its length upfront, so a streamed message is encoded twice.
+ * First with `flush` set to NULL to find the length of the message and then with `flush`
+ * set to push out the chunks as they fill.
+ */
+typedef struct {
+    esp_err_t (*flush)(const void *data, size_t len); /* Called for every filled chunk, NULL while sizing */
+    uint8_t *chunk;         /* Chunk buffer */
+    size_t chunk_size;
+    size_t chunk_len;       /* Bytes pending in the chunk */
+    size_t len;             /* Bytes written to the stream, TLV header included */
+    size_t msg_len;         /* Length of the message found while sizing */
+    uint64_t ts;            /* Timestamp of the message, same for both the passes */
+    esp_err_t err;          /* First error hit while writing to the stream */
+    esp_insights_cbor_enc_t cbor;   /* Encoder context of the message in the stream */
+} esp_insights_enc_stream_t;
+
+/**
+ * @brief initialize stream for sizing the message
+ *
+ * @param stream stream to initialize
+ * @param chunk chunk buffer
+ * @param chunk_size size of the chunk buffer
+ */
+void esp_insights_enc_stream_init(esp_insights_enc_stream_t *stream, uint8_t *chunk, size_t chunk_size);
+
+/**
+ * @brief switch sized stream to send the message, message must be encoded again after this
+ *
+ * @param stream stream which was used to size the message
+ * @param flush called for every filled chunk
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_insights_enc_stream_start(esp_insights_enc_stream_t *stream,
+                                        esp_err_t (*flush)(const void *data, size_t len));
+
+/**
+ * @brief flush the remaining data and check that complete message was sent
+ *
+ * @param stream stream which is being sent
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_insights_enc_stream_finish(esp_insights_enc_stream_t *stream);
+
+/**
+ * @brief hashes of a metrics or variable meta entry
+ */
+typedef struct {
+    uint32_t id;        /* CRC32 of data point type, tag and key */
+    uint32_t hash;      /* CRC32 of the complete meta of the entry */
+} esp_insights_meta_entry_t;
+
+/**
+ * @brief meta acknowledged by the cloud, which a delta meta message is encoded against
+ *
+ * Current entries are from the same esp_insights_meta_entries_get() snapshot which is stored
+ * as the next base once the message is acknowledged.
+ */
+typedef struct {
+    uint32_t crc;                               /* meta CRC, see esp_diag_meta_crc_get() */
+    const esp_insights_meta_entry_t *entries;   /* entries of the meta */
+    size_t cnt;
+    const esp_insights_meta_entry_t *cur;       /* entries of the meta being sent */
+    size_t cur_metrics_cnt;
+    size_t cur_cnt;
+} esp_insights_meta_base_t;
+
+/**
+ * @brief get the hashes of the registered metrics and variables, in the order they are encoded
+ *
+ * Array is sized from the registered entries at the time of the call, metrics come first
+ * and then the variables.
+ *
+ * @param[out] entries allocated array of the entries, to be freed by the caller. NULL if there are none
+ * @param[out] metrics_cnt number of metrics entries
+ * @param[out] cnt number of entries
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_insights_meta_entries_get(esp_insights_meta_entry_t **entries, size_t *metrics_cnt, size_t *cnt);
+
+/**
+ * @brief encode meta message
+ *
+ * With CONFIG_ESP_INSIGHTS_META_DELTA and base set, only the entries added or changed since
+ * base are encoded, along with the ids of the removed entries. Complete meta is encoded otherwise.
+ */
+size_t esp_insights_encode_meta(uint8_t *out_data, size_t out_data_size, char *sha256,
+                                const esp_insights_meta_base_t *base);
+size_t esp_insights_encode_meta_stream(esp_insights_enc_stream_t *stream, char *sha256,
+                                       const esp_insights_meta_base_t *base);
 size_t esp_insights_encode_conf_meta(uint8_t *out_data, size_t out_data_size, char *sha256);
-esp_err_t esp_insights_encode_data_begin(uint8_t *out_data, size_t out_data_size);
-void esp_insights_encode_boottime_data(void);
+size_t esp_insights_encode_conf_meta_stream(esp_insights_enc_stream_t *stream, char *sha256);
+esp_err_t esp_insights_encode_data_begin(esp_insights_cbor_enc_t *enc, uint8_t *out_data, size_t out_data_size);
+esp_err_t esp_insights_encode_data_begin_stream(esp_insights_enc_stream_t *stream);
+void esp_insights_encode_boottime_data(esp_insights_cbor_enc_t *enc);
 
 /**
  * @brief encode critical data
  *
+ * @param enc context passed to begin, `&stream->cbor` for a streamed message
  * @param critical_data pointer to critical data
  * @param critical_data_size size of critical data
  * @return size_t length of data consumed
  */
-size_t esp_insights_encode_critical_data(const void *critical_data, size_t critical_data_size);
+size_t esp_insights_encode_critical_data(esp_insights_cbor_enc_t *enc, const void *critical_data, size_t critical_data_size);
+
+#if CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED
+/**
+ * @brief encode the sequence range of the critical data in the message
+ *
+ * Lets the cloud drop critical data it has already received, e.g. when a message is sent
+ * again because its acknowledgement was lost.
+ *
+ * @param enc context passed to begin, `&stream->cbor` for a streamed message
+ * @param seq_id identifier of the sequence, from esp_diag_data_store_critical_get_seq()
+ * @param seq sequence number of the first byte of critical data encoded
+ * @param consumed length of critical data encoded, nothing is encoded if 0
+ */
+void esp_insights_encode_critical_seq(esp_insights_cbor_enc_t *enc, uint32_t seq_id, uint32_t seq, size_t consumed);
+#endif /* CONFIG_ESP_INSIGHTS_DATA_SEQ_ENABLED */
 
 /**
  * @brief encode non_critical data
  *
+ * @param enc context passed to begin, `&stream->cbor` for a streamed message
  * @param critical_data pointer to non_critical data
  * @param critical_data_size size of non_critical data
  * @return size_t length of data consumed
  */
-size_t esp_insights_encode_non_critical_data(const void *non_critical_data, size_t non_critical_data_size);
+size_t esp_insights_encode_non_critical_data(esp_insights_cbor_enc_t *enc, const void *non_critical_data, size_t non_critical_data_size);
 
 /**
  * @brief finish encoding message
  *
+ * @param enc context passed to esp_insights_encode_data_begin()
  * @param out_data encoded data pointer
  * @return size_t size of the data encoded
  */
-size_t esp_insights_encode_data_end(uint8_t *out_data);
+size_t esp_insights_encode_data_end(esp_insights_cbor_enc_t *enc, uint8_t *out_data);
+
+/**
+ * @brief finish encoding message in the stream
+ *
+ * @param stream stream passed to esp_insights_encode_data_begin_stream()
+ * @return size_t size of the message, TLV header included. 0 on failure
+ */
+size_t esp_insights_encode_data_end_stream(esp_insights_enc_stream_t *stream);
+
+#if CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED
+/**
+ * @brief compress the payload of an encoded message in place
+ *
+ * Compressed message has the compressed flag set in the TLV type, message is left as is
+ * if compression does not make it smaller or the memory for it can not be allocated.
+ *
+ * @param data encoded message, TLV header included
+ * @param len length of the message
+ * @return size_t length of the message after compression
+ */
+size_t esp_insights_encode_compress(uint8_t *data, size_t len);
+#endif /* CONFIG_ESP_INSIGHTS_COMPRESSION_ENABLED */
+
+#if CONFIG_ESP_INSIGHTS_BUNDLE_ENABLED
+/**
+ * @brief finish encoding a bundle message
+ *
+ * Sections of the bundle are complete messages, TLV header included, encoded back to back
+ * at out_data + ESP_INSIGHTS_TLV_HDR_LEN. This writes the TLV header of the bundle.
+ *
+ * @param out_data bundle message
+ * @param sections_len length of the sections
+ * @return size_t size of the bundle, TLV header included. 0 if the sections are too long
+ */
+size_t esp_insights_encode_bundle_end(uint8_t *out_data, size_t sections_len);
+#endif /* CONFIG_ESP_INSIGHTS_BUNDLE_ENABLED */
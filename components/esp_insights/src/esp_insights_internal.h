@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <esp_err.h>
 
 #ifdef CONFIG_ESP_INSIGHTS_TRANSPORT_MQTT
@@ -17,6 +18,9 @@ extern esp_insights_transport_config_t g_default_insights_transport_mqtt;
 /* other functions for more granularity */
 esp_err_t esp_insights_mqtt_publish(const char *topic, void *data, size_t data_len, uint8_t qos, int *msg_id);
 esp_err_t esp_insights_mqtt_subscribe(const char *topic, esp_rmaker_mqtt_subscribe_cb_t cb, uint8_t qos, void *priv_data);
+#elif CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK
+/* Default configurations for loopback, userdata is esp_insights_loopback_config_t */
+extern esp_insights_transport_config_t g_default_insights_transport_loopback;
 #else
 /* Default configurations for https */
 extern esp_insights_transport_config_t g_default_insights_transport_https;
@@ -47,6 +51,39 @@ void esp_insights_transport_disconnect(void);
  */
 int esp_insights_transport_data_send(void *data, size_t len);
 
+/**
+ * @brief Check if the transport can send a message in chunks
+ *
+ * @return true if data_begin, data_write and data_end callbacks are registered, false otherwise
+ */
+bool esp_insights_transport_data_stream_supported(void);
+
+/**
+ * @brief Begin a streamed message of `len` bytes
+ *
+ * @param[in] len Total length of the message
+ *
+ * @return ESP_OK on success, otherwise appropriate error code
+ */
+esp_err_t esp_insights_transport_data_begin(size_t len);
+
+/**
+ * @brief Write a chunk of the streamed message
+ *
+ * @param[in] data Chunk to send
+ * @param[in] len  Length of the chunk
+ *
+ * @return ESP_OK on success, otherwise appropriate error code
+ */
+esp_err_t esp_insights_transport_data_write(const void *data, size_t len);
+
+/**
+ * @brief Finish the streamed message
+ *
+ * @return msg_id  Message_id of the sent data, same as esp_insights_transport_data_send()
+ */
+int esp_insights_transport_data_end(void);
+
 /**
  * @brief Send update to the cloud about new state
  */
@@ -0,0 +1,77 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include "esp_insights_sched.h"
+
+#define SCHED_RATE_RISE_SHIFT   1   /* new rate sample weight 1/2 when rising */
+#define SCHED_RATE_FALL_SHIFT   3   /* and 1/8 when falling */
+#define SCHED_MIN_ELAPSED_MS    1000 /* shorter intervals give too noisy rate samples */
+
+void esp_insights_sched_init(esp_insights_sched_t *sched, uint32_t min_sec, uint32_t max_sec, uint32_t target_pct)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->min_sec = min_sec;
+    sched->max_sec = max_sec < min_sec ? min_sec : max_sec;
+    sched->target_pct = target_pct > 100 ? 100 : target_pct;
+}
+
+static void sched_rate_update(esp_insights_sched_t *sched, const esp_insights_sched_store_t store[], uint32_t elapsed_ms)
+{
+    for (int i = 0; i < ESP_INSIGHTS_SCHED_CLASS_CNT; i++) {
+        uint32_t delta = store[i].written - sched->written[i];
+        uint64_t sample = (((uint64_t) delta << ESP_INSIGHTS_SCHED_RATE_SHIFT) * 1000) / elapsed_ms;
+        if (sample > UINT32_MAX) {
+            sample = UINT32_MAX;
+        }
+        if (!sched->rate_valid) {
+            sched->rate[i] = sample;
+        } else if (sample > sched->rate[i]) {
+            sched->rate[i] += (sample - sched->rate[i]) >> SCHED_RATE_RISE_SHIFT;
+        } else {
+            sched->rate[i] -= (sched->rate[i] - sample) >> SCHED_RATE_FALL_SHIFT;
+        }
+        sched->written[i] = store[i].written;
+    }
+    sched->rate_valid = true;
+}
+
+uint32_t esp_insights_sched_update(esp_insights_sched_t *sched,
+                                   const esp_insights_sched_store_t store[ESP_INSIGHTS_SCHED_CLASS_CNT],
+                                   uint32_t elapsed_ms)
+{
+    if (!sched->started) {
+        /* Rate is measured from here on */
+        for (int i = 0; i < ESP_INSIGHTS_SCHED_CLASS_CNT; i++) {
+            sched->written[i] = store[i].written;
+        }
+        sched->started = true;
+        return sched->min_sec;
+    }
+    if (elapsed_ms >= SCHED_MIN_ELAPSED_MS) {
+        sched_rate_update(sched, store, elapsed_ms);
+    }
+
+    uint64_t next_sec = sched->max_sec;
+    for (int i = 0; i < ESP_INSIGHTS_SCHED_CLASS_CNT; i++) {
+        uint32_t target = (uint64_t) store[i].size * sched->target_pct / 100;
+        if (store[i].pending >= target) {
+            next_sec = 0;
+            break;
+        }
+        if (sched->rate[i] == 0) {
+            continue;
+        }
+        uint64_t sec = ((uint64_t) (target - store[i].pending) << ESP_INSIGHTS_SCHED_RATE_SHIFT) / sched->rate[i];
+        if (sec < next_sec) {
+            next_sec = sec;
+        }
+    }
+    if (next_sec < sched->min_sec) {
+        next_sec = sched->min_sec;
+    }
+    return next_sec;
+}
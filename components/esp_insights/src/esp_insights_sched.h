@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/**
+ * @file esp_insights_sched.h
+ * @brief Fill rate based scheduling of insights reports
+ *
+ * Rate at which data enters every class of the data store is estimated from the bytes written
+ * between two reports. The next report is scheduled for when the fastest filling class is
+ * expected to reach the target fill level, within the min and max period. Light traffic is
+ * batched in fewer reports, and a report is sent sooner when the store is filling up fast.
+ *
+ * Rate follows an increase quickly and a decrease slowly, so that a burst is not forgotten
+ * right after it is sent.
+ *
+ * @note please keep this file free of ESP-IDF dependencies, it is built on host for the simulator
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ESP_INSIGHTS_SCHED_CLASS_CNT    2   /* critical and non-critical data */
+#define ESP_INSIGHTS_SCHED_RATE_SHIFT   4   /* fixed point fraction bits of rate */
+
+/* Data store class as seen by the scheduler */
+typedef struct {
+    uint32_t size;      /* size of the store */
+    uint32_t pending;   /* bytes in the store, not yet sent */
+    uint32_t written;   /* bytes written since start, wraps around */
+} esp_insights_sched_store_t;
+
+typedef struct {
+    uint32_t min_sec;
+    uint32_t max_sec;
+    uint32_t target_pct;
+    uint32_t rate[ESP_INSIGHTS_SCHED_CLASS_CNT];    /* bytes per second << ESP_INSIGHTS_SCHED_RATE_SHIFT */
+    uint32_t written[ESP_INSIGHTS_SCHED_CLASS_CNT]; /* written bytes at the previous update */
+    bool started;       /* written holds the bytes written at the previous update */
+    bool rate_valid;    /* rate holds at least one sample */
+} esp_insights_sched_t;
+
+/**
+ * @brief Initialize the scheduler
+ *
+ * @param[out] sched scheduler
+ * @param[in] min_sec minimum period between two reports
+ * @param[in] max_sec maximum period between two reports
+ * @param[in] target_pct fill level of the store, in percent, at which a report is due
+ */
+void esp_insights_sched_init(esp_insights_sched_t *sched, uint32_t min_sec, uint32_t max_sec, uint32_t target_pct);
+
+/**
+ * @brief Update the fill rate estimate and get the period until the next report
+ *
+ * Called after every report with the data store state at that time.
+ *
+ * @param[in] sched scheduler
+ * @param[in] store state of every class of the data store
+ * @param[in] elapsed_ms time since the previous update, ignored for the first update
+ *
+ * @return seconds until the next report, between min_sec and max_sec
+ */
+uint32_t esp_insights_sched_update(esp_insights_sched_t *sched,
+                                   const esp_insights_sched_store_t store[ESP_INSIGHTS_SCHED_CLASS_CNT],
+                                   uint32_t elapsed_ms);
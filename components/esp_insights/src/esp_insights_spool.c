@@ -0,0 +1,304 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_crc.h>
+#include <esp_partition.h>
+#include "esp_insights_spool.h"
+
+#define SPOOL_MAGIC             0x5349      /* "IS" */
+#define SPOOL_SENT_MAGIC        0x544e4553  /* "SENT" */
+/* Encrypted partitions are written in 16 byte blocks, every part of a record starts at one */
+#define SPOOL_BLOCK_SIZE        16
+#define SPOOL_ALIGN(x)          (((x) + SPOOL_BLOCK_SIZE - 1) & ~(SPOOL_BLOCK_SIZE - 1))
+
+static const char *TAG = "insights_spool";
+
+typedef struct {
+    uint16_t magic;
+    uint16_t len;       /* length of the message following the marker */
+    uint32_t seq;       /* incremented for every record, finds the newest sector */
+    uint32_t crc;       /* crc32 of the message */
+    uint32_t hdr_crc;   /* crc32 of the fields above, tells a header from message bytes */
+} spool_hdr_t;
+
+/* Left erased after the header and written once the message is sent. Nothing is ever
+ * written twice to the same block, which an encrypted partition does not allow.
+ */
+typedef struct {
+    uint32_t magic;     /* SPOOL_SENT_MAGIC */
+    uint32_t seq;       /* seq of the record */
+    uint32_t reserved[2];
+} spool_mark_t;
+
+_Static_assert(sizeof(spool_hdr_t) == SPOOL_BLOCK_SIZE, "spool header must take a block");
+_Static_assert(sizeof(spool_mark_t) == SPOOL_BLOCK_SIZE, "spool marker must take a block");
+
+typedef struct {
+    const esp_partition_t *part;
+    uint32_t sector_size;
+    uint32_t sector_cnt;
+    uint32_t wr_sector;     /* next record is written here */
+    uint32_t wr_off;
+    uint32_t rd_sector;     /* oldest record which may not be sent yet */
+    uint32_t rd_off;
+    uint32_t rd_size;       /* size of the record returned by the last peek, 0 if none */
+    uint32_t rd_seq;        /* seq of the record returned by the last peek */
+    uint32_t seq;           /* seq of the next record */
+} spool_t;
+
+static spool_t s_spool;
+
+static inline uint32_t spool_rec_size(const spool_hdr_t *hdr)
+{
+    return sizeof(spool_hdr_t) + sizeof(spool_mark_t) + SPOOL_ALIGN(hdr->len);
+}
+
+static inline uint32_t spool_hdr_crc(const spool_hdr_t *hdr)
+{
+    return esp_crc32_le(0, (const uint8_t *) hdr, offsetof(spool_hdr_t, hdr_crc));
+}
+
+static inline uint32_t spool_addr(uint32_t sector, uint32_t off)
+{
+    return sector * s_spool.sector_size + off;
+}
+
+/* Returns true if a valid record header is at off */
+static bool spool_hdr_read(uint32_t sector, uint32_t off, spool_hdr_t *hdr)
+{
+    if (off + sizeof(*hdr) > s_spool.sector_size) {
+        return false;
+    }
+    if (esp_partition_read(s_spool.part, spool_addr(sector, off), hdr, sizeof(*hdr)) != ESP_OK) {
+        return false;
+    }
+    return hdr->magic == SPOOL_MAGIC && hdr->hdr_crc == spool_hdr_crc(hdr) &&
+           off + spool_rec_size(hdr) <= s_spool.sector_size;
+}
+
+/* Finds the first valid record header at or after off, below end. Blocks in between, left
+ * by a write which failed part way, are skipped.
+ */
+static bool spool_hdr_find(uint32_t sector, uint32_t *off, uint32_t end, spool_hdr_t *hdr)
+{
+    for (; *off + sizeof(*hdr) <= end; *off += SPOOL_BLOCK_SIZE) {
+        if (spool_hdr_read(sector, *off, hdr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool spool_is_sent(uint32_t sector, uint32_t off, const spool_hdr_t *hdr)
+{
+    spool_mark_t mark;
+    /* Erased marker of an encrypted partition reads as random bytes, which do not match either */
+    if (esp_partition_read(s_spool.part, spool_addr(sector, off) + sizeof(*hdr), &mark, sizeof(mark)) != ESP_OK) {
+        return false;
+    }
+    return mark.magic == SPOOL_SENT_MAGIC && mark.seq == hdr->seq;
+}
+
+static bool spool_is_erased(uint32_t sector, uint32_t off)
+{
+    spool_hdr_t hdr;
+    if (off + sizeof(hdr) > s_spool.sector_size) {
+        return true; // nothing more fits in the sector
+    }
+    /* Raw read, erased flash of an encrypted partition does not decrypt to 0xff */
+    if (esp_partition_read_raw(s_spool.part, spool_addr(sector, off), &hdr, sizeof(hdr)) != ESP_OK) {
+        return false;
+    }
+    const uint8_t *p = (const uint8_t *) &hdr;
+    for (size_t i = 0; i < sizeof(hdr); i++) {
+        if (p[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Moves writing to the next sector, erasing the oldest records in it */
+static esp_err_t spool_next_sector(void)
+{
+    uint32_t next = (s_spool.wr_sector + 1) % s_spool.sector_cnt;
+    esp_err_t err = esp_partition_erase_range(s_spool.part, spool_addr(next, 0), s_spool.sector_size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase sector %" PRIu32 ", err 0x%x", next, err);
+        return err;
+    }
+    if (s_spool.rd_sector == next) {
+        /* Unsent records in it are lost, oldest data is now in the sector after it */
+        s_spool.rd_sector = (next + 1) % s_spool.sector_cnt;
+        s_spool.rd_off = 0;
+        s_spool.rd_size = 0;
+    }
+    s_spool.wr_sector = next;
+    s_spool.wr_off = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_insights_spool_init(const char *label)
+{
+    memset(&s_spool, 0, sizeof(s_spool));
+    s_spool.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!s_spool.part) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_spool.sector_size = s_spool.part->erase_size;
+    s_spool.sector_cnt = s_spool.part->size / s_spool.sector_size;
+    if (s_spool.sector_cnt < 2) {
+        ESP_LOGE(TAG, "Partition %s needs at least 2 sectors", label);
+        s_spool.part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    /* Newest sector is the one whose first record has the highest seq */
+    spool_hdr_t hdr;
+    bool found = false;
+    for (uint32_t sector = 0; sector < s_spool.sector_cnt; sector++) {
+        if (spool_hdr_read(sector, 0, &hdr) && (!found || (int32_t) (hdr.seq - s_spool.seq) >= 0)) {
+            found = true;
+            s_spool.wr_sector = sector;
+            s_spool.seq = hdr.seq;
+        }
+    }
+    if (found) {
+        uint32_t off = 0;
+        while (spool_hdr_find(s_spool.wr_sector, &off, s_spool.sector_size, &hdr)) {
+            s_spool.seq = hdr.seq + 1;
+            off += spool_rec_size(&hdr);
+            s_spool.wr_off = off;
+        }
+    }
+    /* Leftover of an interrupted write can not be written over */
+    if (!spool_is_erased(s_spool.wr_sector, s_spool.wr_off)) {
+        esp_err_t err = spool_next_sector();
+        if (err != ESP_OK) {
+            s_spool.part = NULL;
+            return err;
+        }
+    }
+    s_spool.rd_sector = (s_spool.wr_sector + 1) % s_spool.sector_cnt;
+    s_spool.rd_off = 0;
+    ESP_LOGI(TAG, "Spool %s: %" PRIu32 " sectors, writing at %" PRIu32 ":%" PRIu32,
+             label, s_spool.sector_cnt, s_spool.wr_sector, s_spool.wr_off);
+    return ESP_OK;
+}
+
+void esp_insights_spool_deinit(void)
+{
+    memset(&s_spool, 0, sizeof(s_spool));
+}
+
+size_t esp_insights_spool_msg_max(void)
+{
+    if (!s_spool.part) {
+        return 0;
+    }
+    return s_spool.sector_size - sizeof(spool_hdr_t) - sizeof(spool_mark_t);
+}
+
+esp_err_t esp_insights_spool_write(const void *data, size_t len)
+{
+    if (!s_spool.part) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!data || !len || len > esp_insights_spool_msg_max()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    spool_hdr_t hdr = {
+        .magic = SPOOL_MAGIC,
+        .len = len,
+        .seq = s_spool.seq,
+        .crc = esp_crc32_le(0, data, len),
+    };
+    hdr.hdr_crc = spool_hdr_crc(&hdr);
+    esp_err_t err;
+    if (s_spool.wr_off + spool_rec_size(&hdr) > s_spool.sector_size) {
+        err = spool_next_sector();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    /* Marker block after the header is left erased, the message is written in whole blocks */
+    uint32_t addr = spool_addr(s_spool.wr_sector, s_spool.wr_off);
+    uint32_t data_addr = addr + sizeof(hdr) + sizeof(spool_mark_t);
+    size_t head_len = len & ~(SPOOL_BLOCK_SIZE - 1);
+    err = esp_partition_write(s_spool.part, addr, &hdr, sizeof(hdr));
+    if (err == ESP_OK && head_len) {
+        err = esp_partition_write(s_spool.part, data_addr, data, head_len);
+    }
+    if (err == ESP_OK && len > head_len) {
+        uint8_t tail[SPOOL_BLOCK_SIZE];
+        memset(tail, 0xff, sizeof(tail));
+        memcpy(tail, (const uint8_t *) data + head_len, len - head_len);
+        err = esp_partition_write(s_spool.part, data_addr + head_len, tail, sizeof(tail));
+    }
+    /* Space is used up even if the write failed part way */
+    s_spool.wr_off += spool_rec_size(&hdr);
+    s_spool.seq++;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write %" PRIu32 " bytes, err 0x%x", (uint32_t) len, err);
+    }
+    return err;
+}
+
+size_t esp_insights_spool_peek(void *buf, size_t size)
+{
+    if (!s_spool.part || !buf) {
+        return 0;
+    }
+    spool_hdr_t hdr;
+    while (s_spool.rd_sector != s_spool.wr_sector || s_spool.rd_off < s_spool.wr_off) {
+        uint32_t end = (s_spool.rd_sector == s_spool.wr_sector) ? s_spool.wr_off : s_spool.sector_size;
+        if (!spool_hdr_find(s_spool.rd_sector, &s_spool.rd_off, end, &hdr)) {
+            if (s_spool.rd_sector == s_spool.wr_sector) {
+                s_spool.rd_off = s_spool.wr_off;
+                break;
+            }
+            s_spool.rd_sector = (s_spool.rd_sector + 1) % s_spool.sector_cnt;
+            s_spool.rd_off = 0;
+            continue;
+        }
+        uint32_t rec_size = spool_rec_size(&hdr);
+        uint32_t data_addr = spool_addr(s_spool.rd_sector, s_spool.rd_off) + sizeof(hdr) + sizeof(spool_mark_t);
+        if (!spool_is_sent(s_spool.rd_sector, s_spool.rd_off, &hdr) && hdr.len <= size &&
+            esp_partition_read(s_spool.part, data_addr, buf, hdr.len) == ESP_OK &&
+            esp_crc32_le(0, buf, hdr.len) == hdr.crc) {
+            s_spool.rd_size = rec_size;
+            s_spool.rd_seq = hdr.seq;
+            return hdr.len;
+        }
+        /* Already sent, too large or corrupt */
+        s_spool.rd_off += rec_size;
+    }
+    s_spool.rd_size = 0;
+    return 0;
+}
+
+esp_err_t esp_insights_spool_pop(void)
+{
+    if (!s_spool.part || !s_spool.rd_size) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    spool_mark_t mark = {
+        .magic = SPOOL_SENT_MAGIC,
+        .seq = s_spool.rd_seq,
+    };
+    esp_err_t err = esp_partition_write(s_spool.part,
+                                        spool_addr(s_spool.rd_sector, s_spool.rd_off) + sizeof(spool_hdr_t),
+                                        &mark, sizeof(mark));
+    /* Move on even if marking failed, the message may be sent again after reboot */
+    s_spool.rd_off += s_spool.rd_size;
+    s_spool.rd_size = 0;
+    return err;
+}
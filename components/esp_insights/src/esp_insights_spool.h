@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/**
+ * @file esp_insights_spool.h
+ * @brief Flash spool of encoded insights messages
+ *
+ * Messages which can not be sent are appended to a data partition used as a ring of sectors.
+ * A record never crosses a sector boundary. When the sector being written is full, the next
+ * one is erased, dropping the oldest records in it, so every sector is erased once per wrap
+ * of the ring. A record is written in 16 byte blocks and is marked as sent by writing a block
+ * left erased after its header, so that the partition may be encrypted.
+ *
+ * @note functions are not thread safe, they are called from the insights work queue only
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Open the spool partition and find the records left from earlier boots
+ *
+ * @param[in] label label of the data partition
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no such partition, appropriate error otherwise
+ */
+esp_err_t esp_insights_spool_init(const char *label);
+
+void esp_insights_spool_deinit(void);
+
+/**
+ * @brief Maximum length of a message which can be spooled
+ */
+size_t esp_insights_spool_msg_max(void);
+
+/**
+ * @brief Append a message to the spool
+ *
+ * @return ESP_OK on success, appropriate error otherwise
+ */
+esp_err_t esp_insights_spool_write(const void *data, size_t len);
+
+/**
+ * @brief Read the oldest message not sent yet
+ *
+ * @param[out] buf buffer to read the message in
+ * @param[in] size size of the buffer, larger messages are skipped
+ *
+ * @return length of the message, 0 if there is none
+ */
+size_t esp_insights_spool_peek(void *buf, size_t size);
+
+/**
+ * @brief Mark the message returned by the last esp_insights_spool_peek() as sent
+ *
+ * @return ESP_OK on success, appropriate error otherwise
+ */
+esp_err_t esp_insights_spool_pop(void);
+
+#ifdef __cplusplus
+}
+#endif
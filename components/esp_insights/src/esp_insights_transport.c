@@ -86,3 +86,39 @@ int esp_insights_transport_data_send(void *data, size_t len)
     ESP_LOGW(TAG, "data send callback not set");
     return -1;
 }
+
+bool esp_insights_transport_data_stream_supported(void)
+{
+    return s_priv_data.init && s_priv_data.config.callbacks.data_begin &&
+           s_priv_data.config.callbacks.data_write && s_priv_data.config.callbacks.data_end;
+}
+
+esp_err_t esp_insights_transport_data_begin(size_t len)
+{
+    CHECK_TRANSPORT_INIT(ESP_ERR_INVALID_STATE);
+    if (s_priv_data.config.callbacks.data_begin) {
+        return s_priv_data.config.callbacks.data_begin(len);
+    }
+    ESP_LOGW(TAG, "data begin callback not set");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_insights_transport_data_write(const void *data, size_t len)
+{
+    CHECK_TRANSPORT_INIT(ESP_ERR_INVALID_STATE);
+    if (s_priv_data.config.callbacks.data_write) {
+        return s_priv_data.config.callbacks.data_write(data, len);
+    }
+    ESP_LOGW(TAG, "data write callback not set");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+int esp_insights_transport_data_end(void)
+{
+    CHECK_TRANSPORT_INIT(-1);
+    if (s_priv_data.config.callbacks.data_end) {
+        return s_priv_data.config.callbacks.data_end();
+    }
+    ESP_LOGW(TAG, "data end callback not set");
+    return -1;
+}
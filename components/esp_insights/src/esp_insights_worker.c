@@ -0,0 +1,136 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "sdkconfig.h"
+#include "esp_insights_worker.h"
+
+#if CONFIG_ESP_INSIGHTS_WORKER_CORE_ID < 0 || CONFIG_FREERTOS_UNICORE
+#define WORKER_CORE_ID      tskNO_AFFINITY
+#else
+#define WORKER_CORE_ID      CONFIG_ESP_INSIGHTS_WORKER_CORE_ID
+#endif
+
+static const char *TAG = "insights_worker";
+
+typedef struct {
+    void (*work_fn)(void *priv_data);   /* NULL stops the task */
+    void *priv_data;
+    TickType_t queued;                  /* tick at which the job is queued */
+} worker_job_t;
+
+typedef struct {
+    QueueHandle_t queue;        /* kept across stop and start */
+    TaskHandle_t task;
+    volatile bool running;
+    atomic_uint_least32_t jobs;
+    atomic_uint_least32_t dropped;
+    atomic_uint_least32_t latency_sum_ms;
+    atomic_uint_least32_t latency_max_ms;
+} worker_t;
+
+static worker_t s_worker;
+
+static void worker_task(void *arg)
+{
+    worker_job_t job;
+    while (1) {
+        if (xQueueReceive(s_worker.queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (!job.work_fn) {
+            break;
+        }
+        uint32_t latency_ms = (xTaskGetTickCount() - job.queued) * portTICK_PERIOD_MS;
+        atomic_fetch_add_explicit(&s_worker.jobs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&s_worker.latency_sum_ms, latency_ms, memory_order_relaxed);
+        /* Only this task raises the max, a concurrent reset at worst loses this sample */
+        if (latency_ms > atomic_load_explicit(&s_worker.latency_max_ms, memory_order_relaxed)) {
+            atomic_store_explicit(&s_worker.latency_max_ms, latency_ms, memory_order_relaxed);
+        }
+        job.work_fn(job.priv_data);
+    }
+    s_worker.task = NULL;
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_insights_worker_start(void)
+{
+    if (s_worker.running) {
+        return ESP_OK;
+    }
+    if (s_worker.task) {
+        ESP_LOGW(TAG, "Worker is still stopping");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!s_worker.queue) {
+        s_worker.queue = xQueueCreate(CONFIG_ESP_INSIGHTS_WORKER_QUEUE_SIZE, sizeof(worker_job_t));
+        if (!s_worker.queue) {
+            ESP_LOGE(TAG, "Failed to create the queue");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    /* Jobs queued after the last stop are stale */
+    xQueueReset(s_worker.queue);
+    s_worker.running = true;
+    if (xTaskCreatePinnedToCore(worker_task, "insights_worker", CONFIG_ESP_INSIGHTS_WORKER_STACK_SIZE, NULL,
+                                CONFIG_ESP_INSIGHTS_WORKER_PRIORITY, &s_worker.task, WORKER_CORE_ID) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the task");
+        s_worker.running = false;
+        s_worker.task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void esp_insights_worker_stop(void)
+{
+    if (!s_worker.running) {
+        return;
+    }
+    s_worker.running = false;
+    worker_job_t job = { 0 };
+    xQueueSend(s_worker.queue, &job, portMAX_DELAY);
+}
+
+esp_err_t esp_insights_worker_add_task(void (*work_fn)(void *priv_data), void *priv_data)
+{
+    if (!work_fn) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_worker.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    worker_job_t job = {
+        .work_fn = work_fn,
+        .priv_data = priv_data,
+        .queued = xTaskGetTickCount(),
+    };
+    if (xQueueSend(s_worker.queue, &job, 0) != pdTRUE) {
+        atomic_fetch_add_explicit(&s_worker.dropped, 1, memory_order_relaxed);
+        ESP_LOGE(TAG, "Queue full, job dropped");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void esp_insights_worker_stats_get(esp_insights_worker_stats_t *stats)
+{
+    if (!stats) {
+        return;
+    }
+    uint32_t latency_sum_ms = atomic_exchange_explicit(&s_worker.latency_sum_ms, 0, memory_order_relaxed);
+    stats->jobs = atomic_exchange_explicit(&s_worker.jobs, 0, memory_order_relaxed);
+    stats->dropped = atomic_exchange_explicit(&s_worker.dropped, 0, memory_order_relaxed);
+    stats->latency_max_ms = atomic_exchange_explicit(&s_worker.latency_max_ms, 0, memory_order_relaxed);
+    stats->latency_avg_ms = stats->jobs ? latency_sum_ms / stats->jobs : 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/**
+ * @file esp_insights_worker.h
+ * @brief Dedicated task running insights work
+ *
+ * Replaces the RainMaker work queue for insights work when CONFIG_ESP_INSIGHTS_WORKER_ENABLED
+ * is set, so that uploads are not delayed by other work on that queue and the other way round.
+ * Jobs run one at a time in the order they are queued.
+ */
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Queueing statistics since the last esp_insights_worker_stats_get()
+ */
+typedef struct {
+    uint32_t jobs;              /*!< Jobs run */
+    uint32_t dropped;           /*!< Jobs not queued as the queue was full */
+    uint32_t latency_max_ms;    /*!< Longest time a job waited in the queue */
+    uint32_t latency_avg_ms;    /*!< Average time a job waited in the queue */
+} esp_insights_worker_stats_t;
+
+/**
+ * @brief Start the worker task, does nothing if it is running
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the queue or the task can not be created
+ */
+esp_err_t esp_insights_worker_start(void);
+
+/**
+ * @brief Stop the worker task once the jobs queued before are done
+ */
+void esp_insights_worker_stop(void);
+
+/**
+ * @brief Queue a job, same as esp_rmaker_work_queue_add_task()
+ *
+ * @param[in] work_fn function to run in the worker task
+ * @param[in] priv_data argument passed to work_fn
+ *
+ * @return ESP_OK on success, ESP_FAIL if the queue is full, ESP_ERR_INVALID_STATE if the worker is not running
+ */
+esp_err_t esp_insights_worker_add_task(void (*work_fn)(void *priv_data), void *priv_data);
+
+/**
+ * @brief Get the queueing statistics and start over
+ *
+ * @param[out] stats statistics since the last call
+ */
+void esp_insights_worker_stats_get(esp_insights_worker_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,10 +13,13 @@
 // limitations under the License.
 
 #include <string.h>
+#include <strings.h>
+#include <inttypes.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_event.h>
 #include <esp_http_client.h>
+#include <esp_timer.h>
 #include <esp_insights.h>
 #include <esp_insights_internal.h>
 
@@ -24,12 +27,28 @@ typedef struct {
     const char *auth_key;
     const char *node_id;
     const char *url;
+    esp_http_client_handle_t client;    /* kept across messages for connection and TLS session reuse */
+    bool streaming;                     /* a message is being streamed */
+    size_t len;                         /* length of the message being streamed */
+    size_t written;                     /* bytes of the message written so far */
+    bool conn_close;                    /* server asked to close the connection after the response */
+    bool conn_open;                     /* connection of the previous message is kept open */
+    int64_t last_used_us;               /* time the open connection was last used */
+    uint32_t conn_cnt;                  /* connections made, each with a TLS handshake */
+    uint32_t msg_cnt;                   /* messages sent */
 } https_data_t;
 
 static https_data_t s_https_data;
 
 static const char *TAG = "tport_https";
 #define HTTPS_URL_PATH "prod/node/data"
+/* Cloud does not have the meta a delta meta message was encoded against */
+#define HTTPS_STATUS_META_MISMATCH  409
+
+#ifdef CONFIG_ESP_INSIGHTS_TRANSPORT_HTTPS_KEEP_ALIVE
+#define HTTPS_KEEP_ALIVE
+#define HTTPS_IDLE_TIMEOUT_US   (CONFIG_ESP_INSIGHTS_TRANSPORT_HTTPS_IDLE_TIMEOUT_SEC * 1000000LL)
+#endif
 
 extern const uint8_t insights_https_server_crt_start[] asm("_binary_https_server_crt_start");
 extern const uint8_t insights_https_server_crt_end[] asm("_binary_https_server_crt_end");
@@ -49,6 +68,9 @@ static esp_err_t esp_insights_https_init(void *userdata)
 
 static void esp_insights_https_deinit(void)
 {
+    if (s_https_data.client) {
+        esp_http_client_cleanup(s_https_data.client);
+    }
     memset(&s_https_data, 0, sizeof(s_https_data));
 }
 
@@ -60,12 +82,16 @@ static esp_err_t http_event_handle(esp_http_client_event_t *evt)
             break;
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            s_https_data.conn_cnt++;
             break;
         case HTTP_EVENT_HEADER_SENT:
             ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
             break;
         case HTTP_EVENT_ON_HEADER:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER %s:%s", evt->header_key, evt->header_value);
+            if (strcasecmp(evt->header_key, "Connection") == 0 && strcasecmp(evt->header_value, "close") == 0) {
+                s_https_data.conn_close = true;
+            }
             break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
@@ -85,17 +111,9 @@ static esp_err_t http_event_handle(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-static int esp_insights_https_data_send(void *data, size_t len)
+/* Returns client with headers set, NULL on failure */
+static esp_http_client_handle_t https_client_init(void)
 {
-    if (!data) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    if (!s_https_data.auth_key) {
-        ESP_LOGE(TAG, "Transport not initialized");
-        return ESP_ERR_INVALID_STATE;
-    }
-
-    int msg_id = -1;
     char url[256];
     memset(url, 0, sizeof(url));
     snprintf(url, sizeof(url), "%s?node_id=%s", s_https_data.url, s_https_data.node_id);
@@ -107,34 +125,80 @@ static int esp_insights_https_data_send(void *data, size_t len)
         .buffer_size_tx = 1024,
         .event_handler = http_event_handle,
         .cert_pem = (const char *)insights_https_server_crt_start,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        /* Session ticket of the last connection is used to resume TLS session on reconnect */
+        .save_client_session = true,
+#endif
     };
     esp_http_client_handle_t client = esp_http_client_init(&client_config);
     if (!client) {
         ESP_LOGE(TAG, "Failed to initialize esp_http_client");
-        return msg_id;
+        return NULL;
     }
     esp_err_t err = esp_http_client_set_header(client, "Authorization", s_https_data.auth_key);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set Authorization header err:0x%x", err);
-        goto cleanup;
+        goto init_err;
     }
     err = esp_http_client_set_header(client, "Content-type", "application/octet-stream");
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set content type err:0x%x", err);
-        goto cleanup;
+        goto init_err;
     }
-    err = esp_http_client_set_post_field(client, data, len);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_http_client_set_post_field failed err:0x%x", err);
-        goto cleanup;
+    return client;
+init_err:
+    esp_http_client_cleanup(client);
+    return NULL;
+}
+
+/* Returns the client, created on first use. The connection left open by the previous message
+ * is closed here if it cannot be reused, esp_http_client then reconnects on open/perform.
+ */
+static esp_http_client_handle_t https_client_get(void)
+{
+    if (!s_https_data.client) {
+        s_https_data.client = https_client_init();
+        return s_https_data.client;
     }
-    err = esp_http_client_perform(client);
+#ifdef HTTPS_KEEP_ALIVE
+    if (s_https_data.conn_close || esp_timer_get_time() - s_https_data.last_used_us > HTTPS_IDLE_TIMEOUT_US) {
+        esp_http_client_close(s_https_data.client);
+        s_https_data.conn_close = false;
+        s_https_data.conn_open = false;
+    }
+#endif
+    return s_https_data.client;
+}
+
+/* Keeps the connection open for the next message if the request went through, closes it otherwise */
+static void https_request_done(int msg_id)
+{
+    s_https_data.msg_cnt++;
+    ESP_LOGD(TAG, "Messages %" PRIu32 ", connections %" PRIu32, s_https_data.msg_cnt, s_https_data.conn_cnt);
+#ifdef HTTPS_KEEP_ALIVE
+    if (msg_id == 0 && !s_https_data.conn_close) {
+        s_https_data.last_used_us = esp_timer_get_time();
+        s_https_data.conn_open = true;
+        return;
+    }
+#endif
+    esp_http_client_close(s_https_data.client);
+    s_https_data.conn_close = false;
+    s_https_data.conn_open = false;
+}
+
+static int https_post_result(esp_http_client_handle_t client, esp_err_t err)
+{
+    int msg_id = -1;
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_http_client_perform failed err:0x%x", err);
     } else {
         int status = esp_http_client_get_status_code(client);
         if (status == HttpStatus_Ok) {
             msg_id = 0;
+        } else if (status == HTTPS_STATUS_META_MISMATCH) {
+            ESP_LOGW(TAG, "API response status = %d, metadata mismatch", status);
+            esp_insights_meta_resync();
         } else {
             ESP_LOGE(TAG, "API response status = %d", status);
         }
@@ -144,8 +208,120 @@ static int esp_insights_https_data_send(void *data, size_t len)
     } else {
         esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_FAILED, NULL, 0, portMAX_DELAY);
     }
-cleanup:
-    esp_http_client_cleanup(client);
+    return msg_id;
+}
+
+static int esp_insights_https_data_send(void *data, size_t len)
+{
+    if (!data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_https_data.auth_key) {
+        ESP_LOGE(TAG, "Transport not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (s_https_data.streaming) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int msg_id = -1;
+    esp_http_client_handle_t client = https_client_get();
+    if (!client) {
+        return msg_id;
+    }
+    esp_err_t err = esp_http_client_set_post_field(client, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_http_client_set_post_field failed err:0x%x", err);
+        esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_FAILED, NULL, 0, portMAX_DELAY);
+        return msg_id;
+    }
+#ifdef HTTPS_KEEP_ALIVE
+    bool reused = s_https_data.conn_open;
+    uint32_t conn_cnt = s_https_data.conn_cnt;
+    err = esp_http_client_perform(client);
+    /* Server may have dropped the idle connection, retry once on a new one. A failure
+     * on a connection made for this request is not retried, the server is likely down.
+     */
+    if (err != ESP_OK && reused && conn_cnt == s_https_data.conn_cnt) {
+        ESP_LOGD(TAG, "Request on the open connection failed err:0x%x, reconnecting", err);
+        esp_http_client_close(client);
+        err = esp_http_client_perform(client);
+    }
+#else
+    err = esp_http_client_perform(client);
+#endif
+    msg_id = https_post_result(client, err);
+    https_request_done(msg_id);
+    return msg_id;
+}
+
+static esp_err_t esp_insights_https_data_begin(size_t len)
+{
+    if (!s_https_data.auth_key) {
+        ESP_LOGE(TAG, "Transport not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_https_data.streaming) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_http_client_handle_t client = https_client_get();
+    if (!client) {
+        return ESP_FAIL;
+    }
+    /* Content-Length is set from len, body is then written in chunks */
+    esp_err_t err = esp_http_client_open(client, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_http_client_open failed err:0x%x", err);
+        esp_http_client_close(client);
+        s_https_data.conn_open = false;
+        esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_FAILED, NULL, 0, portMAX_DELAY);
+        return err;
+    }
+    s_https_data.streaming = true;
+    s_https_data.len = len;
+    s_https_data.written = 0;
+    return ESP_OK;
+}
+
+static esp_err_t esp_insights_https_data_write(const void *data, size_t len)
+{
+    if (!s_https_data.streaming || !data) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_https_data.written + len > s_https_data.len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (len) {
+        int wlen = esp_http_client_write(s_https_data.client, data, len);
+        if (wlen <= 0) {
+            ESP_LOGE(TAG, "esp_http_client_write failed, written %u of %u",
+                     (unsigned) s_https_data.written, (unsigned) s_https_data.len);
+            return ESP_FAIL;
+        }
+        s_https_data.written += wlen;
+        data = (const uint8_t *) data + wlen;
+        len -= wlen;
+    }
+    return ESP_OK;
+}
+
+static int esp_insights_https_data_end(void)
+{
+    if (!s_https_data.streaming) {
+        return -1;
+    }
+    esp_err_t err = ESP_OK;
+    if (s_https_data.written != s_https_data.len) {
+        err = ESP_ERR_INVALID_SIZE; // incomplete message, do not wait for the response
+    } else if (esp_http_client_fetch_headers(s_https_data.client) < 0) {
+        err = ESP_FAIL;
+    } else {
+        /* Response body has to be read out before the connection can take the next request */
+        err = esp_http_client_flush_response(s_https_data.client, NULL);
+    }
+    int msg_id = https_post_result(s_https_data.client, err);
+    https_request_done(msg_id);
+    s_https_data.streaming = false;
     return msg_id;
 }
 
@@ -154,5 +330,8 @@ esp_insights_transport_config_t g_default_insights_transport_https = {
         .init = esp_insights_https_init,
         .deinit = esp_insights_https_deinit,
         .data_send = esp_insights_https_data_send,
+        .data_begin = esp_insights_https_data_begin,
+        .data_write = esp_insights_https_data_write,
+        .data_end = esp_insights_https_data_end,
     }
 };
@@ -0,0 +1,266 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <freertos/semphr.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_event.h>
+#include <esp_insights.h>
+#include <esp_insights_loopback.h>
+#include <esp_insights_internal.h>
+
+static const char *TAG = "tport_loopback";
+
+#define LOOPBACK_PENDING_MAX    16  /* asynchronous messages awaiting acknowledgment */
+#define LOOPBACK_RETRY_MS       10  /* acknowledgment is posted again after this, if the event queue was full */
+
+/* Built in every configuration for esp_insights_loopback_register(), sdkconfig has the defaults
+ * only if loopback is the default transport
+ */
+#if CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK
+#define LOOPBACK_DEFAULT_PATH           CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK_PATH
+#define LOOPBACK_DEFAULT_ACK_DELAY_MS   CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK_ACK_DELAY_MS
+#define LOOPBACK_DEFAULT_LOSS_PERCENT   CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK_LOSS_PERCENT
+#else
+#define LOOPBACK_DEFAULT_PATH           ""
+#define LOOPBACK_DEFAULT_ACK_DELAY_MS   0
+#define LOOPBACK_DEFAULT_LOSS_PERCENT   0
+#endif /* CONFIG_ESP_INSIGHTS_TRANSPORT_LOOPBACK */
+
+/* Message awaiting asynchronous acknowledgment */
+typedef struct {
+    int msg_id;
+    TickType_t due;     /* tick at which the message is acknowledged */
+    bool lost;
+} loopback_pending_t;
+
+typedef struct {
+    esp_insights_loopback_config_t config;
+    FILE *file;
+    bool init_done;
+    int msg_id;                 /* msg_id of the last message */
+    uint32_t rand;              /* state of the loss generator, fixed seed for repeatable runs */
+    SemaphoreHandle_t lock;     /* protects pending and stats, acks are sent from the timer task */
+    TimerHandle_t ack_timer;
+    loopback_pending_t pending[LOOPBACK_PENDING_MAX];   /* oldest first */
+    uint8_t pending_cnt;
+    esp_insights_loopback_stats_t stats;
+} loopback_data_t;
+
+static loopback_data_t s_loopback_data;
+
+static bool loopback_msg_lost(void)
+{
+    if (s_loopback_data.config.loss_percent == 0) {
+        return false;
+    }
+    s_loopback_data.rand = s_loopback_data.rand * 1103515245 + 12345;
+    return ((s_loopback_data.rand >> 16) % 100) < s_loopback_data.config.loss_percent;
+}
+
+static void loopback_deliver(const void *data, size_t len)
+{
+    if (s_loopback_data.file) {
+        if (fwrite(data, 1, len, s_loopback_data.file) != len) {
+            ESP_LOGW(TAG, "Failed to write %" PRIu32 " bytes to %s", (uint32_t) len, s_loopback_data.config.path);
+        }
+    }
+    if (s_loopback_data.config.sink) {
+        s_loopback_data.config.sink(data, len, s_loopback_data.config.sink_arg);
+    }
+}
+
+/* Acknowledges the messages which are due, in the timer task.
+ * Events are posted without blocking, the handler waits on the timer task to reset its own timers.
+ */
+static void loopback_ack_timer_cb(TimerHandle_t handle)
+{
+    while (1) {
+        xSemaphoreTake(s_loopback_data.lock, portMAX_DELAY);
+        if (s_loopback_data.pending_cnt == 0) {
+            xSemaphoreGive(s_loopback_data.lock);
+            return;
+        }
+        TickType_t wait = s_loopback_data.pending[0].due - xTaskGetTickCount();
+        if ((int32_t) wait > 0) {
+            xTimerChangePeriod(s_loopback_data.ack_timer, wait, 0);
+            xSemaphoreGive(s_loopback_data.lock);
+            return;
+        }
+        /* Only this callback removes messages, so the oldest one stays in place while it is posted */
+        loopback_pending_t msg = s_loopback_data.pending[0];
+        xSemaphoreGive(s_loopback_data.lock);
+
+        esp_insights_transport_event_data_t data;
+        memset(&data, 0, sizeof(data));
+        data.msg_id = msg.msg_id;
+        if (esp_event_post(INSIGHTS_EVENT, msg.lost ? INSIGHTS_EVENT_TRANSPORT_SEND_FAILED : INSIGHTS_EVENT_TRANSPORT_SEND_SUCCESS,
+                           &data, sizeof(data), 0) != ESP_OK) {
+            TickType_t retry = pdMS_TO_TICKS(LOOPBACK_RETRY_MS);
+            xTimerChangePeriod(s_loopback_data.ack_timer, retry ? retry : 1, 0);
+            return;
+        }
+
+        xSemaphoreTake(s_loopback_data.lock, portMAX_DELAY);
+        s_loopback_data.pending_cnt--;
+        memmove(&s_loopback_data.pending[0], &s_loopback_data.pending[1],
+                s_loopback_data.pending_cnt * sizeof(s_loopback_data.pending[0]));
+        if (!msg.lost) {
+            s_loopback_data.stats.acked_msgs++;
+        }
+        xSemaphoreGive(s_loopback_data.lock);
+    }
+}
+
+static esp_err_t esp_insights_loopback_init(void *userdata)
+{
+    if (s_loopback_data.init_done) {
+        return ESP_OK;
+    }
+    memset(&s_loopback_data, 0, sizeof(s_loopback_data));
+    if (userdata) {
+        memcpy(&s_loopback_data.config, userdata, sizeof(s_loopback_data.config));
+    } else {
+        if (sizeof(LOOPBACK_DEFAULT_PATH) > 1) {
+            s_loopback_data.config.path = LOOPBACK_DEFAULT_PATH;
+        }
+        s_loopback_data.config.ack_delay_ms = LOOPBACK_DEFAULT_ACK_DELAY_MS;
+        s_loopback_data.config.loss_percent = LOOPBACK_DEFAULT_LOSS_PERCENT;
+    }
+    s_loopback_data.rand = 1;
+    s_loopback_data.lock = xSemaphoreCreateMutex();
+    if (!s_loopback_data.lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (s_loopback_data.config.ack_delay_ms) {
+        s_loopback_data.ack_timer = xTimerCreate("insights_lb", pdMS_TO_TICKS(s_loopback_data.config.ack_delay_ms),
+                                                 pdFALSE, NULL, loopback_ack_timer_cb);
+        if (!s_loopback_data.ack_timer) {
+            vSemaphoreDelete(s_loopback_data.lock);
+            s_loopback_data.lock = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (s_loopback_data.config.path) {
+        s_loopback_data.file = fopen(s_loopback_data.config.path, "ab");
+        if (!s_loopback_data.file) {
+            ESP_LOGW(TAG, "Failed to open %s, messages are not written", s_loopback_data.config.path);
+        }
+    }
+    s_loopback_data.init_done = true;
+    ESP_LOGI(TAG, "Loopback transport, ack delay %" PRIu32 " ms, loss %d%%",
+             s_loopback_data.config.ack_delay_ms, s_loopback_data.config.loss_percent);
+    return ESP_OK;
+}
+
+static void esp_insights_loopback_deinit(void)
+{
+    if (!s_loopback_data.init_done) {
+        return;
+    }
+    if (s_loopback_data.ack_timer) {
+        xTimerDelete(s_loopback_data.ack_timer, portMAX_DELAY);
+    }
+    if (s_loopback_data.file) {
+        fclose(s_loopback_data.file);
+    }
+    if (s_loopback_data.lock) {
+        vSemaphoreDelete(s_loopback_data.lock);
+    }
+    memset(&s_loopback_data, 0, sizeof(s_loopback_data));
+}
+
+static int esp_insights_loopback_data_send(void *data, size_t len)
+{
+    if (!data) {
+        return 0;
+    }
+    if (!s_loopback_data.init_done) {
+        return -1;
+    }
+    xSemaphoreTake(s_loopback_data.lock, portMAX_DELAY);
+    if (s_loopback_data.ack_timer && s_loopback_data.pending_cnt >= LOOPBACK_PENDING_MAX) {
+        /* Like a full MQTT outbox */
+        xSemaphoreGive(s_loopback_data.lock);
+        return -1;
+    }
+    bool lost = loopback_msg_lost();
+    s_loopback_data.stats.sent_msgs++;
+    s_loopback_data.stats.sent_bytes += len;
+    if (lost) {
+        s_loopback_data.stats.lost_msgs++;
+    } else {
+        s_loopback_data.stats.delivered_msgs++;
+        s_loopback_data.stats.delivered_bytes += len;
+    }
+    int msg_id = 0;
+    if (s_loopback_data.ack_timer) {
+        s_loopback_data.msg_id = s_loopback_data.msg_id == INT32_MAX ? 1 : s_loopback_data.msg_id + 1;
+        msg_id = s_loopback_data.msg_id;
+        TickType_t delay = pdMS_TO_TICKS(s_loopback_data.config.ack_delay_ms);
+        s_loopback_data.pending[s_loopback_data.pending_cnt++] = (loopback_pending_t) {
+            .msg_id = msg_id,
+            .due = xTaskGetTickCount() + delay,
+            .lost = lost,
+        };
+        if (s_loopback_data.pending_cnt == 1) {
+            xTimerChangePeriod(s_loopback_data.ack_timer, delay ? delay : 1, 0);
+        }
+    } else if (lost) {
+        msg_id = -1;
+    } else {
+        s_loopback_data.stats.acked_msgs++;
+    }
+    xSemaphoreGive(s_loopback_data.lock);
+
+    if (!lost) {
+        loopback_deliver(data, len);
+    }
+    return msg_id;
+}
+
+esp_insights_transport_config_t g_default_insights_transport_loopback = {
+    .callbacks = {
+        .init = esp_insights_loopback_init,
+        .deinit = esp_insights_loopback_deinit,
+        .data_send = esp_insights_loopback_data_send,
+    }
+};
+
+esp_err_t esp_insights_loopback_register(const esp_insights_loopback_config_t *config)
+{
+    g_default_insights_transport_loopback.userdata = (void *) config;
+    return esp_insights_transport_register(&g_default_insights_transport_loopback);
+}
+
+esp_err_t esp_insights_loopback_get_stats(esp_insights_loopback_stats_t *stats)
+{
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_loopback_data.init_done) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_loopback_data.lock, portMAX_DELAY);
+    memcpy(stats, &s_loopback_data.stats, sizeof(*stats));
+    xSemaphoreGive(s_loopback_data.lock);
+    return ESP_OK;
+}
+
+void esp_insights_loopback_reset_stats(void)
+{
+    if (!s_loopback_data.init_done) {
+        return;
+    }
+    xSemaphoreTake(s_loopback_data.lock, portMAX_DELAY);
+    memset(&s_loopback_data.stats, 0, sizeof(s_loopback_data.stats));
+    xSemaphoreGive(s_loopback_data.lock);
+}
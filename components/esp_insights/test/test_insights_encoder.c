@@ -0,0 +1,338 @@
+/*
+ * SPDX-FileCopyrightText: 2021-2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <esp_diagnostics.h>
+#include <rtc_store.h>
+#include "esp_insights_cbor_encoder.h"
+
+#if CONFIG_APP_TEST_INSIGHTS_ENCODER
+
+#define LOGS_BUF_SIZE   1024
+#define PTS_BUF_SIZE    2048
+#define OUT_BUF_SIZE    4096
+
+static uint8_t s_logs[LOGS_BUF_SIZE];
+static size_t s_logs_len;
+static uint8_t s_pts[PTS_BUF_SIZE];
+static size_t s_pts_len;
+static uint8_t s_out[2][OUT_BUF_SIZE];
+
+/* Records are laid out as in the data store, meta index byte followed by the record */
+static void add_log(esp_diag_log_type_t type, uint32_t pc, uint64_t ts, const char *tag,
+                    uint32_t msg_ptr, const char *task)
+{
+    esp_diag_log_data_t log;
+    memset(&log, 0, sizeof(log));
+    log.type = type;
+    log.pc = pc;
+    log.timestamp = ts;
+    strlcpy(log.tag, tag, sizeof(log.tag));
+    log.msg_ptr = (void *) msg_ptr;
+    strlcpy(log.task_name, task, sizeof(log.task_name));
+
+    TEST_ASSERT(s_logs_len + 1 + sizeof(log) <= sizeof(s_logs));
+    s_logs[s_logs_len++] = 0;
+    memcpy(&s_logs[s_logs_len], &log, sizeof(log));
+    s_logs_len += sizeof(log);
+}
+
+static void add_pt_record(const void *pt, size_t len)
+{
+    rtc_store_non_critical_data_hdr_t hdr = { .len = len };
+    TEST_ASSERT(s_pts_len + 1 + sizeof(hdr) + len <= sizeof(s_pts));
+    s_pts[s_pts_len++] = 0;
+    memcpy(&s_pts[s_pts_len], &hdr, sizeof(hdr));
+    s_pts_len += sizeof(hdr);
+    memcpy(&s_pts[s_pts_len], pt, len);
+    s_pts_len += len;
+}
+
+static void add_pt(uint16_t type, esp_diag_data_type_t data_type, const char *key, int32_t value, uint64_t ts)
+{
+    esp_diag_data_pt_t pt;
+    memset(&pt, 0, sizeof(pt));
+    pt.type = type;
+    pt.data_type = data_type;
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    strlcpy(pt.tag, "test", sizeof(pt.tag));
+#endif
+    strlcpy(pt.key, key, sizeof(pt.key));
+    pt.ts = ts;
+    pt.value.i = value;
+    add_pt_record(&pt, sizeof(pt));
+}
+
+static void add_str_pt(uint16_t type, const char *key, const char *value, uint64_t ts)
+{
+    esp_diag_str_data_pt_t pt;
+    memset(&pt, 0, sizeof(pt));
+    pt.type = type;
+    pt.data_type = ESP_DIAG_DATA_TYPE_STR;
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    strlcpy(pt.tag, "test", sizeof(pt.tag));
+#endif
+    strlcpy(pt.key, key, sizeof(pt.key));
+    pt.ts = ts;
+    strlcpy(pt.value.str, value, sizeof(pt.value.str));
+    add_pt_record(&pt, sizeof(pt));
+}
+
+static void add_fixed_records(void)
+{
+    s_logs_len = s_pts_len = 0;
+    add_log(ESP_DIAG_LOG_TYPE_ERROR, 0x400d1234, 1000, "wifi", 0x3f401000, "main");
+    add_log(ESP_DIAG_LOG_TYPE_EVENT, 0x400d5678, 2000, "boot", 0x3f402000, "");
+    add_pt(ESP_DIAG_DATA_PT_METRICS, ESP_DIAG_DATA_TYPE_UINT, "free", 180000, 3000);
+    add_pt(ESP_DIAG_DATA_PT_METRICS, ESP_DIAG_DATA_TYPE_INT, "rssi", -61, 3001);
+    add_str_pt(ESP_DIAG_DATA_PT_VARIABLE, "state", "connected", 3002);
+}
+
+/* Header of the message carries the timestamp and the meta of the running firmware,
+ * so only the data map, which is encoded from the records alone, is compared.
+ */
+static const uint8_t *data_section(const uint8_t *msg, size_t len, size_t *data_len)
+{
+    static const uint8_t data_key[] = { 0x64, 'd', 'a', 't', 'a', 0xbf };
+    for (size_t i = 0; i + sizeof(data_key) <= len; i++) {
+        if (memcmp(&msg[i], data_key, sizeof(data_key)) == 0) {
+            *data_len = len - i;
+            return &msg[i];
+        }
+    }
+    TEST_FAIL_MESSAGE("data map not found");
+    return NULL;
+}
+
+#if CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV && CONFIG_DIAG_ENABLE_METRICS && CONFIG_DIAG_ENABLE_VARIABLES
+#define TEST_FIXED_DATA 1
+/* Data map of the fixed records, up to the end of the message, for each payload version */
+#if CONFIG_ESP_INSIGHTS_COMPACT_PAYLOAD
+static const uint8_t s_fixed_data[] = {
+    0x64, 'd', 'a', 't', 'a', 0xbf,
+    0x66, 't', 'r', 'a', 'c', 'e', 's', 0xbf,
+    0x66, 'e', 'r', 'r', 'o', 'r', 's', 0x9f,
+    0x86, 0x19, 0x03, 0xe8, 0x64, 'w', 'i', 'f', 'i',
+    0x1a, 0x40, 0x0d, 0x12, 0x34, 0x1a, 0x3f, 0x40, 0x10, 0x00,
+    0x9f, 0xff, 0x64, 'm', 'a', 'i', 'n',
+    0xff,
+    0x68, 'w', 'a', 'r', 'n', 'i', 'n', 'g', 's', 0x9f, 0xff,
+    0x66, 'e', 'v', 'e', 'n', 't', 's', 0x9f,
+    0x85, 0x19, 0x07, 0xd0, 0x64, 'b', 'o', 'o', 't',
+    0x1a, 0x40, 0x0d, 0x56, 0x78, 0x1a, 0x3f, 0x40, 0x20, 0x00,
+    0x9f, 0xff,
+    0xff,
+    0xff,
+    0x66, 's', 'e', 'r', 'i', 'e', 's', 0x9f,
+    0x84, 0x82, 0x64, 't', 'e', 's', 't', 0x64, 'f', 'r', 'e', 'e', 0x02,
+    0x81, 0x19, 0x0b, 0xb8, 0x81, 0x1a, 0x00, 0x02, 0xbf, 0x20,
+    0x84, 0x82, 0x64, 't', 'e', 's', 't', 0x64, 'r', 's', 's', 'i', 0x01,
+    0x81, 0x19, 0x0b, 0xb9, 0x81, 0x38, 0x3c,
+    0xff,
+    0x66, 'p', 'a', 'r', 'a', 'm', 's', 0x9f,
+    0x83, 0x82, 0x64, 't', 'e', 's', 't', 0x65, 's', 't', 'a', 't', 'e',
+    0x69, 'c', 'o', 'n', 'n', 'e', 'c', 't', 'e', 'd', 0x19, 0x0b, 0xba,
+    0xff,
+    0xff,   /* data map */
+    0xff,   /* diag map */
+};
+#elif CONFIG_ESP_INSIGHTS_META_VERSION_10
+static const uint8_t s_fixed_data[] = {
+    0x64, 'd', 'a', 't', 'a', 0xbf,
+    0x66, 't', 'r', 'a', 'c', 'e', 's', 0xbf,
+    0x66, 'e', 'r', 'r', 'o', 'r', 's', 0x9f,
+    0xbf,
+    0x62, 't', 's', 0x19, 0x03, 0xe8,
+    0x63, 't', 'a', 'g', 0x64, 'w', 'i', 'f', 'i',
+    0x62, 'p', 'c', 0x1a, 0x40, 0x0d, 0x12, 0x34,
+    0x62, 'r', 'o', 0x1a, 0x3f, 0x40, 0x10, 0x00,
+    0x62, 'a', 'v', 0x9f, 0xff,
+    0x64, 't', 'a', 's', 'k', 0x64, 'm', 'a', 'i', 'n',
+    0xff,
+    0xff,
+    0x68, 'w', 'a', 'r', 'n', 'i', 'n', 'g', 's', 0x9f, 0xff,
+    0x66, 'e', 'v', 'e', 'n', 't', 's', 0x9f,
+    0xbf,
+    0x62, 't', 's', 0x19, 0x07, 0xd0,
+    0x63, 't', 'a', 'g', 0x64, 'b', 'o', 'o', 't',
+    0x62, 'p', 'c', 0x1a, 0x40, 0x0d, 0x56, 0x78,
+    0x62, 'r', 'o', 0x1a, 0x3f, 0x40, 0x20, 0x00,
+    0x62, 'a', 'v', 0x9f, 0xff,
+    0xff,
+    0xff,
+    0xff,
+    0x67, 'm', 'e', 't', 'r', 'i', 'c', 's', 0x9f,
+    0xbf, 0x61, 'n', 0x64, 'f', 'r', 'e', 'e', 0x61, 'v', 0x1a, 0x00, 0x02, 0xbf, 0x20,
+    0x61, 't', 0x19, 0x0b, 0xb8, 0xff,
+    0xbf, 0x61, 'n', 0x64, 'r', 's', 's', 'i', 0x61, 'v', 0x38, 0x3c,
+    0x61, 't', 0x19, 0x0b, 0xb9, 0xff,
+    0xff,
+    0x66, 'p', 'a', 'r', 'a', 'm', 's', 0x9f,
+    0xbf, 0x61, 'n', 0x65, 's', 't', 'a', 't', 'e',
+    0x61, 'v', 0x69, 'c', 'o', 'n', 'n', 'e', 'c', 't', 'e', 'd',
+    0x61, 't', 0x19, 0x0b, 0xba, 0xff,
+    0xff,
+    0xff,   /* data map */
+    0xff,   /* diag map */
+};
+#else
+static const uint8_t s_fixed_data[] = {
+    0x64, 'd', 'a', 't', 'a', 0xbf,
+    0x66, 't', 'r', 'a', 'c', 'e', 's', 0xbf,
+    0x66, 'e', 'r', 'r', 'o', 'r', 's', 0x9f,
+    0xbf,
+    0x62, 't', 's', 0x19, 0x03, 0xe8,
+    0x63, 't', 'a', 'g', 0x64, 'w', 'i', 'f', 'i',
+    0x62, 'p', 'c', 0x1a, 0x40, 0x0d, 0x12, 0x34,
+    0x62, 'r', 'o', 0x1a, 0x3f, 0x40, 0x10, 0x00,
+    0x62, 'a', 'v', 0x9f, 0xff,
+    0x64, 't', 'a', 's', 'k', 0x64, 'm', 'a', 'i', 'n',
+    0xff,
+    0xff,
+    0x68, 'w', 'a', 'r', 'n', 'i', 'n', 'g', 's', 0x9f, 0xff,
+    0x66, 'e', 'v', 'e', 'n', 't', 's', 0x9f,
+    0xbf,
+    0x62, 't', 's', 0x19, 0x07, 0xd0,
+    0x63, 't', 'a', 'g', 0x64, 'b', 'o', 'o', 't',
+    0x62, 'p', 'c', 0x1a, 0x40, 0x0d, 0x56, 0x78,
+    0x62, 'r', 'o', 0x1a, 0x3f, 0x40, 0x20, 0x00,
+    0x62, 'a', 'v', 0x9f, 0xff,
+    0xff,
+    0xff,
+    0xff,
+    0x67, 'm', 'e', 't', 'r', 'i', 'c', 's', 0x9f,
+    0xbf, 0x61, 'n', 0x9f, 0x61, 'M', 0x64, 't', 'e', 's', 't', 0x64, 'f', 'r', 'e', 'e', 0xff,
+    0x61, 'v', 0x1a, 0x00, 0x02, 0xbf, 0x20, 0x61, 't', 0x19, 0x0b, 0xb8, 0xff,
+    0xbf, 0x61, 'n', 0x9f, 0x61, 'M', 0x64, 't', 'e', 's', 't', 0x64, 'r', 's', 's', 'i', 0xff,
+    0x61, 'v', 0x38, 0x3c, 0x61, 't', 0x19, 0x0b, 0xb9, 0xff,
+    0xff,
+    0x66, 'p', 'a', 'r', 'a', 'm', 's', 0x9f,
+    0xbf, 0x61, 'n', 0x9f, 0x61, 'P', 0x64, 't', 'e', 's', 't', 0x65, 's', 't', 'a', 't', 'e', 0xff,
+    0x61, 'v', 0x69, 'c', 'o', 'n', 'n', 'e', 'c', 't', 'e', 'd',
+    0x61, 't', 0x19, 0x0b, 0xba, 0xff,
+    0xff,
+    0xff,   /* data map */
+    0xff,   /* diag map */
+};
+#endif
+#endif
+
+TEST_CASE("encoder fixed records", "[insights][encoder]")
+{
+    esp_insights_cbor_enc_t enc[2];
+    size_t len[2], consumed;
+
+    add_fixed_records();
+
+    /* Two messages encoded side by side in their own contexts come out the same */
+    for (int m = 0; m < 2; m++) {
+        esp_insights_cbor_encode_diag_begin(&enc[m], s_out[m], OUT_BUF_SIZE, "1.0");
+    }
+    for (int m = 0; m < 2; m++) {
+        esp_insights_cbor_encode_diag_data_begin(&enc[m]);
+    }
+    for (int m = 0; m < 2; m++) {
+        consumed = esp_insights_cbor_encode_diag_logs(&enc[m], s_logs, s_logs_len);
+        TEST_ASSERT_EQUAL(s_logs_len, consumed);
+    }
+    for (int m = 0; m < 2; m++) {
+        consumed = esp_insights_cbor_encode_diag_data_points(&enc[m], s_pts, s_pts_len);
+        TEST_ASSERT_EQUAL(s_pts_len, consumed);
+    }
+    for (int m = 0; m < 2; m++) {
+        esp_insights_cbor_encode_diag_data_end(&enc[m]);
+    }
+    for (int m = 0; m < 2; m++) {
+        len[m] = esp_insights_cbor_encode_diag_end(&enc[m], s_out[m]);
+        TEST_ASSERT(len[m] > 0);
+    }
+
+    size_t data_len[2];
+    const uint8_t *data[2];
+    for (int m = 0; m < 2; m++) {
+        data[m] = data_section(s_out[m], len[m], &data_len[m]);
+    }
+    TEST_ASSERT_EQUAL(data_len[0], data_len[1]);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data[0], data[1], data_len[0]);
+
+#if TEST_FIXED_DATA
+    TEST_ASSERT_EQUAL(sizeof(s_fixed_data), data_len[0]);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(s_fixed_data, data[0], sizeof(s_fixed_data));
+#endif
+}
+
+static void add_many_records(void)
+{
+    char tag[16], task[16];
+    s_logs_len = s_pts_len = 0;
+    for (int r = 0; r < 7; r++) {
+        snprintf(tag, sizeof(tag), "component%d", r);
+        snprintf(task, sizeof(task), "task%d", r);
+        add_log(1 << (r % 3), 0x400d0000 + r, 1700000000000000ULL + r, tag, 0x3f400000 + r, (r % 2) ? task : "");
+    }
+    uint64_t ts = 1700000000000000ULL;
+    for (int r = 0; r < 10; r++) {
+        ts += 30000000;
+        add_pt(ESP_DIAG_DATA_PT_METRICS, ESP_DIAG_DATA_TYPE_UINT, "free", 180000 - r * 37, ts);
+        add_pt(ESP_DIAG_DATA_PT_METRICS, ESP_DIAG_DATA_TYPE_INT, "rssi", -60 - r, ts + 1);
+        if (r % 4 == 0) {
+            add_str_pt(ESP_DIAG_DATA_PT_VARIABLE, "state", "connected", ts + 2);
+        }
+    }
+}
+
+static size_t encode_records(esp_insights_cbor_enc_t *enc, uint8_t *out, size_t out_size,
+                             size_t logs_len, size_t pts_len, size_t *logs_consumed, size_t *pts_consumed)
+{
+    esp_insights_cbor_encode_diag_begin(enc, out, out_size, "1.0");
+    esp_insights_cbor_encode_diag_data_begin(enc);
+    *logs_consumed = esp_insights_cbor_encode_diag_logs(enc, s_logs, logs_len);
+    *pts_consumed = pts_len ? esp_insights_cbor_encode_diag_data_points(enc, s_pts, pts_len) : 0;
+    esp_insights_cbor_encode_diag_data_end(enc);
+    return esp_insights_cbor_encode_diag_end(enc, out);
+}
+
+TEST_CASE("encoder stops at the record which does not fit", "[insights][encoder]")
+{
+    esp_insights_cbor_enc_t enc;
+    size_t logs_consumed, pts_consumed, logs_again, pts_again;
+    bool partial = false;
+
+    add_many_records();
+    size_t full_len = encode_records(&enc, s_out[0], OUT_BUF_SIZE, s_logs_len, s_pts_len,
+                                     &logs_consumed, &pts_consumed);
+    TEST_ASSERT(full_len > 0);
+    TEST_ASSERT_EQUAL(s_logs_len, logs_consumed);
+    TEST_ASSERT_EQUAL(s_pts_len, pts_consumed);
+
+    for (size_t size = 400; size <= full_len; size += 7) {
+        /* Message fits the buffer however many records were left out */
+        size_t len = encode_records(&enc, s_out[0], size, s_logs_len, s_pts_len, &logs_consumed, &pts_consumed);
+        TEST_ASSERT(len > 0);
+        TEST_ASSERT(len <= size);
+        partial |= (logs_consumed < s_logs_len || pts_consumed < s_pts_len);
+        if (!pts_consumed) {
+            continue; // data point lists are not encoded at all without records
+        }
+
+        /* and carries exactly the records which are reported consumed */
+        size_t len_again = encode_records(&enc, s_out[1], OUT_BUF_SIZE, logs_consumed, pts_consumed,
+                                          &logs_again, &pts_again);
+        TEST_ASSERT_EQUAL(logs_consumed, logs_again);
+        TEST_ASSERT_EQUAL(pts_consumed, pts_again);
+
+        size_t data_len, data_len_again;
+        const uint8_t *data = data_section(s_out[0], len, &data_len);
+        const uint8_t *data_again = data_section(s_out[1], len_again, &data_len_again);
+        TEST_ASSERT_EQUAL(data_len, data_len_again);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(data, data_again, data_len);
+    }
+    TEST_ASSERT(partial);
+}
+
+#endif /* CONFIG_APP_TEST_INSIGHTS_ENCODER */